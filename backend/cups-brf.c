@@ -19,6 +19,246 @@
 #include <grp.h>
 
 
+// Size of the buffer used when data cannot be moved inside the kernel
+#define BRF_COPY_SIZE (1024 * 1024)
+
+// Amount of data after which writeback is started in "sync=batch" mode
+#define BRF_SYNC_BATCH_SIZE (8 * 1024 * 1024)
+
+// Durability of the written file, selected by the "sync" option of the
+// device URI, e.g. "cups-brf:/?sync=batch"
+typedef enum
+{
+  BRF_SYNC_NONE,	// Leave writeback to the kernel
+  BRF_SYNC_BATCH,	// Start writeback every few MiB, fsync at the end
+  BRF_SYNC_DIRECT	// Bypass the page cache with O_DIRECT, fsync at the end
+} brf_sync_t;
+
+
+//
+// 'get_sync_mode()' - Get the durability mode from the device URI.
+//
+
+static brf_sync_t
+get_sync_mode(void)
+{
+  const char *uri = getenv("DEVICE_URI");
+  const char *opt;
+
+  if (!uri || (opt = strchr(uri, '?')) == NULL)
+    return (BRF_SYNC_NONE);
+
+  for (opt++; *opt; opt += strcspn(opt, "&+"), opt += (*opt != '\0'))
+  {
+    if (!strncmp(opt, "sync=batch", 10) && strchr("&+", opt[10]))
+      return (BRF_SYNC_BATCH);
+    if (!strncmp(opt, "sync=direct", 11) && strchr("&+", opt[11]))
+      return (BRF_SYNC_DIRECT);
+  }
+
+  return (BRF_SYNC_NONE);
+}
+
+
+//
+// 'write_all()' - Write a whole buffer.
+//
+
+static int
+write_all(int fd,
+	  const char *buffer,
+	  size_t size)
+{
+  ssize_t sizeout;
+
+  for (; size > 0; buffer += sizeout, size -= sizeout)
+  {
+    if ((sizeout = write(fd, buffer, size)) < 0)
+    {
+      if (errno == EINTR)
+      {
+	sizeout = 0;
+	continue;
+      }
+      return (-1);
+    }
+  }
+
+  return (0);
+}
+
+
+//
+// 'copy_data()' - Copy standard input to the output file.
+//
+// Data is moved inside the kernel with copy_file_range() when the input is
+// a file and with splice() when it is a pipe, falling back to read()/write()
+// when neither is possible.  Returns the number of bytes copied or -1.
+//
+
+static off_t
+copy_data(int fd,
+	  brf_sync_t sync,
+	  const char *outfile)
+{
+  struct stat st;
+  char *buffer;
+  ssize_t sizein;
+  off_t total = 0,
+	synced = 0,
+	prealloc = 0;
+  size_t align = 4096;
+  int use_copy = 0,
+      use_splice = 0;
+
+  if (!fstat(STDIN_FILENO, &st))
+  {
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+      // Size is known, reserve the blocks up front
+      if (!fallocate(fd, 0, 0, st.st_size))
+	prealloc = st.st_size;
+      else if (errno != EOPNOTSUPP && errno != ENOSYS)
+	fprintf(stderr, "DEBUG: could not preallocate %lld bytes: %s\n",
+		(long long)st.st_size, strerror(errno));
+      use_copy = 1;
+    }
+    else if (S_ISFIFO(st.st_mode))
+      use_splice = 1;
+  }
+
+  if (sync == BRF_SYNC_DIRECT)
+  {
+    struct stat ost;
+
+    if (!fstat(fd, &ost) && ost.st_blksize > 0 && BRF_COPY_SIZE % ost.st_blksize == 0)
+      align = ost.st_blksize;
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) < 0)
+    {
+      fprintf(stderr, "DEBUG: O_DIRECT not supported for \"%s\", using batched sync\n", outfile);
+      sync = BRF_SYNC_BATCH;
+    }
+    else
+      // O_DIRECT needs aligned buffers, which in-kernel copies can't give us
+      use_copy = use_splice = 0;
+  }
+
+  while (use_copy || use_splice)
+  {
+    ssize_t moved;
+
+    if (use_copy)
+      moved = copy_file_range(STDIN_FILENO, NULL, fd, NULL, BRF_COPY_SIZE, 0);
+    else
+      moved = splice(STDIN_FILENO, NULL, fd, NULL, BRF_COPY_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+    if (moved == 0)
+      goto done;
+
+    if (moved < 0)
+    {
+      if (errno == EINTR)
+	continue;
+
+      if (total == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+      {
+	// Not supported for this pair of files, nothing copied yet
+	fprintf(stderr, "DEBUG: in-kernel copy not available: %s\n", strerror(errno));
+	use_copy = use_splice = 0;
+	break;
+      }
+
+      fprintf(stderr, "ERROR: while copying to \"%s\": %s\n",
+	      outfile, strerror(errno));
+      return (-1);
+    }
+
+    total += moved;
+
+    if (sync == BRF_SYNC_BATCH && total - synced >= BRF_SYNC_BATCH_SIZE)
+    {
+      sync_file_range(fd, synced, total - synced, SYNC_FILE_RANGE_WRITE);
+      synced = total;
+    }
+  }
+
+  if (posix_memalign((void **)&buffer, align, BRF_COPY_SIZE))
+  {
+    fprintf(stderr, "ERROR: could not allocate memory\n");
+    return (-1);
+  }
+
+  while (1)
+  {
+    size_t fill = 0;
+
+    // Read some, filling the buffer so that O_DIRECT writes stay aligned.
+    while (fill < BRF_COPY_SIZE)
+    {
+      sizein = read(STDIN_FILENO, buffer + fill, BRF_COPY_SIZE - fill);
+      if (sizein < 0 && errno == EINTR)
+	continue;
+      if (sizein <= 0)
+	break;
+      fill += sizein;
+      if (sync != BRF_SYNC_DIRECT)
+	break;
+    }
+
+    if (sizein < 0)
+    {
+      fprintf(stderr, "ERROR: while reading input: %s\n", strerror(errno));
+      free(buffer);
+      return (-1);
+    }
+    if (fill == 0)
+      // We are done!
+      break;
+
+    if (sync == BRF_SYNC_DIRECT && fill % align)
+    {
+      // Unaligned tail, finish with buffered I/O
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      sync = BRF_SYNC_BATCH;
+    }
+
+    // Write it.
+    if (write_all(fd, buffer, fill) < 0)
+    {
+      fprintf(stderr, "ERROR: while writing to \"%s\": %s\n",
+	      outfile, strerror(errno));
+      free(buffer);
+      return (-1);
+    }
+
+    total += fill;
+
+    if (sync == BRF_SYNC_BATCH && total - synced >= BRF_SYNC_BATCH_SIZE)
+    {
+      sync_file_range(fd, synced, total - synced, SYNC_FILE_RANGE_WRITE);
+      synced = total;
+    }
+
+    if (sizein == 0)
+      break;
+  }
+
+  free(buffer);
+
+ done:
+  // Drop any preallocated blocks we did not use
+  if (total < prealloc && ftruncate(fd, total) < 0)
+  {
+    fprintf(stderr, "ERROR: while truncating \"%s\": %s\n",
+	    outfile, strerror(errno));
+    return (-1);
+  }
+
+  return (total);
+}
+
+
 int
 main(int argc,
      char *argv[])
@@ -28,9 +268,8 @@ main(int argc,
   char *title;
   char *outfile;
   char *c;
-  char buffer[4096];
-  ssize_t sizein, sizeout, done;
   struct passwd *pw;
+  brf_sync_t sync;
   int ret;
   int fd;
 
@@ -149,31 +388,28 @@ main(int argc,
   }
 
   // We are all set, copy data.
-  while (1)
+  sync = get_sync_mode();
+  if (copy_data(fd, sync, outfile) < 0)
+    return (CUPS_BACKEND_FAILED);
+
+  if (sync != BRF_SYNC_NONE)
   {
-    // Read some.
-    sizein = read(STDIN_FILENO, buffer, sizeof(buffer));
-    if (sizein < 0)
+    // Make both the data and the new directory entry durable
+    int dirfd;
+
+    if (fsync(fd) < 0)
     {
-      fprintf(stderr, "ERROR: while reading input: %s\n", strerror(errno));
+      fprintf(stderr, "ERROR: while syncing \"%s\": %s\n",
+	      outfile, strerror(errno));
       return (CUPS_BACKEND_FAILED);
     }
-    if (sizein == 0)
-      // We are done!
-      break;
-
-    // Write it.
-    for (done = 0; done < sizein; done += sizeout)
+    if ((dirfd = open(dir, O_RDONLY | O_DIRECTORY)) >= 0)
     {
-      sizeout = write(fd, buffer + done, sizein - done);
-      if (sizeout < 0)
-      {
-	fprintf(stderr, "ERROR: while writing to \"%s\": %s\n",
-		outfile, strerror(errno));
-	return (CUPS_BACKEND_FAILED);
-      }
+      fsync(dirfd);
+      close(dirfd);
     }
   }
+
   if (close(fd) < 0)
   {
     fprintf(stderr, "ERROR: while closing \"%s\": %s\n",
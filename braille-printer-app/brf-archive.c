@@ -0,0 +1,435 @@
+//
+// Job output archive and resume support for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The final BRF stream of every job is kept in the spool directory as
+// "job-NNN.brf" next to a "job-NNN.idx" sidecar holding the offset of each
+// page and a checkpoint of what was sent to the embosser.  After a jam, a
+// small resume ticket ("application/vnd.cups-brf-resume") printed through
+// brf_resume_filter_function() sends the stored pages from page N again,
+// without converting the document a second time.  Only the user who
+// printed the job can resume it, on the same printer.  Archived jobs are
+// removed once they are older than "job-archive-hours".
+//
+// Index layout, native byte order as the files never leave the host:
+//
+//   "BRFX", 32-bit version, 32-bit flags, 32-bit reserved,
+//   64-bit pages sent, 64-bit bytes sent, 256-byte user name,
+//   256-byte printer name, then 64-bit page offsets
+//
+
+#include <pappl/pappl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_ARCHIVE_VERSION 2      // Index format version
+#define BRF_ARCHIVE_COMPLETE 1     // Job finished normally
+#define BRF_ARCHIVE_HEADER 544     // Size of index header
+#define BRF_ARCHIVE_PRUNE 60       // Seconds between removals of old jobs
+
+// Local types...
+
+struct brf_archive_s // Job output archive
+{
+  int datafd,                    // BRF data file
+      indexfd;                   // Page index file
+  uint64_t bytes,                // Bytes archived
+      pages;                     // Form feeds archived
+};
+
+typedef struct brf_archive_header_s // Index header
+{
+  char magic[4];                 // "BRFX"
+  uint32_t version,              // Format version
+      flags,                     // BRF_ARCHIVE_ flags
+      reserved;                  // Reserved, 0
+  uint64_t pages_sent,           // Pages sent to the embosser
+      bytes_sent;                // Bytes sent to the embosser
+  char username[256],            // User who printed the job
+      printer[256];              // Printer of the job
+} brf_archive_header_t;
+
+// Local functions...
+
+static void archive_prune(void);
+static void archive_stop(brf_archive_t *a);
+
+// Local globals...
+
+static char brf_archive_dir[1024] = ""; // Archive directory, empty if disabled
+static int brf_archive_hours = 0;   // Hours to keep archived jobs
+static time_t brf_archive_pruned = 0; // Time old jobs were last removed
+static pthread_mutex_t brf_archive_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for removing old jobs
+
+// 'brf_ArchiveCreate()' - Start archiving the output of a job.
+
+brf_archive_t * // O - Archive or `NULL` if disabled or on error
+brf_ArchiveCreate(int job_id,  // I - Job ID
+                  const char *username, // I - User who printed the job
+                  const char *printer) // I - Printer of the job
+{
+  brf_archive_t *a;        // Archive
+  brf_archive_header_t header; // Index header
+  uint64_t first = 0;      // Offset of first page
+  char filename[1024];     // File name
+
+  if (!brf_archive_dir[0])
+    return (NULL);
+
+  archive_prune();
+
+  if ((a = (brf_archive_t *)calloc(1, sizeof(brf_archive_t))) == NULL)
+    return (NULL);
+
+  snprintf(filename, sizeof(filename), "%s/job-%d.brf", brf_archive_dir, job_id);
+  a->datafd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+  snprintf(filename, sizeof(filename), "%s/job-%d.idx", brf_archive_dir, job_id);
+  a->indexfd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "BRFX", 4);
+  header.version = BRF_ARCHIVE_VERSION;
+  papplCopyString(header.username, username ? username : "", sizeof(header.username));
+  papplCopyString(header.printer, printer ? printer : "", sizeof(header.printer));
+
+  if (a->datafd < 0 || a->indexfd < 0 || write(a->indexfd, &header, sizeof(header)) != sizeof(header) || write(a->indexfd, &first, sizeof(first)) != sizeof(first))
+  {
+    archive_stop(a);
+    free(a);
+    return (NULL);
+  }
+
+  return (a);
+}
+
+// 'brf_ArchiveWrite()' - Archive job output, indexing its pages.
+
+void
+brf_ArchiveWrite(brf_archive_t *a,   // I - Archive
+                 const char *buffer, // I - BRF data
+                 size_t bytes)       // I - Number of bytes
+{
+  uint64_t offsets[256];             // Offsets of new pages
+  size_t num_offsets = 0;            // Number of new pages
+  const char *ptr,                   // Pointer into buffer
+      *end = buffer + bytes;         // End of buffer
+
+  if (!a || a->datafd < 0)
+    return;
+
+  if (write(a->datafd, buffer, bytes) != (ssize_t)bytes)
+  {
+    archive_stop(a);
+    return;
+  }
+
+  for (ptr = buffer; ptr < end && (ptr = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL; ptr++)
+  {
+    offsets[num_offsets++] = a->bytes + (uint64_t)(ptr - buffer) + 1;
+    a->pages++;
+
+    if (num_offsets == (sizeof(offsets) / sizeof(offsets[0])))
+    {
+      if (write(a->indexfd, offsets, sizeof(offsets)) != sizeof(offsets))
+      {
+        archive_stop(a);
+        return;
+      }
+
+      num_offsets = 0;
+    }
+  }
+
+  if (num_offsets > 0 && write(a->indexfd, offsets, num_offsets * sizeof(uint64_t)) != (ssize_t)(num_offsets * sizeof(uint64_t)))
+  {
+    archive_stop(a);
+    return;
+  }
+
+  a->bytes += bytes;
+}
+
+// 'brf_ArchiveCheckpoint()' - Record that everything archived so far was
+//                             sent to the embosser.
+
+bool                                    // O - `true` on success, `false` on error
+brf_ArchiveCheckpoint(brf_archive_t *a) // I - Archive
+{
+  uint64_t sent[2];                     // Pages and bytes sent
+
+  if (!a || a->datafd < 0)
+    return (false);
+
+  sent[0] = a->pages;
+  sent[1] = a->bytes;
+
+  return (pwrite(a->indexfd, sent, sizeof(sent), offsetof(brf_archive_header_t, pages_sent)) == sizeof(sent));
+}
+
+// 'brf_ArchiveClose()' - Finish archiving the output of a job.
+
+bool                               // O - `true` on success, `false` on error
+brf_ArchiveClose(brf_archive_t *a, // I - Archive
+                 bool complete)    // I - Was the whole job sent?
+{
+  uint32_t flags = BRF_ARCHIVE_COMPLETE; // Index flags
+  bool ret;                        // Return value
+
+  if (!a)
+    return (false);
+
+  ret = brf_ArchiveCheckpoint(a);
+
+  if (ret && complete)
+    ret = pwrite(a->indexfd, &flags, sizeof(flags), offsetof(brf_archive_header_t, flags)) == sizeof(flags);
+
+  archive_stop(a);
+  free(a);
+
+  return (ret);
+}
+
+// 'brf_ArchiveInit()' - Set up the job archive and remove old jobs.
+//
+// Archived jobs older than "max_hours" are removed, now and whenever a job
+// is archived, 0 disables archiving.
+
+void
+brf_ArchiveInit(const char *spool_dir, // I - Spool directory
+                int max_hours)         // I - Maximum age in hours
+{
+  papplCopyString(brf_archive_dir, max_hours > 0 && spool_dir ? spool_dir : "", sizeof(brf_archive_dir));
+  brf_archive_hours = max_hours;
+
+  archive_prune();
+}
+
+// 'brf_resume_filter_function()' - Send the archived output of a job from a
+//                                  given page.
+//
+// The input is a resume ticket with "job-id=NNN" and optionally "page=NNN"
+// lines.  Without a page, the job resumes after the last page that was
+// completely sent to the embosser.
+
+int // O - Exit status
+brf_resume_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  char ticket[1024],        // Resume ticket
+      filename[1024],       // File name
+      *ptr;                 // Pointer into ticket
+  ssize_t bytes;            // Bytes read/written
+  int job_id = 0,           // Job to resume
+      page = 0,             // Page to resume from
+      datafd = -1,          // BRF data file
+      indexfd = -1;         // Page index file
+  struct stat datainfo,     // BRF data file information
+      indexinfo;            // Page index file information
+  unsigned char *datamap = MAP_FAILED;
+                            // Mapped BRF data
+  void *indexmap = MAP_FAILED; // Mapped page index
+  const brf_archive_header_t *header; // Index header
+  const uint64_t *offsets;  // Page offsets
+  size_t num_pages;         // Number of pages
+  uint64_t offset;          // Offset to resume from
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)inputseekable;
+  (void)parameters;
+
+  // Read the ticket...
+  if ((bytes = read(inputfd, ticket, sizeof(ticket) - 1)) < 0)
+    bytes = 0;
+  ticket[bytes] = '\0';
+
+  for (ptr = ticket; ptr && *ptr; ptr = strchr(ptr, '\n') ? strchr(ptr, '\n') + 1 : NULL)
+  {
+    if (!strncmp(ptr, "job-id=", 7))
+      job_id = atoi(ptr + 7);
+    else if (!strncmp(ptr, "page=", 5))
+      page = atoi(ptr + 5);
+  }
+
+  if (job_id <= 0 || page < 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Bad resume ticket.");
+    return (1);
+  }
+
+  // Map the archived output and its index...
+  if (!brf_archive_dir[0])
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Job archive is disabled.");
+    return (1);
+  }
+
+  snprintf(filename, sizeof(filename), "%s/job-%d.brf", brf_archive_dir, job_id);
+  if ((datafd = open(filename, O_RDONLY | O_CLOEXEC)) < 0 || fstat(datafd, &datainfo))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: No archived output for job %d: %s", job_id, strerror(errno));
+    goto done;
+  }
+
+  snprintf(filename, sizeof(filename), "%s/job-%d.idx", brf_archive_dir, job_id);
+  if ((indexfd = open(filename, O_RDONLY | O_CLOEXEC)) < 0 || fstat(indexfd, &indexinfo) || indexinfo.st_size < (off_t)(BRF_ARCHIVE_HEADER + sizeof(uint64_t)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: No page index for job %d.", job_id);
+    goto done;
+  }
+
+  if ((indexmap = mmap(NULL, (size_t)indexinfo.st_size, PROT_READ, MAP_SHARED, indexfd, 0)) == MAP_FAILED ||
+      (datainfo.st_size > 0 && (datamap = mmap(NULL, (size_t)datainfo.st_size, PROT_READ, MAP_SHARED, datafd, 0)) == MAP_FAILED))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Unable to map job %d: %s", job_id, strerror(errno));
+    goto done;
+  }
+
+  header = (const brf_archive_header_t *)indexmap;
+  offsets = (const uint64_t *)((const char *)indexmap + BRF_ARCHIVE_HEADER);
+  num_pages = ((size_t)indexinfo.st_size - BRF_ARCHIVE_HEADER) / sizeof(uint64_t);
+
+  if (memcmp(header->magic, "BRFX", 4) || header->version != BRF_ARCHIVE_VERSION)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Bad page index for job %d.", job_id);
+    goto done;
+  }
+
+  // Only the user who printed the job may resume it, on the same printer...
+  if (!data->job_user || strncmp(header->username, data->job_user, sizeof(header->username)) || !data->printer || strncmp(header->printer, data->printer, sizeof(header->printer)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Job %d was not printed by user '%s' on printer '%s'.", job_id, data->job_user ? data->job_user : "", data->printer ? data->printer : "");
+    goto done;
+  }
+
+  // A trailing form feed does not start another page...
+  if (num_pages > 1 && offsets[num_pages - 1] >= (uint64_t)datainfo.st_size)
+    num_pages--;
+
+  if (page == 0)
+    page = (int)header->pages_sent + 1;
+
+  if ((size_t)page > num_pages)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Job %d only has %u pages.", job_id, (unsigned)num_pages);
+    goto done;
+  }
+
+  offset = offsets[page - 1];
+
+  if (log)
+    log(ld, CF_LOGLEVEL_INFO, "brf_resume_filter_function: Resuming job %d at page %d of %u (%s).", job_id, page, (unsigned)num_pages, (header->flags & BRF_ARCHIVE_COMPLETE) ? "completed" : "interrupted");
+
+  // Send the remaining pages...
+  while (offset < (uint64_t)datainfo.st_size)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      break;
+
+    if ((bytes = write(outputfd, datamap + offset, (size_t)((uint64_t)datainfo.st_size - offset))) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_resume_filter_function: Unable to write: %s", strerror(errno));
+      goto done;
+    }
+
+    offset += (uint64_t)bytes;
+  }
+
+  ret = 0;
+
+  done:
+
+  if (datamap != MAP_FAILED)
+    munmap(datamap, (size_t)datainfo.st_size);
+  if (indexmap != MAP_FAILED)
+    munmap(indexmap, (size_t)indexinfo.st_size);
+  if (datafd >= 0)
+    close(datafd);
+  if (indexfd >= 0)
+    close(indexfd);
+
+  return (ret);
+}
+
+// 'archive_prune()' - Remove archived jobs that are too old.
+
+static void
+archive_prune(void)
+{
+  DIR *dir;                             // Spool directory
+  struct dirent *dent;                  // Directory entry
+  struct stat st;                       // File information
+  char filename[1024];                  // File name
+  time_t now = time(NULL),              // Current time
+      oldest;                           // Oldest time to keep
+
+  // Scan the directory at most once per BRF_ARCHIVE_PRUNE seconds...
+  pthread_mutex_lock(&brf_archive_lock);
+  if (brf_archive_pruned && now < brf_archive_pruned + BRF_ARCHIVE_PRUNE)
+  {
+    pthread_mutex_unlock(&brf_archive_lock);
+    return;
+  }
+  brf_archive_pruned = now;
+  pthread_mutex_unlock(&brf_archive_lock);
+
+  if (brf_archive_hours <= 0 || !brf_archive_dir[0] || (dir = opendir(brf_archive_dir)) == NULL)
+    return;
+
+  oldest = now - 3600 * (time_t)brf_archive_hours;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    size_t len = strlen(dent->d_name); // Length of name
+
+    if (strncmp(dent->d_name, "job-", 4) || len < 8 || (strcmp(dent->d_name + len - 4, ".brf") && strcmp(dent->d_name + len - 4, ".idx")))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", brf_archive_dir, dent->d_name);
+    if (!stat(filename, &st) && st.st_mtime < oldest)
+      unlink(filename);
+  }
+
+  closedir(dir);
+}
+
+// 'archive_stop()' - Stop archiving, rather than keep a truncated copy.
+
+static void
+archive_stop(brf_archive_t *a) // I - Archive
+{
+  if (a->datafd >= 0)
+    close(a->datafd);
+  if (a->indexfd >= 0)
+    close(a->indexfd);
+
+  a->datafd = a->indexfd = -1;
+}
@@ -0,0 +1,485 @@
+//
+// Rendered tactile graphic cache for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Rendered dot grids are kept as files in the "graphics" subdirectory of the
+// spool directory, so a diagram embossed again for another student skips
+// decoding and rendering.  The key is the SHA-256 of the picture file
+// together with the options that change the dots and the size of the
+// graphic area.  Files are named after the SHA-256 of the key and hold the
+// key itself, so a lookup is a single open.
+//
+// The text margins are not part of the key because they are only added when
+// the grid is written.  The page margins move the graphic area: a grid
+// rendered at another offset is moved to the new one when the render would
+// not change, that is when the picture and the dots around it stay inside
+// the grid, the area outside the picture has no dots and any dither or
+// texture pattern stays aligned.
+//
+// Files are written to a temporary name and renamed, so readers never see a
+// partial grid.  Lookups touch the file and the least recently used files
+// are removed when the cache grows larger than its size.
+//
+// File layout, native byte order as the files never leave the host:
+//
+//   header, key, dots (one bit per dot, rows of the whole grid)
+//
+
+#include <pappl/pappl.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_CACHE_VERSION 1         // File format version
+#define BRF_CACHE_MAX_KEY 1024      // Maximum length of key
+
+// Local types...
+
+typedef struct brf_cache_header_s   // File header
+{
+  char magic[4];                    // "BRFG"
+  uint32_t version;                 // Format version
+  int32_t width,                    // Width of grid in dots
+      height,                       // Height of grid in dots
+      hoffset,                      // Offset of graphic area
+      voffset,
+      x, y,                         // Picture in the grid
+      w, h;
+  uint32_t keylen;                  // Length of key
+} brf_cache_header_t;
+
+typedef struct brf_cache_stats_s    // Counters shared with the filters
+{
+  uint64_t hits,                    // Number of lookups found
+      misses;                       // Number of lookups not found
+} brf_cache_stats_t;
+
+typedef struct brf_cache_file_s     // File in the cache directory
+{
+  char name[80];                    // File name
+  time_t mtime;                     // Time of last use
+  off_t size;                       // Size of file
+} brf_cache_file_t;
+
+// Local functions...
+
+static int cache_compare(const brf_cache_file_t *a, const brf_cache_file_t *b);
+static bool cache_filename(const char *key, char *filename, size_t filesize);
+static bool cache_movable(const brf_cache_header_t *header, const brf_tactile_t *tac, int dx, int dy);
+static void cache_prune(size_t max_size, unsigned long long *files, unsigned long long *bytes);
+
+// Local globals...
+
+static char cache_dir[1024] = "";   // Cache directory, empty if disabled
+static size_t cache_size = 0;       // Maximum size of cache
+static brf_cache_stats_t *cache_stats = NULL;
+                                    // Counters
+
+// 'brf_CacheGetStats()' - Get the graphic cache counters.
+
+bool                                // O - `true` if enabled, `false` otherwise
+brf_CacheGetStats(
+    unsigned long long *hits,       // O - Number of lookups found
+    unsigned long long *misses,     // O - Number of lookups not found
+    unsigned long long *files,      // O - Number of cached grids
+    unsigned long long *bytes)      // O - Bytes used
+{
+  if (!cache_dir[0] || !cache_stats)
+  {
+    *hits = *misses = *files = *bytes = 0;
+    return (false);
+  }
+
+  *hits = __atomic_load_n(&cache_stats->hits, __ATOMIC_RELAXED);
+  *misses = __atomic_load_n(&cache_stats->misses, __ATOMIC_RELAXED);
+
+  cache_prune(0, files, bytes);
+
+  return (true);
+}
+
+// 'brf_CacheInit()' - Set up the graphic cache.
+//
+// A size of 0 disables the cache.
+
+void
+brf_CacheInit(const char *spool_dir, // I - Spool directory
+              size_t size)           // I - Maximum size in bytes
+{
+  brf_cache_stats_t *stats;          // Counters
+
+  cache_dir[0] = '\0';
+
+  if (!size || !spool_dir || !*spool_dir)
+    return;
+
+  snprintf(cache_dir, sizeof(cache_dir), "%s/graphics", spool_dir);
+
+  if (mkdir(cache_dir, 0700) && errno != EEXIST)
+  {
+    fprintf(stderr, "brf: Unable to create graphic cache '%s': %s\n", cache_dir, strerror(errno));
+    cache_dir[0] = '\0';
+    return;
+  }
+
+  // The filter processes inherit the counters...
+  if (!cache_stats && (stats = (brf_cache_stats_t *)mmap(NULL, sizeof(brf_cache_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED)
+    cache_stats = stats;
+
+  cache_size = size;
+
+  cache_prune(cache_size, NULL, NULL);
+}
+
+// 'brf_CacheKey()' - Make the cache key of a picture.
+//
+// Only pictures in regular files can be cached, as the picture must be
+// hashed before it is decoded.
+
+bool                                // O - `true` if cacheable, `false` otherwise
+brf_CacheKey(
+    int fd,                         // I - Picture file
+    const brf_tactile_t *tac,       // I - Tactile graphic
+    const brf_geometry_t *geom,     // I - Page geometry
+    int num_options,                // I - Number of options
+    cups_option_t *options,         // I - Options
+    char *key,                      // O - Key
+    size_t keysize)                 // I - Size of key buffer
+{
+  struct stat st;                   // File information
+  void *map;                        // Mapped picture
+  unsigned char hash[32];           // SHA-256 of picture
+  char hex[65];                     // SHA-256 as hex
+  const char *rotate,               // Placement options
+      *fitplot,
+      *mirror;
+  ssize_t hashlen;                  // Length of hash
+
+  if (!cache_dir[0] || fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return (false);
+
+  if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    return (false);
+
+  hashlen = cupsHashData("sha2-256", map, (size_t)st.st_size, hash, sizeof(hash));
+
+  munmap(map, (size_t)st.st_size);
+
+  if (hashlen <= 0)
+    return (false);
+
+  if ((rotate = cupsGetOption("Rotate", num_options, options)) == NULL)
+    rotate = "";
+  if ((fitplot = cupsGetOption("fitplot", num_options, options)) == NULL)
+    fitplot = "";
+  if ((mirror = cupsGetOption("mirror", num_options, options)) == NULL)
+    mirror = "";
+
+  snprintf(key, keysize, "%s Rotate=%s fitplot=%s mirror=%s Dither=%d Texture=%d Edge=%d Negate=%d EdgeFactor=%d Canny=%d,%d,%d,%d grid=%dx%d area=%dx%d", cupsHashString(hash, (size_t)hashlen, hex, sizeof(hex)), rotate, fitplot, mirror, (int)tac->dither, tac->texture, (int)tac->edge, tac->negate, tac->edge_factor, tac->canny_radius, tac->canny_sigma, tac->canny_lower, tac->canny_upper, tac->width, tac->height, geom->graphic_width, geom->graphic_height);
+
+  return (strlen(key) < keysize - 1);
+}
+
+// 'brf_CacheLookup()' - Get the rendered dots of a picture.
+
+bool                                // O - `true` if found, `false` otherwise
+brf_CacheLookup(
+    const char *key,                // I - Key
+    brf_tactile_t *tac,             // I - Tactile graphic
+    const brf_geometry_t *geom)     // I - Page geometry
+{
+  char filename[1024],              // File name
+      filekey[BRF_CACHE_MAX_KEY];   // Key in file
+  int fd;                           // File descriptor
+  brf_cache_header_t header;        // File header
+  unsigned char *bits = NULL;       // Dots of file
+  size_t keylen = strlen(key),      // Length of key
+      bytes = (size_t)tac->width * (size_t)tac->height;
+                                    // Number of dots
+  int x, y,                         // Looping vars
+      dx = 0, dy = 0;               // Move of the graphic area
+  bool found = false;               // Was the grid found?
+
+  if (!cache_filename(key, filename, sizeof(filename)))
+    return (false);
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) >= 0)
+  {
+    if (read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && !memcmp(header.magic, "BRFG", 4) && header.version == BRF_CACHE_VERSION && header.width == tac->width && header.height == tac->height && header.keylen == keylen && keylen < sizeof(filekey) && read(fd, filekey, keylen) == (ssize_t)keylen && !memcmp(filekey, key, keylen))
+    {
+      dx = geom->graphic_hoffset - header.hoffset;
+      dy = geom->graphic_voffset - header.voffset;
+
+      if ((!dx && !dy) || cache_movable(&header, tac, dx, dy))
+      {
+        if ((bits = (unsigned char *)malloc((bytes + 7) / 8)) != NULL && read(fd, bits, (bytes + 7) / 8) == (ssize_t)((bytes + 7) / 8))
+          found = true;
+      }
+    }
+
+    // Keep the file for longer...
+    if (found)
+      futimens(fd, NULL);
+
+    close(fd);
+  }
+
+  if (found)
+  {
+    memset(tac->dots, 0, bytes);
+
+    for (y = 0; y < tac->height; y++)
+    {
+      if (y + dy < 0 || y + dy >= tac->height)
+        continue;
+
+      for (x = 0; x < tac->width; x++)
+      {
+        size_t i = (size_t)y * (size_t)tac->width + (size_t)x;
+                                    // Index of dot
+
+        if (x + dx >= 0 && x + dx < tac->width && (bits[i / 8] & (0x80 >> (i & 7))))
+          tac->dots[(size_t)(y + dy) * (size_t)tac->width + (size_t)(x + dx)] = 255;
+      }
+    }
+  }
+
+  free(bits);
+
+  if (cache_stats)
+    __atomic_add_fetch(found ? &cache_stats->hits : &cache_stats->misses, 1, __ATOMIC_RELAXED);
+
+  return (found);
+}
+
+// 'brf_CacheStore()' - Store the rendered dots of a picture.
+
+void
+brf_CacheStore(
+    const char *key,                // I - Key
+    const brf_tactile_t *tac,       // I - Tactile graphic
+    const brf_geometry_t *geom,     // I - Page geometry
+    int x,                          // I - Left of picture in the grid
+    int y,                          // I - Top of picture in the grid
+    int w,                          // I - Width of picture
+    int h)                          // I - Height of picture
+{
+  char filename[1024],              // File name
+      tempname[1024];               // Temporary file name
+  int fd;                           // File descriptor
+  brf_cache_header_t header;        // File header
+  unsigned char *bits;              // Dots of file
+  size_t i,                         // Looping var
+      keylen = strlen(key),         // Length of key
+      bytes = (size_t)tac->width * (size_t)tac->height;
+                                    // Number of dots
+  bool written;                     // Was the file written?
+
+  if (keylen >= BRF_CACHE_MAX_KEY || !cache_filename(key, filename, sizeof(filename)))
+    return;
+
+  if ((bits = (unsigned char *)calloc(1, (bytes + 7) / 8)) == NULL)
+    return;
+
+  for (i = 0; i < bytes; i++)
+  {
+    if (tac->dots[i])
+      bits[i / 8] |= 0x80 >> (i & 7);
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "BRFG", 4);
+  header.version = BRF_CACHE_VERSION;
+  header.width = tac->width;
+  header.height = tac->height;
+  header.hoffset = geom->graphic_hoffset;
+  header.voffset = geom->graphic_voffset;
+  header.x = x;
+  header.y = y;
+  header.w = w;
+  header.h = h;
+  header.keylen = (uint32_t)keylen;
+
+  snprintf(tempname, sizeof(tempname), "%s.%d", filename, (int)getpid());
+
+  if ((fd = open(tempname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    free(bits);
+    return;
+  }
+
+  written = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && write(fd, key, keylen) == (ssize_t)keylen && write(fd, bits, (bytes + 7) / 8) == (ssize_t)((bytes + 7) / 8);
+
+  free(bits);
+
+  if (close(fd) || !written || rename(tempname, filename))
+  {
+    unlink(tempname);
+    return;
+  }
+
+  cache_prune(cache_size, NULL, NULL);
+}
+
+// 'cache_compare()' - Sort files from the least recently used.
+
+static int                          // O - Result of comparison
+cache_compare(const brf_cache_file_t *a, // I - First file
+              const brf_cache_file_t *b) // I - Second file
+{
+  if (a->mtime < b->mtime)
+    return (-1);
+  else if (a->mtime > b->mtime)
+    return (1);
+  else
+    return (strcmp(a->name, b->name));
+}
+
+// 'cache_filename()' - Get the file name of a key.
+
+static bool                         // O - `true` on success, `false` if disabled
+cache_filename(const char *key,     // I - Key
+               char *filename,      // O - File name
+               size_t filesize)     // I - Size of file name buffer
+{
+  unsigned char hash[32];           // SHA-256 of key
+  char hex[65];                     // SHA-256 as hex
+  ssize_t hashlen;                  // Length of hash
+
+  if (!cache_dir[0] || (hashlen = cupsHashData("sha2-256", key, strlen(key), hash, sizeof(hash))) <= 0)
+    return (false);
+
+  snprintf(filename, filesize, "%s/%s.dots", cache_dir, cupsHashString(hash, (size_t)hashlen, hex, sizeof(hex)));
+
+  return (true);
+}
+
+// 'cache_movable()' - Can a grid be moved to another graphic area offset?
+//
+// Dots outside the picture come from the contour detectors only, up to the
+// blur radius plus the gradient kernel away.  Negated pictures raise the
+// whole area around the picture, error diffusion carries errors across it
+// and dither matrices and textures repeat every 8 dots.
+
+static bool                         // O - `true` if movable, `false` otherwise
+cache_movable(
+    const brf_cache_header_t *header, // I - File header
+    const brf_tactile_t *tac,       // I - Tactile graphic
+    int dx,                         // I - Horizontal move
+    int dy)                         // I - Vertical move
+{
+  int border = 0;                   // Dots around the picture
+
+  if (tac->negate || tac->dither == BRF_DITHER_DIFFUSION)
+    return (false);
+
+  if ((tac->dither == BRF_DITHER_ORDERED || tac->dither == BRF_DITHER_TEXTURE) && ((dx & 7) || (dy & 7)))
+    return (false);
+
+  if (tac->edge == BRF_EDGE_SIMPLE)
+  {
+    border = 2;
+  }
+  else if (tac->edge == BRF_EDGE_CANNY)
+  {
+    border = tac->canny_radius > 0 ? tac->canny_radius : 2 * tac->canny_sigma;
+    if (border > 16)
+      border = 16;
+    border += 2;
+  }
+
+  // The picture and its border must be inside the grid before and after...
+  return (header->x - border >= 0 && header->y - border >= 0 &&
+          header->x + header->w + border <= tac->width && header->y + header->h + border <= tac->height &&
+          header->x + dx - border >= 0 && header->y + dy - border >= 0 &&
+          header->x + dx + header->w + border <= tac->width && header->y + dy + header->h + border <= tac->height);
+}
+
+// 'cache_prune()' - Remove the least recently used files over the size.
+//
+// A size of 0 only counts the files.
+
+static void
+cache_prune(size_t max_size,        // I - Maximum size or 0 to count
+            unsigned long long *files, // O - Number of files or `NULL`
+            unsigned long long *bytes) // O - Bytes used or `NULL`
+{
+  DIR *dir;                         // Cache directory
+  struct dirent *dent;              // Directory entry
+  struct stat st;                   // File information
+  char filename[1024];              // File name
+  brf_cache_file_t *list = NULL,    // Files
+      *temp;                        // New list
+  size_t i,                         // Looping var
+      num_list = 0,                 // Number of files
+      alloc_list = 0;               // Allocated files
+  unsigned long long total = 0;     // Total size
+
+  if ((dir = opendir(cache_dir)) == NULL)
+    return;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    size_t len = strlen(dent->d_name); // Length of name
+
+    if (len < 6 || len >= sizeof(list->name) || strcmp(dent->d_name + len - 5, ".dots"))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", cache_dir, dent->d_name);
+    if (stat(filename, &st))
+      continue;
+
+    total += (unsigned long long)st.st_size;
+
+    if (!max_size)
+    {
+      num_list ++;
+      continue;
+    }
+
+    if (num_list >= alloc_list)
+    {
+      if ((temp = (brf_cache_file_t *)realloc(list, (alloc_list + 256) * sizeof(brf_cache_file_t))) == NULL)
+        break;
+
+      list = temp;
+      alloc_list += 256;
+    }
+
+    papplCopyString(list[num_list].name, dent->d_name, sizeof(list[num_list].name));
+    list[num_list].mtime = st.st_mtime;
+    list[num_list].size = st.st_size;
+    num_list ++;
+  }
+
+  closedir(dir);
+
+  if (max_size && total > max_size)
+  {
+    qsort(list, num_list, sizeof(brf_cache_file_t), (int (*)(const void *, const void *))cache_compare);
+
+    for (i = 0; i < num_list && total > max_size; i++)
+    {
+      snprintf(filename, sizeof(filename), "%s/%s", cache_dir, list[i].name);
+
+      if (!unlink(filename))
+        total -= (unsigned long long)list[i].size;
+    }
+
+    num_list -= i;
+  }
+
+  free(list);
+
+  if (files)
+    *files = num_list;
+  if (bytes)
+    *bytes = total;
+}
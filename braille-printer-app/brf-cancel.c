@@ -0,0 +1,308 @@
+//
+// Job cancellation for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The filter chain runs its stages in child processes which only see the
+// state of the job as it was when they were forked, so they never learn
+// from papplJobIsCanceled() that the job was canceled, and the external
+// filters and their "file2brl", "gs" or "convert" children do not look at
+// all.  Every stage therefore runs its filter in a child process which
+// starts its own process group, and records the group in a shared anonymous
+// mapping.  A watch thread of the job polls the job and, once it is
+// canceled, sets the shared flag and sends SIGTERM to the process groups,
+// followed by SIGKILL for those that are still there after a grace period.
+// The pipes of the killed stages are closed with them, so the print stage
+// sees the end of its input right away.
+//
+// A process group ID can be reused once the group is gone, so the stage
+// keeps the exited child unreaped, which keeps its ID, until the group is
+// cleared from the mapping, and after a cancel until the SIGKILL was sent.
+// The watch thread marks the group it is about to signal, and the stage
+// waits for that mark to go away before it reaps the child.
+//
+
+#include <pappl/pappl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_CANCEL_GRACE 1000000    // Microseconds until SIGKILL
+#define BRF_CANCEL_INTERVAL 10000   // Microseconds between job polls
+#define BRF_CANCEL_MAX_STAGES 16    // Maximum number of stages
+
+// Local types...
+
+typedef struct brf_cancel_shared_s  // State shared with the filter stages
+{
+  int canceled;             // Is the job canceled?
+  int killed;               // Was SIGKILL sent or will it never be?
+  int stop;                 // Stop the watch thread?
+  pid_t groups[BRF_CANCEL_MAX_STAGES];
+                            // Process groups of running stages
+  int signaling[BRF_CANCEL_MAX_STAGES];
+                            // Is the group about to be signaled?
+} brf_cancel_shared_t;
+
+typedef struct brf_cancel_stage_s   // Stage of the filter chain
+{
+  brf_cancel_t *cancel;     // Job cancellation
+  int index;                // Index of process group
+  cf_filter_filter_in_chain_t *filter;
+                            // Filter of stage
+  cf_filter_filter_in_chain_t wrapper;
+                            // Filter running the stage
+} brf_cancel_stage_t;
+
+struct brf_cancel_s         // Job cancellation
+{
+  pappl_job_t *job;         // Job
+  pid_t server_pid;         // Process ID of the server
+  brf_cancel_shared_t *shared; // Shared state
+  pthread_t tid;            // Watch thread
+  bool running;             // Is the watch thread running?
+  int num_stages;           // Number of stages
+  brf_cancel_stage_t stages[BRF_CANCEL_MAX_STAGES];
+                            // Stages
+};
+
+// Local functions...
+
+static int cancel_signal(brf_cancel_t *c, int sig);
+static void *cancel_thread(void *data);
+
+// 'brf_CancelCreate()' - Start watching a job for cancellation.
+
+brf_cancel_t *              // O - Job cancellation or `NULL` on error
+brf_CancelCreate(
+    pappl_job_t *job)       // I - Job
+{
+  brf_cancel_t *c;          // Job cancellation
+
+  if ((c = (brf_cancel_t *)calloc(1, sizeof(brf_cancel_t))) == NULL)
+    return (NULL);
+
+  if ((c->shared = (brf_cancel_shared_t *)mmap(NULL, sizeof(brf_cancel_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to map cancellation state: %s", strerror(errno));
+    free(c);
+    return (NULL);
+  }
+
+  c->job = job;
+  c->server_pid = getpid();
+
+  if (pthread_create(&c->tid, NULL, cancel_thread, c))
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to start cancellation thread, filters only stop by themselves.");
+  else
+    c->running = true;
+
+  return (c);
+}
+
+// 'brf_CancelDelete()' - Stop watching a job for cancellation.
+
+void
+brf_CancelDelete(
+    brf_cancel_t *c)        // I - Job cancellation or `NULL`
+{
+  if (!c)
+    return;
+
+  if (c->running)
+  {
+    __atomic_store_n(&c->shared->stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(c->tid, NULL);
+  }
+
+  munmap(c->shared, sizeof(brf_cancel_shared_t));
+  free(c);
+}
+
+// 'brf_CancelIsCanceled()' - Return 1 if the job is canceled.
+//
+// This is the "iscanceledfunc" of the filter data, it also works in the
+// stages of the filter chain.
+
+int                         // O - 1 if canceled, 0 otherwise
+brf_CancelIsCanceled(
+    void *data)             // I - Job cancellation
+{
+  brf_cancel_t *c = (brf_cancel_t *)data;
+                            // Job cancellation
+
+  return (c && __atomic_load_n(&c->shared->canceled, __ATOMIC_SEQ_CST) ? 1 : 0);
+}
+
+// 'brf_CancelStage()' - Run a stage of the filter chain in its own process
+//                       group.
+//
+// The returned filter replaces "filter" in the chain and is valid until the
+// job cancellation is deleted.  The stage that writes to the device must
+// not be added, it stops by itself and ends the job cleanly.
+
+cf_filter_filter_in_chain_t *  // O - Filter for the chain
+brf_CancelStage(
+    brf_cancel_t *c,           // I - Job cancellation or `NULL`
+    cf_filter_filter_in_chain_t *filter)
+                               // I - Filter of stage
+{
+  brf_cancel_stage_t *stage;   // New stage
+
+  if (!c || c->num_stages >= BRF_CANCEL_MAX_STAGES)
+    return (filter);
+
+  stage = c->stages + c->num_stages;
+
+  stage->cancel = c;
+  stage->index = c->num_stages++;
+  stage->filter = filter;
+  stage->wrapper.function = brf_cancel_filter_function;
+  stage->wrapper.parameters = stage;
+  stage->wrapper.name = filter->name;
+
+  return (&stage->wrapper);
+}
+
+// 'brf_cancel_filter_function()' - Run a stage in its own process group.
+
+int                         // O - Exit status
+brf_cancel_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable?
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Stage
+{
+  brf_cancel_stage_t *stage = (brf_cancel_stage_t *)parameters;
+                            // Stage
+  brf_cancel_shared_t *shared = stage->cancel->shared;
+                            // Shared state
+  pid_t pid;                // Process ID of filter
+  siginfo_t info;           // Exit information of filter
+  int status,               // Exit status of filter
+      nullfd;               // File descriptor for /dev/null
+
+  // A chain of one stage runs in the server, which keeps its group...
+  if (getpid() == stage->cancel->server_pid || (pid = fork()) < 0)
+    return ((stage->filter->function)(inputfd, outputfd, inputseekable, data, stage->filter->parameters));
+
+  if (pid == 0)
+  {
+    // Run the filter in its own process group...
+    setpgid(0, 0);
+
+    if (__atomic_load_n(&shared->canceled, __ATOMIC_SEQ_CST))
+      _exit(1);
+
+    _exit((stage->filter->function)(inputfd, outputfd, inputseekable, data, stage->filter->parameters));
+  }
+
+  // Only the filter keeps the pipes open, so the other stages see their
+  // end when it exits...
+  if ((nullfd = open("/dev/null", O_RDWR)) >= 0)
+  {
+    dup2(nullfd, inputfd);
+    dup2(nullfd, outputfd);
+    close(nullfd);
+  }
+
+  // Either process may create the group first, it fails here only when the
+  // filter already did...
+  setpgid(pid, pid);
+
+  __atomic_store_n(shared->groups + stage->index, pid, __ATOMIC_SEQ_CST);
+
+  // The watch thread may have looked at the groups before this one...
+  if (__atomic_load_n(&shared->canceled, __ATOMIC_SEQ_CST))
+    killpg(pid, SIGTERM);
+
+  // Wait for the filter to exit without reaping it, so its process group ID
+  // stays ours...
+  while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR);
+
+  // Children of a canceled filter may still ignore SIGTERM...
+  while (__atomic_load_n(&shared->canceled, __ATOMIC_SEQ_CST) && !__atomic_load_n(&shared->killed, __ATOMIC_SEQ_CST))
+    usleep(BRF_CANCEL_INTERVAL);
+
+  __atomic_store_n(shared->groups + stage->index, 0, __ATOMIC_SEQ_CST);
+
+  while (__atomic_load_n(shared->signaling + stage->index, __ATOMIC_SEQ_CST))
+    usleep(BRF_CANCEL_INTERVAL);
+
+  while (waitpid(pid, &status, 0) < 0)
+  {
+    if (errno != EINTR)
+      return (1);
+  }
+
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+// 'cancel_signal()' - Signal the process groups of the running stages.
+
+static int                  // O - Number of process groups signaled
+cancel_signal(brf_cancel_t *c, // I - Job cancellation
+              int sig)      // I - Signal
+{
+  int i,                    // Looping var
+      count = 0;            // Number of process groups signaled
+  pid_t group;              // Process group
+
+  for (i = 0; i < c->num_stages; i++)
+  {
+    // The stage does not reap its filter while the group is marked...
+    __atomic_store_n(c->shared->signaling + i, 1, __ATOMIC_SEQ_CST);
+
+    if ((group = __atomic_load_n(c->shared->groups + i, __ATOMIC_SEQ_CST)) > 0 && !killpg(group, sig))
+      count++;
+
+    __atomic_store_n(c->shared->signaling + i, 0, __ATOMIC_SEQ_CST);
+  }
+
+  return (count);
+}
+
+// 'cancel_thread()' - Watch the job and stop the stages once it is canceled.
+
+static void *               // O - Thread exit status
+cancel_thread(void *data)   // I - Job cancellation
+{
+  brf_cancel_t *c = (brf_cancel_t *)data;
+                            // Job cancellation
+  int waited = -1,          // Microseconds since SIGTERM or -1
+      count;                // Number of process groups signaled
+
+  while (!__atomic_load_n(&c->shared->stop, __ATOMIC_SEQ_CST))
+  {
+    if (waited < 0 && papplJobIsCanceled(c->job))
+    {
+      __atomic_store_n(&c->shared->canceled, 1, __ATOMIC_SEQ_CST);
+
+      count = cancel_signal(c, SIGTERM);
+      waited = 0;
+
+      papplLogJob(c->job, PAPPL_LOGLEVEL_INFO, "Job canceled, stopped %d filter process groups.", count);
+    }
+    else if (waited >= 0 && waited < BRF_CANCEL_GRACE && (waited += BRF_CANCEL_INTERVAL) >= BRF_CANCEL_GRACE)
+    {
+      if ((count = cancel_signal(c, SIGKILL)) > 0)
+        papplLogJob(c->job, PAPPL_LOGLEVEL_WARN, "Killed %d filter process groups which ignored SIGTERM.", count);
+
+      __atomic_store_n(&c->shared->killed, 1, __ATOMIC_SEQ_CST);
+    }
+
+    usleep(BRF_CANCEL_INTERVAL);
+  }
+
+  __atomic_store_n(&c->shared->killed, 1, __ATOMIC_SEQ_CST);
+
+  return (NULL);
+}
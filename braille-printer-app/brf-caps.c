@@ -0,0 +1,471 @@
+//
+// External tool capabilities for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The shell filters need external tools like lynx or antiword, and used to
+// search PATH for them on every job.  The tools are now probed once at
+// startup and again on SIGHUP.  Conversions whose filter or tools are
+// missing, or which do not lead to BRF, are pruned from the routing, and the
+// filters get the tools found in the BRF_TOOLS environment variable as
+// "name=path" words.
+//
+// Formats are registered with PAPPL at startup, so a tool which shows up
+// later is only used after a restart, while a tool which goes away is noticed
+// on SIGHUP.
+//
+
+#include <pappl/pappl.h>
+#include <liblouisutdml/liblouisutdml.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "brf-printer.h"
+
+// Local types...
+
+typedef struct brf_caps_need_s      // Tools needed by a filter
+{
+  const char *filter;               // Filter name in the chain
+  const char *srctype;              // Input format or `NULL` for any
+  const char *tools;                // Alternative tools, space-delimited
+} brf_caps_need_t;
+
+// Local functions...
+
+static bool caps_find_tool(const char *name, char *path, size_t pathsize);
+static bool caps_has_tools(const brf_spooling_conversion_t *conversion, char **missing);
+static void caps_sighup(int sig);
+
+// Local globals...
+
+static const char *const caps_tools[] =
+{                                   // Tools used by the filters
+  "FreeDots", "antiword", "convert", "docx2txt", "file2brl", "inkscape",
+  "lou_translate", "lynx", "pdftotext", "rtf2txt", "rtf2xml", "unzip"
+};
+static const brf_caps_need_t caps_needs[] =
+{                                   // Tools needed by the conversions
+  { "texttobrf", "application/msword", "antiword" },
+  { "texttobrf", "text/rtf", "rtf2txt rtf2xml" },
+  { "texttobrf", "application/rtf", "rtf2txt rtf2xml" },
+  { "imagetobrf", NULL, "convert" },
+  { "imagetoubrl", NULL, "convert" },
+  { "vectortobrf", NULL, "convert" },
+  { "vectortoubrl", NULL, "convert" },
+  { "xfigtopdf", NULL, "inkscape" },
+  { "wmftopdf", NULL, "inkscape" },
+  { "emftopdf", NULL, "inkscape" },
+  { "cgmtopdf", NULL, "inkscape" },
+  { "cmxtopdf", NULL, "inkscape" }
+};
+static pthread_mutex_t caps_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for the capabilities
+static brf_spooling_conversion_t *caps_conversions = NULL;
+                                    // Conversion table
+static bool *caps_available = NULL; // Usable conversions
+static size_t caps_num_conversions = 0;
+                                    // Number of conversions
+static char caps_env[4096] = "BRF_TOOLS=";
+                                    // Tools for the filters
+static char caps_found[sizeof(caps_tools) / sizeof(caps_tools[0])][1024];
+                                    // Paths of the tools
+static volatile sig_atomic_t caps_reprobe = 0;
+                                    // SIGHUP received?
+static struct sigaction caps_oldhup;
+                                    // Previous SIGHUP action
+
+// 'brf_CapsCopyFilter()' - Copy a conversion filter for a job.
+//
+// External filters get the tools in their environment.  Free the copy with
+// brf_CapsFreeFilter().
+
+cf_filter_filter_in_chain_t *       // O - Copy of filter or `NULL` on error
+brf_CapsCopyFilter(
+    const cf_filter_filter_in_chain_t *filter) // I - Conversion filter
+{
+  cf_filter_filter_in_chain_t *copy; // Copy of filter
+  cf_filter_external_t *ext;        // Copy of external filter parameters
+  char **envp = NULL;               // Environment of external filter
+  size_t i,                         // Looping var
+      count = 0;                    // Number of environment strings
+
+  if ((copy = (cf_filter_filter_in_chain_t *)malloc(sizeof(cf_filter_filter_in_chain_t))) == NULL)
+    return (NULL);
+
+  *copy = *filter;
+
+  if (filter->function != cfFilterExternal || !filter->parameters)
+    return (copy);
+
+  if ((ext = (cf_filter_external_t *)malloc(sizeof(cf_filter_external_t))) == NULL)
+  {
+    free(copy);
+    return (NULL);
+  }
+
+  *ext = *(cf_filter_external_t *)filter->parameters;
+
+  if (ext->envp)
+  {
+    while (ext->envp[count])
+      count++;
+  }
+
+  if ((envp = (char **)calloc(count + 2, sizeof(char *))) == NULL)
+  {
+    free(ext);
+    free(copy);
+    return (NULL);
+  }
+
+  for (i = 0; i < count; i++)
+    envp[i] = ext->envp[i];
+
+  pthread_mutex_lock(&caps_lock);
+  envp[count] = strdup(caps_env);
+  pthread_mutex_unlock(&caps_lock);
+
+  ext->envp = envp;
+  copy->parameters = ext;
+
+  return (copy);
+}
+
+// 'brf_CapsFindConversion()' - Find a usable conversion for a format.
+
+brf_spooling_conversion_t *         // O - Conversion or `NULL` if none
+brf_CapsFindConversion(
+    const char *srctype)            // I - Input format
+{
+  size_t i;                         // Looping var
+  brf_spooling_conversion_t *conversion = NULL;
+                                    // Conversion
+
+  pthread_mutex_lock(&caps_lock);
+
+  for (i = 0; i < caps_num_conversions; i++)
+  {
+    if (caps_available[i] && !strcmp(caps_conversions[i].srctype, srctype))
+    {
+      conversion = caps_conversions + i;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&caps_lock);
+
+  return (conversion);
+}
+
+// 'brf_CapsFreeFilter()' - Free a filter copied by brf_CapsCopyFilter().
+
+void
+brf_CapsFreeFilter(
+    cf_filter_filter_in_chain_t *filter) // I - Copy of filter
+{
+  cf_filter_external_t *ext;        // External filter parameters
+  size_t count = 0;                 // Number of environment strings
+
+  if (!filter)
+    return;
+
+  if (filter->function == cfFilterExternal && (ext = (cf_filter_external_t *)filter->parameters) != NULL)
+  {
+    // The last environment string is ours...
+    while (ext->envp[count])
+      count++;
+
+    free(ext->envp[count - 1]);
+    free(ext->envp);
+    free(ext);
+  }
+
+  free(filter);
+}
+
+// 'brf_CapsHasTool()' - Was a tool found?
+
+bool                                // O - `true` if found
+brf_CapsHasTool(const char *name)   // I - Tool name
+{
+  size_t i;                         // Looping var
+  bool found = false;               // Was the tool found?
+
+  pthread_mutex_lock(&caps_lock);
+  for (i = 0; i < (sizeof(caps_tools) / sizeof(caps_tools[0])); i++)
+  {
+    if (!strcmp(caps_tools[i], name))
+    {
+      found = caps_found[i][0] != '\0';
+      break;
+    }
+  }
+  pthread_mutex_unlock(&caps_lock);
+
+  return (found);
+}
+
+// 'brf_CapsIsAvailable()' - Is a conversion usable?
+
+bool                                // O - `true` if usable
+brf_CapsIsAvailable(
+    const brf_spooling_conversion_t *conversion) // I - Conversion
+{
+  bool available;                   // Is the conversion usable?
+
+  pthread_mutex_lock(&caps_lock);
+  available = conversion >= caps_conversions && conversion < (caps_conversions + caps_num_conversions) && caps_available[conversion - caps_conversions];
+  pthread_mutex_unlock(&caps_lock);
+
+  return (available);
+}
+
+// 'brf_CapsProbe()' - Probe the external tools and prune the conversions.
+
+void
+brf_CapsProbe(
+    pappl_system_t *system,         // I - System
+    brf_spooling_conversion_t *conversions) // I - Conversion table, `NULL`-terminated
+{
+  size_t i, j,                      // Looping vars
+      count;                        // Number of conversions
+  bool *available,                  // Usable conversions
+      *has_tools,                   // Conversions with their tools
+      changed;                      // Did a conversion become usable?
+  char **missing,                   // Missing tool of each conversion
+      env[4096],                    // Tools for the filters
+      found[sizeof(caps_tools) / sizeof(caps_tools[0])][1024];
+                                    // Paths of the tools
+  char *version;                    // Library version
+
+  for (count = 0; conversions[count].srctype; count++);
+
+  available = (bool *)calloc(count, sizeof(bool));
+  has_tools = (bool *)calloc(count, sizeof(bool));
+  missing = (char **)calloc(count, sizeof(char *));
+
+  if (!available || !has_tools || !missing)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to probe tools: %s", strerror(errno));
+    free(available);
+    free(has_tools);
+    free(missing);
+    return;
+  }
+
+  // Find the tools once...
+  papplCopyString(env, "BRF_TOOLS=", sizeof(env));
+
+  for (i = 0; i < (sizeof(caps_tools) / sizeof(caps_tools[0])); i++)
+  {
+    if (!caps_find_tool(caps_tools[i], found[i], sizeof(found[i])))
+    {
+      found[i][0] = '\0';
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Tool %s not found.", caps_tools[i]);
+      continue;
+    }
+
+    papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Tool %s is '%s'.", caps_tools[i], found[i]);
+
+    if (!strchr(found[i], ' '))
+    {
+      size_t len = strlen(env);     // Length of environment string
+
+      snprintf(env + len, sizeof(env) - len, "%s%s=%s", env[len - 1] == '=' ? "" : " ", caps_tools[i], found[i]);
+    }
+  }
+
+  pthread_mutex_lock(&caps_lock);
+  memcpy(caps_found, found, sizeof(caps_found));
+  pthread_mutex_unlock(&caps_lock);
+
+  if ((version = lou_version()) != NULL)
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "Using liblouis %s.", version);
+
+  if ((version = lbu_version()) != NULL)
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "Using liblouisutdml %s.", version);
+
+  // Then the conversions which have their filter and tools, and lead to
+  // BRF directly or through other usable conversions...
+  for (i = 0; i < count; i++)
+    has_tools[i] = caps_has_tools(conversions + i, missing + i);
+
+  do
+  {
+    changed = false;
+
+    for (i = 0; i < count; i++)
+    {
+      if (available[i] || !has_tools[i])
+        continue;
+
+      if (!strcmp(conversions[i].dsttype, "application/vnd.cups-brf"))
+        available[i] = true;
+
+      for (j = 0; j < count && !available[i]; j++)
+      {
+        if (available[j] && !strcmp(conversions[j].srctype, conversions[i].dsttype))
+          available[i] = true;
+      }
+
+      changed |= available[i];
+    }
+  }
+  while (changed);
+
+  for (i = 0; i < count; i++)
+  {
+    if (available[i])
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Conversion %s to %s (%s) is available.", conversions[i].srctype, conversions[i].dsttype, conversions[i].filters.name);
+    else if (!has_tools[i])
+      papplLog(system, PAPPL_LOGLEVEL_INFO, "Conversion %s to %s (%s) needs %s.", conversions[i].srctype, conversions[i].dsttype, conversions[i].filters.name, missing[i]);
+    else
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG, "Conversion %s to %s (%s) does not lead to BRF.", conversions[i].srctype, conversions[i].dsttype, conversions[i].filters.name);
+
+    free(missing[i]);
+  }
+
+  free(has_tools);
+  free(missing);
+
+  pthread_mutex_lock(&caps_lock);
+  free(caps_available);
+  caps_conversions = conversions;
+  caps_available = available;
+  caps_num_conversions = count;
+  papplCopyString(caps_env, env, sizeof(caps_env));
+  pthread_mutex_unlock(&caps_lock);
+}
+
+// 'brf_CapsUpdate()' - Probe again after SIGHUP.
+//
+// Called periodically from a background thread.  The signal handler is
+// installed on the first call, after PAPPL has installed its own, which
+// keeps getting the signal.
+
+void
+brf_CapsUpdate(pappl_system_t *system) // I - System
+{
+  static bool installed = false;    // Is the handler installed?
+  struct sigaction action;          // Signal action
+
+  if (!installed)
+  {
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = caps_sighup;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &action, &caps_oldhup);
+
+    installed = true;
+  }
+
+  if (!caps_reprobe || !caps_conversions)
+    return;
+
+  caps_reprobe = 0;
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Probing tools again.");
+  brf_CapsProbe(system, caps_conversions);
+}
+
+// 'caps_find_tool()' - Find a tool in the PATH.
+
+static bool                         // O - `true` if found
+caps_find_tool(const char *name,    // I - Tool name
+               char *path,          // O - Path of tool
+               size_t pathsize)     // I - Size of path buffer
+{
+  const char *dirs,                 // PATH value
+      *dir,                         // Current directory
+      *end;                         // End of directory
+
+  if ((dirs = getenv("PATH")) == NULL)
+    dirs = "/usr/local/bin:/usr/bin:/bin";
+
+  for (dir = dirs; *dir; dir = *end ? end + 1 : end)
+  {
+    if ((end = strchr(dir, ':')) == NULL)
+      end = dir + strlen(dir);
+
+    if (end == dir)
+      continue;
+
+    snprintf(path, pathsize, "%.*s/%s", (int)(end - dir), dir, name);
+
+    if (!access(path, X_OK))
+      return (true);
+  }
+
+  return (false);
+}
+
+// 'caps_has_tools()' - Check the filter and tools of a conversion.
+
+static bool                         // O - `true` if all are present
+caps_has_tools(
+    const brf_spooling_conversion_t *conversion, // I - Conversion
+    char **missing)                 // O - What is missing, free when done
+{
+  const cf_filter_external_t *ext;  // External filter parameters
+  const brf_caps_need_t *need;      // Current need
+  char tools[256],                  // Copy of alternative tools
+      *tool,                        // Current tool
+      *ptr;                         // Pointer into tools
+  size_t i;                         // Looping var
+  bool found;                       // Was an alternative found?
+
+  *missing = NULL;
+
+  if (conversion->filters.function != cfFilterExternal)
+    return (true);
+
+  if ((ext = (const cf_filter_external_t *)conversion->filters.parameters) != NULL && access(ext->filter, X_OK))
+  {
+    *missing = strdup(ext->filter);
+    return (false);
+  }
+
+  for (need = caps_needs; need < (caps_needs + sizeof(caps_needs) / sizeof(caps_needs[0])); need++)
+  {
+    if (strcmp(need->filter, conversion->filters.name) || (need->srctype && strcmp(need->srctype, conversion->srctype)))
+      continue;
+
+    papplCopyString(tools, need->tools, sizeof(tools));
+
+    for (found = false, tool = strtok_r(tools, " ", &ptr); tool && !found; tool = strtok_r(NULL, " ", &ptr))
+    {
+      pthread_mutex_lock(&caps_lock);
+      for (i = 0; i < (sizeof(caps_tools) / sizeof(caps_tools[0])); i++)
+      {
+        if (!strcmp(caps_tools[i], tool))
+        {
+          found = caps_found[i][0] != '\0';
+          break;
+        }
+      }
+      pthread_mutex_unlock(&caps_lock);
+    }
+
+    if (!found)
+    {
+      *missing = strdup(need->tools);
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
+// 'caps_sighup()' - Note a SIGHUP and pass it on.
+
+static void
+caps_sighup(int sig)                // I - Signal number
+{
+  caps_reprobe = 1;
+
+  if (caps_oldhup.sa_handler != SIG_DFL && caps_oldhup.sa_handler != SIG_IGN)
+    (caps_oldhup.sa_handler)(sig);
+}
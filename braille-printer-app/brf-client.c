@@ -0,0 +1,98 @@
+//
+// IPP client helpers for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Sub-commands use these to talk to the running server, the same way the
+// standard PAPPL sub-commands do: through the server's domain socket, or
+// through the loopback interface when the socket is not available.
+//
+
+#include <pappl/pappl.h>
+#include <sys/socket.h>
+
+#include "brf-printer.h"
+
+// 'brf_ClientConnect()' - Connect to the running server.
+
+http_t * // O - HTTP connection or `NULL` if the server is not running
+brf_ClientConnect(
+    const char *base_name, // I - Base name of the program
+    int port)              // I - Server port or 0 for the domain socket only
+{
+  http_t *http;            // HTTP connection
+  char sockname[1024];     // Domain socket name
+  const char *snap_common; // SNAP_COMMON environment variable
+
+  // Same socket names as the PAPPL main loop...
+  if ((snap_common = getenv("SNAP_COMMON")) != NULL)
+    snprintf(sockname, sizeof(sockname), "%s/%s.sock", snap_common, base_name);
+  else if (!getuid())
+    snprintf(sockname, sizeof(sockname), "/var/run/%s.sock", base_name);
+  else
+    snprintf(sockname, sizeof(sockname), "%s/%s%d.sock", papplGetTempDir(), base_name, (int)getuid());
+
+  if ((http = httpConnect2(sockname, 0, NULL, AF_LOCAL, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL)) == NULL && port > 0)
+    http = httpConnect2("localhost", port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL);
+
+  return (http);
+}
+
+// 'brf_ClientPrint()' - Print a document held in memory.
+
+int // O - Job ID or 0 on error
+brf_ClientPrint(
+    http_t *http,           // I - HTTP connection
+    const char *printer,    // I - Printer name or `NULL` for the default
+    const char *format,     // I - MIME media type of document
+    const char *job_name,   // I - Job name
+    const char *buffer,     // I - Document data
+    size_t bytes)           // I - Size of document
+{
+  ipp_t *request,           // IPP request
+      *response;            // IPP response
+  ipp_attribute_t *attr;    // job-id attribute
+  char resource[1024],      // Printer resource path
+      uri[1024],            // Printer URI
+      *ptr;                 // Pointer into resource
+  int job_id = 0;           // Job ID
+
+  // PAPPL printer resources use the printer name with everything but
+  // letters and digits replaced by "_"...
+  if (printer && *printer)
+  {
+    snprintf(resource, sizeof(resource), "/ipp/print/%s", printer);
+    for (ptr = resource + 11; *ptr; ptr++)
+    {
+      if (!isalnum(*ptr & 255) && *ptr != '-')
+        *ptr = '_';
+      else
+        *ptr = (char)tolower(*ptr & 255);
+    }
+  }
+  else
+    papplCopyString(resource, "/ipp/print", sizeof(resource));
+
+  httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, "localhost", 0, resource);
+
+  request = ippNewRequest(IPP_OP_PRINT_JOB);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, format);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, job_name);
+
+  if (cupsSendRequest(http, request, resource, bytes) == HTTP_STATUS_CONTINUE &&
+      cupsWriteRequestData(http, buffer, bytes) == HTTP_STATUS_CONTINUE &&
+      (response = cupsGetResponse(http, resource)) != NULL)
+  {
+    if ((attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) != NULL && cupsLastError() < IPP_STATUS_REDIRECTION_OTHER_SITE)
+      job_id = ippGetInteger(attr, 0);
+
+    ippDelete(response);
+  }
+
+  ippDelete(request);
+
+  return (job_id);
+}
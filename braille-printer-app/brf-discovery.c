@@ -0,0 +1,405 @@
+//
+// Device discovery for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <limits.h>
+#include <poll.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux
+#  include <linux/netlink.h>
+#endif // __linux
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_DISCOVERY_SETTLE 2 // Seconds to wait after a hot-plug event so
+                               // that udev and usblp are done with the device
+
+// Local types...
+
+typedef struct brf_discovered_s // Printer auto-added by discovery
+{
+  char device_uri[1024]; // Device URI
+  int printer_id;        // Printer ID
+  unsigned generation;   // Last scan which saw the device
+} brf_discovered_t;
+
+typedef struct brf_discovery_s // Discovery thread state
+{
+  brf_printer_app_global_data_t *global_data; // Global data
+  pappl_system_t *system;                     // System
+  cups_array_t *printers;                     // Printers added by discovery
+  unsigned generation;                        // Current scan number
+  int uevent_fd;                              // Kernel uevent socket or -1
+} brf_discovery_t;
+
+// Local functions...
+
+static bool discovery_device_cb(const char *device_info, const char *device_uri, const char *device_id, void *data);
+static void discovery_remove_missing(brf_discovery_t *d);
+static void discovery_scan(brf_discovery_t *d);
+static void *discovery_thread(void *data);
+static bool discovery_uevent(brf_discovery_t *d);
+static int discovery_uevent_open(void);
+static void discovery_virtual_printer(brf_discovery_t *d);
+
+// 'brf_DiscoveryStart()' - Start the background discovery thread.
+//
+// The thread creates the virtual "cups-brf" printer, auto-adds USB embossers
+// and then keeps watching for hot-plug events and periodic rescans, so that
+// the system can start serving IPP requests right away.
+
+bool // O - `true` on success, `false` on error
+brf_DiscoveryStart(
+    brf_printer_app_global_data_t *global_data) // I - Global data
+{
+  brf_discovery_t *d;  // Discovery state
+  pthread_t tid;       // Thread ID
+  pthread_attr_t attr; // Thread attributes
+
+  if ((d = (brf_discovery_t *)calloc(1, sizeof(brf_discovery_t))) == NULL)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for device discovery.");
+    return (false);
+  }
+
+  d->global_data = global_data;
+  d->system = global_data->system;
+  d->printers = cupsArrayNew(NULL, NULL);
+  d->uevent_fd = discovery_uevent_open();
+
+  if (d->uevent_fd < 0)
+    papplLog(d->system, PAPPL_LOGLEVEL_INFO, "USB hot-plug events not available, using periodic rescans only.");
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&tid, &attr, discovery_thread, d))
+  {
+    papplLog(d->system, PAPPL_LOGLEVEL_ERROR, "Unable to create device discovery thread: %s", strerror(errno));
+    pthread_attr_destroy(&attr);
+
+    if (d->uevent_fd >= 0)
+      close(d->uevent_fd);
+    cupsArrayDelete(d->printers);
+    free(d);
+    return (false);
+  }
+
+  pthread_attr_destroy(&attr);
+
+  return (true);
+}
+
+// 'discovery_device_cb()' - Auto-add a discovered printer, if it is new.
+
+static bool                                  // O - `false` to continue
+discovery_device_cb(const char *device_info, // I - Device information
+                    const char *device_uri,  // I - Device URI
+                    const char *device_id,   // I - IEEE-1284 device ID
+                    void *data)              // I - Discovery state
+{
+  brf_discovery_t *d = (brf_discovery_t *)data;
+  brf_discovered_t *dp;      // Discovered printer
+  pappl_printer_t *printer;  // Printer
+  const char *driver_name;   // Driver name, if any
+  pappl_pr_autoadd_cb_t autoadd_cb = d->global_data->config->autoadd_cb;
+
+  // Mark printers we already know about as still present...
+  for (dp = (brf_discovered_t *)cupsArrayFirst(d->printers); dp; dp = (brf_discovered_t *)cupsArrayNext(d->printers))
+  {
+    if (!strcmp(dp->device_uri, device_uri))
+    {
+      dp->generation = d->generation;
+      return (false);
+    }
+  }
+
+  if (papplSystemFindPrinter(d->system, NULL, 0, device_uri))
+    return (false);
+
+  if (!autoadd_cb || (driver_name = (autoadd_cb)(device_info, device_uri, device_id, d->system)) == NULL)
+    return (false);
+
+  char name[128], // Printer name
+      *nameptr;   // Pointer in name
+
+  papplCopyString(name, device_info, sizeof(name));
+
+  if ((nameptr = strstr(name, " (")) != NULL)
+    *nameptr = '\0';
+
+  if ((printer = papplPrinterCreate(d->system, 0, name, driver_name, device_id, device_uri)) == NULL)
+  {
+    // Printer already exists with this name, so try adding a number to the name
+    int i;                         // Looping var
+    char newname[128],             // New name
+        number[4];                 // Number string
+    size_t namelen = strlen(name), // Length of original name string
+        numberlen;                 // Length of number string
+
+    for (i = 2; i < 100; i++)
+    {
+      // Append " NNN" to the name, truncating the existing name as needed to
+      // include the number at the end...
+
+      snprintf(number, sizeof(number), " %d", i);
+      numberlen = strlen(number);
+
+      papplCopyString(newname, name, sizeof(newname));
+      if ((namelen + numberlen) < sizeof(newname))
+        memcpy(newname + namelen, number, numberlen + 1);
+      else
+        memcpy(newname + sizeof(newname) - numberlen - 1, number, numberlen + 1);
+
+      // Try creating with this name...
+
+      if ((printer = papplPrinterCreate(d->system, 0, newname, driver_name, device_id, device_uri)) != NULL)
+        break;
+    }
+  }
+
+  if (printer && (dp = (brf_discovered_t *)calloc(1, sizeof(brf_discovered_t))) != NULL)
+  {
+    papplCopyString(dp->device_uri, device_uri, sizeof(dp->device_uri));
+    dp->printer_id = papplPrinterGetID(printer);
+    dp->generation = d->generation;
+    cupsArrayAdd(d->printers, dp);
+
+    papplLog(d->system, PAPPL_LOGLEVEL_INFO, "Added printer '%s' for '%s'.", papplPrinterGetName(printer), device_uri);
+  }
+
+  return (false);
+}
+
+// 'discovery_remove_missing()' - Remove auto-added printers which are gone.
+//
+// Only printers that were added by this thread are removed, and only once
+// they have no active jobs left.  A printer that comes back is simply added
+// again by the next scan.
+
+static void
+discovery_remove_missing(
+    brf_discovery_t *d) // I - Discovery state
+{
+  brf_discovered_t *dp;     // Discovered printer
+  pappl_printer_t *printer; // Printer
+
+  for (dp = (brf_discovered_t *)cupsArrayFirst(d->printers); dp; dp = (brf_discovered_t *)cupsArrayNext(d->printers))
+  {
+    if (dp->generation == d->generation)
+      continue;
+
+    if ((printer = papplSystemFindPrinter(d->system, NULL, dp->printer_id, NULL)) != NULL)
+    {
+      if (papplPrinterGetNumberOfActiveJobs(printer) > 0)
+        continue; // Try again after the jobs are done
+
+      papplLog(d->system, PAPPL_LOGLEVEL_INFO, "Removing printer '%s', '%s' is gone.", papplPrinterGetName(printer), dp->device_uri);
+      papplPrinterDelete(printer);
+    }
+
+    cupsArrayRemove(d->printers, dp);
+    free(dp);
+  }
+}
+
+// 'discovery_scan()' - Enumerate USB devices and update the printer list.
+
+static void
+discovery_scan(brf_discovery_t *d) // I - Discovery state
+{
+  struct timespec start, end; // Scan times
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  d->generation++;
+  papplDeviceList(PAPPL_DEVTYPE_USB, discovery_device_cb, d, papplLogDevice, d->system);
+  discovery_remove_missing(d);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  papplLog(d->system, PAPPL_LOGLEVEL_DEBUG, "USB scan %u took %.3f seconds.", d->generation, (end.tv_sec - start.tv_sec) + 0.000000001 * (end.tv_nsec - start.tv_nsec));
+}
+
+// 'discovery_thread()' - Discover printers in the background.
+
+static void *             // O - Thread exit status (unused)
+discovery_thread(void *data) // I - Discovery state
+{
+  brf_discovery_t *d = (brf_discovery_t *)data;
+  int interval = d->global_data->discovery_interval;
+  bool running = false;     // Has the system been running?
+  time_t now,               // Current time
+      next_scan = 0,        // Time of next scan
+      settle_scan = 0;      // Time of hot-plug triggered scan, if any
+
+  papplLog(d->system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
+
+  discovery_virtual_printer(d);
+
+  for (;;)
+  {
+    // Stop once the system has been running and is now shutting down...
+    if (papplSystemIsRunning(d->system))
+      running = true;
+    else if (running)
+      break;
+
+    now = time(NULL);
+
+    if (now >= next_scan || (settle_scan && now >= settle_scan))
+    {
+      discovery_scan(d);
+
+      settle_scan = 0;
+      next_scan = interval > 0 ? time(NULL) + interval : (time_t)LONG_MAX;
+    }
+
+    if (d->uevent_fd >= 0)
+    {
+      struct pollfd pfd; // Poll data
+
+      pfd.fd = d->uevent_fd;
+      pfd.events = POLLIN;
+
+      if (poll(&pfd, 1, 1000) > 0 && discovery_uevent(d) && !settle_scan)
+        settle_scan = time(NULL) + BRF_DISCOVERY_SETTLE;
+    }
+    else
+      sleep(1);
+  }
+
+  if (d->uevent_fd >= 0)
+    close(d->uevent_fd);
+
+  return (NULL);
+}
+
+// 'discovery_uevent()' - Read a kernel uevent and report USB hot-plugs.
+
+static bool                      // O - `true` for a USB add/remove event
+discovery_uevent(brf_discovery_t *d) // I - Discovery state
+{
+#ifdef __linux
+  char buffer[8192],     // Message buffer
+      *ptr,              // Pointer into message
+      *end;              // End of message
+  ssize_t bytes;         // Bytes received
+  bool usb = false,      // USB subsystem?
+      hotplug = false;   // Add or remove action?
+
+  if ((bytes = recv(d->uevent_fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT)) <= 0)
+    return (false);
+
+  buffer[bytes] = '\0';
+
+  // Messages are "ACTION@DEVPATH" followed by nul-separated KEY=VALUE pairs...
+  for (ptr = buffer, end = buffer + bytes; ptr < end; ptr += strlen(ptr) + 1)
+  {
+    if (!strcmp(ptr, "SUBSYSTEM=usb"))
+      usb = true;
+    else if (!strcmp(ptr, "ACTION=add") || !strcmp(ptr, "ACTION=remove"))
+      hotplug = true;
+  }
+
+  if (usb && hotplug)
+    papplLog(d->system, PAPPL_LOGLEVEL_DEBUG, "USB hot-plug event '%s'.", buffer);
+
+  return (usb && hotplug);
+#else
+  (void)d;
+
+  return (false);
+#endif // __linux
+}
+
+// 'discovery_uevent_open()' - Open a socket for kernel hot-plug events.
+
+static int // O - Socket or -1 if not supported
+discovery_uevent_open(void)
+{
+#ifdef __linux
+  int fd;                   // Socket
+  struct sockaddr_nl addr;  // Netlink address
+
+  if ((fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT)) < 0)
+    return (-1);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_pid = 0;
+  addr.nl_groups = 1; // Kernel events
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    close(fd);
+    return (-1);
+  }
+
+  return (fd);
+#else
+  return (-1);
+#endif // __linux
+}
+
+// 'discovery_virtual_printer()' - Create the "cups-brf" virtual printer.
+
+static void
+discovery_virtual_printer(
+    brf_discovery_t *d) // I - Discovery state
+{
+  char *dir;             // BRF directory
+  char device_uri[1024]; // Device URI
+  struct passwd *pw;     // User information
+  int ret;               // Return value of mkdir()
+
+  // Get the current user's information
+  if ((pw = getpwuid(getuid())) == NULL)
+  {
+    papplLog(d->system, PAPPL_LOGLEVEL_ERROR, "Could not get user information.");
+    return;
+  }
+
+  // Create the directory path in the user's home directory
+  if (asprintf(&dir, "%s/BRF", pw->pw_dir) < 0)
+  {
+    papplLog(d->system, PAPPL_LOGLEVEL_ERROR, "Could not allocate memory.");
+    return;
+  }
+
+  // Try creating the "BRF" directory with permissions 0700
+  if ((ret = mkdir(dir, 0700)) == -1 && errno != EEXIST)
+  {
+    papplLog(d->system, PAPPL_LOGLEVEL_ERROR, "Could not create directory \"%s\": %s", dir, strerror(errno));
+    free(dir);
+    return;
+  }
+  else if (ret == 0)
+    papplLog(d->system, PAPPL_LOGLEVEL_DEBUG, "Created directory \"%s\".", dir);
+
+  // Construct the device URI and create the printer, unless it exists already
+  snprintf(device_uri, sizeof(device_uri), "file://%s", dir);
+
+  if (papplSystemFindPrinter(d->system, NULL, 0, device_uri))
+    papplLog(d->system, PAPPL_LOGLEVEL_DEBUG, "Printer for '%s' already exists.", device_uri);
+  else if (papplPrinterCreate(d->system, 0, "cups-brf", "gen_brf", NULL, device_uri))
+    papplLog(d->system, PAPPL_LOGLEVEL_INFO, "Printer created with device URI: %s", device_uri);
+  else
+    papplLog(d->system, PAPPL_LOGLEVEL_ERROR, "Failed to create printer with device URI: %s", device_uri);
+
+  free(dir);
+}
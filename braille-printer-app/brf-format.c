@@ -0,0 +1,439 @@
+//
+// Braille page formatter for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The formatter wraps lines of Braille ASCII at the text width, breaks
+// pages at the text height, adds the top and left margins like addmargins
+// in filter/cups-braille.sh, and puts the braille page number in the top or
+// bottom line.  Print page changes are marked with a line of dashes when the
+// PageSeparator option is set, like file2brl does.  Every finished page is
+// written out immediately so that the embosser can start while the rest of
+// the document is still converted.
+//
+
+#include <pappl/pappl.h>
+
+#include "brf-printer.h"
+
+// Local functions...
+
+static bool format_bool(const char *name, int num_options, cups_option_t *options, bool *value, cf_logfunc_t log, void *ld);
+static size_t format_digits(char *number, size_t numsize, int n);
+static bool format_flush(brf_formatter_t *f);
+static void format_line(brf_formatter_t *f, const char *cells, size_t len);
+static void format_number(brf_formatter_t *f);
+static void format_put(brf_formatter_t *f, const char *s, size_t len);
+
+// 'brf_FormatterInit()' - Start formatting pages.
+
+bool // O - `true` on success, `false` on bad options
+brf_FormatterInit(
+    brf_formatter_t *f,         // O - Formatter
+    int fd,                     // I - Output file
+    const brf_geometry_t *geom, // I - Page geometry
+    int num_options,            // I - Number of options
+    cups_option_t *options,     // I - Options
+    cf_logfunc_t log,           // I - Log function
+    void *ld)                   // I - Log function data
+{
+  const char *val;              // Option value
+  static const char *const positions[] = { "None", "TopMargin", "BottomMargin", "TopInline", "BottomInline" };
+  int i;                        // Looping var
+
+  memset(f, 0, sizeof(brf_formatter_t));
+
+  f->fd = fd;
+  f->log = log;
+  f->ld = ld;
+  f->width = geom->text_width;
+  f->height = geom->text_height;
+  f->top_margin = geom->top_margin;
+  f->left_margin = geom->left_margin;
+  f->page = 1;
+
+  if ((val = cupsGetOption("BraillePageNumber", num_options, options)) == NULL)
+    val = "None";
+
+  for (i = 0; i < (int)(sizeof(positions) / sizeof(positions[0])); i++)
+  {
+    if (!strcmp(val, positions[i]))
+      break;
+  }
+
+  if (i >= (int)(sizeof(positions) / sizeof(positions[0])))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unknown braille page number option '%s'", val);
+    return (false);
+  }
+
+  f->number_at = (brf_pagenum_t)i;
+
+  if (!format_bool("PageSeparator", num_options, options, &f->separator, log, ld) ||
+      !format_bool("PageSeparatorNumber", num_options, options, &f->separator_number, log, ld))
+    return (false);
+
+  // Page numbering in top or bottom margin actually reduces the given
+  // margin, inline numbers take a text line...
+  if (f->number_at == BRF_PAGENUM_TOP_MARGIN && f->top_margin > 0)
+    f->top_margin--;
+  else if (f->number_at == BRF_PAGENUM_BOTTOM_MARGIN && geom->bottom_margin > 0)
+    ; // Number goes in the first line of the bottom margin
+  else if (f->number_at != BRF_PAGENUM_NONE && f->height > 1)
+    f->height--;
+
+  return (true);
+}
+
+// 'brf_FormatterAddLine()' - Add a line as is, wrapping it if needed.
+
+bool // O - `true` on success, `false` on write error
+brf_FormatterAddLine(
+    brf_formatter_t *f,  // I - Formatter
+    const char *cells,   // I - Braille ASCII
+    size_t len)          // I - Number of cells
+{
+  do
+  {
+    size_t count = len > (size_t)f->width ? (size_t)f->width : len;
+                         // Cells on this line
+
+    format_line(f, cells, count);
+    cells += count;
+    len -= count;
+  }
+  while (len > 0 && !f->error);
+
+  return (!f->error);
+}
+
+// 'brf_FormatterAddParagraph()' - Add a paragraph, wrapping at word
+//                                 boundaries.
+
+bool // O - `true` on success, `false` on write error
+brf_FormatterAddParagraph(
+    brf_formatter_t *f,  // I - Formatter
+    const char *cells,   // I - Braille ASCII
+    size_t len,          // I - Number of cells
+    int indent)          // I - Indentation of first line
+{
+  char line[1024];       // Current line
+  size_t linelen,        // Length of current line
+      start,             // Start of text on current line
+      wordlen;           // Length of current word
+  size_t width = (size_t)f->width < sizeof(line) ? (size_t)f->width : sizeof(line);
+                         // Cells per line
+
+  if (indent < 0 || (size_t)indent >= width)
+    indent = 0;
+
+  memset(line, ' ', (size_t)indent);
+  linelen = start = (size_t)indent;
+
+  while (len > 0 && !f->error)
+  {
+    // Skip blanks between words...
+    while (len > 0 && *cells == ' ')
+    {
+      cells++;
+      len--;
+    }
+
+    if (len == 0)
+      break;
+
+    for (wordlen = 0; wordlen < len && cells[wordlen] != ' '; wordlen++);
+
+    if (linelen > start && linelen + 1 + wordlen > width)
+    {
+      // Word does not fit, start a new line...
+      format_line(f, line, linelen);
+      linelen = start = 0;
+    }
+    else if (linelen > start)
+      line[linelen++] = ' ';
+
+    // Words longer than a line are split...
+    while (linelen + wordlen > width)
+    {
+      size_t count = width - linelen; // Cells that fit
+
+      memcpy(line + linelen, cells, count);
+      format_line(f, line, width);
+      linelen = start = 0;
+      cells += count;
+      len -= count;
+      wordlen -= count;
+    }
+
+    memcpy(line + linelen, cells, wordlen);
+    linelen += wordlen;
+    cells += wordlen;
+    len -= wordlen;
+  }
+
+  if (linelen > 0)
+    format_line(f, line, linelen);
+
+  return (!f->error);
+}
+
+// 'brf_FormatterEndPage()' - Finish the current braille page.
+
+bool // O - `true` on success, `false` on write error
+brf_FormatterEndPage(brf_formatter_t *f) // I - Formatter
+{
+  if (!f->started)
+    return (!f->error);
+
+  // Move the number down to the bottom line...
+  if (f->number_at == BRF_PAGENUM_BOTTOM_MARGIN || f->number_at == BRF_PAGENUM_BOTTOM_INLINE)
+  {
+    while (f->line < f->height)
+    {
+      format_put(f, "\r\n", 2);
+      f->line++;
+    }
+
+    format_number(f);
+  }
+
+  format_put(f, "\f", 1);
+
+  f->line = 0;
+  f->started = false;
+  f->page++;
+
+  return (format_flush(f));
+}
+
+// 'brf_FormatterFinish()' - Finish the document.
+
+bool // O - `true` on success, `false` on write error
+brf_FormatterFinish(brf_formatter_t *f) // I - Formatter
+{
+  if (f->started)
+    brf_FormatterEndPage(f);
+
+  format_flush(f);
+
+  free(f->buffer);
+  f->buffer = NULL;
+
+  return (!f->error);
+}
+
+// 'brf_FormatterPrintPage()' - Mark the start of a new print page.
+//
+// The mark is a line of dashes, ending with the print page number when the
+// PageSeparatorNumber option is set.  Nothing is added when the
+// PageSeparator option is not set.
+
+bool // O - `true` on success, `false` on write error
+brf_FormatterPrintPage(
+    brf_formatter_t *f,  // I - Formatter
+    int print_page)      // I - New print page number
+{
+  char line[1024],       // Separator line
+      number[32];        // Print page number
+  size_t width = (size_t)f->width < sizeof(line) ? (size_t)f->width : sizeof(line),
+                         // Cells per line
+      numlen = 0;        // Length of number
+
+  if (!f->separator)
+    return (!f->error);
+
+  if (f->separator_number)
+    numlen = format_digits(number, sizeof(number), print_page);
+
+  if (numlen >= width)
+    numlen = 0;
+
+  memset(line, '-', width - numlen);
+  memcpy(line + width - numlen, number, numlen);
+
+  format_line(f, line, width);
+
+  return (!f->error);
+}
+
+// 'brf_FormatterSkipLines()' - Add blank lines, without starting a page.
+
+bool // O - `true` on success, `false` on write error
+brf_FormatterSkipLines(
+    brf_formatter_t *f,  // I - Formatter
+    int lines)           // I - Number of blank lines
+{
+  while (lines > 0 && f->line > 0 && f->line < f->height)
+  {
+    format_line(f, "", 0);
+    lines--;
+  }
+
+  return (!f->error);
+}
+
+// 'format_bool()' - Get a boolean option.
+
+static bool                   // O - `true` on success, `false` on bad value
+format_bool(const char *name, // I - Option name
+            int num_options,  // I - Number of options
+            cups_option_t *options, // I - Options
+            bool *value,      // O - Option value
+            cf_logfunc_t log, // I - Log function
+            void *ld)         // I - Log function data
+{
+  const char *val;            // Option value
+
+  if ((val = cupsGetOption(name, num_options, options)) == NULL || !strcasecmp(val, "false"))
+    *value = false;
+  else if (!strcasecmp(val, "true"))
+    *value = true;
+  else
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unknown %s option '%s'", name, val);
+    return (false);
+  }
+
+  return (true);
+}
+
+// 'format_digits()' - Make a number in Braille ASCII.
+
+static size_t                 // O - Length of number
+format_digits(char *number,   // O - Number in Braille ASCII
+              size_t numsize, // I - Size of number buffer
+              int n)          // I - Number
+{
+  char *ptr;                  // Pointer into number
+
+  // Braille digits are the letters A-J after a number sign...
+  snprintf(number, numsize, "#%d", n);
+  for (ptr = number + 1; *ptr; ptr++)
+    *ptr = *ptr == '0' ? 'J' : (char)('A' + *ptr - '1');
+
+  return (strlen(number));
+}
+
+// 'format_flush()' - Write the buffered page.
+
+static bool                   // O - `true` on success, `false` on error
+format_flush(brf_formatter_t *f) // I - Formatter
+{
+  const char *ptr = f->buffer; // Pointer into buffer
+  ssize_t bytes;               // Bytes written
+
+  while (!f->error && ptr < (f->buffer + f->buflen))
+  {
+    if ((bytes = write(f->fd, ptr, (size_t)(f->buffer + f->buflen - ptr))) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (f->log)
+        (f->log)(f->ld, CF_LOGLEVEL_ERROR, "Unable to write braille page: %s", strerror(errno));
+      f->error = true;
+      break;
+    }
+
+    ptr += bytes;
+  }
+
+  f->buflen = 0;
+
+  return (!f->error);
+}
+
+// 'format_line()' - Add a line to the page, starting a new page as needed.
+
+static void
+format_line(brf_formatter_t *f,  // I - Formatter
+            const char *cells,   // I - Braille ASCII
+            size_t len)          // I - Number of cells
+{
+  int i;              // Looping var
+  const char *nbsp;   // Non-breaking space
+
+  if (f->line >= f->height)
+    brf_FormatterEndPage(f);
+
+  if (!f->started)
+  {
+    // Top margin and page number...
+    for (i = 0; i < f->top_margin; i++)
+      format_put(f, "\r\n", 2);
+
+    if (f->number_at == BRF_PAGENUM_TOP_MARGIN || f->number_at == BRF_PAGENUM_TOP_INLINE)
+      format_number(f);
+
+    f->started = true;
+  }
+
+  for (i = 0; i < f->left_margin; i++)
+    format_put(f, " ", 1);
+
+  // Non-breaking spaces are only kept apart until here...
+  while ((nbsp = memchr(cells, BRF_FORMAT_NBSP, len)) != NULL)
+  {
+    format_put(f, cells, (size_t)(nbsp - cells));
+    format_put(f, " ", 1);
+    len -= (size_t)(nbsp - cells) + 1;
+    cells = nbsp + 1;
+  }
+
+  format_put(f, cells, len);
+  format_put(f, "\r\n", 2);
+
+  f->line++;
+}
+
+// 'format_number()' - Add the braille page number line, right aligned.
+
+static void
+format_number(brf_formatter_t *f) // I - Formatter
+{
+  char number[32];                // Number in Braille ASCII
+  int i,                          // Looping var
+      len;                        // Length of number
+
+  len = (int)format_digits(number, sizeof(number), f->page);
+
+  for (i = 0; i < f->left_margin + f->width - len; i++)
+    format_put(f, " ", 1);
+
+  format_put(f, number, (size_t)len);
+  format_put(f, "\r\n", 2);
+}
+
+// 'format_put()' - Add bytes to the page buffer.
+
+static void
+format_put(brf_formatter_t *f, // I - Formatter
+           const char *s,      // I - Bytes
+           size_t len)         // I - Number of bytes
+{
+  if (f->buflen + len > f->bufsize)
+  {
+    size_t bufsize = f->bufsize ? 2 * f->bufsize : 4096;
+                               // New buffer size
+    char *temp;                // New buffer
+
+    while (bufsize < f->buflen + len)
+      bufsize *= 2;
+
+    if ((temp = (char *)realloc(f->buffer, bufsize)) == NULL)
+    {
+      f->error = true;
+      return;
+    }
+
+    f->buffer = temp;
+    f->bufsize = bufsize;
+  }
+
+  memcpy(f->buffer + f->buflen, s, len);
+  f->buflen += len;
+}
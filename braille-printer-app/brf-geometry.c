@@ -0,0 +1,223 @@
+//
+// Page geometry for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// This is the C version of the page size, margin and cell computations of
+// filter/cups-braille.sh, for the filter functions which run inside the
+// Printer Application.  All lengths are in 1/100th of mm like in the
+// script.
+//
+
+#include <pappl/pappl.h>
+
+#include "brf-printer.h"
+
+// Local types...
+
+typedef struct brf_pagesize_s // Page size
+{
+  const char *name;   // PageSize value
+  int width,          // Width in 1/100th of mm
+      height;         // Height in 1/100th of mm
+} brf_pagesize_t;
+
+// Local globals...
+
+static const brf_pagesize_t brf_pagesizes[] =
+{
+  { "Legal",   21590, 35560 },
+  { "Letter",  21590, 27940 },
+  { "A3",      29700, 42000 },
+  { "A4",      21000, 29700 },
+  { "A4TF",    21000, 30480 },
+  { "A5",      14850, 21000 },
+  { "110x115", 27940, 29210 },
+  { "110x120", 27940, 30480 },
+  { "110x170", 27940, 43180 },
+  { "115x110", 29210, 27940 },
+  { "120x120", 30480, 30480 }
+};
+
+// Local functions...
+
+static bool get_number(int num_options, cups_option_t *options, const char *name, int defvalue, int *value, cf_logfunc_t log, void *ld);
+static int points_to_mm(int points);
+
+// 'brf_GeometryInit()' - Compute the page geometry from the job options.
+
+bool // O - `true` on success, `false` on bad options
+brf_GeometryInit(
+    brf_geometry_t *geom,   // O - Page geometry
+    int num_options,        // I - Number of options
+    cups_option_t *options, // I - Options
+    cf_logfunc_t log,       // I - Log function
+    void *ld)               // I - Log function data
+{
+  const char *val;          // Option value
+  size_t i;                 // Looping var
+  int text_dot_distance,    // Dot distance in cells
+      text_cell_distance,   // Distance between cells
+      line_spacing,         // Distance between lines
+      printable_text_width, // Cells per line without margins
+      printable_text_height; // Lines per page without margins
+
+  memset(geom, 0, sizeof(brf_geometry_t));
+
+  // Page size...
+  if ((val = cupsGetOption("PageSize", num_options, options)) == NULL)
+    val = "A4";
+
+  for (i = 0; i < (sizeof(brf_pagesizes) / sizeof(brf_pagesizes[0])); i++)
+  {
+    if (!strcmp(val, brf_pagesizes[i].name))
+      break;
+  }
+
+  if (i >= (sizeof(brf_pagesizes) / sizeof(brf_pagesizes[0])))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unknown page size '%s'", val);
+    return (false);
+  }
+
+  geom->page_width = brf_pagesizes[i].width;
+  geom->page_height = brf_pagesizes[i].height;
+
+  // Margins requested by the user, the embosser has no hard margins that we
+  // know of...
+  if (!get_number(num_options, options, "page-left", 0, &geom->page_left, log, ld) ||
+      !get_number(num_options, options, "page-right", 0, &geom->page_right, log, ld) ||
+      !get_number(num_options, options, "page-top", 0, &geom->page_top, log, ld) ||
+      !get_number(num_options, options, "page-bottom", 0, &geom->page_bottom, log, ld))
+    return (false);
+
+  geom->page_left = points_to_mm(geom->page_left);
+  geom->page_right = points_to_mm(geom->page_right);
+  geom->page_top = points_to_mm(geom->page_top);
+  geom->page_bottom = points_to_mm(geom->page_bottom);
+
+  geom->printable_width = geom->page_width;
+  geom->printable_height = geom->page_height;
+
+  // Text spacing...
+  if (!get_number(num_options, options, "TextDotDistance", 250, &text_dot_distance, log, ld) ||
+      !get_number(num_options, options, "TextDots", 6, &geom->text_dots, log, ld) ||
+      !get_number(num_options, options, "LineSpacing", 500, &line_spacing, log, ld))
+    return (false);
+
+  switch (text_dot_distance)
+  {
+    case 220 :
+        text_cell_distance = 310;
+        break;
+    case 250 :
+        text_cell_distance = 350;
+        break;
+    case 320 :
+        text_cell_distance = 525;
+        break;
+    default :
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Unknown text dot distance '%d'", text_dot_distance);
+        return (false);
+  }
+
+  printable_text_width = (geom->printable_width + text_cell_distance) / (text_dot_distance + text_cell_distance);
+  printable_text_height = (geom->printable_height + line_spacing) / (text_dot_distance * (geom->text_dots / 2 - 1) + line_spacing);
+
+  if ((val = cupsGetOption("TopMargin", num_options, options)) == NULL || !*val)
+  {
+    // No margin
+    geom->text_width = printable_text_width;
+    geom->text_height = printable_text_height;
+  }
+  else
+  {
+    // Margins in cells
+    if (!get_number(num_options, options, "TopMargin", 0, &geom->top_margin, log, ld) ||
+        !get_number(num_options, options, "BottomMargin", 0, &geom->bottom_margin, log, ld) ||
+        !get_number(num_options, options, "LeftMargin", 0, &geom->left_margin, log, ld) ||
+        !get_number(num_options, options, "RightMargin", 0, &geom->right_margin, log, ld))
+      return (false);
+
+    geom->text_width = printable_text_width - geom->left_margin - geom->right_margin;
+    geom->text_height = printable_text_height - geom->top_margin - geom->bottom_margin;
+  }
+
+  if (geom->text_width < 1 || geom->text_height < 1)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Margins leave no room for text (%dx%d cells)", geom->text_width, geom->text_height);
+    return (false);
+  }
+
+  // Graphic spacing...
+  if (!get_number(num_options, options, "GraphicDotDistance", 200, &geom->graphic_dot_distance, log, ld))
+    return (false);
+
+  if (geom->graphic_dot_distance <= 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Bad graphic dot distance '%d'", geom->graphic_dot_distance);
+    return (false);
+  }
+
+  geom->total_graphic_width = ((geom->printable_width - 160) / geom->graphic_dot_distance) / 2 * 2;
+  geom->total_graphic_height = ((geom->printable_height - 160) / geom->graphic_dot_distance) / 4 * 4;
+  geom->graphic_hoffset = (geom->page_left + geom->graphic_dot_distance - 1) / geom->graphic_dot_distance;
+  geom->graphic_voffset = (geom->page_top + geom->graphic_dot_distance - 1) / geom->graphic_dot_distance;
+  geom->graphic_width = ((geom->page_width - geom->graphic_hoffset * geom->graphic_dot_distance - geom->page_right) - 160) / geom->graphic_dot_distance;
+  geom->graphic_height = ((geom->page_height - geom->graphic_voffset * geom->graphic_dot_distance - geom->page_bottom) - 160) / geom->graphic_dot_distance;
+
+  if (log)
+  {
+    log(ld, CF_LOGLEVEL_DEBUG, "Text area is %dx%d cells, margins left %d top %d", geom->text_width, geom->text_height, geom->left_margin, geom->top_margin);
+    log(ld, CF_LOGLEVEL_DEBUG, "Graphic area is %dx%d dots at offset %dx%d", geom->graphic_width, geom->graphic_height, geom->graphic_hoffset, geom->graphic_voffset);
+  }
+
+  return (true);
+}
+
+// 'get_number()' - Get a numeric option, "Custom." prefix allowed.
+
+static bool                         // O - `true` on success, `false` if not a number
+get_number(int num_options,         // I - Number of options
+           cups_option_t *options,  // I - Options
+           const char *name,        // I - Option name
+           int defvalue,            // I - Default value
+           int *value,              // O - Value
+           cf_logfunc_t log,        // I - Log function
+           void *ld)                // I - Log function data
+{
+  const char *val; // Option value
+
+  if ((val = cupsGetOption(name, num_options, options)) == NULL || !*val)
+  {
+    *value = defvalue;
+    return (true);
+  }
+
+  if (!strncmp(val, "Custom.", 7))
+    val += 7;
+
+  if (!isdigit(*val & 255))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Option %s must be a number, got '%s'", name, val);
+    return (false);
+  }
+
+  *value = atoi(val);
+
+  return (true);
+}
+
+// 'points_to_mm()' - Convert points to 1/100th of mm, rounding up.
+
+static int           // O - Length in 1/100th of mm
+points_to_mm(int points) // I - Length in points
+{
+  return ((int)(((long long)points * 2540 + 71) / 72));
+}
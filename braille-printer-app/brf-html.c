@@ -0,0 +1,448 @@
+//
+// HTML and XML text rendering for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Replaces "lynx -dump" and "file2brl -t" of texttobrf for HTML, XHTML and
+// XML documents.  The document is read in small pieces through the markup
+// tokenizer and every paragraph goes to the translator as soon as it ends,
+// so memory use does not depend on the size of the page.
+//
+// Structure is kept the way braille transcriptions usually show it:
+// headings start at the margin after a blank line, paragraphs are indented,
+// list items start at the margin with their number in ordered lists, table
+// rows become one paragraph with the cells separated by spaces, and every
+// line of preformatted text stays a line.
+//
+
+#include <pappl/pappl.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_HTML_MAX_LISTS 16         // Nesting depth of numbered lists
+
+// Local types...
+
+typedef enum brf_html_block_e         // Kinds of block elements
+{
+  BRF_HTML_INLINE,                    // Not a block
+  BRF_HTML_BLOCK,                     // Paragraph or other block
+  BRF_HTML_HEADING,                   // Heading
+  BRF_HTML_ITEM,                      // List item
+  BRF_HTML_LIST,                      // Unordered list
+  BRF_HTML_OLIST,                     // Ordered list
+  BRF_HTML_ROW,                       // Table row
+  BRF_HTML_CELL,                      // Table cell
+  BRF_HTML_PRE,                       // Preformatted text
+  BRF_HTML_BREAK,                     // Line break
+  BRF_HTML_SKIP                       // Not rendered
+} brf_html_block_t;
+
+typedef struct brf_html_s             // Document conversion state
+{
+  brf_text_t t;                       // Translation and formatting
+  int indent;                         // Indent of current paragraph
+  bool space;                         // Whitespace pending?
+  int skip,                           // Inside skipped elements
+      pre;                            // Inside preformatted text
+  bool pre_text;                      // Preformatted text started?
+  int num_lists;                      // Depth of lists
+  int items[BRF_HTML_MAX_LISTS];      // Next item number or 0 if unordered
+  bool heading_gap;                   // Blank line before the next paragraph?
+  bool error;                         // Translation or write error?
+} brf_html_t;
+
+// Local functions...
+
+static bool html_add(brf_html_t *html, const char *text, size_t len);
+static brf_html_block_t html_block(const char *name);
+static bool html_end_paragraph(brf_html_t *html, int next_indent);
+static bool html_markup_cb(void *data, brf_markup_event_t event, const char *name, const char *text, size_t len);
+
+// 'brf_htmltobrf_filter_function()' - Convert an HTML or XML document to BRF.
+
+int // O - Exit status
+brf_htmltobrf_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_html_t html;          // Conversion state
+  brf_markup_t markup;      // Markup tokenizer
+  char buffer[65536];       // Read buffer
+  ssize_t bytes;            // Bytes read
+  bool complete = false;    // Was the whole document converted?
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)inputseekable;
+  (void)parameters;
+
+  memset(&html, 0, sizeof(html));
+
+  if (!brf_TextInit(&html.t, outputfd, data->num_options, data->options, log, ld))
+    return (1);
+
+  html.indent = 2;
+
+  brf_MarkupInit(&markup, html_markup_cb, &html);
+  markup.html = !data->content_type || strstr(data->content_type, "html") != NULL;
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_htmltobrf_filter_function: %s document, tables '%s'.", markup.html ? "HTML" : "XML", html.t.tables);
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_htmltobrf_filter_function: Unable to read: %s", strerror(errno));
+      break;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "brf_htmltobrf_filter_function: Job canceled.");
+      break;
+    }
+
+    if (!brf_MarkupParse(&markup, buffer, (size_t)bytes))
+      break;
+  }
+
+  if (bytes == 0 && brf_MarkupFinish(&markup) && !html.error)
+    complete = true;
+
+  if (brf_TextFinish(&html.t, complete) && complete)
+    ret = 0;
+
+  return (ret);
+}
+
+// 'html_add()' - Add character data to the current paragraph.
+//
+// Whitespace is collapsed like browsers do, except in preformatted text
+// where blanks are kept and every line break ends the line.  Like browsers,
+// a line break right after the start of preformatted text is dropped.
+
+static bool                         // O - `true` on success, `false` on error
+html_add(brf_html_t *html,          // I - Conversion state
+         const char *text,          // I - Character data
+         size_t len)                // I - Length of character data
+{
+  const char *ptr,                  // Pointer into text
+      *start,                       // Start of run of characters
+      *end = text + len;            // End of text
+
+  for (ptr = text; ptr < end;)
+  {
+    if (html->pre && *ptr == '\n')
+    {
+      if (html->t.paralen > 0)
+      {
+        if (!html_end_paragraph(html, 0))
+          return (false);
+      }
+      else if (html->pre_text && !brf_TextEndLine(&html->t))
+        return (false);
+
+      html->pre_text = true;
+      ptr++;
+    }
+    else if (html->pre && (*ptr == ' ' || *ptr == '\t'))
+    {
+      if (!brf_TextAdd(&html->t, ptr, 1))
+        return (false);
+
+      html->pre_text = true;
+      ptr++;
+    }
+    else if (isspace(*ptr & 255))
+    {
+      html->space = true;
+      ptr++;
+    }
+    else
+    {
+      for (start = ptr; ptr < end && !isspace(*ptr & 255); ptr++);
+
+      if (html->space && html->t.paralen > 0 && !brf_TextAdd(&html->t, " ", 1))
+        return (false);
+
+      html->space = false;
+
+      if (!brf_TextAdd(&html->t, start, (size_t)(ptr - start)))
+        return (false);
+
+      html->pre_text = true;
+    }
+  }
+
+  return (true);
+}
+
+// 'html_block()' - Get the kind of block of an element.
+//
+// The list also has the common block elements of DocBook and DTBook, so that
+// XML documents get paragraphs too.
+
+static brf_html_block_t             // O - Kind of block
+html_block(const char *name)        // I - Element name, lowercase
+{
+  static const struct
+  {
+    const char *name;               // Element name
+    brf_html_block_t block;         // Kind of block
+  } blocks[] =
+  {
+    { "address", BRF_HTML_BLOCK },
+    { "article", BRF_HTML_BLOCK },
+    { "aside", BRF_HTML_BLOCK },
+    { "blockquote", BRF_HTML_BLOCK },
+    { "br", BRF_HTML_BREAK },
+    { "caption", BRF_HTML_BLOCK },
+    { "center", BRF_HTML_BLOCK },
+    { "chapter", BRF_HTML_BLOCK },
+    { "dd", BRF_HTML_ITEM },
+    { "div", BRF_HTML_BLOCK },
+    { "dl", BRF_HTML_LIST },
+    { "dt", BRF_HTML_ITEM },
+    { "figcaption", BRF_HTML_BLOCK },
+    { "figure", BRF_HTML_BLOCK },
+    { "footer", BRF_HTML_BLOCK },
+    { "form", BRF_HTML_BLOCK },
+    { "h1", BRF_HTML_HEADING },
+    { "h2", BRF_HTML_HEADING },
+    { "h3", BRF_HTML_HEADING },
+    { "h4", BRF_HTML_HEADING },
+    { "h5", BRF_HTML_HEADING },
+    { "h6", BRF_HTML_HEADING },
+    { "head", BRF_HTML_SKIP },
+    { "header", BRF_HTML_BLOCK },
+    { "hr", BRF_HTML_BLOCK },
+    { "itemizedlist", BRF_HTML_LIST },
+    { "li", BRF_HTML_ITEM },
+    { "list", BRF_HTML_LIST },
+    { "listitem", BRF_HTML_ITEM },
+    { "main", BRF_HTML_BLOCK },
+    { "nav", BRF_HTML_BLOCK },
+    { "noscript", BRF_HTML_SKIP },
+    { "ol", BRF_HTML_OLIST },
+    { "orderedlist", BRF_HTML_OLIST },
+    { "p", BRF_HTML_BLOCK },
+    { "para", BRF_HTML_BLOCK },
+    { "pre", BRF_HTML_PRE },
+    { "programlisting", BRF_HTML_PRE },
+    { "row", BRF_HTML_ROW },
+    { "script", BRF_HTML_SKIP },
+    { "section", BRF_HTML_BLOCK },
+    { "style", BRF_HTML_SKIP },
+    { "table", BRF_HTML_BLOCK },
+    { "td", BRF_HTML_CELL },
+    { "template", BRF_HTML_SKIP },
+    { "th", BRF_HTML_CELL },
+    { "title", BRF_HTML_HEADING },
+    { "tr", BRF_HTML_ROW },
+    { "ul", BRF_HTML_LIST }
+  };
+  int left = 0,                     // Left side of search
+      right = (int)(sizeof(blocks) / sizeof(blocks[0])) - 1,
+                                    // Right side of search
+      current,                      // Current entry
+      result;                       // Result of comparison
+
+  while (left <= right)
+  {
+    current = (left + right) / 2;
+
+    if ((result = strcmp(name, blocks[current].name)) == 0)
+      return (blocks[current].block);
+    else if (result < 0)
+      right = current - 1;
+    else
+      left = current + 1;
+  }
+
+  // DTBook levels and headings...
+  if (!strncmp(name, "level", 5))
+    return (BRF_HTML_BLOCK);
+
+  return (BRF_HTML_INLINE);
+}
+
+// 'html_end_paragraph()' - End the current paragraph.
+
+static bool                         // O - `true` on success, `false` on error
+html_end_paragraph(brf_html_t *html, // I - Conversion state
+                   int next_indent) // I - Indent of the next paragraph
+{
+  html->space = false;
+
+  if (html->t.paralen > 0)
+  {
+    if (html->heading_gap)
+    {
+      if (html->t.fmt.line > 0 && !brf_FormatterSkipLines(&html->t.fmt, 1))
+        return (false);
+
+      html->heading_gap = false;
+    }
+
+    if (html->pre ? !brf_TextEndLine(&html->t) : !brf_TextEndParagraph(&html->t, html->indent))
+      return (false);
+  }
+
+  html->indent = next_indent;
+
+  return (true);
+}
+
+// 'html_markup_cb()' - Map the document structure to paragraphs.
+
+static bool                         // O - `true` to continue, `false` to stop
+html_markup_cb(
+    void *data,                     // I - Conversion state
+    brf_markup_event_t event,       // I - Event
+    const char *name,               // I - Element name
+    const char *text,               // I - Character data or attributes
+    size_t len)                     // I - Length of text
+{
+  brf_html_t *html = (brf_html_t *)data;
+                                    // Conversion state
+  brf_html_block_t block;           // Kind of block
+  char value[256];                  // Attribute value
+  int *item;                        // Current list item number
+
+  if (event == BRF_MARKUP_TEXT)
+  {
+    if (!html->skip)
+      html->error |= !html_add(html, text, len);
+
+    return (!html->error);
+  }
+
+  // Strip namespace prefixes of XHTML and DTBook...
+  if (strchr(name, ':'))
+    name = strchr(name, ':') + 1;
+
+  if ((block = html_block(name)) == BRF_HTML_SKIP)
+  {
+    if (event == BRF_MARKUP_START)
+      html->skip++;
+    else if (html->skip > 0)
+      html->skip--;
+
+    return (true);
+  }
+
+  if (html->skip)
+    return (true);
+
+  if (event == BRF_MARKUP_START)
+  {
+    switch (block)
+    {
+      case BRF_HTML_INLINE :
+          // Images are shown with their alternate text...
+          if (!strcmp(name, "img") && brf_MarkupGetAttr(text, "alt", value, sizeof(value)))
+            html->error |= !html_add(html, " ", 1) || !html_add(html, value, strlen(value)) || !html_add(html, " ", 1);
+          break;
+
+      case BRF_HTML_HEADING :
+          html->error |= !html_end_paragraph(html, 0);
+          html->heading_gap = true;
+          break;
+
+      case BRF_HTML_LIST :
+      case BRF_HTML_OLIST :
+          html->error |= !html_end_paragraph(html, 2);
+
+          if (html->num_lists < BRF_HTML_MAX_LISTS)
+          {
+            html->items[html->num_lists] = 0;
+
+            if (block == BRF_HTML_OLIST)
+              html->items[html->num_lists] = brf_MarkupGetAttr(text, "start", value, sizeof(value)) ? atoi(value) : 1;
+          }
+
+          html->num_lists++;
+          break;
+
+      case BRF_HTML_ITEM :
+          html->error |= !html_end_paragraph(html, 0);
+
+          if (html->num_lists > 0 && html->num_lists <= BRF_HTML_MAX_LISTS && *(item = html->items + html->num_lists - 1) > 0 && strcmp(name, "dt") && strcmp(name, "dd"))
+          {
+            snprintf(value, sizeof(value), "%d. ", (*item)++);
+            html->error |= !html_add(html, value, strlen(value));
+          }
+          break;
+
+      case BRF_HTML_ROW :
+          html->error |= !html_end_paragraph(html, 0);
+          break;
+
+      case BRF_HTML_CELL :
+          html->space = true;
+          break;
+
+      case BRF_HTML_PRE :
+          html->error |= !html_end_paragraph(html, 0);
+          html->pre++;
+          html->pre_text = false;
+          break;
+
+      case BRF_HTML_BREAK :
+          html->error |= !html_end_paragraph(html, 0);
+          break;
+
+      default :
+          html->error |= !html_end_paragraph(html, 2);
+          break;
+    }
+  }
+  else
+  {
+    switch (block)
+    {
+      case BRF_HTML_INLINE :
+      case BRF_HTML_BREAK :
+          break;
+
+      case BRF_HTML_LIST :
+      case BRF_HTML_OLIST :
+          html->error |= !html_end_paragraph(html, 2);
+
+          if (html->num_lists > 0)
+            html->num_lists--;
+          break;
+
+      case BRF_HTML_CELL :
+          html->space = true;
+          break;
+
+      case BRF_HTML_PRE :
+          html->error |= !html_end_paragraph(html, 2);
+
+          if (html->pre > 0)
+            html->pre--;
+          break;
+
+      default :
+          html->error |= !html_end_paragraph(html, 2);
+          break;
+    }
+  }
+
+  return (!html->error);
+}
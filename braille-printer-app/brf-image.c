@@ -0,0 +1,1000 @@
+//
+// Native image conversion for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Replaces the ImageMagick pipeline of imagetobrf for PNG, JPEG and the
+// netpbm formats: the picture is rotated, fitted or cropped, mirrored and
+// placed in the graphic area the way "convert -rotate -page -resize -flop
+// -flatten" does, and then turned into dots by the tactile graphics engine.
+//
+// Pictures are never held in memory.  The decoders hand over one row at a
+// time and every pixel is added to the average of the dot it lands on, so
+// memory is bounded by a row and the dot grid whatever the picture size.
+// JPEG pictures are also scaled down by the decoder when much larger than
+// the grid, and interlaced PNG passes are added where their pixels belong.
+// Rendered grids are kept in the graphic cache, see brf-cache.c.
+//
+
+#include <pappl/pappl.h>
+#include <jpeglib.h>
+#include <jerror.h>
+#include <png.h>
+#include <setjmp.h>
+#include <stdint.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_IMAGE_MAX_SIZE 1000000    // Largest picture width or height
+
+// Local types...
+
+typedef struct brf_image_reader_s     // Buffered input
+{
+  int fd;                             // Input file
+  unsigned char buffer[65536];        // Read buffer
+  size_t pos,                         // Position in buffer
+      len;                            // Bytes in buffer
+} brf_image_reader_t;
+
+typedef struct brf_image_reducer_s    // Area-averaging downsampler
+{
+  brf_tactile_t *tac;                 // Tactile graphic
+  const brf_geometry_t *geom;         // Page geometry
+  cf_filter_data_t *data;             // Job and printer data
+  int rotate;                         // Clockwise rotation
+  char rotate_if;                     // Only rotate wide pictures ('>') or always (0)?
+  bool fit,                           // Fit picture to the graphic area?
+      mirror,                         // Mirror the picture?
+      canceled;                       // Was the job canceled?
+  int width,                          // Picture width
+      height,                         // Picture height
+      rw, rh,                         // Rotated picture size
+      dw, dh;                         // Size in dots
+  int *xmap,                          // First and last+1 dot of each rotated column
+      *ymap;                          // First and last+1 dot of each rotated row
+  uint64_t *sums;                     // Red, green, blue and count of each dot
+  unsigned rows;                      // Rows added
+} brf_image_reducer_t;
+
+typedef struct brf_image_jpeg_s       // JPEG decoder state
+{
+  struct jpeg_error_mgr err;          // Error manager, must be first
+  jmp_buf env;                        // Where to go on errors
+  struct jpeg_source_mgr src;         // Source manager
+  brf_image_reader_t *r;              // Input
+  cf_logfunc_t log;                   // Log function
+  void *ld;                           // Log function data
+} brf_image_jpeg_t;
+
+// Local functions...
+
+static bool image_add(brf_image_reducer_t *red, int y, int x0, int xstep, int count, const unsigned char *rgb);
+static bool image_fill(brf_image_reader_t *r);
+static void image_finish(brf_image_reducer_t *red);
+static int image_getc(brf_image_reader_t *r);
+static void image_jpeg_error(j_common_ptr cinfo);
+static boolean image_jpeg_fill(j_decompress_ptr cinfo);
+static void image_jpeg_init(j_decompress_ptr cinfo);
+static void image_jpeg_message(j_common_ptr cinfo);
+static void image_jpeg_skip(j_decompress_ptr cinfo, long bytes);
+static void image_jpeg_term(j_decompress_ptr cinfo);
+static bool image_number(brf_image_reader_t *r, int *value);
+static bool image_options(brf_image_reducer_t *red, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+static void image_png_error(png_structp pp, png_const_charp message);
+static void image_png_read(png_structp pp, png_bytep data, png_size_t length);
+static void image_png_warning(png_structp pp, png_const_charp message);
+static bool image_read_jpeg(brf_image_reader_t *r, brf_image_reducer_t *red, cf_logfunc_t log, void *ld);
+static bool image_read_png(brf_image_reader_t *r, brf_image_reducer_t *red, cf_logfunc_t log, void *ld);
+static bool image_read_pnm(brf_image_reader_t *r, brf_image_reducer_t *red, cf_logfunc_t log, void *ld);
+static bool image_start(brf_image_reducer_t *red, int width, int height, cf_logfunc_t log, void *ld);
+
+// 'brf_imagetobrf_filter_function()' - Convert a picture to tactile BRF.
+
+int // O - Exit status
+brf_imagetobrf_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_geometry_t geom;      // Page geometry
+  brf_tactile_t tac;        // Tactile graphic
+  brf_image_reader_t *r;    // Input
+  brf_image_reducer_t red;  // Downsampler
+  char key[1024];           // Graphic cache key
+  bool cacheable,           // Can the graphic be cached?
+      read = false,         // Was the picture read?
+      rendered = false;     // Was the graphic rendered?
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)inputseekable;
+  (void)parameters;
+
+  memset(&red, 0, sizeof(red));
+
+  if (!brf_GeometryInit(&geom, data->num_options, data->options, log, ld) ||
+      !brf_TactileInit(&tac, geom.total_graphic_width, geom.total_graphic_height, data->num_options, data->options, log, ld))
+    return (1);
+
+  red.tac = &tac;
+  red.geom = &geom;
+  red.data = data;
+
+  if (!image_options(&red, data->num_options, data->options, log, ld) || (r = (brf_image_reader_t *)calloc(1, sizeof(brf_image_reader_t))) == NULL)
+  {
+    brf_TactileFree(&tac);
+    return (1);
+  }
+
+  r->fd = inputfd;
+
+  // Repeated pictures skip decoding and rendering...
+  if ((cacheable = brf_CacheKey(inputfd, &tac, &geom, data->num_options, data->options, key, sizeof(key))) && brf_CacheLookup(key, &tac, &geom))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG, "brf_imagetobrf_filter_function: Rendered graphic found in cache.");
+
+    rendered = true;
+  }
+  else
+  {
+    // Look at the magic number, keeping it in the buffer for the decoder...
+    while (r->len < 8 && image_fill(r));
+
+    if (r->len >= 8 && !memcmp(r->buffer, "\211PNG\r\n\032\n", 8))
+      read = image_read_png(r, &red, log, ld);
+    else if (r->len >= 3 && !memcmp(r->buffer, "\377\330\377", 3))
+      read = image_read_jpeg(r, &red, log, ld);
+    else if (r->len >= 2 && r->buffer[0] == 'P' && r->buffer[1] >= '1' && r->buffer[1] <= '6')
+      read = image_read_pnm(r, &red, log, ld);
+    else if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unsupported picture, only PNG, JPEG and netpbm files are converted natively.");
+
+    if (red.canceled)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "brf_imagetobrf_filter_function: Job canceled.");
+    }
+    else if (read)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "brf_imagetobrf_filter_function: %dx%d picture on %dx%d of %dx%d dots.", red.width, red.height, red.dw, red.dh, tac.width, tac.height);
+
+      image_finish(&red);
+
+      if ((rendered = brf_TactileRender(&tac)) && cacheable)
+        brf_CacheStore(key, &tac, &geom, geom.graphic_hoffset, geom.graphic_voffset, red.dw, red.dh);
+    }
+  }
+
+  if (rendered && brf_TactileWrite(&tac, outputfd, &geom, log, ld))
+    ret = 0;
+
+  free(red.xmap);
+  free(red.ymap);
+  free(red.sums);
+  free(r);
+  brf_TactileFree(&tac);
+
+  return (ret);
+}
+
+// 'image_add()' - Add pixels of a picture row to the dots they land on.
+//
+// Pixels are given as packed RGB, "count" of them starting at column "x0"
+// and "xstep" columns apart.
+
+static bool                         // O - `true` to continue, `false` if canceled
+image_add(brf_image_reducer_t *red, // I - Downsampler
+          int y,                    // I - Picture row
+          int x0,                   // I - First column
+          int xstep,                // I - Columns between pixels
+          int count,                // I - Number of pixels
+          const unsigned char *rgb) // I - Pixels
+{
+  cf_filter_data_t *data = red->data; // Job and printer data
+  int i,                            // Looping var
+      x,                            // Picture column
+      rx, ry,                       // Rotated pixel
+      dx, dy;                       // Dot
+
+  // Check for cancellation every so often...
+  if ((++red->rows & 255) == 0 && data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+  {
+    red->canceled = true;
+    return (false);
+  }
+
+  for (i = 0, x = x0; i < count; i++, x += xstep, rgb += 3)
+  {
+    switch (red->rotate)
+    {
+      default :
+          rx = x;
+          ry = y;
+          break;
+      case 90 :
+          rx = red->height - 1 - y;
+          ry = x;
+          break;
+      case 180 :
+          rx = red->width - 1 - x;
+          ry = red->height - 1 - y;
+          break;
+      case 270 :
+          rx = y;
+          ry = red->width - 1 - x;
+          break;
+    }
+
+    if (red->mirror)
+      rx = red->rw - 1 - rx;
+
+    // Up-scaled pixels cover several dots, down-scaled ones a single dot...
+    for (dy = red->ymap[2 * ry]; dy < red->ymap[2 * ry + 1]; dy++)
+    {
+      for (dx = red->xmap[2 * rx]; dx < red->xmap[2 * rx + 1]; dx++)
+      {
+        uint64_t *sum = red->sums + 4 * ((size_t)dy * (size_t)red->dw + (size_t)dx);
+
+        sum[0] += rgb[0];
+        sum[1] += rgb[1];
+        sum[2] += rgb[2];
+        sum[3] ++;
+      }
+    }
+  }
+
+  return (true);
+}
+
+// 'image_fill()' - Read more input into the buffer.
+
+static bool                         // O - `true` if more bytes are available
+image_fill(brf_image_reader_t *r)   // I - Input
+{
+  ssize_t bytes;                    // Bytes read
+
+  if (r->pos > 0)
+  {
+    memmove(r->buffer, r->buffer + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+  }
+
+  while ((bytes = read(r->fd, r->buffer + r->len, sizeof(r->buffer) - r->len)) < 0)
+  {
+    if (errno != EINTR && errno != EAGAIN)
+      return (false);
+  }
+
+  r->len += (size_t)bytes;
+
+  return (bytes > 0);
+}
+
+// 'image_finish()' - Store the average colour of each dot.
+
+static void
+image_finish(brf_image_reducer_t *red) // I - Downsampler
+{
+  brf_tactile_t *tac = red->tac;    // Tactile graphic
+  int dx, dy;                       // Dot
+  const uint64_t *sum;              // Sums of dot
+
+  for (dy = 0, sum = red->sums; dy < red->dh; dy++)
+  {
+    int y = dy + red->geom->graphic_voffset;
+                                    // Row in the graphic
+
+    for (dx = 0; dx < red->dw; dx++, sum += 4)
+    {
+      int x = dx + red->geom->graphic_hoffset;
+                                    // Column in the graphic
+      unsigned char *rgb;           // Colour of dot
+
+      if (!sum[3] || x >= tac->width || y >= tac->height)
+        continue;
+
+      rgb = tac->rgb + 3 * ((size_t)y * (size_t)tac->width + (size_t)x);
+      rgb[0] = (unsigned char)(sum[0] / sum[3]);
+      rgb[1] = (unsigned char)(sum[1] / sum[3]);
+      rgb[2] = (unsigned char)(sum[2] / sum[3]);
+    }
+  }
+}
+
+// 'image_getc()' - Read a byte.
+
+static int                          // O - Byte or -1 at end of file
+image_getc(brf_image_reader_t *r)   // I - Input
+{
+  if (r->pos >= r->len && !image_fill(r))
+    return (-1);
+
+  return (r->buffer[r->pos++]);
+}
+
+// 'image_jpeg_error()' - Report a JPEG error and give up.
+
+static void
+image_jpeg_error(j_common_ptr cinfo) // I - Decoder
+{
+  brf_image_jpeg_t *jpeg = (brf_image_jpeg_t *)cinfo->err;
+                                    // Decoder state
+  char message[JMSG_LENGTH_MAX];    // Error message
+
+  (cinfo->err->format_message)(cinfo, message);
+
+  if (jpeg->log)
+    (jpeg->log)(jpeg->ld, CF_LOGLEVEL_ERROR, "Bad JPEG picture: %s", message);
+
+  longjmp(jpeg->env, 1);
+}
+
+// 'image_jpeg_fill()' - Give the JPEG decoder more input.
+
+static boolean                      // O - Always TRUE
+image_jpeg_fill(j_decompress_ptr cinfo) // I - Decoder
+{
+  static const JOCTET eoi[2] = { 0xff, JPEG_EOI };
+                                    // Fake end of image
+  brf_image_jpeg_t *jpeg = (brf_image_jpeg_t *)cinfo->err;
+                                    // Decoder state
+  brf_image_reader_t *r = jpeg->r;  // Input
+
+  r->pos = r->len;
+
+  if (image_fill(r))
+  {
+    cinfo->src->next_input_byte = r->buffer;
+    cinfo->src->bytes_in_buffer = r->len;
+  }
+  else
+  {
+    // Truncated picture, libjpeg fills the rest in gray...
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+  }
+
+  return (TRUE);
+}
+
+// 'image_jpeg_init()' - Start reading JPEG input.
+
+static void
+image_jpeg_init(j_decompress_ptr cinfo) // I - Decoder
+{
+  (void)cinfo;
+}
+
+// 'image_jpeg_message()' - Log a JPEG warning.
+
+static void
+image_jpeg_message(j_common_ptr cinfo) // I - Decoder
+{
+  brf_image_jpeg_t *jpeg = (brf_image_jpeg_t *)cinfo->err;
+                                    // Decoder state
+  char message[JMSG_LENGTH_MAX];    // Warning message
+
+  (cinfo->err->format_message)(cinfo, message);
+
+  if (jpeg->log)
+    (jpeg->log)(jpeg->ld, CF_LOGLEVEL_DEBUG, "JPEG picture: %s", message);
+}
+
+// 'image_jpeg_skip()' - Skip JPEG input.
+
+static void
+image_jpeg_skip(j_decompress_ptr cinfo, // I - Decoder
+                long bytes)         // I - Bytes to skip
+{
+  while (bytes > (long)cinfo->src->bytes_in_buffer)
+  {
+    bytes -= (long)cinfo->src->bytes_in_buffer;
+    (cinfo->src->fill_input_buffer)(cinfo);
+  }
+
+  if (bytes > 0)
+  {
+    cinfo->src->next_input_byte += bytes;
+    cinfo->src->bytes_in_buffer -= (size_t)bytes;
+  }
+}
+
+// 'image_jpeg_term()' - Stop reading JPEG input.
+
+static void
+image_jpeg_term(j_decompress_ptr cinfo) // I - Decoder
+{
+  (void)cinfo;
+}
+
+// 'image_number()' - Read a decimal number of a netpbm header or raster.
+
+static bool                         // O - `true` on success, `false` on error
+image_number(brf_image_reader_t *r, // I - Input
+             int *value)            // O - Number
+{
+  int ch;                           // Current byte
+
+  // Skip whitespace and comments...
+  while ((ch = image_getc(r)) != -1)
+  {
+    if (ch == '#')
+    {
+      while ((ch = image_getc(r)) != -1 && ch != '\n');
+    }
+    else if (!isspace(ch))
+      break;
+  }
+
+  if (ch < '0' || ch > '9')
+    return (false);
+
+  for (*value = 0; ch >= '0' && ch <= '9'; ch = image_getc(r))
+  {
+    if (*value > 10000000)
+      return (false);
+
+    *value = *value * 10 + ch - '0';
+  }
+
+  return (true);
+}
+
+// 'image_options()' - Get the Rotate, fitplot and mirror options.
+
+static bool                         // O - `true` on success, `false` on bad options
+image_options(
+    brf_image_reducer_t *red,       // I - Downsampler
+    int num_options,                // I - Number of options
+    cups_option_t *options,         // I - Options
+    cf_logfunc_t log,               // I - Log function
+    void *ld)                       // I - Log function data
+{
+  const char *val;                  // Option value
+  char *end;                        // End of rotation
+
+  if ((val = cupsGetOption("Rotate", num_options, options)) == NULL)
+    val = "90>";
+
+  red->rotate = (int)strtol(val, &end, 10);
+
+  if (end == val || (red->rotate != 0 && red->rotate != 90 && red->rotate != 180 && red->rotate != 270) || (*end && (strcmp(end, ">") || red->rotate % 180 == 0)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Option Rotate must be a valid rotation value, got '%s'", val);
+    return (false);
+  }
+
+  red->rotate_if = *end;
+
+  val = cupsGetOption("fitplot", num_options, options);
+  red->fit = !val || !strcasecmp(val, "true");
+
+  val = cupsGetOption("mirror", num_options, options);
+  red->mirror = val && !strcasecmp(val, "true");
+
+  return (true);
+}
+
+// 'image_png_error()' - Report a PNG error and give up.
+
+static void
+image_png_error(png_structp pp,     // I - Decoder
+                png_const_charp message) // I - Error message
+{
+  brf_image_reducer_t *red = (brf_image_reducer_t *)png_get_error_ptr(pp);
+                                    // Downsampler
+
+  if (red->data->logfunc)
+    (red->data->logfunc)(red->data->logdata, CF_LOGLEVEL_ERROR, "Bad PNG picture: %s", message);
+
+  png_longjmp(pp, 1);
+}
+
+// 'image_png_read()' - Give the PNG decoder more input.
+
+static void
+image_png_read(png_structp pp,      // I - Decoder
+               png_bytep data,      // I - Buffer
+               png_size_t length)   // I - Bytes wanted
+{
+  brf_image_reader_t *r = (brf_image_reader_t *)png_get_io_ptr(pp);
+                                    // Input
+  size_t bytes;                     // Bytes copied
+
+  while (length > 0)
+  {
+    if (r->pos >= r->len && !image_fill(r))
+      png_error(pp, "Unexpected end of file");
+
+    bytes = r->len - r->pos < length ? r->len - r->pos : length;
+    memcpy(data, r->buffer + r->pos, bytes);
+    r->pos += bytes;
+    data += bytes;
+    length -= bytes;
+  }
+}
+
+// 'image_png_warning()' - Log a PNG warning.
+
+static void
+image_png_warning(png_structp pp,   // I - Decoder
+                  png_const_charp message) // I - Warning message
+{
+  brf_image_reducer_t *red = (brf_image_reducer_t *)png_get_error_ptr(pp);
+                                    // Downsampler
+
+  if (red->data->logfunc)
+    (red->data->logfunc)(red->data->logdata, CF_LOGLEVEL_DEBUG, "PNG picture: %s", message);
+}
+
+// 'image_read_jpeg()' - Read a JPEG picture.
+//
+// When the picture is at least twice as large as the dots it goes to, the
+// decoder scales it down by 2, 4 or 8 in the DCT, which also saves most of
+// the decoding time.
+
+static bool                         // O - `true` on success, `false` on error
+image_read_jpeg(brf_image_reader_t *r, // I - Input
+                brf_image_reducer_t *red, // I - Downsampler
+                cf_logfunc_t log,   // I - Log function
+                void *ld)           // I - Log function data
+{
+  struct jpeg_decompress_struct cinfo; // Decoder
+  brf_image_jpeg_t jpeg;            // Decoder state
+  JSAMPROW volatile row = NULL;     // Decoded row
+  unsigned char * volatile rgb = NULL;
+                                    // Row as RGB
+  bool ret = false;                 // Return value
+  int x, y;                         // Looping vars
+
+  memset(&jpeg, 0, sizeof(jpeg));
+  jpeg.r = r;
+  jpeg.log = log;
+  jpeg.ld = ld;
+
+  cinfo.err = jpeg_std_error(&jpeg.err);
+  jpeg.err.error_exit = image_jpeg_error;
+  jpeg.err.output_message = image_jpeg_message;
+
+  if (setjmp(jpeg.env))
+  {
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+    free(rgb);
+    return (false);
+  }
+
+  jpeg_create_decompress(&cinfo);
+
+  jpeg.src.init_source = image_jpeg_init;
+  jpeg.src.fill_input_buffer = image_jpeg_fill;
+  jpeg.src.skip_input_data = image_jpeg_skip;
+  jpeg.src.resync_to_restart = jpeg_resync_to_restart;
+  jpeg.src.term_source = image_jpeg_term;
+  jpeg.src.next_input_byte = r->buffer + r->pos;
+  jpeg.src.bytes_in_buffer = r->len - r->pos;
+  cinfo.src = &jpeg.src;
+
+  jpeg_read_header(&cinfo, TRUE);
+
+  if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK)
+    cinfo.out_color_space = JCS_CMYK;
+  else if (cinfo.jpeg_color_space == JCS_GRAYSCALE)
+    cinfo.out_color_space = JCS_GRAYSCALE;
+  else
+    cinfo.out_color_space = JCS_RGB;
+
+  // Let the decoder do the first steps of the reduction...
+  if (!image_start(red, (int)cinfo.image_width, (int)cinfo.image_height, log, ld))
+    goto done;
+
+  if (red->fit)
+  {
+    cinfo.scale_num = 1;
+
+    for (cinfo.scale_denom = 8; cinfo.scale_denom > 1; cinfo.scale_denom /= 2)
+    {
+      if (cinfo.image_width / cinfo.scale_denom >= (unsigned)(red->rotate % 180 ? red->dh : red->dw) &&
+          cinfo.image_height / cinfo.scale_denom >= (unsigned)(red->rotate % 180 ? red->dw : red->dh))
+        break;
+    }
+  }
+
+  jpeg_start_decompress(&cinfo);
+
+  if (cinfo.scale_denom > 1)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG, "brf_imagetobrf_filter_function: JPEG decoded at 1/%u scale.", cinfo.scale_denom);
+
+    if (!image_start(red, (int)cinfo.output_width, (int)cinfo.output_height, log, ld))
+      goto done;
+  }
+
+  if ((row = (JSAMPROW)malloc((size_t)cinfo.output_width * (size_t)cinfo.output_components)) == NULL || (rgb = (unsigned char *)malloc(3 * (size_t)cinfo.output_width)) == NULL)
+    goto done;
+
+  for (y = 0; cinfo.output_scanline < cinfo.output_height; y++)
+  {
+    JSAMPROW line = row;            // Row for the decoder
+
+    jpeg_read_scanlines(&cinfo, &line, 1);
+
+    for (x = 0; x < (int)cinfo.output_width; x++)
+    {
+      unsigned char *src = row + x * cinfo.output_components;
+                                    // Decoded pixel
+
+      if (cinfo.out_color_space == JCS_GRAYSCALE)
+      {
+        rgb[3 * x] = rgb[3 * x + 1] = rgb[3 * x + 2] = src[0];
+      }
+      else if (cinfo.out_color_space == JCS_CMYK)
+      {
+        // Adobe writes inverted CMYK...
+        rgb[3 * x]     = (unsigned char)(src[0] * src[3] / 255);
+        rgb[3 * x + 1] = (unsigned char)(src[1] * src[3] / 255);
+        rgb[3 * x + 2] = (unsigned char)(src[2] * src[3] / 255);
+      }
+      else
+        memcpy(rgb + 3 * x, src, 3);
+    }
+
+    if (!image_add(red, y, 0, 1, (int)cinfo.output_width, rgb))
+      break;
+  }
+
+  if (!red->canceled)
+    jpeg_finish_decompress(&cinfo);
+
+  ret = true;
+
+  done:
+
+  jpeg_destroy_decompress(&cinfo);
+  free(row);
+  free(rgb);
+
+  return (ret);
+}
+
+// 'image_read_png()' - Read a PNG picture.
+//
+// Interlaced pictures are read pass by pass, without the interlace handling
+// of libpng that needs the whole picture in memory.
+
+static bool                         // O - `true` on success, `false` on error
+image_read_png(brf_image_reader_t *r, // I - Input
+               brf_image_reducer_t *red, // I - Downsampler
+               cf_logfunc_t log,    // I - Log function
+               void *ld)            // I - Log function data
+{
+  static const int starts[7][2] = { { 0, 0 }, { 4, 0 }, { 0, 4 }, { 2, 0 }, { 0, 2 }, { 1, 0 }, { 0, 1 } },
+                   steps[7][2] = { { 8, 8 }, { 8, 8 }, { 4, 8 }, { 4, 4 }, { 2, 4 }, { 2, 2 }, { 1, 2 } };
+                                    // Adam7 passes
+  png_structp pp;                   // Decoder
+  png_infop info;                   // Picture information
+  png_bytep volatile row = NULL;    // Decoded row, RGBA
+  unsigned char * volatile rgb = NULL;
+                                    // Row on white
+  png_uint_32 width, height;        // Picture size
+  int bit_depth, color_type, interlace,
+                                    // Picture format
+      pass, passes,                 // Looping var and number of passes
+      x, y, count;                  // Looping vars and pixels in row
+  bool ret = false;                 // Return value
+
+  (void)log;
+  (void)ld;
+
+  if ((pp = png_create_read_struct(PNG_LIBPNG_VER_STRING, red, image_png_error, image_png_warning)) == NULL)
+    return (false);
+
+  if ((info = png_create_info_struct(pp)) == NULL)
+  {
+    png_destroy_read_struct(&pp, NULL, NULL);
+    return (false);
+  }
+
+  if (setjmp(png_jmpbuf(pp)))
+  {
+    png_destroy_read_struct(&pp, &info, NULL);
+    free(row);
+    free(rgb);
+    return (false);
+  }
+
+  png_set_read_fn(pp, r, image_png_read);
+  png_read_info(pp, info);
+  png_get_IHDR(pp, info, &width, &height, &bit_depth, &color_type, &interlace, NULL, NULL);
+
+  // Always decode to 8-bit RGBA...
+  png_set_expand(pp);
+  png_set_strip_16(pp);
+  png_set_gray_to_rgb(pp);
+  if (!(color_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(pp, info, PNG_INFO_tRNS))
+    png_set_add_alpha(pp, 0xff, PNG_FILLER_AFTER);
+  png_read_update_info(pp, info);
+
+  if (!image_start(red, (int)width, (int)height, log, ld))
+    goto done;
+
+  if ((row = (png_bytep)malloc(4 * (size_t)width)) == NULL || (rgb = (unsigned char *)malloc(3 * (size_t)width)) == NULL)
+    goto done;
+
+  passes = interlace == PNG_INTERLACE_ADAM7 ? 7 : 1;
+
+  for (pass = 0; pass < passes && !red->canceled; pass++)
+  {
+    int x0 = passes > 1 ? starts[pass][0] : 0,
+        y0 = passes > 1 ? starts[pass][1] : 0,
+        xstep = passes > 1 ? steps[pass][0] : 1,
+        ystep = passes > 1 ? steps[pass][1] : 1;
+                                    // Pixels of this pass
+
+    if ((int)width <= x0)
+      continue;
+
+    count = ((int)width - x0 + xstep - 1) / xstep;
+
+    for (y = y0; y < (int)height; y += ystep)
+    {
+      png_read_row(pp, row, NULL);
+
+      // Flatten on white...
+      for (x = 0; x < count; x++)
+      {
+        png_bytep src = row + 4 * x;// Decoded pixel
+
+        rgb[3 * x]     = (unsigned char)((src[0] * src[3] + 255 * (255 - src[3])) / 255);
+        rgb[3 * x + 1] = (unsigned char)((src[1] * src[3] + 255 * (255 - src[3])) / 255);
+        rgb[3 * x + 2] = (unsigned char)((src[2] * src[3] + 255 * (255 - src[3])) / 255);
+      }
+
+      if (!image_add(red, y, x0, xstep, count, rgb))
+        break;
+    }
+  }
+
+  ret = true;
+
+  done:
+
+  png_destroy_read_struct(&pp, &info, NULL);
+  free(row);
+  free(rgb);
+
+  return (ret);
+}
+
+// 'image_read_pnm()' - Read a netpbm picture.
+
+static bool                         // O - `true` on success, `false` on error
+image_read_pnm(brf_image_reader_t *r, // I - Input
+               brf_image_reducer_t *red, // I - Downsampler
+               cf_logfunc_t log,    // I - Log function
+               void *ld)            // I - Log function data
+{
+  int format,                       // Format number, 1 to 6
+      width, height,                // Picture size
+      maxval = 1,                   // Largest sample value
+      x, y, c,                      // Looping vars
+      value = 0,                    // Sample value
+      ch;                           // Current byte
+  unsigned char *rgb,               // Row as RGB
+      *ptr;                         // Pointer into row
+
+  image_getc(r);
+  format = image_getc(r) - '0';
+
+  if (!image_number(r, &width) || !image_number(r, &height) || ((format % 3) != 1 && !image_number(r, &maxval)) || maxval < 1 || maxval > 65535)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Bad netpbm header.");
+    return (false);
+  }
+
+  if (!image_start(red, width, height, log, ld))
+    return (false);
+
+  if ((rgb = (unsigned char *)malloc(3 * (size_t)width)) == NULL)
+    return (false);
+
+  // A single whitespace separates the header from a binary raster, which
+  // image_number() has already consumed...
+  for (y = 0; y < height; y++)
+  {
+    for (x = 0, ptr = rgb; x < width; x++, ptr += 3)
+    {
+      switch (format)
+      {
+        case 1 : // ASCII bitmap, 1 is black
+            do
+              ch = image_getc(r);
+            while (ch != -1 && ch != '0' && ch != '1');
+
+            if (ch == -1)
+              goto truncated;
+
+            memset(ptr, ch == '1' ? 0 : 255, 3);
+            break;
+
+        case 4 : // Binary bitmap, rows padded to bytes
+            if ((x & 7) == 0 && (value = image_getc(r)) == -1)
+              goto truncated;
+
+            memset(ptr, (value & (0x80 >> (x & 7))) ? 0 : 255, 3);
+            break;
+
+        case 2 : // Grey map
+        case 5 :
+        case 3 : // Pixel map
+        case 6 :
+            for (c = 0; c < (format % 3 ? 1 : 3); c++)
+            {
+              if (format < 4)
+              {
+                if (!image_number(r, &value))
+                  goto truncated;
+              }
+              else if ((value = image_getc(r)) == -1 || (maxval > 255 && (ch = image_getc(r)) == -1))
+                goto truncated;
+              else if (maxval > 255)
+                value = (value << 8) | ch;
+
+              ptr[c] = (unsigned char)((value > maxval ? maxval : value) * 255 / maxval);
+            }
+
+            if (format % 3)
+              ptr[1] = ptr[2] = ptr[0];
+            break;
+      }
+    }
+
+    if (!image_add(red, y, 0, 1, width, rgb))
+      break;
+  }
+
+  free(rgb);
+
+  return (true);
+
+  truncated:
+
+  if (log)
+    log(ld, CF_LOGLEVEL_ERROR, "Truncated netpbm raster.");
+
+  free(rgb);
+
+  return (false);
+}
+
+// 'image_start()' - Place a picture in the graphic area.
+//
+// The Rotate, fitplot and mirror options work like in imagetobrf: "90>" and
+// "270>" only rotate pictures that are wider than high, or higher than wide
+// when the graphic area is in landscape.  Fitted pictures keep their aspect
+// ratio like "-resize WxH", others are cropped.
+
+static bool                         // O - `true` on success, `false` on error
+image_start(brf_image_reducer_t *red, // I - Downsampler
+            int width,              // I - Picture width
+            int height,             // I - Picture height
+            cf_logfunc_t log,       // I - Log function
+            void *ld)               // I - Log function data
+{
+  const brf_geometry_t *geom = red->geom;
+                                    // Page geometry
+  int i;                            // Looping var
+
+  if (width < 1 || height < 1 || width > BRF_IMAGE_MAX_SIZE || height > BRF_IMAGE_MAX_SIZE)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Bad picture size %dx%d.", width, height);
+    return (false);
+  }
+
+  // Decide on the rotation with the first size, as scaled JPEG pictures
+  // may have a slightly different aspect ratio...
+  if (red->rotate_if == '>')
+  {
+    if (geom->graphic_width > geom->graphic_height ? width >= height : width <= height)
+      red->rotate = 0;
+
+    red->rotate_if = 0;
+  }
+
+  red->width = width;
+  red->height = height;
+  red->rw = red->rotate % 180 ? height : width;
+  red->rh = red->rotate % 180 ? width : height;
+
+  if (red->fit)
+  {
+    if ((long)red->rw * geom->graphic_height > (long)red->rh * geom->graphic_width)
+    {
+      red->dw = geom->graphic_width;
+      red->dh = (int)((long)red->rh * geom->graphic_width / red->rw);
+    }
+    else
+    {
+      red->dh = geom->graphic_height;
+      red->dw = (int)((long)red->rw * geom->graphic_height / red->rh);
+    }
+
+    if (red->dw < 1)
+      red->dw = 1;
+    if (red->dh < 1)
+      red->dh = 1;
+  }
+  else
+  {
+    red->dw = red->rw < geom->graphic_width ? red->rw : geom->graphic_width;
+    red->dh = red->rh < geom->graphic_height ? red->rh : geom->graphic_height;
+  }
+
+  free(red->xmap);
+  free(red->ymap);
+  free(red->sums);
+
+  red->xmap = (int *)malloc(2 * (size_t)red->rw * sizeof(int));
+  red->ymap = (int *)malloc(2 * (size_t)red->rh * sizeof(int));
+  red->sums = (uint64_t *)calloc(4 * (size_t)red->dw * (size_t)red->dh, sizeof(uint64_t));
+
+  if (!red->xmap || !red->ymap || !red->sums)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unable to allocate %dx%d dot averages.", red->dw, red->dh);
+    return (false);
+  }
+
+  // Dots covered by each rotated column and row, cropped pixels cover
+  // none...
+  for (i = 0; i < red->rw; i++)
+  {
+    if (red->fit)
+    {
+      red->xmap[2 * i] = (int)((long)i * red->dw / red->rw);
+      red->xmap[2 * i + 1] = (int)((long)(i + 1) * red->dw / red->rw);
+
+      if (red->xmap[2 * i + 1] <= red->xmap[2 * i])
+        red->xmap[2 * i + 1] = red->xmap[2 * i] + 1;
+    }
+    else
+    {
+      red->xmap[2 * i] = i;
+      red->xmap[2 * i + 1] = i < red->dw ? i + 1 : i;
+    }
+  }
+
+  for (i = 0; i < red->rh; i++)
+  {
+    if (red->fit)
+    {
+      red->ymap[2 * i] = (int)((long)i * red->dh / red->rh);
+      red->ymap[2 * i + 1] = (int)((long)(i + 1) * red->dh / red->rh);
+
+      if (red->ymap[2 * i + 1] <= red->ymap[2 * i])
+        red->ymap[2 * i + 1] = red->ymap[2 * i] + 1;
+    }
+    else
+    {
+      red->ymap[2 * i] = i;
+      red->ymap[2 * i + 1] = i < red->dh ? i + 1 : i;
+    }
+  }
+
+  return (true);
+}
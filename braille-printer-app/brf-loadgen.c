@@ -0,0 +1,642 @@
+//
+// IPP load generator for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   brf-loadgen [OPTIONS] [FILE ...]
+//
+// Prints the files, or those in the "print-test" directory, round robin on
+// a running server from several connections at once and reports the jobs
+// per minute with percentiles of the submission latency, the time until the
+// first page reached the device and the completion time.  Each connection
+// keeps one job in flight, so "-c" is the number of jobs in the server at
+// once, and "-r" caps the submission rate.  The "-t" tables and "-g" page
+// ranges are cycled through the jobs to mix the workload.
+//
+// The first page is seen through "job-impressions-completed", which the
+// server updates 4 times per second, so that time is accurate to about 0.3
+// seconds.
+//
+// With "-x SECONDS" every job is canceled once it was processing for that
+// long, and the time from the Cancel-Job request until the server is done
+// with the job is reported as well.
+//
+
+#include <cups/cups.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local constants...
+
+#define BRF_LOADGEN_MAX_LIST 64       // Maximum files, tables, ranges, options
+#define BRF_LOADGEN_CANCEL_POLL 5000  // Microseconds between polls after a cancel
+#define BRF_LOADGEN_POLL 50000        // Microseconds between job state polls
+
+// Local types...
+
+typedef struct brf_loadgen_sample_s   // Times of one job
+{
+  double submit,                      // Seconds to submit
+      first_page,                     // Seconds until the first page or -1
+      complete,                       // Seconds until completed
+      cancel;                         // Seconds from cancel to done or -1
+} brf_loadgen_sample_t;
+
+typedef struct brf_loadgen_s          // Load generator state
+{
+  const char *host;                   // Server host or `NULL` for local
+  int port;                           // Server port
+  const char *printer;                // Printer or `NULL` for the default
+  int num_files;                      // Number of files
+  const char *files[BRF_LOADGEN_MAX_LIST];
+                                      // Files
+  int num_tables;                     // Number of LibLouis tables
+  const char *tables[BRF_LOADGEN_MAX_LIST];
+                                      // LibLouis tables
+  int num_ranges;                     // Number of page ranges
+  const char *ranges[BRF_LOADGEN_MAX_LIST];
+                                      // Page ranges
+  int num_options;                    // Number of fixed job options
+  cups_option_t *options;             // Fixed job options
+  int jobs,                           // Number of jobs
+      concurrency;                    // Number of connections
+  double rate;                        // Jobs per minute or 0 for no limit
+  double cancel_after;                // Seconds of processing until a cancel
+                                      // or 0 to not cancel
+  struct timespec start;              // Start of run
+  pthread_mutex_t lock;               // Lock for the following
+  int next;                           // Next job number
+  int failed;                         // Failed jobs
+  int num_samples;                    // Completed jobs
+  brf_loadgen_sample_t *samples;      // Times of completed jobs
+} brf_loadgen_t;
+
+// Local functions...
+
+static int loadgen_compare(const void *a, const void *b);
+static http_t *loadgen_connect(brf_loadgen_t *lg);
+static const char *loadgen_format(const char *filename);
+static void loadgen_metrics(brf_loadgen_t *lg);
+static double loadgen_now(brf_loadgen_t *lg);
+static bool loadgen_print(brf_loadgen_t *lg, http_t *http, int number, brf_loadgen_sample_t *sample);
+static void loadgen_report(const char *name, double *values, int count);
+static void *loadgen_thread(void *data);
+static int loadgen_usage(int status);
+
+// 'main()' - Run the load generator.
+
+int                                   // O - Exit status
+main(int argc,                        // I - Number of command-line arguments
+     char *argv[])                    // I - Command-line arguments
+{
+  brf_loadgen_t lg;                   // Load generator state
+  pthread_t *tids;                    // Connection threads
+  int i,                              // Looping var
+      count;                          // Number of values
+  const char *opt;                    // Current option
+  char *value;                        // Option value
+  DIR *dir;                           // Corpus directory
+  struct dirent *dent;                // Directory entry
+  static char paths[BRF_LOADGEN_MAX_LIST][1024];
+                                      // Corpus files
+  double seconds,                     // Length of run
+      *values;                        // Values to report
+
+  memset(&lg, 0, sizeof(lg));
+  lg.jobs = 100;
+  lg.concurrency = 4;
+  pthread_mutex_init(&lg.lock, NULL);
+
+  for (i = 1; i < argc; i++)
+  {
+    opt = argv[i];
+
+    if (opt[0] != '-' || !opt[1])
+    {
+      if (lg.num_files < BRF_LOADGEN_MAX_LIST)
+        lg.files[lg.num_files++] = opt;
+      continue;
+    }
+    else if (!strcmp(opt, "--help"))
+      return (loadgen_usage(0));
+    else if (opt[2] || !strchr("cdghnoprtx", opt[1]) || i + 1 >= argc)
+      return (loadgen_usage(1));
+
+    value = argv[++i];
+
+    switch (opt[1])
+    {
+      case 'c' :
+          if ((lg.concurrency = atoi(value)) < 1)
+            return (loadgen_usage(1));
+          break;
+      case 'd' :
+          lg.printer = value;
+          break;
+      case 'g' :
+          if (lg.num_ranges < BRF_LOADGEN_MAX_LIST)
+            lg.ranges[lg.num_ranges++] = value;
+          break;
+      case 'h' :
+          lg.host = value;
+          break;
+      case 'n' :
+          if ((lg.jobs = atoi(value)) < 1)
+            return (loadgen_usage(1));
+          break;
+      case 'o' :
+          lg.num_options = cupsParseOptions(value, lg.num_options, &lg.options);
+          break;
+      case 'p' :
+          lg.port = atoi(value);
+          break;
+      case 'r' :
+          lg.rate = strtod(value, NULL);
+          break;
+      case 't' :
+          if (lg.num_tables < BRF_LOADGEN_MAX_LIST)
+            lg.tables[lg.num_tables++] = value;
+          break;
+      case 'x' :
+          if ((lg.cancel_after = strtod(value, NULL)) <= 0.0)
+            return (loadgen_usage(1));
+          break;
+    }
+  }
+
+  // Default to the test corpus...
+  if (!lg.num_files && (dir = opendir("print-test")) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL && lg.num_files < BRF_LOADGEN_MAX_LIST)
+    {
+      if (dent->d_name[0] == '.')
+        continue;
+
+      snprintf(paths[lg.num_files], sizeof(paths[0]), "print-test/%s", dent->d_name);
+      lg.files[lg.num_files] = paths[lg.num_files];
+      lg.num_files ++;
+    }
+
+    closedir(dir);
+  }
+
+  if (!lg.num_files)
+  {
+    fputs("brf-loadgen: No files to print.\n", stderr);
+    return (loadgen_usage(1));
+  }
+
+  if ((lg.samples = (brf_loadgen_sample_t *)calloc((size_t)lg.jobs, sizeof(brf_loadgen_sample_t))) == NULL || (tids = (pthread_t *)calloc((size_t)lg.concurrency, sizeof(pthread_t))) == NULL || (values = (double *)calloc((size_t)lg.jobs, sizeof(double))) == NULL)
+  {
+    perror("brf-loadgen");
+    return (1);
+  }
+
+  printf("brf-loadgen: %d jobs of %d files on %d connections", lg.jobs, lg.num_files, lg.concurrency);
+  if (lg.rate > 0.0)
+    printf(" at %.1f jobs/min", lg.rate);
+  if (lg.cancel_after > 0.0)
+    printf(", canceled after %.3f seconds", lg.cancel_after);
+  putchar('\n');
+
+  clock_gettime(CLOCK_MONOTONIC, &lg.start);
+
+  for (i = 0; i < lg.concurrency; i++)
+  {
+    if (pthread_create(tids + i, NULL, loadgen_thread, &lg))
+    {
+      perror("brf-loadgen");
+      lg.concurrency = i;
+      break;
+    }
+  }
+
+  for (i = 0; i < lg.concurrency; i++)
+    pthread_join(tids[i], NULL);
+
+  seconds = loadgen_now(&lg);
+
+  printf("completed %d failed %d seconds %.3f jobs/min %.1f\n", lg.num_samples, lg.failed, seconds, seconds > 0.0 ? 60.0 * lg.num_samples / seconds : 0.0);
+
+  for (i = 0; i < lg.num_samples; i++)
+    values[i] = lg.samples[i].submit;
+  loadgen_report("submit", values, lg.num_samples);
+
+  for (i = 0, count = 0; i < lg.num_samples; i++)
+  {
+    if (lg.samples[i].first_page >= 0.0)
+      values[count++] = lg.samples[i].first_page;
+  }
+  loadgen_report("first_page", values, count);
+
+  for (i = 0; i < lg.num_samples; i++)
+    values[i] = lg.samples[i].complete;
+  loadgen_report("complete", values, lg.num_samples);
+
+  if (lg.cancel_after > 0.0)
+  {
+    for (i = 0, count = 0; i < lg.num_samples; i++)
+    {
+      if (lg.samples[i].cancel >= 0.0)
+        values[count++] = lg.samples[i].cancel;
+    }
+    loadgen_report("cancel", values, count);
+  }
+
+  loadgen_metrics(&lg);
+
+  free(values);
+  free(tids);
+  free(lg.samples);
+  cupsFreeOptions(lg.num_options, lg.options);
+
+  return (lg.failed ? 1 : 0);
+}
+
+// 'loadgen_compare()' - Compare two times.
+
+static int                            // O - Result of comparison
+loadgen_compare(const void *a,        // I - First time
+                const void *b)        // I - Second time
+{
+  double da = *((const double *)a),   // First time
+      db = *((const double *)b);      // Second time
+
+  return (da < db ? -1 : da > db);
+}
+
+// 'loadgen_connect()' - Connect to the server.
+//
+// Uses the domain socket of a local server like the sub-commands do, or the
+// given host and port.
+
+static http_t *                       // O - HTTP connection or `NULL`
+loadgen_connect(brf_loadgen_t *lg)    // I - Load generator state
+{
+  http_t *http = NULL;                // HTTP connection
+  char sockname[1024];                // Domain socket name
+  const char *snap_common,            // SNAP_COMMON environment variable
+      *tmpdir;                        // TMPDIR environment variable
+
+  if (!lg->host)
+  {
+    if ((snap_common = getenv("SNAP_COMMON")) != NULL)
+      snprintf(sockname, sizeof(sockname), "%s/brf-printer-app.sock", snap_common);
+    else if (!getuid())
+      snprintf(sockname, sizeof(sockname), "/var/run/brf-printer-app.sock");
+    else
+    {
+      if ((tmpdir = getenv("TMPDIR")) == NULL)
+        tmpdir = "/tmp";
+
+      snprintf(sockname, sizeof(sockname), "%s/brf-printer-app%d.sock", tmpdir, (int)getuid());
+    }
+
+    http = httpConnect2(sockname, 0, NULL, AF_LOCAL, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL);
+  }
+
+  if (!http && (lg->host || lg->port > 0))
+    http = httpConnect2(lg->host ? lg->host : "localhost", lg->port > 0 ? lg->port : 8000, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL);
+
+  return (http);
+}
+
+// 'loadgen_format()' - Get the MIME media type of a file from its extension.
+
+static const char *                   // O - MIME media type
+loadgen_format(const char *filename)  // I - Filename
+{
+  static const char *const formats[][2] =
+  {                                   // Extensions and MIME media types
+    { ".brf", "application/vnd.cups-brf" },
+    { ".docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+    { ".htm", "text/html" },
+    { ".html", "text/html" },
+    { ".jpeg", "image/jpeg" },
+    { ".jpg", "image/jpeg" },
+    { ".odt", "application/vnd.oasis.opendocument.text" },
+    { ".pdf", "application/pdf" },
+    { ".png", "image/png" },
+    { ".svg", "image/svg+xml" },
+    { ".txt", "text/plain" },
+    { ".xml", "application/xml" }
+  };
+  const char *ext;                    // Extension
+  size_t i;                           // Looping var
+
+  if ((ext = strrchr(filename, '.')) != NULL)
+  {
+    for (i = 0; i < (sizeof(formats) / sizeof(formats[0])); i++)
+    {
+      if (!strcasecmp(ext, formats[i][0]))
+        return (formats[i][1]);
+    }
+  }
+
+  // Let the server type other files...
+  return ("application/octet-stream");
+}
+
+// 'loadgen_metrics()' - Show the job counters of the server.
+
+static void
+loadgen_metrics(brf_loadgen_t *lg)    // I - Load generator state
+{
+  http_t *http;                       // HTTP connection
+  char buffer[8192],                  // Metrics from server
+      *line,                          // Current line
+      *next;                          // Next line
+  ssize_t bytes;                      // Bytes read
+  size_t used = 0;                    // Bytes in buffer
+
+  if ((http = loadgen_connect(lg)) == NULL)
+    return;
+
+  if (!httpGet(http, "/metrics"))
+  {
+    while (httpUpdate(http) == HTTP_STATUS_CONTINUE);
+
+    if (httpGetStatus(http) == HTTP_STATUS_OK)
+    {
+      while (used < sizeof(buffer) - 1 && (bytes = httpRead2(http, buffer + used, sizeof(buffer) - 1 - used)) > 0)
+        used += (size_t)bytes;
+    }
+  }
+
+  httpClose(http);
+
+  buffer[used] = '\0';
+
+  for (line = buffer; *line; line = next)
+  {
+    if ((next = strchr(line, '\n')) != NULL)
+      *next++ = '\0';
+    else
+      next = line + strlen(line);
+
+    if (!strncmp(line, "jobs_", 5))
+      printf("server %s\n", line);
+  }
+}
+
+// 'loadgen_now()' - Get the seconds since the start of the run.
+
+static double                         // O - Seconds
+loadgen_now(brf_loadgen_t *lg)        // I - Load generator state
+{
+  struct timespec now;                // Current time
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((now.tv_sec - lg->start.tv_sec) + (now.tv_nsec - lg->start.tv_nsec) / 1000000000.0);
+}
+
+// 'loadgen_print()' - Print a job and wait for it to complete.
+
+static bool                           // O - `true` on success, `false` on error
+loadgen_print(brf_loadgen_t *lg,      // I - Load generator state
+              http_t *http,           // I - HTTP connection
+              int number,             // I - Job number
+              brf_loadgen_sample_t *sample) // O - Times of job
+{
+  const char *filename = lg->files[number % lg->num_files];
+                                      // File to print
+  ipp_t *request,                     // IPP request
+      *response;                      // IPP response
+  ipp_attribute_t *attr;              // Attribute
+  char resource[1024],                // Printer resource
+      uri[1024],                      // Printer URI
+      job_name[256],                  // Job name
+      *ptr;                           // Pointer into resource
+  int job_id = 0,                     // Job ID
+      lower, upper;                   // Page range
+  ipp_jstate_t state = IPP_JSTATE_PENDING;
+                                      // Job state
+  double start = loadgen_now(lg),     // Start of job
+      processing = -1.0,              // Start of processing or -1
+      canceled = -1.0;                // Time of cancel or -1
+  static const char *const requested[] =
+  {                                   // Job attributes to poll
+    "job-impressions-completed",
+    "job-state"
+  };
+
+  // Same resource names as the server...
+  if (lg->printer && *lg->printer)
+  {
+    snprintf(resource, sizeof(resource), "/ipp/print/%s", lg->printer);
+    for (ptr = resource + 11; *ptr; ptr++)
+    {
+      if (!isalnum(*ptr & 255) && *ptr != '-')
+        *ptr = '_';
+      else
+        *ptr = (char)tolower(*ptr & 255);
+    }
+  }
+  else
+    snprintf(resource, sizeof(resource), "/ipp/print");
+
+  httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, "localhost", 0, resource);
+  snprintf(job_name, sizeof(job_name), "Load %d %s", number + 1, filename);
+
+  request = ippNewRequest(IPP_OP_PRINT_JOB);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, loadgen_format(filename));
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, job_name);
+
+  cupsEncodeOptions2(request, lg->num_options, lg->options, IPP_TAG_JOB);
+
+  if (lg->num_tables > 0)
+    ippAddString(request, IPP_TAG_JOB, IPP_TAG_TEXT, "LibLouis", NULL, lg->tables[number % lg->num_tables]);
+
+  if (lg->num_ranges > 0 && sscanf(lg->ranges[number % lg->num_ranges], "%d-%d", &lower, &upper) == 2)
+    ippAddRange(request, IPP_TAG_JOB, "page-ranges", lower, upper);
+
+  if ((response = cupsDoFileRequest(http, request, resource, filename)) != NULL)
+  {
+    if ((attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) != NULL && cupsLastError() < IPP_STATUS_REDIRECTION_OTHER_SITE)
+      job_id = ippGetInteger(attr, 0);
+
+    ippDelete(response);
+  }
+
+  if (!job_id)
+  {
+    fprintf(stderr, "brf-loadgen: Unable to print '%s': %s\n", filename, cupsLastErrorString());
+    return (false);
+  }
+
+  sample->submit = loadgen_now(lg) - start;
+  sample->first_page = -1.0;
+  sample->cancel = -1.0;
+
+  while (state < IPP_JSTATE_CANCELED)
+  {
+    usleep(canceled < 0.0 ? BRF_LOADGEN_POLL : BRF_LOADGEN_CANCEL_POLL);
+
+    if (lg->cancel_after > 0.0 && canceled < 0.0 && processing >= 0.0 && loadgen_now(lg) - processing >= lg->cancel_after)
+    {
+      request = ippNewRequest(IPP_OP_CANCEL_JOB);
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+      ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+
+      canceled = loadgen_now(lg);
+
+      ippDelete(cupsDoRequest(http, request, resource));
+
+      if (cupsLastError() >= IPP_STATUS_REDIRECTION_OTHER_SITE)
+        fprintf(stderr, "brf-loadgen: Unable to cancel job %d: %s\n", job_id, cupsLastErrorString());
+    }
+
+    request = ippNewRequest(IPP_OP_GET_JOB_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", (int)(sizeof(requested) / sizeof(requested[0])), NULL, requested);
+
+    if ((response = cupsDoRequest(http, request, resource)) == NULL)
+    {
+      fprintf(stderr, "brf-loadgen: Unable to get state of job %d: %s\n", job_id, cupsLastErrorString());
+      return (false);
+    }
+
+    if ((attr = ippFindAttribute(response, "job-state", IPP_TAG_ENUM)) != NULL)
+      state = (ipp_jstate_t)ippGetInteger(attr, 0);
+
+    if (processing < 0.0 && state >= IPP_JSTATE_PROCESSING)
+      processing = loadgen_now(lg);
+
+    if (sample->first_page < 0.0 && (attr = ippFindAttribute(response, "job-impressions-completed", IPP_TAG_INTEGER)) != NULL && ippGetInteger(attr, 0) > 0)
+      sample->first_page = loadgen_now(lg) - start;
+
+    ippDelete(response);
+  }
+
+  sample->complete = loadgen_now(lg) - start;
+
+  // Jobs finishing before they could be canceled are fine too...
+  if (canceled >= 0.0 && state == IPP_JSTATE_CANCELED)
+  {
+    sample->cancel = loadgen_now(lg) - canceled;
+    return (true);
+  }
+
+  if (state != IPP_JSTATE_COMPLETED)
+  {
+    fprintf(stderr, "brf-loadgen: Job %d for '%s' was %s.\n", job_id, filename, state == IPP_JSTATE_CANCELED ? "canceled" : "aborted");
+    return (false);
+  }
+
+  return (true);
+}
+
+// 'loadgen_report()' - Show the percentiles of some times.
+
+static void
+loadgen_report(const char *name,      // I - Name of times
+               double *values,        // I - Times, sorted on return
+               int count)             // I - Number of times
+{
+  if (count < 1)
+  {
+    printf("%s none\n", name);
+    return;
+  }
+
+  qsort(values, (size_t)count, sizeof(double), loadgen_compare);
+
+  // Nearest rank percentiles...
+  printf("%s p50 %.3f p90 %.3f p99 %.3f max %.3f\n", name, values[(count - 1) * 50 / 100], values[(count - 1) * 90 / 100], values[(count - 1) * 99 / 100], values[count - 1]);
+}
+
+// 'loadgen_thread()' - Print jobs on one connection.
+
+static void *                         // O - Thread exit status (unused)
+loadgen_thread(void *data)            // I - Load generator state
+{
+  brf_loadgen_t *lg = (brf_loadgen_t *)data;
+  http_t *http;                       // HTTP connection
+  int number;                         // Job number
+  double due,                         // Time the job is due
+      now;                            // Current time
+  brf_loadgen_sample_t sample;        // Times of job
+
+  if ((http = loadgen_connect(lg)) == NULL)
+  {
+    fprintf(stderr, "brf-loadgen: Unable to connect to server: %s\n", cupsLastErrorString());
+
+    pthread_mutex_lock(&lg->lock);
+    lg->failed ++;
+    pthread_mutex_unlock(&lg->lock);
+    return (NULL);
+  }
+
+  for (;;)
+  {
+    pthread_mutex_lock(&lg->lock);
+    number = lg->next < lg->jobs ? lg->next++ : -1;
+    pthread_mutex_unlock(&lg->lock);
+
+    if (number < 0)
+      break;
+
+    // Jobs are due at a steady rate, late connections do not catch up...
+    if (lg->rate > 0.0 && (due = number * 60.0 / lg->rate) > (now = loadgen_now(lg)))
+      usleep((useconds_t)((due - now) * 1000000.0));
+
+    if (loadgen_print(lg, http, number, &sample))
+    {
+      pthread_mutex_lock(&lg->lock);
+      lg->samples[lg->num_samples++] = sample;
+      pthread_mutex_unlock(&lg->lock);
+    }
+    else
+    {
+      pthread_mutex_lock(&lg->lock);
+      lg->failed ++;
+      pthread_mutex_unlock(&lg->lock);
+    }
+  }
+
+  httpClose(http);
+
+  return (NULL);
+}
+
+// 'loadgen_usage()' - Show program usage.
+
+static int                            // O - Exit status
+loadgen_usage(int status)             // I - Exit status
+{
+  FILE *fp = status ? stderr : stdout;// Output file
+
+  fputs("Usage: brf-loadgen [OPTIONS] [FILE ...]\n", fp);
+  fputs("Options:\n", fp);
+  fputs("  -c CONNECTIONS   Jobs in flight at once (default 4)\n", fp);
+  fputs("  -d PRINTER       Printer (default is the default printer)\n", fp);
+  fputs("  -g FIRST-LAST    Page range, cycled with other -g options\n", fp);
+  fputs("  -h HOST          Server host (default is the local server)\n", fp);
+  fputs("  -n JOBS          Number of jobs (default 100)\n", fp);
+  fputs("  -o NAME=VALUE    Job option for all jobs\n", fp);
+  fputs("  -p PORT          Server port\n", fp);
+  fputs("  -r JOBS          Jobs per minute (default no limit)\n", fp);
+  fputs("  -t TABLE         LibLouis table, cycled with other -t options\n", fp);
+  fputs("  -x SECONDS       Cancel jobs after processing that long\n", fp);
+  fputs("Without files the files in the \"print-test\" directory are printed.\n", fp);
+
+  return (status);
+}
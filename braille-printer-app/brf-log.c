@@ -0,0 +1,368 @@
+//
+// Job logging for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The filters log through brf_JobLog() from the server and from the stages
+// of the filter chain, which are child processes, and the bash filters add
+// a message for every line they write to stderr.  Messages below the log
+// level are dropped before they are formatted.  The others are formatted
+// by the caller, while its arguments are still valid, and the text is
+// written as a record with the log level and job ID into a ring of the
+// calling thread or stage, in a shared anonymous mapping, without taking a
+// lock.  A drain thread of the server passes the records on to the PAPPL
+// log, so a job never waits for the log file.  When a ring is full its
+// messages are dropped and counted.
+//
+
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_LOG_INTERVAL 20000      // Microseconds between drains
+#define BRF_LOG_MAX_MESSAGE 1024    // Maximum length of a message
+#define BRF_LOG_NUM_RINGS 64        // Number of rings
+#define BRF_LOG_RING_SIZE 16384     // Bytes per ring, a power of 2
+
+#define BRF_LOG_FREE 0              // Ring is free
+#define BRF_LOG_CLAIMED 1           // Ring is being set up
+#define BRF_LOG_USED 2              // Ring has a producer
+#define BRF_LOG_RELEASED 3          // Ring is freed once drained
+
+// Local types...
+
+typedef struct brf_log_record_s     // Log record
+{
+  uint32_t size;                    // Size of record with padding, 0 for a
+                                    // wrap to the start of the ring
+  int32_t level;                    // Log level
+  int32_t job_id;                   // Job ID
+  uint32_t length;                  // Length of message
+  char message[];                   // Message, not nul-terminated
+} brf_log_record_t;
+
+typedef struct brf_log_ring_s       // Ring of one thread or stage
+{
+  int state;                        // BRF_LOG_FREE, ...
+  pid_t pid;                        // Process of producer
+  uint32_t head,                    // Bytes written by the producer
+      tail;                         // Bytes read by the drain thread
+  unsigned dropped;                 // Messages dropped
+  char data[BRF_LOG_RING_SIZE];     // Records
+} brf_log_ring_t;
+
+typedef struct brf_log_shared_s     // State shared with the filter stages
+{
+  int level;                        // Lowest level logged
+  int stopped;                      // Has the drain thread stopped?
+  brf_log_ring_t rings[BRF_LOG_NUM_RINGS];
+                                    // Rings
+} brf_log_shared_t;
+
+// Local functions...
+
+static void log_child(void);
+static void log_drain(brf_log_ring_t *ring);
+static void log_release(void *data);
+static brf_log_ring_t *log_ring(void);
+static void *log_thread(void *data);
+
+// Local globals...
+
+static pappl_system_t *log_system = NULL;
+                                    // System
+static pid_t log_pid = 0;           // Process ID of the server
+static brf_log_shared_t *log_shared = NULL;
+                                    // Shared state
+static pthread_key_t log_key;       // Key for releasing rings
+static __thread brf_log_ring_t *log_current = NULL;
+                                    // Ring of the current thread
+static unsigned long long log_dropped = 0;
+                                    // Messages dropped by drained rings
+
+// 'brf_LogEnabled()' - Return whether messages of a level are logged.
+
+bool                                // O - `true` if logged, `false` otherwise
+brf_LogEnabled(
+    pappl_loglevel_t level)         // I - Log level
+{
+  return (!log_shared || (int)level >= __atomic_load_n(&log_shared->level, __ATOMIC_RELAXED));
+}
+
+// 'brf_LogGetDropped()' - Get the number of dropped messages.
+
+unsigned long long                  // O - Number of dropped messages
+brf_LogGetDropped(void)
+{
+  unsigned long long dropped;       // Number of dropped messages
+  int i;                            // Looping var
+
+  if (!log_shared)
+    return (0);
+
+  dropped = __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+
+  for (i = 0; i < BRF_LOG_NUM_RINGS; i++)
+    dropped += __atomic_load_n(&log_shared->rings[i].dropped, __ATOMIC_RELAXED);
+
+  return (dropped);
+}
+
+// 'brf_LogInit()' - Set up the rings and start the drain thread.
+
+void
+brf_LogInit(pappl_system_t *system) // I - System
+{
+  brf_log_shared_t *shared;         // Shared state
+  pthread_t tid;                    // Drain thread
+  pthread_attr_t attr;              // Thread attributes
+
+  if (log_shared)
+    return;
+
+  if ((shared = (brf_log_shared_t *)mmap(NULL, sizeof(brf_log_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to map job log rings, jobs log directly: %s", strerror(errno));
+    return;
+  }
+
+  shared->level = (int)papplSystemGetLogLevel(system);
+
+  log_system = system;
+  log_pid = getpid();
+
+  pthread_key_create(&log_key, log_release);
+  pthread_atfork(NULL, NULL, log_child);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&tid, &attr, log_thread, shared))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to start job log thread, jobs log directly.");
+    munmap(shared, sizeof(brf_log_shared_t));
+  }
+  else
+    log_shared = shared;
+
+  pthread_attr_destroy(&attr);
+}
+
+// 'brf_LogJob()' - Log a message for a job.
+
+void
+brf_LogJob(pappl_job_t *job,        // I - Job
+           pappl_loglevel_t level,  // I - Log level
+           const char *message,     // I - Printf-style message
+           ...)                     // I - Additional arguments as needed
+{
+  va_list ap;                       // Argument pointer
+
+  if (!brf_LogEnabled(level))
+    return;
+
+  va_start(ap, message);
+  brf_LogJobv(job, level, message, ap);
+  va_end(ap);
+}
+
+// 'brf_LogJobv()' - Log a message for a job with an argument list.
+
+void
+brf_LogJobv(pappl_job_t *job,       // I - Job
+            pappl_loglevel_t level, // I - Log level
+            const char *message,    // I - Printf-style message
+            va_list ap)             // I - Pointer to additional arguments
+{
+  brf_log_ring_t *ring;             // Ring of thread
+  brf_log_record_t *record;         // New record
+  char buffer[BRF_LOG_MAX_MESSAGE]; // Formatted message
+  int length;                       // Length of message
+  uint32_t head,                    // Bytes written
+      offset,                       // Offset of record in ring
+      pad,                          // Bytes skipped at the end of the ring
+      size;                         // Size of record
+
+  if (!brf_LogEnabled(level))
+    return;
+
+  if ((length = vsnprintf(buffer, sizeof(buffer), message, ap)) < 0)
+    return;
+  else if (length >= (int)sizeof(buffer))
+    length = (int)sizeof(buffer) - 1;
+
+  if ((ring = log_ring()) == NULL)
+  {
+    papplLogJob(job, level, "%s", buffer);
+    return;
+  }
+
+  size = (uint32_t)((sizeof(brf_log_record_t) + (size_t)length + 7) & ~(size_t)7);
+  head = ring->head;
+  offset = head & (BRF_LOG_RING_SIZE - 1);
+
+  if ((pad = BRF_LOG_RING_SIZE - offset) >= size)
+    pad = 0;
+
+  if (head + pad + size - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > BRF_LOG_RING_SIZE)
+  {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // Records do not wrap, a short end of the ring is skipped...
+  if (pad >= sizeof(brf_log_record_t))
+    ((brf_log_record_t *)(ring->data + offset))->size = 0;
+
+  record = (brf_log_record_t *)(ring->data + ((head + pad) & (BRF_LOG_RING_SIZE - 1)));
+  record->size = size;
+  record->level = (int32_t)level;
+  record->job_id = papplJobGetID(job);
+  record->length = (uint32_t)length;
+  memcpy(record->message, buffer, (size_t)length);
+
+  __atomic_store_n(&ring->head, head + pad + size, __ATOMIC_RELEASE);
+}
+
+// 'log_child()' - Use new rings in a forked stage.
+
+static void
+log_child(void)
+{
+  log_current = NULL;
+}
+
+// 'log_drain()' - Pass the records of a ring on to the PAPPL log.
+
+static void
+log_drain(brf_log_ring_t *ring)     // I - Ring
+{
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+      tail = ring->tail,            // Bytes written and read
+      offset;                       // Offset of record in ring
+  brf_log_record_t *record;         // Current record
+
+  while (tail != head)
+  {
+    offset = tail & (BRF_LOG_RING_SIZE - 1);
+    record = (brf_log_record_t *)(ring->data + offset);
+
+    if ((BRF_LOG_RING_SIZE - offset) < sizeof(brf_log_record_t) || !record->size)
+    {
+      tail += BRF_LOG_RING_SIZE - offset;
+      continue;
+    }
+
+    if (record->job_id)
+      papplLog(log_system, (pappl_loglevel_t)record->level, "[Job %d] %.*s", record->job_id, (int)record->length, record->message);
+    else
+      papplLog(log_system, (pappl_loglevel_t)record->level, "%.*s", (int)record->length, record->message);
+
+    tail += record->size;
+  }
+
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+// 'log_release()' - Free the ring of an exiting thread once it is drained.
+
+static void
+log_release(void *data)             // I - Ring
+{
+  brf_log_ring_t *ring = (brf_log_ring_t *)data;
+                                    // Ring
+
+  if (ring->pid == getpid())
+    __atomic_store_n(&ring->state, BRF_LOG_RELEASED, __ATOMIC_RELEASE);
+}
+
+// 'log_ring()' - Get the ring of the current thread.
+
+static brf_log_ring_t *             // O - Ring or `NULL` to log directly
+log_ring(void)
+{
+  brf_log_ring_t *ring;             // Current ring
+  int i,                            // Looping var
+      state;                        // State of ring
+
+  if (!log_shared || __atomic_load_n(&log_shared->stopped, __ATOMIC_ACQUIRE))
+    return (NULL);
+
+  if (log_current)
+    return (log_current);
+
+  for (i = 0, ring = log_shared->rings; i < BRF_LOG_NUM_RINGS; i++, ring++)
+  {
+    state = BRF_LOG_FREE;
+
+    if (__atomic_compare_exchange_n(&ring->state, &state, BRF_LOG_CLAIMED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      ring->pid = getpid();
+      ring->head = ring->tail = 0;
+
+      __atomic_store_n(&ring->state, BRF_LOG_USED, __ATOMIC_RELEASE);
+
+      pthread_setspecific(log_key, ring);
+
+      return (log_current = ring);
+    }
+  }
+
+  return (NULL);
+}
+
+// 'log_thread()' - Drain the rings.
+
+static void *                       // O - Thread exit status (unused)
+log_thread(void *data)              // I - Shared state
+{
+  brf_log_shared_t *shared = (brf_log_shared_t *)data;
+                                    // Shared state
+  brf_log_ring_t *ring;             // Current ring
+  int i,                            // Looping var
+      state;                        // State of ring
+  bool done = false;                // Last drain?
+
+  do
+  {
+    usleep(BRF_LOG_INTERVAL);
+
+    if (papplSystemIsShutdown(log_system))
+    {
+      // Producers log directly from now on, then the rings are drained one
+      // last time...
+      __atomic_store_n(&shared->stopped, 1, __ATOMIC_RELEASE);
+      done = true;
+    }
+
+    __atomic_store_n(&shared->level, (int)papplSystemGetLogLevel(log_system), __ATOMIC_RELAXED);
+
+    for (i = 0, ring = shared->rings; i < BRF_LOG_NUM_RINGS; i++, ring++)
+    {
+      if ((state = __atomic_load_n(&ring->state, __ATOMIC_ACQUIRE)) < BRF_LOG_USED)
+        continue;
+
+      log_drain(ring);
+
+      // Free the rings of exited threads and stages, a stage may have
+      // logged some more before it exited...
+      if (state == BRF_LOG_RELEASED || (ring->pid != log_pid && kill(ring->pid, 0) && errno == ESRCH))
+      {
+        log_drain(ring);
+
+        __atomic_add_fetch(&log_dropped, __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->state, BRF_LOG_FREE, __ATOMIC_RELEASE);
+      }
+    }
+  }
+  while (!done);
+
+  return (NULL);
+}
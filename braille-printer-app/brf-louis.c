@@ -0,0 +1,665 @@
+//
+// Liblouis table selection and translation for the Braille Printer
+// Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Table selection follows getOptionLibLouis in filter/cups-braille.sh, using
+// the table metadata queries of lou_findTable() instead of grepping the
+// table files.
+//
+// Compiling a table list, especially with a hyphenation dictionary, takes
+// much longer than translating a page.  The server compiles the table lists
+// of the configured printers' defaults at startup and keeps them, and every
+// job's table list is compiled in the server before its filter chain starts.
+// The filter processes are forked from the server and find the tables in
+// liblouis' own cache, shared read-only with the server.  Lists not used by
+// a printer default are evicted when they have not been used for a while.
+//
+// Liblouis is not thread-safe, so the server only calls it with louis_lock
+// held, and the lock is also taken around fork() so that a child never
+// sees a half-compiled table.
+//
+
+#include <pappl/pappl.h>
+#include <liblouis/liblouis.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#ifndef BRF_TABLESDIR
+#  define BRF_TABLESDIR "/usr/share/liblouis/tables"
+#endif // !BRF_TABLESDIR
+
+#define BRF_LOUIS_CACHE_MAX 8 // Table lists kept besides printer defaults
+
+// Local types...
+
+typedef struct brf_louis_cache_s // Compiled table list
+{
+  char *tables;                 // Table list
+  bool resident;                // Default of a configured printer?
+  unsigned long used;           // Last use, for LRU eviction
+} brf_louis_cache_t;
+
+// Local functions...
+
+static void cache_evict(void);
+static void cache_fork_lock(void);
+static void cache_fork_unlock(void);
+static void cache_init(void);
+static void cache_list_cb(pappl_printer_t *printer, void *data);
+static bool cache_load(const char *tables, bool resident);
+static bool get_table(int num_options, cups_option_t *options, const char *name, int text_dots, char *table, size_t tablesize, cf_logfunc_t log, void *ld);
+static ssize_t louis_translate(const char *tables, const char *text, size_t textlen, char *cells, size_t cellsize);
+static bool table_exists(const char *name);
+
+// Local globals...
+
+static pthread_once_t louis_once = PTHREAD_ONCE_INIT;
+                                // One-time cache setup
+static pthread_mutex_t louis_lock = PTHREAD_MUTEX_INITIALIZER;
+                                // Lock for liblouis and the cache
+static cups_array_t *louis_cache = NULL;
+                                // Compiled table lists
+static unsigned long louis_serial = 0;
+                                // Use counter
+static bool louis_dirty = true; // Printer defaults changed?
+
+// 'brf_LouisCacheEvent()' - Note printer changes for the table cache.
+//
+// This is called from the system event callback, brf_LouisCachePrinters()
+// does the work later.
+
+void
+brf_LouisCacheEvent(pappl_event_t event) // I - Event
+{
+  if (event & (PAPPL_EVENT_PRINTER_CREATED | PAPPL_EVENT_PRINTER_DELETED | PAPPL_EVENT_PRINTER_CONFIG_CHANGED))
+    __atomic_store_n(&louis_dirty, true, __ATOMIC_RELAXED);
+}
+
+// 'brf_LouisCachePrinters()' - Keep the tables of the printer defaults
+//                              compiled.
+//
+// Table lists which are no longer the default of any printer stay in the
+// cache until they are evicted like any other.
+
+void
+brf_LouisCachePrinters(
+    pappl_system_t *system)       // I - System
+{
+  cups_array_t *ids;              // Printer IDs
+  void *id;                       // Current printer ID
+  pappl_printer_t *printer;       // Current printer
+  ipp_t *driver_attrs;            // Printer driver attributes
+  ipp_attribute_t *attr;          // Default attribute
+  brf_louis_cache_t *c;           // Cached table list
+  static const char *const names[] = { "LibLouis", "LibLouis2", "LibLouis3", "LibLouis4", "TextDots" };
+  char name[256],                 // Attribute name
+      value[256],                 // Attribute value
+      tables[1024];               // Table list
+  const char *val;                // TextDots value
+  int num_options,                // Number of options
+      text_dots;                  // Dots per cell
+  cups_option_t *options;         // Printer default options
+  size_t i;                       // Looping var
+  bool loaded;                    // Were the tables compiled?
+
+  if (!__atomic_exchange_n(&louis_dirty, false, __ATOMIC_RELAXED))
+    return;
+
+  pthread_once(&louis_once, cache_init);
+
+  // Find printers outside of the iteration, which keeps the system locked...
+  ids = cupsArrayNew(NULL, NULL);
+  papplSystemIteratePrinters(system, cache_list_cb, ids);
+
+  pthread_mutex_lock(&louis_lock);
+  for (c = (brf_louis_cache_t *)cupsArrayFirst(louis_cache); c; c = (brf_louis_cache_t *)cupsArrayNext(louis_cache))
+    c->resident = false;
+  pthread_mutex_unlock(&louis_lock);
+
+  for (id = cupsArrayFirst(ids); id; id = cupsArrayNext(ids))
+  {
+    if ((printer = papplSystemFindPrinter(system, NULL, (int)(intptr_t)id, NULL)) == NULL || (driver_attrs = papplPrinterGetDriverAttributes(printer)) == NULL)
+      continue;
+
+    for (i = 0, num_options = 0, options = NULL; i < (sizeof(names) / sizeof(names[0])); i++)
+    {
+      snprintf(name, sizeof(name), "%s-default", names[i]);
+      if ((attr = ippFindAttribute(driver_attrs, name, IPP_TAG_ZERO)) == NULL)
+        continue;
+
+      ippAttributeString(attr, value, sizeof(value));
+      num_options = cupsAddOption(names[i], value, num_options, &options);
+    }
+
+    ippDelete(driver_attrs);
+
+    text_dots = (val = cupsGetOption("TextDots", num_options, options)) != NULL ? atoi(val) : 6;
+
+    // Don't hold the lock while PAPPL locks are taken...
+    pthread_mutex_lock(&louis_lock);
+    loaded = brf_LouisGetTables(num_options, options, text_dots, tables, sizeof(tables), NULL, NULL) && tables[0] && cache_load(tables, true);
+    pthread_mutex_unlock(&louis_lock);
+
+    if (loaded)
+      papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG, "Liblouis tables '%s' are resident.", tables);
+
+    cupsFreeOptions(num_options, options);
+  }
+
+  pthread_mutex_lock(&louis_lock);
+  cache_evict();
+  pthread_mutex_unlock(&louis_lock);
+
+  cupsArrayDelete(ids);
+}
+
+// 'brf_LouisCacheTables()' - Compile the table list of a job.
+//
+// Called in the server before the filter chain of the job starts.  Errors
+// are left to the filter, which logs them for the job.
+
+bool                              // O - `true` if the tables are compiled
+brf_LouisCacheTables(
+    int num_options,              // I - Number of options
+    cups_option_t *options,       // I - Job options
+    int text_dots)                // I - Dots per cell (6 or 8)
+{
+  char tables[1024];              // Table list
+  bool ret;                       // Return value
+
+  pthread_once(&louis_once, cache_init);
+
+  pthread_mutex_lock(&louis_lock);
+
+  ret = brf_LouisGetTables(num_options, options, text_dots, tables, sizeof(tables), NULL, NULL) && tables[0] && cache_load(tables, false);
+
+  if (ret)
+    cache_evict();
+
+  pthread_mutex_unlock(&louis_lock);
+
+  return (ret);
+}
+
+// 'brf_LouisGetTables()' - Get the liblouis table list for the job options.
+//
+// The table list is empty when no translation was selected ("None" for all
+// LibLouis options).
+
+bool // O - `true` on success, `false` on error
+brf_LouisGetTables(
+    int num_options,        // I - Number of options
+    cups_option_t *options, // I - Options
+    int text_dots,          // I - Dots per cell (6 or 8)
+    char *tables,           // I - Table list buffer
+    size_t tablesize,       // I - Size of table list buffer
+    cf_logfunc_t log,       // I - Log function
+    void *ld)               // I - Log function data
+{
+  static const char *const names[] = { "LibLouis", "LibLouis2", "LibLouis3", "LibLouis4" };
+  char table[256],          // Table for one option
+      selected[1024] = "";  // Selected tables
+  size_t i,                 // Looping var
+      len;                  // Length of selected tables
+
+  *tables = '\0';
+
+  for (i = 0; i < (sizeof(names) / sizeof(names[0])); i++)
+  {
+    if (!get_table(num_options, options, names[i], text_dots, table, sizeof(table), log, ld))
+      return (false);
+
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG, "Table%d %s", (int)i + 1, table[0] ? table : "None");
+
+    if (!table[0])
+      continue;
+
+    len = strlen(selected);
+    snprintf(selected + len, sizeof(selected) - len, "%s%s", len ? "," : "", table);
+  }
+
+  if (selected[0])
+    snprintf(tables, tablesize, "en-us-brf.dis,%s,braille-patterns.cti", selected);
+
+  return (true);
+}
+
+// 'brf_LouisGetTablesTime()' - Get the time the tables were last changed.
+
+time_t                              // O - Newest modification time or 0
+brf_LouisGetTablesTime(void)
+{
+  DIR *dir;                         // Tables directory
+  struct dirent *dent;              // Directory entry
+  struct stat st;                   // File information
+  char filename[1024];              // Table filename
+  time_t newest = 0;                // Newest modification time
+
+  if ((dir = opendir(BRF_TABLESDIR)) == NULL)
+    return (0);
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    snprintf(filename, sizeof(filename), "%s/%s", BRF_TABLESDIR, dent->d_name);
+    if (!stat(filename, &st) && st.st_mtime > newest)
+      newest = st.st_mtime;
+  }
+
+  closedir(dir);
+
+  return (newest);
+}
+
+// 'brf_LouisTranslate()' - Translate a UTF-8 paragraph into Braille ASCII.
+//
+// Runs of whitespace are collapsed first, so that the same paragraph is
+// found in the translation memory regardless of its line breaks.
+
+ssize_t // O - Number of cells or -1 on error
+brf_LouisTranslate(
+    const char *tables,    // I - Table list from brf_LouisGetTables()
+    const char *text,      // I - UTF-8 text
+    size_t textlen,        // I - Length of text
+    char *cells,           // O - Braille ASCII
+    size_t cellsize)       // I - Size of cell buffer
+{
+  char *norm,              // Normalized text
+      *normptr;            // Pointer into normalized text
+  size_t i,                // Looping var
+      normlen;             // Length of normalized text
+  ssize_t ret;             // Return value
+
+  if ((norm = (char *)malloc(textlen + 1)) == NULL)
+    return (-1);
+
+  for (i = 0, normptr = norm; i < textlen; i ++)
+  {
+    if (!isspace(text[i] & 255))
+      *normptr++ = text[i];
+    else if (normptr > norm && normptr[-1] != ' ')
+      *normptr++ = ' ';
+  }
+
+  if (normptr > norm && normptr[-1] == ' ')
+    normptr --;
+
+  normlen = (size_t)(normptr - norm);
+
+  if ((ret = brf_MemoryLookup(tables, norm, normlen, cells, cellsize)) < 0 &&
+      (ret = louis_translate(tables, norm, normlen, cells, cellsize)) >= 0)
+    brf_MemoryStore(tables, norm, normlen, cells, (size_t)ret);
+
+  free(norm);
+
+  return (ret);
+}
+
+// 'cache_evict()' - Evict the least recently used table lists.
+//
+// Liblouis can only free all of its tables at once, so the remaining table
+// lists are compiled again afterwards.  This only happens when jobs use more
+// languages than the cache holds.  The caller holds louis_lock.
+
+static void
+cache_evict(void)
+{
+  brf_louis_cache_t *c,           // Cached table list
+      *oldest;                    // Least recently used table list
+  int count;                      // Number of non-resident table lists
+  bool evicted = false;           // Were table lists evicted?
+
+  for (;;)
+  {
+    for (c = (brf_louis_cache_t *)cupsArrayFirst(louis_cache), count = 0, oldest = NULL; c; c = (brf_louis_cache_t *)cupsArrayNext(louis_cache))
+    {
+      if (c->resident)
+        continue;
+
+      count++;
+
+      if (!oldest || c->used < oldest->used)
+        oldest = c;
+    }
+
+    if (count <= BRF_LOUIS_CACHE_MAX)
+      break;
+
+    cupsArrayRemove(louis_cache, oldest);
+    free(oldest->tables);
+    free(oldest);
+    evicted = true;
+  }
+
+  if (!evicted)
+    return;
+
+  lou_free();
+
+  for (c = (brf_louis_cache_t *)cupsArrayFirst(louis_cache); c; c = (brf_louis_cache_t *)cupsArrayNext(louis_cache))
+    lou_getTable(c->tables);
+}
+
+// 'cache_fork_lock()' - Keep liblouis consistent while forking.
+
+static void
+cache_fork_lock(void)
+{
+  pthread_mutex_lock(&louis_lock);
+}
+
+// 'cache_fork_unlock()' - Release liblouis after forking.
+
+static void
+cache_fork_unlock(void)
+{
+  pthread_mutex_unlock(&louis_lock);
+}
+
+// 'cache_init()' - Create the table cache.
+
+static void
+cache_init(void)
+{
+  louis_cache = cupsArrayNew(NULL, NULL);
+
+  pthread_atfork(cache_fork_lock, cache_fork_unlock, cache_fork_unlock);
+}
+
+// 'cache_list_cb()' - Collect the ID of a printer.
+
+static void
+cache_list_cb(pappl_printer_t *printer, // I - Printer
+              void *data)               // I - Printer IDs
+{
+  cupsArrayAdd((cups_array_t *)data, (void *)(intptr_t)papplPrinterGetID(printer));
+}
+
+// 'cache_load()' - Compile a table list and remember it.
+//
+// The caller holds louis_lock.
+
+static bool                       // O - `true` on success, `false` on error
+cache_load(const char *tables,    // I - Table list
+           bool resident)         // I - Default of a configured printer?
+{
+  brf_louis_cache_t *c;           // Cached table list
+
+  for (c = (brf_louis_cache_t *)cupsArrayFirst(louis_cache); c; c = (brf_louis_cache_t *)cupsArrayNext(louis_cache))
+  {
+    if (!strcmp(c->tables, tables))
+      break;
+  }
+
+  if (!c)
+  {
+    if (!lou_getTable(tables) || (c = (brf_louis_cache_t *)calloc(1, sizeof(brf_louis_cache_t))) == NULL)
+      return (false);
+
+    if ((c->tables = strdup(tables)) == NULL)
+    {
+      free(c);
+      return (false);
+    }
+
+    cupsArrayAdd(louis_cache, c);
+  }
+
+  c->resident |= resident;
+  c->used = ++louis_serial;
+
+  return (true);
+}
+
+// 'get_table()' - Resolve the table for one LibLouis option.
+
+static bool                        // O - `true` on success, `false` on error
+get_table(int num_options,         // I - Number of options
+          cups_option_t *options,  // I - Options
+          const char *name,        // I - Option name
+          int text_dots,           // I - Dots per cell
+          char *table,             // O - Table name, empty for none
+          size_t tablesize,        // I - Size of table name buffer
+          cf_logfunc_t log,        // I - Log function
+          void *ld)                // I - Log function data
+{
+  const char *val,                 // Option value
+      *valptr,                     // Pointer into value
+      *lang;                       // LANG environment variable
+  char locale[64],                 // Locale, e.g. "en_US"
+      language[64],                // Language, e.g. "en"
+      louis_locale[64],            // Locale for liblouis, e.g. "en-US"
+      query[256],                  // Metadata query
+      filename[256],               // Table file name
+      *ptr,                        // Pointer into string
+      *found;                      // Table found by lou_findTable()
+
+  *table = '\0';
+
+  if ((val = cupsGetOption(name, num_options, options)) == NULL || !*val || !strcmp(val, "None"))
+    return (true);
+
+  // Only plain table names, liblouis also takes paths and table lists...
+  for (valptr = val; *valptr; valptr++)
+  {
+    if (!isalnum(*valptr & 255) && !strchr("-_.", *valptr))
+      break;
+  }
+
+  if (*valptr || strstr(val, ".."))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Option %s must be a valid liblouis table name, got '%s'", name, val);
+    return (false);
+  }
+
+  // Split the locale like the shell filters do...
+  if ((lang = getenv("LANG")) == NULL)
+    lang = "en_US";
+
+  papplCopyString(locale, lang, sizeof(locale));
+  if ((ptr = strchr(locale, '@')) != NULL)
+    *ptr = '\0';
+  if ((ptr = strchr(locale, '.')) != NULL)
+    *ptr = '\0';
+
+  papplCopyString(language, locale, sizeof(language));
+  if ((ptr = strchr(language, '_')) != NULL)
+    *ptr = '\0';
+
+  papplCopyString(louis_locale, locale, sizeof(louis_locale));
+  if ((ptr = strchr(louis_locale, '_')) != NULL)
+    *ptr = '-';
+
+  if (!strcmp(val, "Locale") || !strncmp(val, "Locale-g", 8))
+  {
+    // Select a table from its metadata...
+    if (val[6] != '-')
+      snprintf(query, sizeof(query), "language:%s region:%s%s", language, louis_locale, text_dots == 8 ? " dots:8" : "");
+    else if (val[8] == '0')
+      snprintf(query, sizeof(query), "language:%s region:%s contraction:no%s", language, louis_locale, text_dots == 8 ? " dots:8" : "");
+    else
+      snprintf(query, sizeof(query), "language:%s region:%s grade:%c%s", language, louis_locale, val[8], text_dots == 8 ? " dots:8" : "");
+
+    if ((found = lou_findTable(query)) != NULL)
+    {
+      // Keep only the file name, the table path finds the rest...
+      if ((ptr = strrchr(found, '/')) != NULL)
+        papplCopyString(table, ptr + 1, tablesize);
+      else
+        papplCopyString(table, found, tablesize);
+
+      free(found);
+      return (true);
+    }
+
+    // Then untagged tables named after the locale...
+    if (val[6] != '-')
+    {
+      snprintf(filename, sizeof(filename), "%s.tbl", locale);
+      if (!table_exists(filename))
+        snprintf(filename, sizeof(filename), "%s.tbl", language);
+
+      if (table_exists(filename))
+      {
+        papplCopyString(table, filename, tablesize);
+        return (true);
+      }
+    }
+
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Could not find %s table with locale %s%s%s", name, locale, val[6] == '-' ? " and grade " : "", val[6] == '-' ? val + 8 : "");
+    return (false);
+  }
+  else if (!strcmp(val, "HyphLocale"))
+  {
+    snprintf(filename, sizeof(filename), "hyph_%s.dic", locale);
+    if (!table_exists(filename))
+      snprintf(filename, sizeof(filename), "hyph_%s.dic", language);
+
+    if (table_exists(filename))
+      papplCopyString(table, filename, tablesize);
+    else if (log)
+      log(ld, CF_LOGLEVEL_WARN, "Could not find %s hyphenation table with locale %s", name, locale);
+
+    return (true);
+  }
+
+  // Explicit table name, with or without extension...
+  snprintf(filename, sizeof(filename), "%s.ctb", val);
+  if (!table_exists(filename))
+    snprintf(filename, sizeof(filename), "%s.utb", val);
+  if (!table_exists(filename))
+    papplCopyString(filename, val, sizeof(filename));
+
+  if (!table_exists(filename))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Could not find %s table '%s'", name, val);
+    return (false);
+  }
+
+  papplCopyString(table, filename, tablesize);
+
+  return (true);
+}
+
+// 'louis_translate()' - Translate UTF-8 text into Braille ASCII.
+
+static ssize_t             // O - Number of cells or -1 on error
+louis_translate(
+    const char *tables,    // I - Table list from brf_LouisGetTables()
+    const char *text,      // I - UTF-8 text
+    size_t textlen,        // I - Length of text
+    char *cells,           // O - Braille ASCII
+    size_t cellsize)       // I - Size of cell buffer
+{
+  widechar *inbuf,         // Input characters
+      *outbuf = NULL;      // Output characters
+  int inlen = 0,           // Number of input characters
+      outlen,              // Number of output characters
+      consumed;            // Number of characters translated
+  size_t outsize,          // Size of output buffer
+      i;                   // Looping var
+  const unsigned char *ptr = (const unsigned char *)text,
+                           // Pointer into text
+      *end = ptr + textlen; // End of text
+  ssize_t ret = -1;        // Return value
+
+  if ((inbuf = (widechar *)malloc((textlen + 1) * sizeof(widechar))) == NULL)
+    return (-1);
+
+  // Decode UTF-8, characters outside the BMP become "?" when liblouis was
+  // built with 16-bit characters...
+  while (ptr < end)
+  {
+    unsigned ch = *ptr++; // Unicode character
+
+    if (ch >= 0xc0 && ch < 0xe0 && ptr < end)
+      ch = ((ch & 0x1f) << 6) | (*ptr++ & 0x3f);
+    else if (ch >= 0xe0 && ch < 0xf0 && (ptr + 1) < end)
+    {
+      ch = ((ch & 0x0f) << 12) | ((ptr[0] & 0x3f) << 6) | (ptr[1] & 0x3f);
+      ptr += 2;
+    }
+    else if (ch >= 0xf0 && (ptr + 2) < end)
+    {
+      ch = ((ch & 0x07) << 18) | ((ptr[0] & 0x3f) << 12) | ((ptr[1] & 0x3f) << 6) | (ptr[2] & 0x3f);
+      ptr += 3;
+    }
+    else if (ch >= 0x80)
+      ch = '?';
+
+    if (ch > 0xffff && lou_charSize() == 2)
+      ch = '?';
+
+    inbuf[inlen++] = (widechar)ch;
+  }
+
+  // Contractions make the output shorter, but capital and number signs can
+  // make it longer, so grow the output buffer until everything fits...
+  for (outsize = (size_t)inlen * 2 + 16;; outsize *= 2)
+  {
+    widechar *temp; // New output buffer
+
+    if ((temp = (widechar *)realloc(outbuf, outsize * sizeof(widechar))) == NULL)
+      goto done;
+
+    outbuf = temp;
+    consumed = inlen;
+    outlen = (int)outsize;
+
+    if (!lou_translateString(tables, inbuf, &consumed, outbuf, &outlen, NULL, NULL, 0))
+      goto done;
+
+    if (consumed >= inlen && (size_t)outlen < outsize)
+      break;
+  }
+
+  if ((size_t)outlen > cellsize)
+    goto done;
+
+  // Map output characters to Braille ASCII, including dot patterns...
+  for (i = 0; i < (size_t)outlen; i++)
+  {
+    widechar ch = outbuf[i]; // Output character
+
+    if (ch >= 0x2800 && ch <= 0x28ff)
+      cells[i] = brf_dots_ascii[ch & 0x3f];
+    else if (ch == 0xa0)
+      cells[i] = ' ';
+    else if (ch >= 0x20 && ch < 0x7f)
+      cells[i] = (char)toupper(ch);
+    else
+      cells[i] = ' ';
+  }
+
+  ret = (ssize_t)outlen;
+
+  done:
+
+  free(inbuf);
+  free(outbuf);
+
+  return (ret);
+}
+
+// 'table_exists()' - Check whether a table file is installed.
+
+static bool                  // O - `true` if the table exists
+table_exists(const char *name) // I - Table file name
+{
+  char filename[1024]; // Table filename
+
+  snprintf(filename, sizeof(filename), "%s/%s", BRF_TABLESDIR, name);
+
+  return (!access(filename, R_OK));
+}
@@ -0,0 +1,517 @@
+//
+// Streaming XML/HTML tokenizer for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The tokenizer takes the document in buffers of any size and reports start
+// tags, end tags and character data to a callback as soon as they are
+// complete, so only the current tag and a little text are kept in memory.
+// Comments, declarations and processing instructions are skipped.  It does
+// not check that the document is well-formed, and entities which are not
+// recognized are kept as they are.
+//
+// In HTML mode the contents of "script" and "style" elements are skipped
+// without looking for tags in them.  The common HTML entities are known in
+// both modes as XHTML documents use them too.
+//
+
+#include <pappl/pappl.h>
+
+#include "brf-printer.h"
+
+// Local functions...
+
+static bool markup_entity(brf_markup_t *m);
+static bool markup_flush(brf_markup_t *m);
+static bool markup_put(brf_markup_t *m, const char *s, size_t len);
+static bool markup_tag(brf_markup_t *m);
+
+// 'brf_MarkupFinish()' - Report the remaining character data.
+
+bool                            // O - `true` on success, `false` if stopped
+brf_MarkupFinish(brf_markup_t *m) // I - Tokenizer
+{
+  if (m->state == BRF_MARKUP_STATE_ENTITY)
+  {
+    m->state = BRF_MARKUP_STATE_TEXT;
+
+    if (!markup_put(m, "&", 1) || !markup_put(m, m->entity, m->entitylen))
+      return (false);
+  }
+
+  return (markup_flush(m));
+}
+
+// 'brf_MarkupGetAttr()' - Get the value of an attribute.
+//
+// Entities in the value are not decoded.
+
+bool                            // O - `true` if found, `false` otherwise
+brf_MarkupGetAttr(
+    const char *attrs,          // I - Attributes from a start tag
+    const char *name,           // I - Attribute name
+    char *value,                // O - Value
+    size_t valuesize)           // I - Size of value buffer
+{
+  const char *ptr = attrs,      // Pointer into attributes
+      *start;                   // Start of name or value
+  size_t namelen = strlen(name), // Length of name
+      len;                      // Length of current name or value
+  char quote;                   // Quote character
+
+  while (*ptr)
+  {
+    while (*ptr && isspace(*ptr & 255))
+      ptr++;
+
+    for (start = ptr; *ptr && *ptr != '=' && !isspace(*ptr & 255); ptr++);
+
+    len = (size_t)(ptr - start);
+
+    while (*ptr && isspace(*ptr & 255))
+      ptr++;
+
+    if (*ptr != '=')
+    {
+      // Attribute without value...
+      if (len == namelen && !strncasecmp(start, name, len))
+      {
+        papplCopyString(value, name, valuesize);
+        return (true);
+      }
+
+      if (len == 0 && *ptr)
+        ptr++;
+      continue;
+    }
+
+    for (ptr++; *ptr && isspace(*ptr & 255); ptr++);
+
+    if (len == namelen && !strncasecmp(start, name, len))
+    {
+      if (*ptr == '\"' || *ptr == '\'')
+      {
+        quote = *ptr++;
+        for (start = ptr; *ptr && *ptr != quote; ptr++);
+      }
+      else
+        for (start = ptr; *ptr && !isspace(*ptr & 255); ptr++);
+
+      len = (size_t)(ptr - start);
+      if (len >= valuesize)
+        len = valuesize - 1;
+
+      memcpy(value, start, len);
+      value[len] = '\0';
+
+      return (true);
+    }
+
+    // Skip the value...
+    if (*ptr == '\"' || *ptr == '\'')
+    {
+      quote = *ptr++;
+      while (*ptr && *ptr != quote)
+        ptr++;
+      if (*ptr)
+        ptr++;
+    }
+    else
+    {
+      while (*ptr && !isspace(*ptr & 255))
+        ptr++;
+    }
+  }
+
+  return (false);
+}
+
+// 'brf_MarkupInit()' - Start tokenizing a document.
+
+void
+brf_MarkupInit(brf_markup_t *m,   // O - Tokenizer
+               brf_markup_cb_t cb, // I - Event callback
+               void *data)        // I - Callback data
+{
+  memset(m, 0, sizeof(brf_markup_t));
+
+  m->cb = cb;
+  m->data = data;
+  m->state = BRF_MARKUP_STATE_TEXT;
+  m->tag = m->tagbuf;
+  m->tagsize = sizeof(m->tagbuf);
+}
+
+// 'brf_MarkupParse()' - Tokenize the next part of a document.
+
+bool                            // O - `true` on success, `false` if stopped
+brf_MarkupParse(brf_markup_t *m,  // I - Tokenizer
+                const char *buffer, // I - Document data
+                size_t bytes)     // I - Size of data
+{
+  const char *ptr,                // Pointer into data
+      *end = buffer + bytes;      // End of data
+  char ch;                        // Current character
+
+  for (ptr = buffer; ptr < end; ptr++)
+  {
+    ch = *ptr;
+
+    switch (m->state)
+    {
+      case BRF_MARKUP_STATE_TEXT :
+          if (ch == '<')
+          {
+            if (!markup_flush(m))
+              return (false);
+
+            m->state = BRF_MARKUP_STATE_TAG;
+            m->taglen = 0;
+            m->quote = 0;
+            m->dashes = 0;
+          }
+          else if (ch == '&')
+          {
+            m->state = BRF_MARKUP_STATE_ENTITY;
+            m->entitylen = 0;
+          }
+          else if (!markup_put(m, &ch, 1))
+            return (false);
+          break;
+
+      case BRF_MARKUP_STATE_ENTITY :
+          if (ch == ';')
+          {
+            m->state = BRF_MARKUP_STATE_TEXT;
+
+            if (!markup_entity(m))
+              return (false);
+          }
+          else if ((isalnum(ch & 255) || ch == '#') && m->entitylen < (sizeof(m->entity) - 1))
+          {
+            m->entity[m->entitylen++] = ch;
+          }
+          else
+          {
+            // Not an entity after all, keep the text and look at this
+            // character again...
+            m->state = BRF_MARKUP_STATE_TEXT;
+
+            if (!markup_put(m, "&", 1) || !markup_put(m, m->entity, m->entitylen))
+              return (false);
+
+            ptr--;
+          }
+          break;
+
+      case BRF_MARKUP_STATE_TAG :
+          if (m->quote)
+          {
+            if (ch == m->quote)
+              m->quote = 0;
+          }
+          else if (ch == '>' && !m->dashes)
+          {
+            m->state = BRF_MARKUP_STATE_TEXT;
+
+            if (!markup_tag(m))
+              return (false);
+            break;
+          }
+          else if ((ch == '\"' || ch == '\'') && m->taglen > 0 && m->tag[0] != '!' && m->tag[0] != '?')
+            m->quote = ch;
+          else if (ch == '[' && m->taglen > 0 && m->tag[0] == '!')
+            m->dashes++;                // Internal subset of a DOCTYPE
+          else if (ch == ']' && m->dashes > 0)
+            m->dashes--;
+
+          if (m->taglen < (m->tagsize - 1))
+            m->tag[m->taglen++] = ch;
+
+          if (m->taglen == 3 && !memcmp(m->tag, "!--", 3))
+          {
+            m->state = BRF_MARKUP_STATE_COMMENT;
+            m->dashes = 0;
+          }
+          else if (m->taglen == 8 && !memcmp(m->tag, "![CDATA[", 8))
+          {
+            m->state = BRF_MARKUP_STATE_CDATA;
+            m->dashes = 0;
+          }
+          break;
+
+      case BRF_MARKUP_STATE_COMMENT :
+          if (ch == '>' && m->dashes >= 2)
+            m->state = BRF_MARKUP_STATE_TEXT;
+          else if (ch == '-')
+            m->dashes++;
+          else
+            m->dashes = 0;
+          break;
+
+      case BRF_MARKUP_STATE_RAWTEXT :
+          if (tolower(ch & 255) == m->rawtext[m->dashes])
+          {
+            if (!m->rawtext[++m->dashes])
+            {
+              // Found the end tag, the rest of it is a normal tag...
+              m->state = BRF_MARKUP_STATE_TAG;
+              m->taglen = strlen(m->rawtext + 1);
+              memcpy(m->tag, m->rawtext + 1, m->taglen);
+              m->quote = 0;
+              m->dashes = 0;
+            }
+          }
+          else
+            m->dashes = ch == '<' ? 1 : 0;
+          break;
+
+      case BRF_MARKUP_STATE_CDATA :
+          if (ch == ']')
+          {
+            m->dashes++;
+            break;
+          }
+
+          if (ch == '>' && m->dashes >= 2)
+          {
+            m->state = BRF_MARKUP_STATE_TEXT;
+            m->dashes -= 2;
+          }
+
+          for (; m->dashes > 0; m->dashes--)
+          {
+            if (!markup_put(m, "]", 1))
+              return (false);
+          }
+
+          if (m->state == BRF_MARKUP_STATE_CDATA && !markup_put(m, &ch, 1))
+            return (false);
+          break;
+    }
+  }
+
+  return (true);
+}
+
+// 'brf_MarkupSetTagBuffer()' - Use a larger buffer for long tags.
+//
+// Call before parsing; the buffer must stay allocated while the tokenizer
+// is used.  SVG path data easily needs more than the default 1k.
+
+void
+brf_MarkupSetTagBuffer(
+    brf_markup_t *m,            // I - Tokenizer
+    char *buffer,               // I - Tag buffer
+    size_t bufsize)             // I - Size of tag buffer
+{
+  m->tag = buffer;
+  m->tagsize = bufsize;
+}
+
+// 'markup_entity()' - Decode an entity or character reference.
+
+static bool                     // O - `true` on success, `false` if stopped
+markup_entity(brf_markup_t *m)  // I - Tokenizer
+{
+  static const struct
+  {
+    const char *name;           // Entity name
+    const char *text;           // UTF-8 text
+  } entities[] =
+  {
+    { "amp", "&" },
+    { "apos", "\'" },
+    { "bull", "\342\200\242" },
+    { "copy", "\302\251" },
+    { "deg", "\302\260" },
+    { "euro", "\342\202\254" },
+    { "gt", ">" },
+    { "hellip", "\342\200\246" },
+    { "laquo", "\302\253" },
+    { "ldquo", "\342\200\234" },
+    { "lsquo", "\342\200\230" },
+    { "lt", "<" },
+    { "mdash", "\342\200\224" },
+    { "middot", "\302\267" },
+    { "nbsp", "\302\240" },
+    { "ndash", "\342\200\223" },
+    { "pound", "\302\243" },
+    { "quot", "\"" },
+    { "raquo", "\302\273" },
+    { "rdquo", "\342\200\235" },
+    { "reg", "\302\256" },
+    { "rsquo", "\342\200\231" },
+    { "shy", "" },
+    { "trade", "\342\204\242" }
+  };
+  static const char * const latin1[] =
+  {                             // Letters U+00C0 to U+00FF
+    "Agrave", "Aacute", "Acirc", "Atilde", "Auml", "Aring", "AElig", "Ccedil",
+    "Egrave", "Eacute", "Ecirc", "Euml", "Igrave", "Iacute", "Icirc", "Iuml",
+    "ETH", "Ntilde", "Ograve", "Oacute", "Ocirc", "Otilde", "Ouml", "times",
+    "Oslash", "Ugrave", "Uacute", "Ucirc", "Uuml", "Yacute", "THORN", "szlig",
+    "agrave", "aacute", "acirc", "atilde", "auml", "aring", "aelig", "ccedil",
+    "egrave", "eacute", "ecirc", "euml", "igrave", "iacute", "icirc", "iuml",
+    "eth", "ntilde", "ograve", "oacute", "ocirc", "otilde", "ouml", "divide",
+    "oslash", "ugrave", "uacute", "ucirc", "uuml", "yacute", "thorn", "yuml"
+  };
+  char utf8[4];                 // UTF-8 character
+  unsigned long ch = 0;         // Unicode character
+  size_t i;                     // Looping var
+
+  m->entity[m->entitylen] = '\0';
+
+  if (m->entity[0] == '#')
+  {
+    if (m->entity[1] == 'x' || m->entity[1] == 'X')
+      ch = strtoul(m->entity + 2, NULL, 16);
+    else
+      ch = strtoul(m->entity + 1, NULL, 10);
+
+    if (ch == 0 || ch > 0x10ffff)
+      ch = '?';
+  }
+  else
+  {
+    for (i = 0; i < (sizeof(latin1) / sizeof(latin1[0])); i++)
+    {
+      if (!strcmp(m->entity, latin1[i]))
+      {
+        ch = 0xc0 + i;
+        break;
+      }
+    }
+  }
+
+  if (ch)
+  {
+
+    if (ch < 0x80)
+    {
+      utf8[0] = (char)ch;
+      return (markup_put(m, utf8, 1));
+    }
+    else if (ch < 0x800)
+    {
+      utf8[0] = (char)(0xc0 | (ch >> 6));
+      utf8[1] = (char)(0x80 | (ch & 0x3f));
+      return (markup_put(m, utf8, 2));
+    }
+    else if (ch < 0x10000)
+    {
+      utf8[0] = (char)(0xe0 | (ch >> 12));
+      utf8[1] = (char)(0x80 | ((ch >> 6) & 0x3f));
+      utf8[2] = (char)(0x80 | (ch & 0x3f));
+      return (markup_put(m, utf8, 3));
+    }
+    else
+    {
+      utf8[0] = (char)(0xf0 | (ch >> 18));
+      utf8[1] = (char)(0x80 | ((ch >> 12) & 0x3f));
+      utf8[2] = (char)(0x80 | ((ch >> 6) & 0x3f));
+      utf8[3] = (char)(0x80 | (ch & 0x3f));
+      return (markup_put(m, utf8, 4));
+    }
+  }
+
+  for (i = 0; i < (sizeof(entities) / sizeof(entities[0])); i++)
+  {
+    if (!strcmp(m->entity, entities[i].name))
+      return (markup_put(m, entities[i].text, strlen(entities[i].text)));
+  }
+
+  return (markup_put(m, "&", 1) && markup_put(m, m->entity, m->entitylen) && markup_put(m, ";", 1));
+}
+
+// 'markup_flush()' - Report the pending character data.
+
+static bool                     // O - `true` on success, `false` if stopped
+markup_flush(brf_markup_t *m)   // I - Tokenizer
+{
+  size_t len = m->textlen;      // Length of character data
+
+  if (!len)
+    return (true);
+
+  m->textlen = 0;
+
+  return ((m->cb)(m->data, BRF_MARKUP_TEXT, NULL, m->text, len));
+}
+
+// 'markup_put()' - Add to the pending character data.
+
+static bool                     // O - `true` on success, `false` if stopped
+markup_put(brf_markup_t *m,     // I - Tokenizer
+           const char *s,       // I - Text
+           size_t len)          // I - Length of text
+{
+  for (; len > 0; s++, len--)
+  {
+    if (m->textlen >= sizeof(m->text) && !markup_flush(m))
+      return (false);
+
+    m->text[m->textlen++] = *s;
+  }
+
+  return (true);
+}
+
+// 'markup_tag()' - Report a complete tag.
+
+static bool                     // O - `true` on success, `false` if stopped
+markup_tag(brf_markup_t *m)     // I - Tokenizer
+{
+  char *name,                   // Element name
+      *attrs,                   // Attributes
+      *ptr;                     // Pointer into tag
+  bool end = false,             // End tag?
+      empty = false;            // Empty element?
+  size_t len = m->taglen;       // Length of tag
+
+  // Skip declarations and processing instructions...
+  if (len == 0 || m->tag[0] == '!' || m->tag[0] == '?')
+    return (true);
+
+  while (len > 0 && isspace(m->tag[len - 1] & 255))
+    len--;
+
+  if (len > 0 && m->tag[len - 1] == '/')
+  {
+    empty = true;
+    len--;
+  }
+
+  m->tag[len] = '\0';
+
+  if ((name = m->tag)[0] == '/')
+  {
+    end = true;
+    name++;
+  }
+
+  for (ptr = name; *ptr && !isspace(*ptr & 255); ptr++)
+    *ptr = (char)tolower(*ptr & 255);
+
+  for (attrs = ptr; *attrs && isspace(*attrs & 255); attrs++)
+    *attrs = '\0';
+
+  if (!*name)
+    return (true);
+
+  if (!end && !(m->cb)(m->data, BRF_MARKUP_START, name, attrs, strlen(attrs)))
+    return (false);
+
+  if (m->html && !end && !empty && (!strcmp(name, "script") || !strcmp(name, "style")))
+  {
+    snprintf(m->rawtext, sizeof(m->rawtext), "</%s", name);
+    m->state = BRF_MARKUP_STATE_RAWTEXT;
+    m->dashes = 0;
+  }
+
+  if ((end || empty) && !(m->cb)(m->data, BRF_MARKUP_END, name, NULL, 0))
+    return (false);
+
+  return (true);
+}
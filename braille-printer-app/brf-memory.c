@@ -0,0 +1,454 @@
+//
+// Translation memory for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Translated paragraphs are kept in a hash table in a memory-mapped file in
+// the spool directory.  The server maps the file at startup and the filter
+// processes inherit the shared mapping, so boilerplate which was translated
+// for one job is reused by all later jobs and across restarts.
+//
+// The key is the normalized paragraph text together with the liblouis table
+// list, which includes the grade.  Line width does not matter here because
+// paragraphs are wrapped after translation.  The header records the liblouis
+// version and the newest modification time of the tables, and the file is
+// started over when either changed.
+//
+// Readers do not lock: writers reserve their data with an atomic add, claim
+// an empty bucket with compare-and-swap and publish the bucket by storing
+// its hash last.  When the data area or the buckets for a new key are full,
+// the writer that notices empties the table and starts over.  A writer that is still copying data from
+// before may overwrite newer entries, so every bucket holds a hash of its
+// value which readers check, and bucket offsets and lengths are checked
+// against the data area as the file is shared.
+//
+// File layout, native byte order as the file never leaves the host:
+//
+//   header, buckets[num_buckets], data (key, value, key, value, ...)
+//
+
+#include <pappl/pappl.h>
+#include <liblouis/liblouis.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_MEMORY_VERSION 2        // File format version
+#define BRF_MEMORY_EMPTY 0          // Empty bucket hash
+#define BRF_MEMORY_BUSY 1           // Bucket being written
+#define BRF_MEMORY_PROBES 32        // Maximum buckets to probe
+#define BRF_MEMORY_BUCKET_BYTES 256 // Bytes of file per bucket
+
+// Local types...
+
+typedef struct brf_memory_header_s  // File header
+{
+  char magic[4];                    // "BRFM"
+  uint32_t version;                 // Format version
+  char louis_version[32];           // Liblouis version
+  int64_t tables_time;              // Newest modification time of tables
+  uint64_t size;                    // Size of file
+  uint64_t num_buckets;             // Number of buckets
+  uint64_t data_offset;             // Offset of data area
+  uint64_t data_used;               // Bytes of data area used or reserved
+  uint64_t hits,                    // Number of lookups found
+      misses,                       // Number of lookups not found
+      entries;                      // Number of stored paragraphs
+} brf_memory_header_t;
+
+typedef struct brf_memory_bucket_s  // Hash bucket
+{
+  uint64_t hash;                    // Hash of key or BRF_MEMORY_EMPTY/BUSY
+  uint64_t offset;                  // Offset of key in data area
+  uint32_t keylen,                  // Length of key
+      valuelen;                     // Length of value
+  uint64_t check;                   // Hash of value
+} brf_memory_bucket_t;
+
+// Local functions...
+
+static uint64_t memory_check(const char *value, size_t valuelen);
+static brf_memory_bucket_t *memory_find(const char *key, size_t keylen, uint64_t hash, bool insert);
+static uint64_t memory_hash(const char *tables, const char *text, size_t textlen);
+static bool memory_key(const char *tables, const char *text, size_t textlen, char **key, size_t *keylen);
+static void memory_reset(void);
+static bool memory_valid(uint64_t offset, uint32_t keylen, uint32_t valuelen);
+
+// Local globals...
+
+static brf_memory_header_t *memory_map = NULL;
+                                    // Mapped file or `NULL` if disabled
+static brf_memory_bucket_t *memory_buckets = NULL;
+                                    // Hash buckets
+static char *memory_data = NULL;    // Data area
+static uint64_t memory_data_size = 0; // Size of data area
+static unsigned memory_hits = 0,    // Hits in this process
+    memory_misses = 0;              // Misses in this process
+
+// 'brf_MemoryGetStats()' - Get the translation memory counters.
+
+bool                                // O - `true` if enabled, `false` otherwise
+brf_MemoryGetStats(
+    unsigned long long *hits,       // O - Number of lookups found
+    unsigned long long *misses,     // O - Number of lookups not found
+    unsigned long long *entries,    // O - Number of stored paragraphs
+    unsigned long long *used,       // O - Bytes of data used
+    unsigned long long *size)       // O - Size of data area
+{
+  if (!memory_map)
+  {
+    *hits = *misses = *entries = *used = *size = 0;
+    return (false);
+  }
+
+  *hits = __atomic_load_n(&memory_map->hits, __ATOMIC_RELAXED);
+  *misses = __atomic_load_n(&memory_map->misses, __ATOMIC_RELAXED);
+  *entries = __atomic_load_n(&memory_map->entries, __ATOMIC_RELAXED);
+  *used = __atomic_load_n(&memory_map->data_used, __ATOMIC_RELAXED);
+  *size = memory_data_size;
+
+  if (*used > *size)
+    *used = *size;
+
+  return (true);
+}
+
+// 'brf_MemoryGetJobStats()' - Get the hits and misses of this process.
+//
+// Filters run in their own processes, so these are the counts of the job.
+
+void
+brf_MemoryGetJobStats(
+    unsigned *hits,                 // O - Number of lookups found
+    unsigned *misses)               // O - Number of lookups not found
+{
+  *hits = memory_hits;
+  *misses = memory_misses;
+}
+
+// 'brf_MemoryInit()' - Map the translation memory file.
+//
+// A size of 0 disables the translation memory.  A file with a different
+// size, version, liblouis version or tables is started over.
+
+void
+brf_MemoryInit(const char *spool_dir, // I - Spool directory
+               size_t size)           // I - Size of file in bytes
+{
+  char filename[1024];                // File name
+  int fd;                             // File descriptor
+  struct stat st;                     // File information
+  brf_memory_header_t *map;           // Mapped file
+  char louis_version[32];             // Liblouis version
+  int64_t tables_time;                // Newest modification time of tables
+  uint64_t num_buckets;               // Number of buckets
+
+  if (!size || !spool_dir || !*spool_dir)
+    return;
+
+  if (size < sizeof(brf_memory_header_t) + BRF_MEMORY_BUCKET_BYTES)
+  {
+    fprintf(stderr, "brf: Translation memory of %u bytes is too small.\n", (unsigned)size);
+    return;
+  }
+
+  snprintf(filename, sizeof(filename), "%s/translation-memory", spool_dir);
+
+  if ((fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+  {
+    fprintf(stderr, "brf: Unable to open translation memory '%s': %s\n", filename, strerror(errno));
+    return;
+  }
+
+  if (fstat(fd, &st) || ((size_t)st.st_size != size && ftruncate(fd, 0)) || ftruncate(fd, (off_t)size))
+  {
+    fprintf(stderr, "brf: Unable to size translation memory '%s': %s\n", filename, strerror(errno));
+    close(fd);
+    return;
+  }
+
+  map = (brf_memory_header_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "brf: Unable to map translation memory '%s': %s\n", filename, strerror(errno));
+    return;
+  }
+
+  memset(louis_version, 0, sizeof(louis_version));
+  papplCopyString(louis_version, lou_version(), sizeof(louis_version));
+  tables_time = (int64_t)brf_LouisGetTablesTime();
+  num_buckets = size / BRF_MEMORY_BUCKET_BYTES;
+
+  if (memcmp(map->magic, "BRFM", 4) || map->version != BRF_MEMORY_VERSION || map->size != size || map->num_buckets != num_buckets || map->data_offset != sizeof(brf_memory_header_t) + num_buckets * sizeof(brf_memory_bucket_t) || memcmp(map->louis_version, louis_version, sizeof(louis_version)) || map->tables_time != tables_time)
+  {
+    // New or incompatible file, or translations from other tables, start
+    // over...
+    memset(map, 0, sizeof(brf_memory_header_t));
+    map->version = BRF_MEMORY_VERSION;
+    memcpy(map->louis_version, louis_version, sizeof(map->louis_version));
+    map->tables_time = tables_time;
+    map->size = size;
+    map->num_buckets = num_buckets;
+    map->data_offset = sizeof(brf_memory_header_t) + map->num_buckets * sizeof(brf_memory_bucket_t);
+    memset(map + 1, 0, map->num_buckets * sizeof(brf_memory_bucket_t));
+    memcpy(map->magic, "BRFM", 4);
+  }
+
+  memory_map = map;
+  memory_buckets = (brf_memory_bucket_t *)(map + 1);
+  memory_data = (char *)map + map->data_offset;
+  memory_data_size = size - map->data_offset;
+}
+
+// 'brf_MemoryLookup()' - Look up the translation of a paragraph.
+
+ssize_t                             // O - Number of cells or -1 if not found
+brf_MemoryLookup(
+    const char *tables,             // I - Table list
+    const char *text,               // I - Normalized UTF-8 text
+    size_t textlen,                 // I - Length of text
+    char *cells,                    // O - Braille ASCII
+    size_t cellsize)                // I - Size of cell buffer
+{
+  char *key;                        // Key
+  size_t keylen;                    // Length of key
+  brf_memory_bucket_t *b;           // Bucket
+  uint64_t offset,                  // Offset of key
+      check;                        // Hash of value
+  uint32_t valuelen;                // Length of value
+  ssize_t ret = -1;                 // Return value
+
+  if (!memory_map || !memory_key(tables, text, textlen, &key, &keylen))
+    return (-1);
+
+  if ((b = memory_find(key, keylen, memory_hash(tables, text, textlen), false)) != NULL)
+  {
+    // Copy the bucket once, it may change under us...
+    offset = __atomic_load_n(&b->offset, __ATOMIC_RELAXED);
+    valuelen = __atomic_load_n(&b->valuelen, __ATOMIC_RELAXED);
+    check = __atomic_load_n(&b->check, __ATOMIC_RELAXED);
+
+    if (valuelen <= cellsize && memory_valid(offset, (uint32_t)keylen, valuelen))
+    {
+      memcpy(cells, memory_data + offset + keylen, valuelen);
+
+      if (memory_check(cells, valuelen) == check)
+        ret = (ssize_t)valuelen;
+    }
+  }
+
+  free(key);
+
+  if (ret < 0)
+  {
+    __atomic_add_fetch(&memory_map->misses, 1, __ATOMIC_RELAXED);
+    memory_misses ++;
+  }
+  else
+  {
+    __atomic_add_fetch(&memory_map->hits, 1, __ATOMIC_RELAXED);
+    memory_hits ++;
+  }
+
+  return (ret);
+}
+
+// 'brf_MemoryStore()' - Store the translation of a paragraph.
+
+void
+brf_MemoryStore(
+    const char *tables,             // I - Table list
+    const char *text,               // I - Normalized UTF-8 text
+    size_t textlen,                 // I - Length of text
+    const char *cells,              // I - Braille ASCII
+    size_t count)                   // I - Number of cells
+{
+  char *key;                        // Key
+  size_t keylen;                    // Length of key
+  uint64_t hash,                    // Hash of key
+      offset;                       // Offset of data
+  brf_memory_bucket_t *b;           // Bucket
+  int tries;                        // Number of tries
+
+  if (!memory_map || !memory_key(tables, text, textlen, &key, &keylen))
+    return;
+
+  hash = memory_hash(tables, text, textlen);
+
+  // Reserve room for key and value and claim a bucket, start over once when
+  // the data area or the buckets for the hash are full...
+  for (tries = 0; tries < 2; tries ++)
+  {
+    offset = __atomic_fetch_add(&memory_map->data_used, (uint64_t)(keylen + count), __ATOMIC_RELAXED);
+
+    if (offset + keylen + count > memory_data_size)
+    {
+      // Only the writer that filled the data area starts over...
+      if (tries == 0 && offset <= memory_data_size && keylen + count <= memory_data_size / 2)
+      {
+        memory_reset();
+        continue;
+      }
+
+      break;
+    }
+
+    memcpy(memory_data + offset, key, keylen);
+    memcpy(memory_data + offset + keylen, cells, count);
+
+    if ((b = memory_find(key, keylen, hash, true)) != NULL)
+    {
+      b->offset = offset;
+      b->keylen = (uint32_t)keylen;
+      b->valuelen = (uint32_t)count;
+      b->check = memory_check(cells, count);
+
+      __atomic_store_n(&b->hash, hash, __ATOMIC_RELEASE);
+      __atomic_add_fetch(&memory_map->entries, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    // Stored by another job meanwhile or no empty bucket left...
+    if (tries > 0 || memory_find(key, keylen, hash, false))
+      break;
+
+    memory_reset();
+  }
+
+  free(key);
+}
+
+// 'memory_check()' - Compute the FNV-1a hash of a value.
+
+static uint64_t                     // O - Hash
+memory_check(const char *value,     // I - Value
+             size_t valuelen)       // I - Length of value
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+                                    // Hash
+  const unsigned char *ptr;         // Pointer into value
+
+  for (ptr = (const unsigned char *)value; ptr < (const unsigned char *)value + valuelen; ptr ++)
+    hash = (hash ^ *ptr) * 0x100000001b3ULL;
+
+  return (hash);
+}
+
+// 'memory_find()' - Find the bucket of a key or claim an empty one.
+
+static brf_memory_bucket_t *        // O - Bucket or `NULL`
+memory_find(const char *key,        // I - Key
+            size_t keylen,          // I - Length of key
+            uint64_t hash,          // I - Hash of key
+            bool insert)            // I - Claim an empty bucket?
+{
+  uint64_t i,                       // Looping var
+      bucket_hash;                  // Hash in bucket
+  brf_memory_bucket_t *b;           // Current bucket
+
+  for (i = 0; i < BRF_MEMORY_PROBES; i ++)
+  {
+    b = memory_buckets + (hash + i) % memory_map->num_buckets;
+
+    bucket_hash = __atomic_load_n(&b->hash, __ATOMIC_ACQUIRE);
+
+    if (bucket_hash == BRF_MEMORY_EMPTY)
+    {
+      uint64_t expected = BRF_MEMORY_EMPTY; // Expected bucket hash
+
+      if (!insert)
+        return (NULL);
+
+      if (__atomic_compare_exchange_n(&b->hash, &expected, BRF_MEMORY_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return (b);
+
+      bucket_hash = expected;
+    }
+
+    if (bucket_hash == hash && b->keylen == keylen && memory_valid(b->offset, b->keylen, 0) && !memcmp(memory_data + b->offset, key, keylen))
+      return (insert ? NULL : b);
+  }
+
+  return (NULL);
+}
+
+// 'memory_hash()' - Compute the FNV-1a hash of a key.
+
+static uint64_t                     // O - Hash, never EMPTY or BUSY
+memory_hash(const char *tables,     // I - Table list
+            const char *text,       // I - Text
+            size_t textlen)         // I - Length of text
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+                                    // Hash
+  const unsigned char *ptr;         // Pointer into key
+
+  for (ptr = (const unsigned char *)tables; *ptr; ptr ++)
+    hash = (hash ^ *ptr) * 0x100000001b3ULL;
+
+  hash = (hash ^ 0) * 0x100000001b3ULL;
+
+  for (ptr = (const unsigned char *)text; ptr < (const unsigned char *)text + textlen; ptr ++)
+    hash = (hash ^ *ptr) * 0x100000001b3ULL;
+
+  if (hash <= BRF_MEMORY_BUSY)
+    hash += 2;
+
+  return (hash);
+}
+
+// 'memory_key()' - Build the key for a paragraph.
+
+static bool                         // O - `true` on success
+memory_key(const char *tables,      // I - Table list
+           const char *text,        // I - Text
+           size_t textlen,          // I - Length of text
+           char **key,              // O - Key, free when done
+           size_t *keylen)          // O - Length of key
+{
+  size_t tableslen = strlen(tables) + 1;
+                                    // Length of table list with nul
+
+  if ((*key = (char *)malloc(tableslen + textlen)) == NULL)
+    return (false);
+
+  memcpy(*key, tables, tableslen);
+  memcpy(*key + tableslen, text, textlen);
+  *keylen = tableslen + textlen;
+
+  return (true);
+}
+
+// 'memory_reset()' - Empty the hash table and data area.
+//
+// Buckets are emptied before the data area is reused, so readers miss
+// rather than find data of the new entries.
+
+static void
+memory_reset(void)
+{
+  uint64_t i;                       // Looping var
+
+  for (i = 0; i < memory_map->num_buckets; i ++)
+    __atomic_store_n(&memory_buckets[i].hash, BRF_MEMORY_EMPTY, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&memory_map->entries, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&memory_map->data_used, 0, __ATOMIC_RELEASE);
+}
+
+// 'memory_valid()' - Check that a bucket's key and value are in the data area.
+
+static bool                         // O - `true` if valid
+memory_valid(uint64_t offset,       // I - Offset of key
+             uint32_t keylen,       // I - Length of key
+             uint32_t valuelen)     // I - Length of value
+{
+  return (offset <= memory_data_size && (uint64_t)keylen + valuelen <= memory_data_size - offset);
+}
@@ -0,0 +1,369 @@
+//
+// ODF and OOXML text extraction for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Replaces "dumptofile; unzip -p $FILE content.xml | file2brl" of texttobrf
+// for OpenDocument text and Word documents.  The ZIP central directory is
+// read from the mapped spool file, only the document part is inflated, in
+// small pieces which go straight through the markup tokenizer into the
+// translator.  No temporary file and no other process is needed.
+//
+
+#include <pappl/pappl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_OFFICE_CHUNK 65536        // Size of inflated pieces
+
+// Local types...
+
+typedef struct brf_office_s           // Document conversion state
+{
+  brf_text_t t;                       // Translation and formatting
+  bool ooxml;                         // Word document?
+  int in_para,                        // Inside a paragraph?
+      in_text,                        // Inside a text run (OOXML)?
+      skip;                           // Inside skipped elements
+  int indent;                         // Indent of current paragraph
+  bool error;                         // Translation or write error?
+} brf_office_t;
+
+// Local functions...
+
+static bool office_markup_cb(void *data, brf_markup_event_t event, const char *name, const char *text, size_t len);
+static const unsigned char *office_find_part(const unsigned char *zip, size_t zipsize, const char *name, int *method, size_t *size);
+static unsigned office_get16(const unsigned char *p);
+static unsigned long office_get32(const unsigned char *p);
+
+// 'brf_officetobrf_filter_function()' - Convert the text of an ODF or OOXML
+//                                       document to BRF.
+
+int // O - Exit status
+brf_officetobrf_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable?
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_office_t doc;         // Conversion state
+  brf_markup_t markup;      // Markup tokenizer
+  struct stat st;           // Input file information
+  unsigned char *zip = NULL; // ZIP archive
+  size_t zipsize = 0;       // Size of archive
+  bool mapped = false;      // Is the archive mapped?
+  const unsigned char *part; // Document part
+  size_t partsize;          // Compressed size of document part
+  int method;               // Compression method
+  z_stream stream;          // Inflate stream
+  char *buffer = NULL;      // Inflated data
+  bool complete = false;    // Was the whole document converted?
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)parameters;
+
+  memset(&doc, 0, sizeof(doc));
+
+  if (!brf_TextInit(&doc.t, outputfd, data->num_options, data->options, log, ld))
+    return (1);
+
+  // The central directory is at the end, so map the spool file or read a
+  // pipe into memory...
+  if (inputseekable && !fstat(inputfd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (zip = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, inputfd, 0)) != MAP_FAILED)
+  {
+    zipsize = (size_t)st.st_size;
+    mapped = true;
+  }
+  else
+  {
+    size_t bufsize = 0;     // Size of buffer
+    ssize_t rbytes;         // Bytes read
+
+    zip = NULL;
+
+    do
+    {
+      if (zipsize == bufsize)
+      {
+        unsigned char *temp; // New buffer
+
+        bufsize = bufsize ? 2 * bufsize : 1048576;
+        if ((temp = (unsigned char *)realloc(zip, bufsize)) == NULL)
+        {
+          if (log)
+            log(ld, CF_LOGLEVEL_ERROR, "brf_officetobrf_filter_function: Unable to allocate memory.");
+          goto done;
+        }
+
+        zip = temp;
+      }
+
+      if ((rbytes = read(inputfd, zip + zipsize, bufsize - zipsize)) > 0)
+        zipsize += (size_t)rbytes;
+    }
+    while (rbytes > 0 || (rbytes < 0 && (errno == EINTR || errno == EAGAIN)));
+  }
+
+  // OpenDocument keeps the text in "content.xml", Word in
+  // "word/document.xml"...
+  if ((part = office_find_part(zip, zipsize, "content.xml", &method, &partsize)) == NULL)
+  {
+    if ((part = office_find_part(zip, zipsize, "word/document.xml", &method, &partsize)) == NULL)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_officetobrf_filter_function: No document text found, not an OpenDocument or Word file?");
+      goto done;
+    }
+
+    doc.ooxml = true;
+  }
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_officetobrf_filter_function: %s document, %lu bytes of %s XML, tables '%s'.", doc.ooxml ? "OOXML" : "ODF", (unsigned long)partsize, method ? "compressed" : "stored", doc.t.tables);
+
+  doc.indent = 2;
+  brf_MarkupInit(&markup, office_markup_cb, &doc);
+
+  if (method == 0)
+  {
+    // Stored, tokenize the mapped data directly...
+    complete = brf_MarkupParse(&markup, (const char *)part, partsize) && brf_MarkupFinish(&markup);
+  }
+  else if (method == Z_DEFLATED)
+  {
+    int status = Z_OK;      // Inflate status
+
+    if ((buffer = (char *)malloc(BRF_OFFICE_CHUNK)) == NULL)
+      goto done;
+
+    memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      goto done;
+
+    stream.next_in = (Bytef *)part;
+    stream.avail_in = (uInt)partsize;
+
+    while (status == Z_OK)
+    {
+      if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_DEBUG, "brf_officetobrf_filter_function: Job canceled.");
+        break;
+      }
+
+      stream.next_out = (Bytef *)buffer;
+      stream.avail_out = BRF_OFFICE_CHUNK;
+
+      if ((status = inflate(&stream, Z_NO_FLUSH)) != Z_OK && status != Z_STREAM_END)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "brf_officetobrf_filter_function: Unable to inflate document: %s", stream.msg ? stream.msg : "bad data");
+        break;
+      }
+
+      if (!brf_MarkupParse(&markup, buffer, BRF_OFFICE_CHUNK - stream.avail_out))
+        break;
+
+      if (status == Z_OK && stream.avail_in == 0 && stream.avail_out != 0)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "brf_officetobrf_filter_function: Document is truncated.");
+        break;
+      }
+    }
+
+    inflateEnd(&stream);
+
+    complete = status == Z_STREAM_END && brf_MarkupFinish(&markup);
+  }
+  else if (log)
+    log(ld, CF_LOGLEVEL_ERROR, "brf_officetobrf_filter_function: Unsupported compression method %d.", method);
+
+  done:
+
+  if (brf_TextFinish(&doc.t, complete && !doc.error) && complete && !doc.error)
+    ret = 0;
+
+  free(buffer);
+
+  if (mapped)
+    munmap(zip, zipsize);
+  else
+    free(zip);
+
+  return (ret);
+}
+
+// 'office_find_part()' - Find a part of a ZIP archive.
+
+static const unsigned char *        // O - Part data or `NULL` if not found
+office_find_part(
+    const unsigned char *zip,       // I - ZIP archive
+    size_t zipsize,                 // I - Size of archive
+    const char *name,               // I - Part name
+    int *method,                    // O - Compression method
+    size_t *size)                   // O - Compressed size
+{
+  const unsigned char *eocd,        // End of central directory record
+      *entry,                       // Central directory entry
+      *local,                       // Local file header
+      *end = zip + zipsize;         // End of archive
+  unsigned i,                       // Looping var
+      count;                        // Number of entries
+  size_t namelen = strlen(name);    // Length of name
+
+  if (!zip || zipsize < 22)
+    return (NULL);
+
+  // The end record is followed by a comment of up to 64k...
+  for (eocd = end - 22; eocd >= zip && eocd >= (end - 22 - 65535); eocd--)
+  {
+    if (!memcmp(eocd, "PK\005\006", 4))
+      break;
+  }
+
+  if (eocd < zip || eocd < (end - 22 - 65535))
+    return (NULL);
+
+  count = office_get16(eocd + 10);
+
+  if (office_get32(eocd + 16) >= zipsize)
+    return (NULL);
+
+  for (entry = zip + office_get32(eocd + 16), i = 0; i < count; i++)
+  {
+    unsigned entry_namelen,         // Length of entry name
+        extralen,                   // Length of extra field
+        commentlen;                 // Length of comment
+
+    if ((entry + 46) > end || memcmp(entry, "PK\001\002", 4))
+      return (NULL);
+
+    entry_namelen = office_get16(entry + 28);
+    extralen = office_get16(entry + 30);
+    commentlen = office_get16(entry + 32);
+
+    if ((entry + 46 + entry_namelen) > end)
+      return (NULL);
+
+    if (entry_namelen == namelen && !memcmp(entry + 46, name, namelen))
+    {
+      *method = (int)office_get16(entry + 10);
+      *size = office_get32(entry + 20);
+
+      if (office_get32(entry + 42) >= zipsize - 30)
+        return (NULL);
+
+      local = zip + office_get32(entry + 42);
+
+      if (memcmp(local, "PK\003\004", 4))
+        return (NULL);
+
+      local += 30 + office_get16(local + 26) + office_get16(local + 28);
+
+      if (local > end || *size > (size_t)(end - local))
+        return (NULL);
+
+      return (local);
+    }
+
+    entry += 46 + entry_namelen + extralen + commentlen;
+  }
+
+  return (NULL);
+}
+
+// 'office_get16()' - Get a little-endian 16-bit number.
+
+static unsigned                     // O - Number
+office_get16(const unsigned char *p) // I - Pointer to number
+{
+  return ((unsigned)(p[0] | (p[1] << 8)));
+}
+
+// 'office_get32()' - Get a little-endian 32-bit number.
+
+static unsigned long                // O - Number
+office_get32(const unsigned char *p) // I - Pointer to number
+{
+  return ((unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24));
+}
+
+// 'office_markup_cb()' - Collect the paragraphs of the document.
+//
+// ODF has the text directly in "text:p" and "text:h" elements, OOXML has
+// "w:p" paragraphs with the text in "w:t" runs.  Headings are not indented.
+
+static bool                         // O - `true` to continue, `false` to stop
+office_markup_cb(
+    void *data,                     // I - Conversion state
+    brf_markup_event_t event,       // I - Event
+    const char *name,               // I - Element name
+    const char *text,               // I - Character data or attributes
+    size_t len)                     // I - Length of text
+{
+  brf_office_t *doc = (brf_office_t *)data;
+                                    // Conversion state
+
+  switch (event)
+  {
+    case BRF_MARKUP_START :
+        if (!strcmp(name, "office:annotation") || !strcmp(name, "text:note-citation") || !strcmp(name, "w:instrtext") || !strcmp(name, "w:deltext"))
+          doc->skip++;
+        else if (!strcmp(name, "text:p") || !strcmp(name, "w:p"))
+          doc->in_para++;
+        else if (!strcmp(name, "text:h"))
+        {
+          doc->in_para++;
+          doc->indent = 0;
+        }
+        else if (!strcmp(name, "w:t"))
+          doc->in_text++;
+        else if (!strcmp(name, "w:pstyle") && (strstr(text, "Heading") || strstr(text, "Title")))
+          doc->indent = 0;
+        else if (doc->in_para && !doc->skip && (!strcmp(name, "text:s") || !strcmp(name, "text:tab") || !strcmp(name, "text:line-break") || !strcmp(name, "w:tab") || !strcmp(name, "w:br") || !strcmp(name, "w:cr")))
+          doc->error |= !brf_TextAdd(&doc->t, " ", 1);
+        break;
+
+    case BRF_MARKUP_END :
+        if (!strcmp(name, "office:annotation") || !strcmp(name, "text:note-citation") || !strcmp(name, "w:instrtext") || !strcmp(name, "w:deltext"))
+        {
+          if (doc->skip > 0)
+            doc->skip--;
+        }
+        else if (!strcmp(name, "text:p") || !strcmp(name, "text:h") || !strcmp(name, "w:p"))
+        {
+          if (doc->in_para > 0)
+            doc->in_para--;
+
+          // Nested paragraphs, e.g. in notes, end with the outer one...
+          if (!doc->in_para)
+          {
+            doc->error |= !brf_TextEndParagraph(&doc->t, doc->indent);
+            doc->indent = 2;
+          }
+        }
+        else if (!strcmp(name, "w:t") && doc->in_text > 0)
+          doc->in_text--;
+        break;
+
+    case BRF_MARKUP_TEXT :
+        if (doc->in_para && !doc->skip && (!doc->ooxml || doc->in_text))
+          doc->error |= !brf_TextAdd(&doc->t, text, len);
+        break;
+  }
+
+  return (!doc->error);
+}
@@ -0,0 +1,1048 @@
+//
+// Packed 6-dot BRF storage format for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// A packed BRF stream stores each braille cell in 6 bits (one bit per dot)
+// instead of one ASCII byte, run-length codes blank cells and blank lines,
+// and ends with an index of page offsets so that any page can be found
+// without decoding the pages before it.  Decoding gives back the original
+// BRF byte for byte; lines which are not plain braille ASCII (escape
+// sequences, mixed case, ...) are simply stored as literals.
+//
+// Layout, all integers little-endian:
+//
+//   header   "BRF6", version, flags, 2 reserved bytes, 64-bit index offset
+//            (0 when the output was not seekable)
+//   records  one header byte (kind, end of line, case) and a payload
+//   index    "BRFI", 32-bit page count, 64-bit offset of each page
+//   footer   64-bit index offset, 32-bit page count, "BRF6"
+//
+// Packed streams come from print clients too, so the decoder trusts none of
+// the counts: lines never exceed BRF_PACK_MAX_LINE cells, and a stream may
+// have at most as many blank lines as fit on its pages, counted from the
+// page index or, on a pipe, from the form feeds seen so far.
+//
+
+#include <pappl/pappl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_PACK_VERSION 1         // Format version
+#define BRF_PACK_HEADER 16         // Size of header
+#define BRF_PACK_FOOTER 16         // Size of footer
+#define BRF_PACK_MAX_LINE 65536    // Longest line kept as a single record
+#define BRF_PACK_MIN_RUN 4         // Shortest run of blanks worth coding
+
+#define BRF_REC_PACKED 0           // Line of 6-bit cells
+#define BRF_REC_LITERAL 1          // Line of raw bytes
+#define BRF_REC_BLANK 2            // Run of empty lines
+#define BRF_REC_CONTROL 3          // Page break or end of stream
+#define BRF_REC_KIND(h) ((h) & 3)
+#define BRF_REC_EOL(h) (((h) >> 2) & 3)
+#define BRF_REC_LOWER 0x10         // Letters are lowercase
+#define BRF_REC_SIMPLE 0x20        // Packed line without blank runs
+
+#define BRF_EOL_NONE 0             // Line ends at form feed or end of file
+#define BRF_EOL_LF 1               // "\n"
+#define BRF_EOL_CRLF 2             // "\r\n"
+#define BRF_EOL_CR 3               // "\r" before form feed or end of file
+
+#define BRF_CONTROL_FF 0           // Form feed
+#define BRF_CONTROL_END 1          // End of stream
+
+// Braille ASCII for each 6-dot pattern (dot 1 is bit 0, ..., dot 6 is bit 5)
+const char brf_dots_ascii[64] = " A1B'K2L@CIF/MSP\"E3H9O6R^DJG>NTQ,*5<-U8V.%[$+X!&;:4\\0Z7(_?W]#Y)=";
+
+// 6-dot pattern for each (uppercase) Braille ASCII character, 0xff if none
+const unsigned char brf_ascii_dots[128] =
+{
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0x00, 0x2e, 0x10, 0x3c, 0x2b, 0x29, 0x2f, 0x04, 0x37, 0x3e, 0x21, 0x2c, 0x20, 0x24, 0x28, 0x0c,
+  0x34, 0x02, 0x06, 0x12, 0x32, 0x22, 0x16, 0x36, 0x26, 0x14, 0x31, 0x30, 0x23, 0x3f, 0x1c, 0x39,
+  0x08, 0x01, 0x03, 0x09, 0x19, 0x11, 0x0b, 0x1b, 0x13, 0x0a, 0x1a, 0x05, 0x07, 0x0d, 0x1d, 0x15,
+  0x0f, 0x1f, 0x17, 0x0e, 0x1e, 0x25, 0x27, 0x3a, 0x2d, 0x3d, 0x35, 0x2a, 0x33, 0x3b, 0x18, 0x38,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+// Local types...
+
+typedef struct brf_packer_s // Encoder state
+{
+  int fd;                              // Output file
+  cf_filter_data_t *data;              // Filter data (for logging)
+  unsigned char out[65536];            // Output buffer
+  size_t outlen;                       // Bytes in output buffer
+  uint64_t offset;                     // Stream offset of output buffer
+  unsigned char line[BRF_PACK_MAX_LINE]; // Current line
+  size_t linelen;                      // Length of current line
+  size_t segs[2 * (BRF_PACK_MAX_LINE / BRF_PACK_MIN_RUN + 1)];
+                                       // Segments of line (blanks, cells)
+  unsigned blanks;                     // Pending empty lines
+  int blanks_eol;                      // End of line of pending empty lines
+  uint64_t *pages;                     // Offset of each page
+  size_t num_pages,                    // Number of pages
+      alloc_pages;                     // Allocated pages
+  bool error;                          // Write error?
+} brf_packer_t;
+
+typedef struct brf_unpacker_s // Decoder state
+{
+  int infd,                            // Input file
+      outfd;                           // Output file
+  unsigned char in[65536],             // Input buffer
+      *inptr,                          // Current position in input
+      *inend;                          // End of input
+  unsigned char out[65536];            // Output buffer
+  size_t outlen;                       // Bytes in output buffer
+  unsigned char cells[BRF_PACK_MAX_LINE]; // Decoded line
+  bool eof,                            // End of input reached?
+      error;                           // Read or write error?
+} brf_unpacker_t;
+
+// Local functions...
+
+static void pack_add_page(brf_packer_t *p);
+static void pack_bytes(brf_packer_t *p, const void *buffer, size_t bytes);
+static void pack_byte(brf_packer_t *p, unsigned char c);
+static void pack_flush(brf_packer_t *p);
+static void pack_flush_blanks(brf_packer_t *p);
+static void pack_line(brf_packer_t *p, int eol);
+static void pack_literal(brf_packer_t *p, int eol, size_t len);
+static void pack_varint(brf_packer_t *p, uint64_t value);
+static uint64_t get_le64(const unsigned char *buffer);
+static void put_le32(unsigned char *buffer, uint32_t value);
+static void put_le64(unsigned char *buffer, uint64_t value);
+static int unpack_byte(brf_unpacker_t *u);
+static void unpack_flush(brf_unpacker_t *u);
+static void unpack_put(brf_unpacker_t *u, const void *buffer, size_t bytes);
+static bool unpack_footer(int fd, uint32_t *num_pages);
+static bool unpack_varint(brf_unpacker_t *u, uint64_t *value);
+static size_t varint_size(uint64_t value);
+
+// 'brf_pack_filter_function()' - Convert BRF into a packed BRF stream.
+
+int // O - Exit status
+brf_pack_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_packer_t *p;             // Encoder state
+  unsigned char buffer[65536], // Read buffer
+      *ptr,                    // Pointer into buffer
+      header[BRF_PACK_HEADER], // Stream header
+      footer[BRF_PACK_FOOTER]; // Stream footer
+  ssize_t bytes;               // Bytes read
+  uint64_t index;              // Offset of page index
+  size_t i;                    // Looping var
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 0;
+
+  (void)inputseekable;
+  (void)parameters;
+
+  if ((p = (brf_packer_t *)calloc(1, sizeof(brf_packer_t))) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_pack_filter_function: Unable to allocate memory.");
+    return (1);
+  }
+
+  p->fd = outputfd;
+  p->data = data;
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, "BRF6", 4);
+  header[4] = BRF_PACK_VERSION;
+  pack_bytes(p, header, sizeof(header));
+  pack_add_page(p);
+
+  while (!p->error && (bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      ret = 1;
+      break;
+    }
+
+    for (ptr = buffer; ptr < (buffer + bytes); ptr++)
+    {
+      if (*ptr == '\n')
+      {
+        if (p->linelen > 0 && p->line[p->linelen - 1] == '\r')
+        {
+          p->linelen--;
+          pack_line(p, BRF_EOL_CRLF);
+        }
+        else
+          pack_line(p, BRF_EOL_LF);
+      }
+      else if (*ptr == '\f')
+      {
+        if (p->linelen > 0 && p->line[p->linelen - 1] == '\r')
+        {
+          p->linelen--;
+          pack_line(p, BRF_EOL_CR);
+        }
+        else
+          pack_line(p, BRF_EOL_NONE);
+
+        pack_flush_blanks(p);
+        pack_byte(p, BRF_REC_CONTROL | (BRF_CONTROL_FF << 2));
+        pack_add_page(p);
+      }
+      else
+      {
+        if (p->linelen >= sizeof(p->line))
+          pack_line(p, BRF_EOL_NONE);
+
+        p->line[p->linelen++] = *ptr;
+      }
+    }
+  }
+
+  // Finish the last line and the stream, dropping the empty page after a
+  // trailing form feed...
+  if (p->linelen > 0 && p->line[p->linelen - 1] == '\r')
+  {
+    p->linelen--;
+    pack_line(p, BRF_EOL_CR);
+  }
+  else
+    pack_line(p, BRF_EOL_NONE);
+
+  pack_flush_blanks(p);
+
+  if (p->num_pages > 1 && p->pages[p->num_pages - 1] == p->offset + p->outlen)
+    p->num_pages--;
+
+  pack_byte(p, BRF_REC_CONTROL | (BRF_CONTROL_END << 2));
+
+  // Then the page index and footer...
+  index = p->offset + p->outlen;
+
+  pack_bytes(p, "BRFI", 4);
+  put_le32(buffer, (uint32_t)p->num_pages);
+  pack_bytes(p, buffer, 4);
+  for (i = 0; i < p->num_pages; i++)
+  {
+    put_le64(buffer, p->pages[i]);
+    pack_bytes(p, buffer, 8);
+  }
+
+  put_le64(footer, index);
+  put_le32(footer + 8, (uint32_t)p->num_pages);
+  memcpy(footer + 12, "BRF6", 4);
+  pack_bytes(p, footer, sizeof(footer));
+  pack_flush(p);
+
+  // Record the index offset in the header if we can seek back to it...
+  put_le64(header + 8, index);
+  if (!p->error && pwrite(outputfd, header + 8, 8, 8) == 8 && log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_pack_filter_function: Page index at offset %llu.", (unsigned long long)index);
+
+  if (p->error)
+    ret = 1;
+  else if (log)
+    log(ld, CF_LOGLEVEL_INFO, "brf_pack_filter_function: Packed %u pages into %llu bytes.", (unsigned)p->num_pages, (unsigned long long)(p->offset));
+
+  free(p->pages);
+  free(p);
+
+  return (ret);
+}
+
+// 'brf_PackIsStream()' - Check whether a file starts like a packed BRF stream.
+//
+// Besides the magic, the version and the reserved bytes must match and the
+// index offset must be 0 or past the header, so that a BRF document which
+// merely starts with the text "BRF6" is not taken for a packed stream.
+
+bool                                // O - `true` if packed BRF
+brf_PackIsStream(
+    const unsigned char *header,    // I - Start of file
+    size_t headersize)              // I - Bytes available
+{
+  uint64_t index;                   // Offset of page index
+
+  if (headersize < (BRF_PACK_HEADER + 1) || memcmp(header, "BRF6", 4) || header[4] != BRF_PACK_VERSION || header[6] || header[7])
+    return (false);
+
+  index = get_le64(header + 8);
+
+  // The first record is a packed line, an empty page or the end...
+  return ((index == 0 || index > BRF_PACK_HEADER) && (header[BRF_PACK_HEADER] & ~0x3f) == 0);
+}
+
+// 'brf_PackPageOffset()' - Find the offset of a page in a packed BRF stream.
+//
+// "buffer" is the whole stream, typically mapped with mmap().  Decoding the
+// stream from the returned offset with brf_unpack_filter_function()
+// produces the page and everything after it.
+
+int64_t // O - Offset of page or -1 on error
+brf_PackPageOffset(
+    const unsigned char *buffer, // I - Packed BRF stream
+    size_t bufsize,              // I - Size of stream
+    unsigned page,               // I - Page number, starting at 1
+    unsigned *num_pages)         // O - Number of pages or `NULL`
+{
+  const unsigned char *footer; // Stream footer
+  uint64_t index;              // Offset of page index
+  uint32_t count;              // Number of pages
+
+  if (bufsize < (BRF_PACK_HEADER + BRF_PACK_FOOTER) || memcmp(buffer, "BRF6", 4))
+    return (-1);
+
+  footer = buffer + bufsize - BRF_PACK_FOOTER;
+  if (memcmp(footer + 12, "BRF6", 4))
+    return (-1);
+
+  index = get_le64(footer);
+  count = footer[8] | (footer[9] << 8) | (footer[10] << 16) | ((uint32_t)footer[11] << 24);
+
+  if (index < BRF_PACK_HEADER || index + 8 + 8 * (uint64_t)count > bufsize - BRF_PACK_FOOTER || memcmp(buffer + index, "BRFI", 4))
+    return (-1);
+
+  if (num_pages)
+    *num_pages = count;
+
+  if (page < 1 || page > count)
+    return (-1);
+
+  return ((int64_t)get_le64(buffer + index + 8 + 8 * (page - 1)));
+}
+
+// 'brf_unpack_filter_function()' - Convert a packed BRF stream back to BRF.
+//
+// The input may also start at a page offset returned by
+// brf_PackPageOffset() instead of at the stream header.  A spooled stream
+// must have a valid page index, which also bounds the number of blank lines
+// written for it.
+
+int // O - Exit status
+brf_unpack_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_unpacker_t *u;         // Decoder state
+  int h;                     // Record header
+  uint64_t count,            // Count from record
+      trailing,              // Trailing blanks
+      *segs = NULL,          // Segments of packed line (blanks, cells)
+      segs_simple[2];        // Segment of a simple packed line
+  size_t alloc_segs = 0;     // Allocated segments
+  uint64_t i, j;             // Looping vars
+  unsigned char *cells;      // Decoded line
+  brf_geometry_t geom;       // Page geometry
+  uint64_t page_lines,       // Lines on a page
+      blank_lines = 0;       // Blank lines written
+  uint32_t num_pages = 0,    // Pages in page index
+      pages_seen = 1;        // Pages decoded so far
+  struct stat st;            // Input file information
+  static const char *const eols[] = { "", "\n", "\r\n", "\r" };
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)parameters;
+
+  if (!brf_GeometryInit(&geom, data->num_options, data->options, log, ld))
+    return (1);
+
+  if ((page_lines = (uint64_t)(geom.text_height + geom.top_margin + geom.bottom_margin)) < 1)
+    page_lines = 1;
+
+  // The footer of a spooled stream is read first, a pipe is only checked
+  // as it is decoded...
+  if (inputseekable && !fstat(inputfd, &st) && S_ISREG(st.st_mode) && !unpack_footer(inputfd, &num_pages))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_unpack_filter_function: No valid page index, not a packed BRF stream.");
+    return (1);
+  }
+
+  if ((u = (brf_unpacker_t *)calloc(1, sizeof(brf_unpacker_t))) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_unpack_filter_function: Unable to allocate memory.");
+    return (1);
+  }
+
+  u->infd = inputfd;
+  u->outfd = outputfd;
+  u->inptr = u->inend = u->in;
+  cells = u->cells;
+
+  // Skip the header when decoding from the start of the stream...
+  if ((h = unpack_byte(u)) == 'B')
+  {
+    for (i = 1; i < BRF_PACK_HEADER; i++)
+      unpack_byte(u);
+    h = unpack_byte(u);
+  }
+
+  while (h >= 0 && !u->error)
+  {
+    switch (BRF_REC_KIND(h))
+    {
+      case BRF_REC_PACKED :
+          if (!unpack_varint(u, &count) || count > BRF_PACK_MAX_LINE)
+            goto bad;
+
+          if (h & BRF_REC_SIMPLE)
+          {
+            // One segment of cells, no blanks before or after...
+            segs_simple[0] = 0;
+            segs_simple[1] = count;
+            count = 1;
+            trailing = 0;
+          }
+          else
+          {
+
+            if (count > alloc_segs)
+            {
+              uint64_t *temp = (uint64_t *)realloc(segs, 2 * count * sizeof(uint64_t));
+
+              if (!temp)
+                goto bad;
+
+              segs = temp;
+              alloc_segs = count;
+            }
+
+            for (i = 0; i < count; i++)
+            {
+              if (!unpack_varint(u, segs + 2 * i) || !unpack_varint(u, segs + 2 * i + 1))
+                goto bad;
+            }
+
+            if (!unpack_varint(u, &trailing))
+              goto bad;
+          }
+
+          {
+            uint64_t *s = (h & BRF_REC_SIMPLE) ? segs_simple : segs;
+                                // Segments of this line
+            uint32_t bits = 0;  // Bit accumulator
+            int nbits = 0;      // Bits in accumulator
+            size_t len = 0;     // Length of line
+
+            for (i = 0; i < count; i++)
+            {
+              // Check each count, their sum could wrap around...
+              if (s[2 * i] > sizeof(u->cells) - len || s[2 * i + 1] > sizeof(u->cells) - len - s[2 * i])
+                goto bad;
+
+              memset(cells + len, ' ', s[2 * i]);
+              len += s[2 * i];
+
+              for (j = 0; j < s[2 * i + 1]; j++)
+              {
+                unsigned char c;  // Character
+
+                if (nbits < 6)
+                {
+                  int b = unpack_byte(u);
+
+                  if (b < 0)
+                    goto bad;
+
+                  bits |= (uint32_t)b << nbits;
+                  nbits += 8;
+                }
+
+                c = brf_dots_ascii[bits & 0x3f];
+                if ((h & BRF_REC_LOWER) && c >= 0x40 && c != 0x5f)
+                  c += 0x20;
+
+                cells[len++] = c;
+                bits >>= 6;
+                nbits -= 6;
+              }
+            }
+
+            unpack_put(u, cells, len);
+
+            if (trailing > sizeof(u->cells) - len)
+              goto bad;
+          }
+
+          for (; trailing > 0; trailing -= j)
+          {
+            j = trailing > sizeof(u->cells) ? sizeof(u->cells) : trailing;
+            memset(cells, ' ', j);
+            unpack_put(u, cells, j);
+          }
+
+          unpack_put(u, eols[BRF_REC_EOL(h)], strlen(eols[BRF_REC_EOL(h)]));
+          break;
+
+      case BRF_REC_LITERAL :
+          if (!unpack_varint(u, &count) || count > BRF_PACK_MAX_LINE)
+            goto bad;
+
+          for (i = 0; i < count; i++)
+          {
+            int c = unpack_byte(u);
+
+            if (c < 0)
+              goto bad;
+
+            cells[i] = (unsigned char)c;
+          }
+
+          unpack_put(u, cells, count);
+          unpack_put(u, eols[BRF_REC_EOL(h)], strlen(eols[BRF_REC_EOL(h)]));
+          break;
+
+      case BRF_REC_BLANK :
+          if (!unpack_varint(u, &count))
+            goto bad;
+
+          // A few bytes must not turn into endless paper feeds...
+          if (count > page_lines * (num_pages > pages_seen ? num_pages : pages_seen) - blank_lines)
+          {
+            if (log)
+              log(ld, CF_LOGLEVEL_ERROR, "brf_unpack_filter_function: More blank lines than fit on %u pages.", (unsigned)(num_pages > pages_seen ? num_pages : pages_seen));
+            goto done;
+          }
+
+          blank_lines += count;
+
+          for (; count > 0; count--)
+            unpack_put(u, eols[BRF_REC_EOL(h)], strlen(eols[BRF_REC_EOL(h)]));
+          break;
+
+      case BRF_REC_CONTROL :
+          if (BRF_REC_EOL(h) == BRF_CONTROL_END)
+          {
+            ret = 0;
+            goto done;
+          }
+
+          unpack_put(u, "\f", 1);
+          pages_seen++;
+          break;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      goto done;
+
+    h = unpack_byte(u);
+  }
+
+  bad:
+
+  if (log)
+    log(ld, CF_LOGLEVEL_ERROR, "brf_unpack_filter_function: Bad or truncated packed BRF stream.");
+
+  done:
+
+  unpack_flush(u);
+
+  if (u->error)
+    ret = 1;
+
+  free(segs);
+  free(u);
+
+  return (ret);
+}
+
+// 'pack_add_page()' - Remember the start of a new page.
+
+static void
+pack_add_page(brf_packer_t *p) // I - Encoder state
+{
+  if (p->num_pages >= p->alloc_pages)
+  {
+    uint64_t *temp; // New page array
+
+    if ((temp = (uint64_t *)realloc(p->pages, (p->alloc_pages + 256) * sizeof(uint64_t))) == NULL)
+    {
+      p->error = true;
+      return;
+    }
+
+    p->pages = temp;
+    p->alloc_pages += 256;
+  }
+
+  p->pages[p->num_pages++] = p->offset + p->outlen;
+}
+
+// 'pack_byte()' - Add a byte to the output.
+
+static void
+pack_byte(brf_packer_t *p, // I - Encoder state
+          unsigned char c) // I - Byte
+{
+  if (p->outlen >= sizeof(p->out))
+    pack_flush(p);
+
+  p->out[p->outlen++] = c;
+}
+
+// 'pack_bytes()' - Add bytes to the output.
+
+static void
+pack_bytes(brf_packer_t *p,      // I - Encoder state
+           const void *buffer,   // I - Bytes
+           size_t bytes)         // I - Number of bytes
+{
+  const unsigned char *ptr = (const unsigned char *)buffer;
+
+  while (bytes > 0)
+  {
+    size_t count = sizeof(p->out) - p->outlen;
+
+    if (count == 0)
+    {
+      pack_flush(p);
+      continue;
+    }
+
+    if (count > bytes)
+      count = bytes;
+
+    memcpy(p->out + p->outlen, ptr, count);
+    p->outlen += count;
+    ptr += count;
+    bytes -= count;
+  }
+}
+
+// 'pack_flush()' - Write the output buffer.
+
+static void
+pack_flush(brf_packer_t *p) // I - Encoder state
+{
+  unsigned char *ptr = p->out; // Pointer into buffer
+  ssize_t bytes;               // Bytes written
+
+  while (!p->error && ptr < (p->out + p->outlen))
+  {
+    if ((bytes = write(p->fd, ptr, (size_t)(p->out + p->outlen - ptr))) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (p->data->logfunc)
+        (p->data->logfunc)(p->data->logdata, CF_LOGLEVEL_ERROR, "brf_pack_filter_function: Unable to write: %s", strerror(errno));
+      p->error = true;
+      break;
+    }
+
+    ptr += bytes;
+  }
+
+  p->offset += p->outlen;
+  p->outlen = 0;
+}
+
+// 'pack_flush_blanks()' - Write pending empty lines.
+
+static void
+pack_flush_blanks(brf_packer_t *p) // I - Encoder state
+{
+  if (p->blanks)
+  {
+    pack_byte(p, BRF_REC_BLANK | (p->blanks_eol << 2));
+    pack_varint(p, p->blanks);
+    p->blanks = 0;
+  }
+}
+
+// 'pack_line()' - Encode the current line.
+
+static void
+pack_line(brf_packer_t *p, // I - Encoder state
+          int eol)         // I - End of line
+{
+  unsigned char *line = p->line; // Line
+  size_t len = p->linelen,       // Length of line
+      end,                       // End of line without trailing blanks
+      i, j,                      // Looping vars
+      cells,                     // Number of cells
+      size;                      // Size of packed record
+  bool upper = true,             // Only uppercase Braille ASCII?
+      lower = true,              // Only lowercase Braille ASCII?
+      simple;                    // Single segment without blanks?
+  size_t *segs = p->segs;        // Segments of line (blanks, cells)
+  size_t num_segs = 0;           // Number of segments
+
+  p->linelen = 0;
+
+  if (len == 0)
+  {
+    // Empty line, coalesce with other empty lines...
+    if (eol == BRF_EOL_NONE)
+      return;
+
+    if (p->blanks && p->blanks_eol != eol)
+      pack_flush_blanks(p);
+
+    p->blanks_eol = eol;
+    p->blanks++;
+    return;
+  }
+
+  pack_flush_blanks(p);
+
+  for (i = 0; i < len && (upper || lower); i++)
+  {
+    if (line[i] < 0x20 || line[i] > 0x7e)
+      upper = lower = false;
+    else if (line[i] >= 0x60)
+      upper = false;
+    else if (line[i] >= 0x40 && line[i] != 0x5f)
+      lower = false;
+  }
+
+  if (!upper && !lower)
+  {
+    // Not plain braille, keep as is...
+    pack_literal(p, eol, len);
+    return;
+  }
+
+  // Split into segments of cells separated by long runs of blanks...
+  for (end = len; end > 0 && line[end - 1] == ' '; end--);
+
+  for (i = 0; i < end;)
+  {
+    size_t blanks,    // Blanks before segment
+        start;        // Start of cells
+
+    for (j = i; j < end && line[j] == ' '; j++);
+    if ((j - i) >= BRF_PACK_MIN_RUN)
+    {
+      blanks = j - i;
+      i = j;
+    }
+    else
+      blanks = 0;
+
+    for (start = i; i < end;)
+    {
+      if (line[i] != ' ')
+      {
+        i++;
+        continue;
+      }
+
+      for (j = i; j < end && line[j] == ' '; j++);
+      if ((j - i) >= BRF_PACK_MIN_RUN)
+        break;
+      i = j;
+    }
+
+    segs[2 * num_segs] = blanks;
+    segs[2 * num_segs + 1] = i - start;
+    num_segs++;
+  }
+
+  // Short lines are smaller as literals...
+  simple = num_segs == 1 && segs[0] == 0 && end == len;
+
+  for (i = 0, cells = 0, size = 1; i < num_segs; i++)
+  {
+    cells += segs[2 * i + 1];
+    if (!simple)
+      size += varint_size(segs[2 * i]) + varint_size(segs[2 * i + 1]);
+  }
+
+  if (simple)
+    size += varint_size(cells);
+  else
+    size += varint_size(num_segs) + varint_size(len - end);
+
+  size += (6 * cells + 7) / 8;
+
+  if (size >= 1 + varint_size(len) + len)
+  {
+    pack_literal(p, eol, len);
+    return;
+  }
+
+  if (simple)
+  {
+    pack_byte(p, BRF_REC_PACKED | (eol << 2) | (upper ? 0 : BRF_REC_LOWER) | BRF_REC_SIMPLE);
+    pack_varint(p, cells);
+  }
+  else
+  {
+    pack_byte(p, BRF_REC_PACKED | (eol << 2) | (upper ? 0 : BRF_REC_LOWER));
+    pack_varint(p, num_segs);
+    for (i = 0; i < num_segs; i++)
+    {
+      pack_varint(p, segs[2 * i]);
+      pack_varint(p, segs[2 * i + 1]);
+    }
+    pack_varint(p, len - end);
+  }
+
+  // Then the cells, 6 bits each...
+  {
+    uint32_t bits = 0; // Bit accumulator
+    int nbits = 0;     // Bits in accumulator
+
+    for (i = 0, j = 0; i < num_segs; i++)
+    {
+      size_t count;    // Cells in segment
+
+      j += segs[2 * i];
+      for (count = segs[2 * i + 1]; count > 0; count--, j++)
+      {
+        unsigned char c = line[j]; // Character
+
+        if (c >= 0x60)
+          c -= 0x20;
+
+        bits |= (uint32_t)brf_ascii_dots[c] << nbits;
+        nbits += 6;
+
+        if (nbits >= 8)
+        {
+          pack_byte(p, (unsigned char)bits);
+          bits >>= 8;
+          nbits -= 8;
+        }
+      }
+    }
+
+    if (nbits > 0)
+      pack_byte(p, (unsigned char)bits);
+  }
+}
+
+// 'pack_literal()' - Encode the current line as raw bytes.
+
+static void
+pack_literal(brf_packer_t *p, // I - Encoder state
+             int eol,         // I - End of line
+             size_t len)      // I - Length of line
+{
+  pack_byte(p, BRF_REC_LITERAL | (eol << 2));
+  pack_varint(p, len);
+  pack_bytes(p, p->line, len);
+}
+
+// 'pack_varint()' - Add a variable-length integer to the output.
+
+static void
+pack_varint(brf_packer_t *p, // I - Encoder state
+            uint64_t value)  // I - Value
+{
+  while (value >= 0x80)
+  {
+    pack_byte(p, (unsigned char)(value | 0x80));
+    value >>= 7;
+  }
+
+  pack_byte(p, (unsigned char)value);
+}
+
+// 'get_le64()' - Get a little-endian 64-bit integer.
+
+static uint64_t                      // O - Value
+get_le64(const unsigned char *buffer) // I - Buffer
+{
+  uint64_t value = 0; // Value
+  int i;              // Looping var
+
+  for (i = 7; i >= 0; i--)
+    value = (value << 8) | buffer[i];
+
+  return (value);
+}
+
+// 'put_le32()' - Store a little-endian 32-bit integer.
+
+static void
+put_le32(unsigned char *buffer, // I - Buffer
+         uint32_t value)        // I - Value
+{
+  int i; // Looping var
+
+  for (i = 0; i < 4; i++, value >>= 8)
+    buffer[i] = (unsigned char)value;
+}
+
+// 'put_le64()' - Store a little-endian 64-bit integer.
+
+static void
+put_le64(unsigned char *buffer, // I - Buffer
+         uint64_t value)        // I - Value
+{
+  int i; // Looping var
+
+  for (i = 0; i < 8; i++, value >>= 8)
+    buffer[i] = (unsigned char)value;
+}
+
+// 'unpack_byte()' - Get the next input byte.
+
+static int                    // O - Byte or -1 at end of input
+unpack_byte(brf_unpacker_t *u) // I - Decoder state
+{
+  ssize_t bytes; // Bytes read
+
+  if (u->inptr >= u->inend)
+  {
+    if (u->eof)
+      return (-1);
+
+    while ((bytes = read(u->infd, u->in, sizeof(u->in))) < 0 && (errno == EINTR || errno == EAGAIN));
+
+    if (bytes <= 0)
+    {
+      u->eof = true;
+      u->error = bytes < 0;
+      return (-1);
+    }
+
+    u->inptr = u->in;
+    u->inend = u->in + bytes;
+  }
+
+  return (*(u->inptr)++);
+}
+
+// 'unpack_footer()' - Check the footer and page index of a spooled stream.
+
+static bool                        // O - `true` if valid, `false` otherwise
+unpack_footer(int fd,              // I - Input file
+              uint32_t *num_pages) // O - Number of pages
+{
+  struct stat st;                  // File information
+  unsigned char footer[BRF_PACK_FOOTER],
+                                   // Stream footer
+      magic[4];                    // Page index magic
+  uint64_t index;                  // Offset of page index
+
+  if (fstat(fd, &st) || st.st_size < (BRF_PACK_HEADER + BRF_PACK_FOOTER) ||
+      pread(fd, footer, sizeof(footer), st.st_size - BRF_PACK_FOOTER) != sizeof(footer) ||
+      memcmp(footer + 12, "BRF6", 4))
+    return (false);
+
+  index = get_le64(footer);
+  *num_pages = footer[8] | (footer[9] << 8) | (footer[10] << 16) | ((uint32_t)footer[11] << 24);
+
+  if (*num_pages < 1 || index < BRF_PACK_HEADER || index + 8 + 8 * (uint64_t)*num_pages > (uint64_t)st.st_size - BRF_PACK_FOOTER ||
+      pread(fd, magic, sizeof(magic), (off_t)index) != sizeof(magic) || memcmp(magic, "BRFI", 4))
+    return (false);
+
+  return (true);
+}
+
+// 'unpack_flush()' - Write the output buffer.
+
+static void
+unpack_flush(brf_unpacker_t *u) // I - Decoder state
+{
+  unsigned char *ptr = u->out; // Pointer into buffer
+  ssize_t bytes;               // Bytes written
+
+  while (!u->error && ptr < (u->out + u->outlen))
+  {
+    if ((bytes = write(u->outfd, ptr, (size_t)(u->out + u->outlen - ptr))) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      u->error = true;
+      break;
+    }
+
+    ptr += bytes;
+  }
+
+  u->outlen = 0;
+}
+
+// 'unpack_put()' - Add bytes to the output.
+
+static void
+unpack_put(brf_unpacker_t *u,  // I - Decoder state
+           const void *buffer, // I - Bytes
+           size_t bytes)       // I - Number of bytes
+{
+  const unsigned char *ptr = (const unsigned char *)buffer;
+
+  while (bytes > 0)
+  {
+    size_t count = sizeof(u->out) - u->outlen;
+
+    if (count == 0)
+    {
+      unpack_flush(u);
+      if (u->error)
+        return;
+      continue;
+    }
+
+    if (count > bytes)
+      count = bytes;
+
+    memcpy(u->out + u->outlen, ptr, count);
+    u->outlen += count;
+    ptr += count;
+    bytes -= count;
+  }
+}
+
+// 'unpack_varint()' - Get a variable-length integer.
+
+static bool                      // O - `true` on success, `false` on error
+unpack_varint(brf_unpacker_t *u, // I - Decoder state
+              uint64_t *value)   // O - Value
+{
+  int c,        // Current byte
+      shift;    // Bit position
+
+  for (*value = 0, shift = 0; shift < 64; shift += 7)
+  {
+    if ((c = unpack_byte(u)) < 0)
+      return (false);
+
+    *value |= (uint64_t)(c & 0x7f) << shift;
+
+    if (!(c & 0x80))
+      return (true);
+  }
+
+  return (false);
+}
+
+// 'varint_size()' - Return the encoded size of a variable-length integer.
+
+static size_t            // O - Number of bytes
+varint_size(uint64_t value) // I - Value
+{
+  size_t bytes = 1; // Number of bytes
+
+  while (value >= 0x80)
+  {
+    value >>= 7;
+    bytes++;
+  }
+
+  return (bytes);
+}
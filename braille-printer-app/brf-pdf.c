@@ -0,0 +1,221 @@
+//
+// PDF text extraction for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Replaces "pdftotext -raw - - | file2brl -p" of texttobrf for PDF jobs.
+// Text is extracted with poppler one page at a time, translated paragraph
+// by paragraph and formatted into braille pages which are written as soon
+// as they are full, so the embosser does not wait for the whole document.
+//
+
+#include <pappl/pappl.h>
+#include <poppler.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local functions...
+
+static bool pdf_page(brf_text_t *t, const char *text);
+
+// 'brf_pdftobrf_filter_function()' - Convert the text of a PDF file to BRF.
+
+int // O - Exit status
+brf_pdftobrf_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable?
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_text_t t;             // Translation and formatting
+  struct stat st;           // Input file information
+  void *map = NULL;         // Mapped input file
+  GBytes *bytes;            // PDF data
+  PopplerDocument *doc;     // PDF document
+  GError *error = NULL;     // Poppler error
+  int i,                    // Looping var
+      num_pages;            // Number of PDF pages
+  bool complete = false;    // Was the whole document converted?
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)parameters;
+
+  if (!brf_TextInit(&t, outputfd, data->num_options, data->options, log, ld))
+    return (1);
+
+  // PDF needs random access, so map the spool file or read a pipe into
+  // memory...
+  if (inputseekable && !fstat(inputfd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, inputfd, 0)) != MAP_FAILED)
+  {
+    bytes = g_bytes_new_static(map, (gsize)st.st_size);
+  }
+  else
+  {
+    char *buffer = NULL;   // Input data
+    size_t bufsize = 0,    // Size of buffer
+        buflen = 0;        // Bytes in buffer
+    ssize_t rbytes;        // Bytes read
+
+    map = NULL;
+
+    do
+    {
+      if (buflen == bufsize)
+      {
+        char *temp; // New buffer
+
+        bufsize = bufsize ? 2 * bufsize : 1048576;
+        if ((temp = (char *)g_try_realloc(buffer, bufsize)) == NULL)
+        {
+          if (log)
+            log(ld, CF_LOGLEVEL_ERROR, "brf_pdftobrf_filter_function: Unable to allocate memory.");
+          g_free(buffer);
+          brf_TextFinish(&t, false);
+          return (1);
+        }
+
+        buffer = temp;
+      }
+
+      if ((rbytes = read(inputfd, buffer + buflen, bufsize - buflen)) > 0)
+        buflen += (size_t)rbytes;
+    }
+    while (rbytes > 0 || (rbytes < 0 && (errno == EINTR || errno == EAGAIN)));
+
+    bytes = g_bytes_new_take(buffer, buflen);
+  }
+
+  if ((doc = poppler_document_new_from_bytes(bytes, NULL, &error)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_pdftobrf_filter_function: Unable to open PDF: %s", error ? error->message : "unknown error");
+    if (error)
+      g_error_free(error);
+    goto done;
+  }
+
+  num_pages = poppler_document_get_n_pages(doc);
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_pdftobrf_filter_function: %d pages, tables '%s'.", num_pages, t.tables);
+
+  for (i = 0; i < num_pages; i++)
+  {
+    PopplerPage *page;  // Current page
+    char *text;         // Text of page
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "brf_pdftobrf_filter_function: Job canceled.");
+      break;
+    }
+
+    if ((page = poppler_document_get_page(doc, i)) == NULL)
+      continue;
+
+    text = poppler_page_get_text(page);
+
+    if (text && !pdf_page(&t, text))
+    {
+      g_free(text);
+      g_object_unref(page);
+      break;
+    }
+
+    g_free(text);
+    g_object_unref(page);
+
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG, "brf_pdftobrf_filter_function: PDF page %d done, braille page %d.", i + 1, t.fmt.page);
+  }
+
+  complete = i >= num_pages;
+
+  g_object_unref(doc);
+
+  done:
+
+  if (brf_TextFinish(&t, complete) && complete)
+    ret = 0;
+
+  g_bytes_unref(bytes);
+
+  if (map)
+    munmap(map, (size_t)st.st_size);
+
+  return (ret);
+}
+
+// 'pdf_page()' - Split the text of a PDF page into paragraphs.
+//
+// A paragraph ends at an empty line or after a line that is clearly shorter
+// than the longest line of the page.  The last paragraph is kept open as it
+// may continue on the next page.
+
+static bool                // O - `true` on success, `false` on error
+pdf_page(brf_text_t *t,    // I - Translation and formatting
+         const char *text) // I - Text of page
+{
+  const char *line,        // Start of line
+      *next;               // Start of next line
+  size_t len,              // Length of line
+      maxlen = 0;          // Length of longest line
+
+  for (line = text; *line; line = next)
+  {
+    if ((next = strchr(line, '\n')) == NULL)
+      next = line + strlen(line);
+
+    if ((size_t)(next - line) > maxlen)
+      maxlen = (size_t)(next - line);
+
+    if (*next)
+      next++;
+  }
+
+  for (line = text; *line; line = next)
+  {
+    if ((next = strchr(line, '\n')) == NULL)
+      next = line + strlen(line);
+
+    for (len = (size_t)(next - line); len > 0 && isspace(line[len - 1] & 255); len--);
+
+    if (*next)
+      next++;
+
+    while (len > 0 && isspace(*line & 255))
+    {
+      line++;
+      len--;
+    }
+
+    if (len == 0)
+    {
+      if (!brf_TextEndParagraph(t, 2))
+        return (false);
+      continue;
+    }
+
+    // Join with the previous line, removing hyphenation...
+    if (t->paralen > 1 && t->para[t->paralen - 1] == '-' && isalpha(t->para[t->paralen - 2] & 255) && islower(*line & 255))
+      t->paralen--;
+    else if (t->paralen > 0 && !brf_TextAdd(t, " ", 1))
+      return (false);
+
+    if (!brf_TextAdd(t, line, len))
+      return (false);
+
+    if (len < maxlen * 2 / 3 && !brf_TextEndParagraph(t, 2))
+      return (false);
+  }
+
+  return (true);
+}
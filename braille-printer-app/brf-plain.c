@@ -0,0 +1,249 @@
+//
+// Plain text reflow for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Replaces "fmt -$TEXTWIDTH" of texttobrf and the pagination the embosser
+// used to do.  Lines are joined into paragraphs the way fmt does it: blank
+// lines and changes of indentation start a new paragraph, and blank lines
+// and the indentation of the first line are kept.  Each paragraph is
+// translated or reduced to ASCII, wrapped at the text width and paginated
+// at the text height in the same pass, so the page count is exact.  Form
+// feeds are print page breaks and get the PageSeparator mark.
+//
+// Translated text still goes through the texttobrf filter given as
+// parameter, as file2brl hyphenates words at the end of lines and liblouis
+// alone does not.  Only without file2brl is it translated here.
+//
+
+#include <pappl/pappl.h>
+
+#include "brf-printer.h"
+
+// Local types...
+
+typedef struct brf_plain_s            // Reflow state
+{
+  brf_text_t t;                       // Translation and formatting
+  bool bol,                           // At the beginning of a line?
+      new_page;                       // Print page break pending?
+  int indent,                         // Indent of current line
+      prev_indent,                    // Indent of previous line
+      para_indent,                    // Indent of paragraph's first line
+      para_lines,                     // Lines in current paragraph
+      print_page;                     // Current print page
+} brf_plain_t;
+
+// Local functions...
+
+static bool plain_end_paragraph(brf_plain_t *p);
+static int plain_external(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, cf_filter_external_t *ext);
+static bool plain_parse(brf_plain_t *p, const char *buffer, size_t bytes);
+
+// 'brf_texttobrf_filter_function()' - Reflow and paginate plain text.
+
+int // O - Exit status
+brf_texttobrf_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - External filter for translated text
+{
+  brf_plain_t p;            // Reflow state
+  brf_geometry_t geom;      // Page geometry
+  char tables[1024];        // Liblouis table list
+  char buffer[65536];       // Read buffer
+  ssize_t bytes;            // Bytes read
+  bool complete = false;    // Was the whole document converted?
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  // Translated text goes through file2brl for hyphenation, bad options are
+  // reported below...
+  if (parameters && brf_CapsHasTool("file2brl") &&
+      brf_GeometryInit(&geom, data->num_options, data->options, NULL, NULL) &&
+      brf_LouisGetTables(data->num_options, data->options, geom.text_dots, tables, sizeof(tables), NULL, NULL) && tables[0])
+    return (plain_external(inputfd, outputfd, inputseekable, data, (cf_filter_external_t *)parameters));
+
+  memset(&p, 0, sizeof(p));
+
+  if (!brf_TextInit(&p.t, outputfd, data->num_options, data->options, log, ld))
+    return (1);
+
+  p.bol = true;
+  p.print_page = 1;
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_texttobrf_filter_function: %dx%d cells, tables '%s'.", p.t.fmt.width, p.t.fmt.height, p.t.tables);
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_texttobrf_filter_function: Unable to read: %s", strerror(errno));
+      break;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "brf_texttobrf_filter_function: Job canceled.");
+      break;
+    }
+
+    if (!plain_parse(&p, buffer, (size_t)bytes))
+      break;
+  }
+
+  if (bytes == 0 && plain_end_paragraph(&p))
+    complete = true;
+
+  if (brf_TextFinish(&p.t, complete) && complete)
+    ret = 0;
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_texttobrf_filter_function: %d print pages, %d braille pages.", p.print_page - (p.new_page ? 1 : 0), p.t.fmt.page - 1);
+
+  return (ret);
+}
+
+// 'plain_end_paragraph()' - Translate and format the current paragraph.
+
+static bool                         // O - `true` on success, `false` on error
+plain_end_paragraph(brf_plain_t *p) // I - Reflow state
+{
+  p->para_lines = 0;
+
+  return (brf_TextEndParagraph(&p->t, p->para_indent));
+}
+
+// 'plain_external()' - Translate text with the external texttobrf filter.
+
+static int                          // O - Exit status
+plain_external(
+    int inputfd,                    // I - File descriptor input stream
+    int outputfd,                   // I - File descriptor output stream
+    int inputseekable,              // I - Is input stream seekable?
+    cf_filter_data_t *data,         // I - Job and printer data
+    cf_filter_external_t *ext)      // I - External filter
+{
+  cf_filter_filter_in_chain_t filter, // External filter in chain
+      *copy;                        // Copy with the tools
+  int ret;                          // Exit status
+
+  filter.function = cfFilterExternal;
+  filter.parameters = ext;
+  filter.name = "texttobrf";
+
+  if ((copy = brf_CapsCopyFilter(&filter)) == NULL)
+    return (1);
+
+  if (data->logfunc)
+    (data->logfunc)(data->logdata, CF_LOGLEVEL_DEBUG, "brf_texttobrf_filter_function: Translating with '%s'.", ext->filter);
+
+  ret = (copy->function)(inputfd, outputfd, inputseekable, data, copy->parameters);
+
+  brf_CapsFreeFilter(copy);
+
+  return (ret);
+}
+
+// 'plain_parse()' - Join the lines of a piece of text into paragraphs.
+
+static bool                         // O - `true` on success, `false` on error
+plain_parse(brf_plain_t *p,         // I - Reflow state
+            const char *buffer,     // I - Text
+            size_t bytes)           // I - Length of text
+{
+  const char *ptr,                  // Pointer into text
+      *start,                       // Start of run of characters
+      *end = buffer + bytes;        // End of text
+
+  for (ptr = buffer; ptr < end;)
+  {
+    if (*ptr == '\f')
+    {
+      // Print page break, marked when the next page has text...
+      if (!plain_end_paragraph(p))
+        return (false);
+
+      p->print_page++;
+      p->new_page = true;
+      p->bol = true;
+      p->indent = p->prev_indent = 0;
+      ptr++;
+    }
+    else if (*ptr == '\r')
+    {
+      ptr++;
+    }
+    else if (p->bol)
+    {
+      // Measure the indentation, then decide whether the line continues the
+      // paragraph...
+      if (*ptr == ' ')
+        p->indent++;
+      else if (*ptr == '\t')
+        p->indent = (p->indent / 8 + 1) * 8;
+      else if (*ptr == '\n')
+      {
+        // Blank lines are kept, except at the top of a print page...
+        if (!plain_end_paragraph(p) || (!p->new_page && !brf_FormatterSkipLines(&p->t.fmt, 1)))
+          return (false);
+
+        p->indent = p->prev_indent = 0;
+      }
+      else
+      {
+        if (p->para_lines > 0 && p->indent != p->prev_indent && (p->para_lines > 1 || p->indent > p->prev_indent))
+        {
+          // Indentation changed, except the usual indented first line...
+          if (!plain_end_paragraph(p))
+            return (false);
+        }
+
+        if (p->new_page)
+        {
+          if (!brf_FormatterPrintPage(&p->t.fmt, p->print_page))
+            return (false);
+
+          p->new_page = false;
+        }
+
+        if (p->para_lines == 0)
+          p->para_indent = p->indent;
+        else if (!brf_TextAdd(&p->t, " ", 1))
+          return (false);
+
+        p->bol = false;
+        continue;
+      }
+
+      ptr++;
+    }
+    else if (*ptr == '\n')
+    {
+      p->bol = true;
+      p->prev_indent = p->indent;
+      p->indent = 0;
+      p->para_lines++;
+      ptr++;
+    }
+    else
+    {
+      for (start = ptr; ptr < end && *ptr != '\n' && *ptr != '\r' && *ptr != '\f'; ptr++);
+
+      if (!brf_TextAdd(&p->t, start, (size_t)(ptr - start)))
+        return (false);
+    }
+  }
+
+  return (true);
+}
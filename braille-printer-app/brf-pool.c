@@ -0,0 +1,539 @@
+//
+// Printer pools for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Embossers on USB or network connections with the same driver and loaded
+// media form a pool.  The pool is a printer of its own with a
+// "pool://DRIVER/MEDIA" device URI, so clients send jobs to one IPP
+// endpoint.  A pool job does not print itself, it hands its document to a
+// member without active jobs as a new job.
+//
+// Pool jobs are not queued on the members, where a job behind a long job
+// would have to be moved to another member later.  The scheduler holds them
+// on the pool and releases the next one whenever a member is idle (see
+// brf-schedule.c), so every member takes new work as soon as it has none.
+// Should the member get busy before the released job is dispatched, the job
+// waits for the next idle member.  A job sent to a member directly stays on
+// that member.  Large BRF jobs can be split into parts of "pool-split"
+// pages that print on several members at once.
+//
+
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_POOL_MAX_GROUPS 64      // Maximum pools
+#define BRF_POOL_MAX_MEMBERS 64     // Maximum members per pool
+
+// Local types...
+
+typedef struct brf_pool_find_s      // Pool member search
+{
+  const char *pool_uri;             // Pool device URI
+  char driver[256],                 // Driver name
+      media[256];                   // Media size name
+  int num_members;                  // Number of members
+  pappl_printer_t *members[BRF_POOL_MAX_MEMBERS];
+                                    // Members
+} brf_pool_find_t;
+
+typedef struct brf_pool_group_s     // Group of printers without a pool
+{
+  char uri[1024];                   // Pool device URI
+  int count;                        // Number of printers
+  bool exists;                      // Pool printer exists?
+} brf_pool_group_t;
+
+// Local functions...
+
+static bool pool_create_job(pappl_job_t *job, pappl_printer_t *member, const char *filename, const char *job_name);
+static void pool_find_members(pappl_system_t *system, brf_pool_find_t *find);
+static void pool_group_cb(pappl_printer_t *printer, void *data);
+static pappl_printer_t *pool_idle_member(brf_pool_find_t *find);
+static bool pool_is_pool(pappl_printer_t *printer);
+static void pool_members_cb(pappl_printer_t *printer, void *data);
+static bool pool_open_cb(pappl_device_t *device, const char *device_uri, const char *name);
+static void pool_close_cb(pappl_device_t *device);
+static ssize_t pool_read_cb(pappl_device_t *device, void *buffer, size_t bytes);
+static ssize_t pool_write_cb(pappl_device_t *device, const void *buffer, size_t bytes);
+static pappl_preason_t pool_status_cb(pappl_device_t *device);
+static bool pool_uri(pappl_printer_t *printer, char *uri, size_t urisize);
+
+// Local globals...
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for dispatching jobs
+static pthread_mutex_t pool_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for pool_cond
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+                                    // Signaled when a member may be idle
+static brf_printer_app_global_data_t *pool_global_data = NULL;
+                                    // Global data
+static int pool_split = 0;          // Pages per part or 0 to not split
+static const char * const pool_schemes[] =
+{                                   // Device schemes of embossers to pool
+  "dnssd:", "snmp:", "socket:", "usb:"
+};
+
+// 'brf_PoolDispatch()' - Hand a pool job to idle pool members.
+//
+// Called from the print callbacks of pool printers, waits until the job is
+// handed off or canceled.
+
+bool // O - `true` on success, `false` on error
+brf_PoolDispatch(pappl_job_t *job) // I - Pool job
+{
+  brf_printer_app_global_data_t *global_data = pool_global_data;
+                                // Global data
+  brf_pool_find_t find;         // Pool members
+  pappl_printer_t *member;      // Member to print on
+  const char *filename = papplJobGetFilename(job);
+                                // Document file
+  const char *map = NULL;       // Mapped BRF document
+  struct stat st;               // Document information
+  int fd,                       // Document file descriptor
+      pages = 0,                // Number of pages
+      part,                     // Current part
+      num_parts = 1;            // Number of parts
+  const char *start,            // Start of part
+      *end;                     // End of part
+  bool ret = true;              // Return value
+
+  memset(&find, 0, sizeof(find));
+  find.pool_uri = papplPrinterGetDeviceURI(papplJobGetPrinter(job));
+
+  // Split large BRF jobs at page boundaries...
+  if (pool_split > 0 && !strcmp(papplJobGetFormat(job), "application/vnd.cups-brf") &&
+      (pages = brf_ProgressCountFile(filename)) > pool_split && !stat(filename, &st) &&
+      (fd = open(filename, O_RDONLY)) >= 0)
+  {
+    if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      map = NULL;
+    else
+      num_parts = (pages + pool_split - 1) / pool_split;
+
+    close(fd);
+  }
+
+  for (part = 1, start = map, end = map; part <= num_parts && ret; part ++, start = end)
+  {
+    char part_name[1024],       // Name of part
+        part_file[1024];        // File for part
+    int page;                   // Page in part
+
+    // Wait for a member with nothing to do...
+    for (;;)
+    {
+      struct timespec timeout;  // Time to check the members again
+
+      pthread_mutex_lock(&pool_lock);
+
+      pool_find_members(global_data->system, &find);
+
+      if ((member = pool_idle_member(&find)) != NULL || papplJobIsCanceled(job))
+        break;
+
+      pthread_mutex_unlock(&pool_lock);
+
+      papplJobSetMessage(job, "Waiting for an idle printer.");
+
+      pthread_mutex_lock(&pool_wait_lock);
+      clock_gettime(CLOCK_REALTIME, &timeout);
+      timeout.tv_sec += 5;
+      pthread_cond_timedwait(&pool_cond, &pool_wait_lock, &timeout);
+      pthread_mutex_unlock(&pool_wait_lock);
+    }
+
+    if (!member)
+    {
+      pthread_mutex_unlock(&pool_lock);
+      ret = false;
+      break;
+    }
+
+    if (num_parts == 1)
+    {
+      ret = pool_create_job(job, member, filename, papplJobGetName(job));
+    }
+    else
+    {
+      // Copy the pages of this part...
+      for (page = 0; page < pool_split && end < (map + st.st_size); page ++)
+      {
+        if ((end = memchr(end, '\f', (size_t)(map + st.st_size - end))) == NULL)
+          end = map + st.st_size;
+        else
+          end ++;
+      }
+
+      snprintf(part_name, sizeof(part_name), "%s (%d/%d)", papplJobGetName(job), part, num_parts);
+      snprintf(part_file, sizeof(part_file), "%s/pool-%d-%d.brf", global_data->spool_dir, papplJobGetID(job), part);
+
+      if ((fd = open(part_file, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL, 0600)) < 0 || write(fd, start, (size_t)(end - start)) != (ssize_t)(end - start))
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to write part %d to '%s': %s", part, part_file, strerror(errno));
+        ret = false;
+      }
+      else
+        ret = pool_create_job(job, member, part_file, part_name);
+
+      if (fd >= 0)
+        close(fd);
+
+      unlink(part_file);
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+  }
+
+  if (map)
+    munmap((void *)map, (size_t)st.st_size);
+
+  if (ret && num_parts > 1)
+    papplJobSetMessage(job, "Printed in %d parts on the pool members.", num_parts);
+
+  return (ret);
+}
+
+// 'brf_PoolEvent()' - Wake up waiting pool jobs for job and printer events.
+//
+// Creating member jobs causes events, so this must not take pool_lock.
+
+void
+brf_PoolEvent(pappl_event_t event) // I - Event
+{
+  if (!(event & (PAPPL_EVENT_JOB_COMPLETED | PAPPL_EVENT_JOB_STATE_CHANGED | PAPPL_EVENT_PRINTER_STATE_CHANGED)))
+    return;
+
+  pthread_mutex_lock(&pool_wait_lock);
+  pthread_cond_broadcast(&pool_cond);
+  pthread_mutex_unlock(&pool_wait_lock);
+}
+
+// 'brf_PoolHasIdleMember()' - Check whether a pool has a member without work.
+//
+// Called from the scheduler thread, outside of printer iterations.
+
+bool                                // O - `true` if a member is idle
+brf_PoolHasIdleMember(
+    pappl_printer_t *printer)       // I - Pool printer
+{
+  brf_pool_find_t find;             // Pool members
+
+  memset(&find, 0, sizeof(find));
+  find.pool_uri = papplPrinterGetDeviceURI(printer);
+
+  pool_find_members(papplPrinterGetSystem(printer), &find);
+
+  return (pool_idle_member(&find) != NULL);
+}
+
+// 'brf_PoolInit()' - Register the pool device scheme.
+
+void
+brf_PoolInit(
+    brf_printer_app_global_data_t *global_data) // I - Global data
+{
+  pool_global_data = global_data;
+  pool_split = global_data->pool_split;
+
+  papplDeviceAddScheme("pool", PAPPL_DEVTYPE_CUSTOM_LOCAL, NULL, pool_open_cb, pool_close_cb, pool_read_cb, pool_write_cb, pool_status_cb, NULL);
+}
+
+// 'brf_PoolUpdate()' - Create the pool printers for new groups of printers.
+//
+// Called from the scheduler thread.
+
+void
+brf_PoolUpdate(pappl_system_t *system) // I - System
+{
+  brf_pool_group_t groups[BRF_POOL_MAX_GROUPS];
+                                      // Printer groups
+  brf_pool_find_t find;               // Pool members
+  int num_groups = 0,                 // Number of groups
+      i;                              // Looping var
+  void *gdata[2];                     // Group callback data
+
+  // Group the printers by driver and media...
+  memset(groups, 0, sizeof(groups));
+  gdata[0] = groups;
+  gdata[1] = &num_groups;
+
+  papplSystemIteratePrinters(system, pool_group_cb, gdata);
+
+  for (i = 0; i < num_groups; i ++)
+  {
+    char name[256],                   // Pool printer name
+        *ptr;                         // Pointer into name
+
+    if (groups[i].exists || groups[i].count < 2)
+      continue;
+
+    snprintf(name, sizeof(name), "Pool %s", groups[i].uri + 7);
+    if ((ptr = strchr(name, '/')) != NULL)
+      *ptr = ' ';
+
+    memset(&find, 0, sizeof(find));
+    find.pool_uri = groups[i].uri;
+    pool_find_members(system, &find);
+
+    if (find.num_members > 0 && papplPrinterCreate(system, 0, name, find.driver, "MFG:Generic;MDL:Braille Pool;CMD:BRF;", groups[i].uri))
+      papplLog(system, PAPPL_LOGLEVEL_INFO, "Created printer pool '%s' with %d members.", name, find.num_members);
+  }
+}
+
+// 'pool_close_cb()' - Close a pool device.
+
+static void
+pool_close_cb(pappl_device_t *device) // I - Device
+{
+  (void)device;
+}
+
+// 'pool_create_job()' - Copy a job to a pool member.
+
+static bool                         // O - `true` on success, `false` on error
+pool_create_job(pappl_job_t *job,   // I - Original job
+                pappl_printer_t *member, // I - Pool member
+                const char *filename,    // I - Document file
+                const char *job_name)    // I - Job name
+{
+  pappl_job_t *newjob;              // New job
+  int i,                            // Looping var
+      num_options = 0;              // Number of job options
+  cups_option_t *options = NULL;    // Job options
+  ipp_attribute_t *attr;            // Job attribute
+  char value[1024];                 // Attribute value
+
+  for (i = 0; brf_job_options[i]; i ++)
+  {
+    if ((attr = papplJobGetAttribute(job, brf_job_options[i])) != NULL)
+    {
+      ippAttributeString(attr, value, sizeof(value));
+      num_options = cupsAddOption(brf_job_options[i], value, num_options, &options);
+    }
+  }
+
+  if ((attr = papplJobGetAttribute(job, "copies")) != NULL)
+  {
+    snprintf(value, sizeof(value), "%d", ippGetInteger(attr, 0));
+    num_options = cupsAddOption("copies", value, num_options, &options);
+  }
+
+  newjob = papplJobCreateWithFile(member, papplJobGetUsername(job), papplJobGetFormat(job), job_name, num_options, options, filename);
+
+  cupsFreeOptions(num_options, options);
+
+  if (!newjob)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send job to printer '%s'.", papplPrinterGetName(member));
+    return (false);
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Sent to printer '%s' as job %d.", papplPrinterGetName(member), papplJobGetID(newjob));
+  papplJobSetMessage(job, "Sent to printer '%s' as job %d.", papplPrinterGetName(member), papplJobGetID(newjob));
+
+  return (true);
+}
+
+// 'pool_find_members()' - Find the members of a pool.
+
+static void
+pool_find_members(
+    pappl_system_t *system, // I - System
+    brf_pool_find_t *find)  // I - Pool search
+{
+  char *ptr;                // Pointer into URI
+
+  // "pool://DRIVER/MEDIA"
+  if (strncmp(find->pool_uri, "pool://", 7))
+    return;
+
+  papplCopyString(find->driver, find->pool_uri + 7, sizeof(find->driver));
+  if ((ptr = strchr(find->driver, '/')) != NULL)
+  {
+    *ptr++ = '\0';
+    papplCopyString(find->media, ptr, sizeof(find->media));
+  }
+
+  find->num_members = 0;
+
+  papplSystemIteratePrinters(system, pool_members_cb, find);
+}
+
+// 'pool_group_cb()' - Group printers by pool device URI.
+
+static void
+pool_group_cb(pappl_printer_t *printer, // I - Printer
+              void *data)               // I - Groups
+{
+  brf_pool_group_t *groups = (brf_pool_group_t *)((void **)data)[0];
+                                        // Groups
+  int *num_groups = (int *)((void **)data)[1],
+                                        // Number of groups
+      i;                                // Looping var
+  char uri[1024];                       // Pool device URI
+  bool is_pool = pool_is_pool(printer); // Is this a pool printer?
+
+  if (is_pool)
+    papplCopyString(uri, papplPrinterGetDeviceURI(printer), sizeof(uri));
+  else if (!pool_uri(printer, uri, sizeof(uri)))
+    return;
+
+  for (i = 0; i < *num_groups; i ++)
+  {
+    if (!strcmp(groups[i].uri, uri))
+      break;
+  }
+
+  if (i >= *num_groups)
+  {
+    if (i >= BRF_POOL_MAX_GROUPS)
+      return;
+
+    papplCopyString(groups[i].uri, uri, sizeof(groups[i].uri));
+    (*num_groups) ++;
+  }
+
+  if (is_pool)
+    groups[i].exists = true;
+  else
+    groups[i].count ++;
+}
+
+// 'pool_idle_member()' - Find a member without active jobs.
+
+static pappl_printer_t *             // O - Idle member or `NULL`
+pool_idle_member(brf_pool_find_t *find) // I - Pool members
+{
+  int i;                             // Looping var
+
+  for (i = 0; i < find->num_members; i ++)
+  {
+    if (papplPrinterGetState(find->members[i]) != IPP_PSTATE_STOPPED && papplPrinterGetNumberOfActiveJobs(find->members[i]) == 0)
+      return (find->members[i]);
+  }
+
+  return (NULL);
+}
+
+// 'pool_is_pool()' - Is this a pool printer?
+
+static bool                      // O - `true` for pool printers
+pool_is_pool(pappl_printer_t *printer) // I - Printer
+{
+  return (!strncmp(papplPrinterGetDeviceURI(printer), "pool:", 5));
+}
+
+// 'pool_members_cb()' - Collect the members of a pool.
+
+static void
+pool_members_cb(pappl_printer_t *printer, // I - Printer
+                void *data)               // I - Pool search
+{
+  brf_pool_find_t *find = (brf_pool_find_t *)data;
+                                          // Pool search
+  char uri[1024];                         // Pool device URI
+
+  if (pool_is_pool(printer) || !pool_uri(printer, uri, sizeof(uri)) || strcmp(uri, find->pool_uri))
+    return;
+
+  if (find->num_members < BRF_POOL_MAX_MEMBERS)
+    find->members[find->num_members++] = printer;
+}
+
+// 'pool_open_cb()' - Open a pool device.
+//
+// Pool jobs never write to the device, the device only exists because
+// PAPPL opens one for every job.
+
+static bool                         // O - `true` on success
+pool_open_cb(pappl_device_t *device, // I - Device
+             const char *device_uri, // I - Device URI
+             const char *name)       // I - Job name
+{
+  (void)device;
+  (void)device_uri;
+  (void)name;
+
+  return (true);
+}
+
+// 'pool_read_cb()' - Read from a pool device.
+
+static ssize_t                      // O - Number of bytes read
+pool_read_cb(pappl_device_t *device, // I - Device
+             void *buffer,           // I - Read buffer
+             size_t bytes)           // I - Size of buffer
+{
+  (void)device;
+  (void)buffer;
+  (void)bytes;
+
+  return (0);
+}
+
+// 'pool_status_cb()' - Get the status of a pool device.
+
+static pappl_preason_t              // O - Printer state reasons
+pool_status_cb(pappl_device_t *device) // I - Device
+{
+  (void)device;
+
+  return (PAPPL_PREASON_NONE);
+}
+
+// 'pool_uri()' - Get the pool device URI for a printer.
+
+static bool                     // O - `true` if the printer can be pooled
+pool_uri(pappl_printer_t *printer, // I - Printer
+         char *uri,                // I - URI buffer
+         size_t urisize)           // I - Size of URI buffer
+{
+  pappl_pr_driver_data_t data;  // Driver data
+  const char *device_uri = papplPrinterGetDeviceURI(printer);
+                                // Device URI
+  size_t i;                     // Looping var
+
+  // Only pool embossers, not files, simulators or stress printers...
+  for (i = 0; i < (sizeof(pool_schemes) / sizeof(pool_schemes[0])); i ++)
+  {
+    if (!strncmp(device_uri, pool_schemes[i], strlen(pool_schemes[i])))
+      break;
+  }
+
+  if (i >= (sizeof(pool_schemes) / sizeof(pool_schemes[0])))
+    return (false);
+
+  if (!papplPrinterGetDriverData(printer, &data) || !data.media_ready[0].size_name[0])
+    return (false);
+
+  snprintf(uri, urisize, "pool://%s/%s", papplPrinterGetDriverName(printer), data.media_ready[0].size_name);
+
+  return (true);
+}
+
+// 'pool_write_cb()' - Write to a pool device.
+//
+// Pool jobs are handed to the members, so writing is an error.
+
+static ssize_t                       // O - Number of bytes written
+pool_write_cb(pappl_device_t *device, // I - Device
+              const void *buffer,     // I - Data
+              size_t bytes)           // I - Size of data
+{
+  (void)buffer;
+  (void)bytes;
+
+  papplDeviceError(device, "Pool printers only print through their members.");
+  errno = EIO;
+
+  return (-1);
+}
@@ -22,8 +22,10 @@
 // Include necessary headers...
 
 #define brf_TESTPAGE_MIMETYPE "application/vnd.cups-brf"
+#define BRF_PRINT_CHUNK 1024 // Bytes written between looks for a cancel
 
 extern bool brf_gen(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+extern bool brf_index(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
 extern char *strdup(const char *);
 
 static bool BRFTestFilterCB(pappl_job_t *job, pappl_device_t *device, void *cbdata);
@@ -38,10 +40,15 @@ static int match_id(int num_did, cups_option_t *did, const char *match_id);
 
 static const char *mime_cb(const unsigned char *header, size_t headersize, void *data);
 
-static bool printer_cb(const char *device_info, const char *device_uri, const char *device_id, pappl_system_t *system);
-
 static pappl_system_t *system_cb(int num_options, cups_option_t *options, void *data);
-static int create_brf_printer(pappl_system_t *system);
+
+static bool number_option(const char *name, int num_options, cups_option_t *options, int *value);
+
+static void event_cb(pappl_system_t *system, pappl_printer_t *printer, pappl_job_t *job, pappl_event_t event, void *data);
+
+static bool metrics_cb(pappl_client_t *client, void *data);
+
+static int resume_cb(const char *base_name, int num_options, cups_option_t *options, int num_files, char **files, void *data);
 
 // Local globals...
 
@@ -50,12 +57,481 @@ static pappl_pr_driver_t brf_drivers[] =
         // Driver list
         {"gen_brf", "Generic Braille embosser",
          NULL, NULL},
+        {"index_basicd3", "Index Basic-D V3",
+         "MFG:Index Braille;MDL:Basic-D V3;", NULL},
+        {"index_basics3", "Index Basic-S V3",
+         "MFG:Index Braille;MDL:Basic-S V3;", NULL},
+        {"index_4waves3", "Index 4-Waves PRO V3",
+         "MFG:Index Braille;MDL:4-Waves PRO;", NULL},
+        {"index_everestd3", "Index Everest-D V3",
+         "MFG:Index Braille;MDL:Everest-D V3;", NULL},
+        {"index_4x4pro3", "Index 4x4 PRO V3",
+         "MFG:Index Braille;MDL:4x4 PRO V3;", NULL},
+        {"index_basicd4", "Index Basic-D V4/V5",
+         "MFG:Index Braille;MDL:Basic-D V4;", NULL},
+        {"index_basics4", "Index Basic-S V4/V5",
+         "MFG:Index Braille;MDL:Basic-S V4;", NULL},
+        {"index_everestd4", "Index Everest-D V4/V5",
+         "MFG:Index Braille;MDL:Everest-D V4;", NULL},
+        {"index_braillebox4", "Index Braille Box V4/V5",
+         "MFG:Index Braille;MDL:Braille Box V4;", NULL},
+
+};
+
+// Filters of the spooling conversions
+
+static cf_filter_external_t texttobrf_filter = {
+
+    .filter = "/usr/lib/cups/filter/texttobrf",
+    .envp =  (char *[]) {
+            "PPD=/dev/null",
+            "CONTENT_TYPE=text/plain",  
+            NULL
+        }
+};
+
+// pdf_to_brf comes in texttobrf_filter
+
+static cf_filter_external_t brftopagedbrf_filter = {
+
+    .filter = "/usr/lib/cups/filter/brftopagedbrf",
+    .envp =   (char *[]) {
+            "PPD=/dev/null", 
+            "CONTENT_TYPE=application/vnd.cups-brf",  
+            NULL
+        }
+};
+
+static cf_filter_external_t imagetobrf_filter = {
+
+    .filter = "/usr/lib/cups/filter/imagetobrf",
+    .envp =   (char *[]) {
+            "PPD=/dev/null",
+            "CONTENT_TYPE=image/jpeg",  
+            NULL
+        }
+};
+
+static cf_filter_external_t imagetoubrl_filter = {
+
+    .filter = "/usr/lib/cups/filter/imagetoubrl",
+    .envp = (char *[]) {
+            "PPD=/dev/null", 
+            "CONTENT_TYPE=image/jpeg",  
+            NULL
+        }
+};
+
+
+static cf_filter_external_t xfigtopdf_filter = {
+
+    .filter = "/usr/lib/cups/filter/xfigtopdf",
+    .envp = (char *[]) {
+            "PPD=/dev/null", 
+            "CONTENT_TYPE=application/x-xfig",  
+            NULL
+        }
+};
+
+static cf_filter_external_t wmftopdf_filter = {
+
+    .filter = "/usr/lib/cups/filter/wmftopdf",
+    .envp = (char *[]) {
+            "PPD=/dev/null",
+            "CONTENT_TYPE=image/x-wmf",  
+            NULL
+        }
+};
+
+static cf_filter_external_t emftopdf_filter = {
+
+    .filter = "/usr/lib/cups/filter/emftopdf",
+    .envp = (char *[]) {
+            "PPD=/dev/null",
+            "CONTENT_TYPE=image/emf",  
+            NULL
+        }
+};
+
+static cf_filter_external_t cgmtopdf_filter = {
+
+    .filter = "/usr/lib/cups/filter/cgmtopdf",
+    .envp = (char *[]) {
+            "PPD=/dev/null",
+            "CONTENT_TYPE=image/cgm",  
+            NULL
+        }
+};
+
+
+static cf_filter_external_t cmxtopdf_filter = {
+
+    .filter = "/usr/lib/cups/filter/cmxtopdf",
+    .envp = (char *[]) {
+            "PPD=/dev/null", 
+            "CONTENT_TYPE=image/x-cmx",  
+            NULL
+        }
+};
+
+
+static cf_filter_external_t vectortobrf_filter = {
+
+    .filter = "/usr/lib/cups/filter/vectortobrf",
+    .envp = (char *[]) {
+            "PPD=/dev/null", 
+            "CONTENT_TYPE=image/vnd.cups-pdf",  
+            NULL
+        }
+};
+
+
+static cf_filter_external_t vectortoubrl_filter = {
+
+    .filter = "/usr/lib/cups/filter/vectortoubrl",
+    .envp = (char *[]) {
+           "PPD=/dev/null", 
+            "CONTENT_TYPE=image/vnd.cups-pdf",  
+            NULL
+        }
+};
+
+
+static brf_spooling_conversion_t converts[] =
+{
+    {
+        "application/vnd.cups-brf-resume",
+        "application/vnd.cups-brf",
+            {brf_resume_filter_function, NULL, "brfresume"}
+    },
+    {
+        "application/vnd.cups-packed-brf",
+        "application/vnd.cups-brf",
+            {brf_unpack_filter_function, NULL, "brfunpack"}
+    },
+
+    {
+        "text/plain",
+        "application/vnd.cups-brf",
+            {brf_texttobrf_filter_function, &texttobrf_filter, "texttobrf"}
+    },
+
+    {
+        "text/html",
+        "application/vnd.cups-brf",
+            {brf_htmltobrf_filter_function, NULL, "htmltobrf"}
+    },
+    {
+        "application/xhtml",
+        "application/vnd.cups-brf",
+            {brf_htmltobrf_filter_function, NULL, "htmltobrf"}
+    },
+    {
+        "application/xhtml+xml",
+        "application/vnd.cups-brf",
+            {brf_htmltobrf_filter_function, NULL, "htmltobrf"}
+    },
+    {
+        "application/xml",
+        "application/vnd.cups-brf",
+            {brf_htmltobrf_filter_function, NULL, "htmltobrf"}
+    },
+    {
+        "text/xml",
+        "application/vnd.cups-brf",
+            {brf_htmltobrf_filter_function, NULL, "htmltobrf"}
+    },
+    {
+        "application/sgml",
+        "application/vnd.cups-brf",
+            {brf_htmltobrf_filter_function, NULL, "htmltobrf"}
+    },
+
+    {
+        "application/vnd.cups-brf",
+        "application/vnd.cups-paged-brf",
+            {cfFilterExternal, &brftopagedbrf_filter, "brftopagedbrf"}
+    },
+    {
+        "application/vnd.cups-ubrl",
+        "application/vnd.cups-paged-ubrl",
+            {cfFilterExternal, &brftopagedbrf_filter, "brftopagedbrf"}
+    },
+   
+    {
+        "application/msword",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+    },
+   {
+        "text/rtf",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+    },
+    {
+        "application/rtf",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+    },
+
+    {
+        "application/pdf",
+        "application/vnd.cups-brf",
+            {brf_pdftobrf_filter_function, NULL, "pdftobrf"}
+    },
+    {
+        "application/vnd.oasis.opendocument.text",
+        "application/vnd.cups-brf",
+            {brf_officetobrf_filter_function, NULL, "officetobrf"}
+    },
+    {
+        "application/vnd.openxmlformats-officedocument.wordprocessingml.document",
+        "application/vnd.cups-brf",
+            {brf_officetobrf_filter_function, NULL, "officetobrf"}
+    },
+
+
+    {
+        "image/gif",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+    {
+        "image/jpeg",
+        "application/vnd.cups-brf",
+            {brf_imagetobrf_filter_function, NULL, "imagetobrf"}
+    },
+    {
+        "image/pcx",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+    {
+        "image/png",
+        "application/vnd.cups-brf",
+            {brf_imagetobrf_filter_function, NULL, "imagetobrf"}
+    },
+    {
+        "image/tiff",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+    {
+        "image/vnd.microsoft.icon",
+        "application/vnd.cups-brff",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+    {
+        "image/x-ms-bmp",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+{
+        "image/x-portable-anymap",
+        "application/vnd.cups-brf",
+            {brf_imagetobrf_filter_function, NULL, "imagetobrf"}
+    },
+    {
+        "image/x-portable-bitmap",
+        "application/vnd.cups-brf",
+            {brf_imagetobrf_filter_function, NULL, "imagetobrf"}
+    },
+    {
+        "image/x-portable-graymap",
+        "application/vnd.cups-brf",
+            {brf_imagetobrf_filter_function, NULL, "imagetobrf"}
+    },
+    {
+        "image/x-portable-pixmap",
+        "application/vnd.cups-brf",
+            {brf_imagetobrf_filter_function, NULL, "imagetobrf"}
+    },
+    {
+        "image/x-xbitmap",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+    {
+        "image/x-xpixmap",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+    {
+        "image/x-xwindowdump",
+        "application/vnd.cups-brf",
+            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+    },
+
+    
+
+   {
+        "image/gif",
+        "application/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/pcx",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/png",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/tiff",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/jpeg",
+        "application/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/vnd.microsoft.icon",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-ms-bmp",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetobrf"}
+    },
+    {
+        "image/x-portable-anymap",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-portable-bitmap",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-portable-graymap",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-portable-pixmap",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-xbitmap",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-xpixmap",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+    {
+        "image/x-xwindowdump",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+    },
+
+
+    {
+        "image/svg",
+        "application/vnd.cups-brf",
+            {brf_svgtobrf_filter_function, NULL, "svgtobrf"}
+    },
 
+    {
+        "image/svg+xml",
+        "application/vnd.cups-brf",
+            {brf_svgtobrf_filter_function, NULL, "svgtobrf"}
+    },
+
+    {
+        "application/x-xfig",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &xfigtopdf_filter, "xfigtopdf"}
+    },
+
+    {
+        "image/wmf",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+    },
+
+    {
+        "image/x-wmf",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+    },
+
+    {
+        "windows/metafile",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+    },
+    {
+        "application/x-msmetafile",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+    },
+    {
+        "image/emf",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &emftopdf_filter, "emftopdf"}
+    },
+    {
+        "image/x-emf",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &emftopdf_filter, "emftopdf"}
+    },
+    {
+        "image/cgm",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &cgmtopdf_filter, "cgmtopdf"}
+    },
+
+    {
+        "image/x-cmx",
+        "image/vnd.cups-pdf",
+            {cfFilterExternal, &cmxtopdf_filter, "cmxtopdf"}
+    },
+
+    {
+        "image/vnd.cups-pdf",
+        "image/vnd.cups-brf",
+            {cfFilterExternal, &vectortobrf_filter, "vectortobrf"}
+    },
+    {
+        "image/vnd.cups-pdf",
+        "image/vnd.cups-ubrl",
+            {cfFilterExternal, &vectortoubrl_filter, "vectortoubrl"}
+    },
+    {
+    NULL
+    }
 };
 
-// State file
+// Makers of Braille embossers, for the generic driver
 
-static char brf_statefile[1024];
+static const char *const brf_embosser_makes[] =
+    {
+        "Braillo", "Enabling Technologies", "Harpo", "HumanWare",
+        "Index", "Irie", "Nippon Telesoft", "ViewPlus"};
+
+// Job options passed to the filters
+
+const char *const brf_job_options[] = {"PageSize","mirror","fitplot",
+                                  "SendFF", "SendSUB",
+                                 "LibLouis", "LibLouis2", "LibLouis3", "LibLouis4",
+                                "TextDotDistance", "TextDots", "LineSpacing", "TopMargin", "BottomMargin",
+                                "LeftMargin", "RightMargin", "BraillePageNumber", "PrintPageNumber",
+                                "PageSeparator", "PageSeparatorNumber", "ContinuePages", "GraphicDotDistance",
+                                "Rotate", "Edge", "Negate", "EdgeFactor", "CannyRadius", "CannySigma", "Dither", "Texture",
+                                "CannyLower", "CannyUpper", "page-left", "page-right", "page-top", "page-bottom",
+                                "IndexFirmwareVersion", "IndexTable", "IndexMultipleImpact", "IndexFolding",
+                                "IndexPaperLength", "HardwarePageNumber", NULL};
 
 // 'main()' - Main entry for brf.
 
@@ -73,6 +549,7 @@ main(int argc,     // I - Number of command-line arguments
   }
 
   brf_printer_app_config_t printer_app_config = {
+      .autoadd_cb = autoadd_cb,
       .spooling_conversions = spooling_conversions};
 
   brf_printer_app_global_data_t global_data;
@@ -86,7 +563,7 @@ main(int argc,     // I - Number of command-line arguments
                         NULL,
                         (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])),
                         brf_drivers, autoadd_cb, driver_cb,
-                        /*subcmd_name*/ NULL, /*subcmd_cb*/ NULL,
+                        "resume", resume_cb,
                         system_cb,
                         /*usage_cb*/ NULL,
                         /*data*/ &global_data));
@@ -119,7 +596,7 @@ autoadd_cb(const char *device_info, // I - Device information/name (not used)
       make = cupsGetOption("MFG", num_did, did);
 
   // Then loop through the driver list to find the best match...
-  // for (i = 0; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
+  for (i = 0; i < (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])); i ++)
   {
 
     if (brf_drivers[i].device_id)
@@ -134,6 +611,19 @@ autoadd_cb(const char *device_info, // I - Device information/name (not used)
     }
   }
 
+  // Other embossers of known makers get the generic driver...
+  if (!best_name && make)
+  {
+    for (i = 0; i < (int)(sizeof(brf_embosser_makes) / sizeof(brf_embosser_makes[0])); i ++)
+    {
+      if (!strncasecmp(make, brf_embosser_makes[i], strlen(brf_embosser_makes[i])))
+      {
+        best_name = "gen_brf";
+        break;
+      }
+    }
+  }
+
   // Clean up and return...
   cupsFreeOptions(num_did, did);
 
@@ -202,6 +692,10 @@ match_id(int num_did,          // I - Number of device ID key/value pairs
       break;
     }
   }
+
+  cupsFreeOptions(num_mid, mid);
+
+  return (score);
 }
 
 // 'driver_cb()' - Main driver callback
@@ -330,6 +824,12 @@ driver_cb(
   data->vendor[data->num_vendor++] = "Edge";
   ipp_attribute_t *edge = ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_TEXT, "Edge-default", NULL,"Canny");
 
+  data->vendor[data->num_vendor++] = "Dither";
+  ipp_attribute_t *dither = ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_TEXT, "Dither-default", NULL, "None");
+
+  data->vendor[data->num_vendor++] = "Texture";
+  ipp_attribute_t *texture = ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_TEXT, "Texture-default", NULL, "Lines");
+
   ipp_attribute_t *mirror = ippAddBoolean(*attrs, IPP_TAG_PRINTER, "mirror-default", 0);
 
   ipp_attribute_t *fitplot = ippAddBoolean(*attrs, IPP_TAG_PRINTER, "fitplot-default", 1);
@@ -361,11 +861,11 @@ driver_cb(
   if (!strncmp(driver_name, "gen_", 4))
     return (brf_gen(system, driver_name, device_uri, device_id, data, attrs, cbdata));
 
+  else if (!strncmp(driver_name, "index_", 6))
+    return (brf_index(system, driver_name, device_uri, device_id, data, attrs, cbdata));
+
   else
-  {
-    printf("****************brfgen-not called***************\n");
     return (false);
-  }
 }
 
 void BRFSetup(pappl_system_t *system, brf_printer_app_global_data_t *global_data)
@@ -375,19 +875,22 @@ void BRFSetup(pappl_system_t *system, brf_printer_app_global_data_t *global_data
   // Track if the MIME filter was added successfully
   bool filter_added = false;
 
+  // Only accept formats which can be converted with the installed tools...
+  brf_CapsProbe(system, converts);
+
   for (int i = 0; converts[i].srctype != NULL; i++)
   {
     conversion = &converts[i];
 
-   
+    if (!brf_CapsIsAvailable(conversion) && strcmp(conversion->srctype, brf_TESTPAGE_MIMETYPE))
+      continue;
+
     // papplSystemAddMIMEFilter(system, conversion->srctype, conversion->dsttype, BRFTestFilterCB, global_data);
     papplSystemAddMIMEFilter(system, conversion->srctype, brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, global_data);
 
     // Set filter_added to true after calling the function
     filter_added = true;
   }
-
-  printf("****************BRFSETUP IS CALLED**********************\n");
 }
 // 'mime_cb()' - MIME typing callback...
 
@@ -399,6 +902,10 @@ mime_cb(const unsigned char *header, // I - Header data
   magic_t magic;
   const char *mime_type = NULL;
 
+  // Packed BRF is our own format, libmagic does not know it...
+  if (brf_PackIsStream(header, headersize))
+    return ("application/vnd.cups-packed-brf");
+
   // Step 1: Open a magic_t object for MIME type detection
   magic = magic_open(MAGIC_MIME_TYPE);
   if (magic == NULL)
@@ -433,61 +940,6 @@ mime_cb(const unsigned char *header, // I - Header data
   return mime_type; // Return the MIME type (or NULL if undetected)
 }
 
-// 'printer_cb()' - Try auto-adding printers.
-
-static bool                         // O - `false` to continue
-printer_cb(const char *device_info, // I - Device information
-           const char *device_uri,  // I - Device URI
-           const char *device_id,   // I - IEEE-1284 device ID
-           pappl_system_t *system)  // I - System
-{
-  const char *driver_name = autoadd_cb(device_info, device_uri, device_id, system);
-
-  // Driver name, if any
-
-  if (driver_name)
-  {
-    char name[128], // Printer name
-        *nameptr;   // Pointer in name
-    papplCopyString(name, device_info, sizeof(name));
-
-    if ((nameptr = strstr(name, " (")) != NULL)
-      *nameptr = '\0';
-
-    if (!papplPrinterCreate(system, 0, name, driver_name, device_id, device_uri))
-    {
-      // Printer already exists with this name, so try adding a number to the name
-      int i;                         // Looping var
-      char newname[128],             // New name
-          number[4];                 // Number string
-      size_t namelen = strlen(name), // Length of original name string
-          numberlen;                 // Length of number string
-
-      for (i = 2; i < 100; i++)
-      {
-        // Append " NNN" to the name, truncating the existing name as needed to
-        // include the number at the end...
-
-        snprintf(number, sizeof(number), " %d", i);
-        numberlen = strlen(number);
-
-        papplCopyString(newname, name, sizeof(newname));
-        if ((namelen + numberlen) < sizeof(newname))
-          memcpy(newname + namelen, number, numberlen + 1);
-        else
-          memcpy(newname + sizeof(newname) - numberlen - 1, number, numberlen + 1);
-
-        // Try creating with this name...
-
-        if (papplPrinterCreate(system, 0, newname, driver_name, device_id, device_uri))
-          break;
-      }
-    }
-  }
-
-  return (false);
-}
-
 // 'system_cb()' - Setup the system object.
 
 static pappl_system_t * // O - System object
@@ -505,6 +957,9 @@ system_cb(
       *system_name;          // System name, if any
   pappl_loglevel_t loglevel; // Log level
   int port = 0;              // Port number, if any
+  int archive_hours = 24;    // Hours to keep archived job output
+  int memory_size = 64;      // Size of translation memory in MiB
+  int cache_size = 16;       // Size of graphic cache in MiB
   pappl_soptions_t soptions = PAPPL_SOPTIONS_MULTI_QUEUE | PAPPL_SOPTIONS_WEB_INTERFACE | PAPPL_SOPTIONS_WEB_LOG | PAPPL_SOPTIONS_WEB_SECURITY;
   // System options
   static pappl_version_t versions[1] = // Software versions
@@ -537,43 +992,117 @@ system_cb(
   hostname = cupsGetOption("server-hostname", num_options, options);
   system_name = cupsGetOption("system-name", num_options, options);
 
-  if ((val = cupsGetOption("server-port", num_options, options)) != NULL)
+  if (!number_option("server-port", num_options, options, &port))
+    return (NULL);
+
+  global_data->discovery_interval = 60;
+  if (!number_option("discovery-interval", num_options, options, &global_data->discovery_interval))
+    return (NULL);
+
+  if (!number_option("job-archive-hours", num_options, options, &archive_hours))
+    return (NULL);
+
+  if ((val = cupsGetOption("printer-pools", num_options, options)) != NULL)
   {
-    if (!isdigit(*val & 255))
+    if (!strcmp(val, "on") || !strcmp(val, "true"))
+      global_data->printer_pools = true;
+    else if (strcmp(val, "off") && strcmp(val, "false"))
     {
-      fprintf(stderr, "brf: Bad server-port value '%s'.\n", val);
+      fprintf(stderr, "brf: Bad printer-pools value '%s'.\n", val);
       return (NULL);
     }
-    else
-      port = atoi(val);
   }
 
+  if (!number_option("pool-split", num_options, options, &global_data->pool_split))
+    return (NULL);
+
+  if ((val = cupsGetOption("job-scheduling", num_options, options)) == NULL || !strcmp(val, "fifo"))
+    global_data->scheduling = BRF_SCHEDULE_FIFO;
+  else if (!strcmp(val, "sjf"))
+    global_data->scheduling = BRF_SCHEDULE_SJF;
+  else
+  {
+    fprintf(stderr, "brf: Bad job-scheduling value '%s'.\n", val);
+    return (NULL);
+  }
+
+  global_data->job_aging = 10;
+  if (!number_option("job-aging", num_options, options, &global_data->job_aging))
+    return (NULL);
+
+  if (!number_option("translation-memory", num_options, options, &memory_size))
+    return (NULL);
+
+  if (!number_option("graphic-cache", num_options, options, &cache_size))
+    return (NULL);
+
+  if ((val = cupsGetOption("brf-storage", num_options, options)) != NULL)
+  {
+    if (!strcmp(val, "packed"))
+      global_data->packed_storage = true;
+    else if (strcmp(val, "text"))
+    {
+      fprintf(stderr, "brf: Bad brf-storage value '%s'.\n", val);
+      return (NULL);
+    }
+  }
+
+  if (!number_option("stress-printers", num_options, options, &global_data->stress_printers))
+    return (NULL);
+
+  global_data->stress_jobs = 100;
+  if (!number_option("stress-jobs", num_options, options, &global_data->stress_jobs))
+    return (NULL);
+
+  global_data->state_delay = 5;
+  if (!number_option("state-save-delay", num_options, options, &global_data->state_delay))
+    return (NULL);
+
+  if ((val = cupsGetOption("stress-file", num_options, options)) != NULL)
+    papplCopyString(global_data->stress_file, val, sizeof(global_data->stress_file));
+
+  // Spool directory for archived job output...
+  if ((val = getenv("SPOOL_DIR")) != NULL || (val = cupsGetOption("spool-directory", num_options, options)) != NULL)
+    papplCopyString(global_data->spool_dir, val, sizeof(global_data->spool_dir));
+  else
+    snprintf(global_data->spool_dir, sizeof(global_data->spool_dir), "%s/brf-printer-app", papplGetTempDir());
+
+  if (mkdir(global_data->spool_dir, 0700) && errno != EEXIST)
+  {
+    fprintf(stderr, "brf: Unable to create spool directory '%s': %s\n", global_data->spool_dir, strerror(errno));
+    return (NULL);
+  }
+
+  brf_ArchiveInit(global_data->spool_dir, archive_hours);
+  brf_MemoryInit(global_data->spool_dir, (size_t)memory_size * 1048576);
+  brf_CacheInit(global_data->spool_dir, (size_t)cache_size * 1048576);
+
   // State file...
   if ((val = getenv("SNAP_DATA")) != NULL)
   {
-    snprintf(brf_statefile, sizeof(brf_statefile), "%s/brf.conf", val);
+    snprintf(global_data->state_file, sizeof(global_data->state_file), "%s/brf.conf", val);
   }
   else if ((val = getenv("XDG_DATA_HOME")) != NULL)
   {
-    snprintf(brf_statefile, sizeof(brf_statefile), "%s/.brf.conf", val);
+    snprintf(global_data->state_file, sizeof(global_data->state_file), "%s/.brf.conf", val);
   }
 #ifdef _WIN32
   else if ((val = getenv("USERPROFILE")) != NULL)
   {
-    snprintf(brf_statefile, sizeof(brf_statefile), "%s/AppData/Local/brf.conf", val);
+    snprintf(global_data->state_file, sizeof(global_data->state_file), "%s/AppData/Local/brf.conf", val);
   }
   else
   {
-    papplCopyString(brf_statefile, "/brf.ini", sizeof(brf_statefile));
+    papplCopyString(global_data->state_file, "/brf.ini", sizeof(global_data->state_file));
   }
 #else
   else if ((val = getenv("HOME")) != NULL)
   {
-    snprintf(brf_statefile, sizeof(brf_statefile), "%s/.brf.conf", val);
+    snprintf(global_data->state_file, sizeof(global_data->state_file), "%s/.brf.conf", val);
   }
   else
   {
-    papplCopyString(brf_statefile, "/etc/brf.conf", sizeof(brf_statefile));
+    papplCopyString(global_data->state_file, "/etc/brf.conf", sizeof(global_data->state_file));
   }
 #endif // _WIN32
 
@@ -581,6 +1110,8 @@ system_cb(
   if ((system = papplSystemCreate(soptions, system_name ? system_name : "Braille printer app", port, "_print,_universal", cupsGetOption("spool-directory", num_options, options), logfile ? logfile : "-", loglevel, cupsGetOption("auth-service", num_options, options), /* tls_only */ false)) == NULL)
     return (NULL);
 
+  global_data->system = system;
+
   papplSystemAddListeners(system, NULL);
   papplSystemSetHostName(system, hostname);
   // initialize_spooling_conversions();
@@ -593,84 +1124,186 @@ system_cb(
 
   papplSystemSetFooterHTML(system, "Copyright &copy; 2024 by Arun Patwa. All rights reserved.");
 
-  papplSystemSetSaveCallback(system, (pappl_save_cb_t)papplSystemSaveState, (void *)brf_statefile);
-
   papplSystemSetVersions(system, (int)(sizeof(versions) / sizeof(versions[0])), versions);
 
-  fprintf(stderr, "brf: statefile='%s'\n", brf_statefile);
+  papplSystemSetEventCallback(system, event_cb, global_data);
+  papplSystemAddResourceCallback(system, "/metrics", "text/plain", metrics_cb, global_data);
+
+  brf_LogInit(system);
+  brf_PoolInit(global_data);
+  brf_SimInit(global_data);
+
+  if (brf_StateInit(global_data))
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "Loaded state file '%s'.", global_data->state_file);
+  else
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "State file is '%s'.", global_data->state_file);
 
   papplSystemSetDNSSDName(system, system_name ? system_name : "brf");
 
-  papplLog(system, PAPPL_LOGLEVEL_INFO, "Auto-adding printers...");
+  // Add printers from a background thread so that we don't block on USB
+  // enumeration before the listeners are serving requests...
+  brf_DiscoveryStart(global_data);
 
-  papplDeviceList(PAPPL_DEVTYPE_USB, (pappl_device_cb_t)printer_cb, system, papplLogDevice, system);
+  brf_ScheduleStart(global_data);
 
-  create_brf_printer(system);
+  brf_StressStart(global_data);
 
   return (system);
 }
 
-// creating uri for cups-brf printer
+// 'number_option()' - Get a non-negative number option of the system.
 
-int create_brf_printer(pappl_system_t *system)
+static bool                         // O - `true` on success, `false` if bad
+number_option(const char *name,     // I - Option name
+              int num_options,      // I - Number of options
+              cups_option_t *options, // I - Options
+              int *value)           // IO - Value, unchanged if not set
 {
-  char *dir;
-  struct passwd *pw;
-  int ret;
+  const char *val;                  // Option value
+
 
-  // Get the current user's information
-  pw = getpwuid(getuid());
-  if (pw == NULL)
+  if ((val = cupsGetOption(name, num_options, options)) == NULL)
+    return (true);
+
+  if (!isdigit(*val & 255))
   {
-    fprintf(stderr, "ERROR: could not get user information\n");
-    return 1;
+    fprintf(stderr, "brf: Bad %s value '%s'.\n", name, val);
+    return (false);
   }
 
-  // Create the directory path in the user's home directory
-  if (asprintf(&dir, "%s/BRF", pw->pw_dir) < 0)
+  *value = atoi(val);
+
+  return (true);
+}
+
+// 'event_cb()' - Pass system events to the background threads.
+
+static void
+event_cb(pappl_system_t *system,   // I - System
+         pappl_printer_t *printer, // I - Printer, if any
+         pappl_job_t *job,         // I - Job, if any
+         pappl_event_t event,      // I - Event
+         void *data)               // I - Global data (unused)
+{
+  (void)system;
+  (void)printer;
+  (void)data;
+
+  brf_ScheduleEvent(event);
+  brf_PoolEvent(event);
+  brf_LouisCacheEvent(event);
+  brf_StressEvent(job, event);
+}
+
+// 'metrics_cb()' - Show the counters of the Printer Application.
+
+static bool                         // O - `true` on success
+metrics_cb(pappl_client_t *client,  // I - Client
+           void *data)              // I - Global data (unused)
+{
+  unsigned long long hits,          // Lookups found
+      misses,                       // Lookups not found
+      entries,                      // Stored entries
+      used,                         // Bytes used
+      size;                         // Size of translation memory
+  double wait;                      // Mean waiting time
+  int count;                        // Number of started jobs
+
+  (void)data;
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/plain", 0, 0))
+    return (false);
+
+  if (brf_MemoryGetStats(&hits, &misses, &entries, &used, &size))
   {
-    fprintf(stderr, "ERROR: could not allocate memory\n");
-    return 1;
+    papplClientPrintf(client, "translation_memory_hits %llu\n", hits);
+    papplClientPrintf(client, "translation_memory_misses %llu\n", misses);
+    papplClientPrintf(client, "translation_memory_hit_rate %.3f\n", hits + misses ? (double)hits / (hits + misses) : 0.0);
+    papplClientPrintf(client, "translation_memory_entries %llu\n", entries);
+    papplClientPrintf(client, "translation_memory_bytes %llu %llu\n", used, size);
   }
 
-  // Try creating the "BRF" directory with permissions 0700
-  fprintf(stderr, "DEBUG: creating directory \"%s\"\n", dir);
-  ret = mkdir(dir, 0700);
-  if (ret == -1 && errno != EEXIST)
+  if (brf_CacheGetStats(&hits, &misses, &entries, &used))
   {
-    fprintf(stderr, "ERROR: could not create directory \"%s\": %s\n",
-            dir, strerror(errno));
-    free(dir);
-    return 1;
+    papplClientPrintf(client, "graphic_cache_hits %llu\n", hits);
+    papplClientPrintf(client, "graphic_cache_misses %llu\n", misses);
+    papplClientPrintf(client, "graphic_cache_hit_rate %.3f\n", hits + misses ? (double)hits / (hits + misses) : 0.0);
+    papplClientPrintf(client, "graphic_cache_entries %llu\n", entries);
+    papplClientPrintf(client, "graphic_cache_bytes %llu\n", used);
   }
-  else if (ret == -1)
+
+  wait = brf_ScheduleGetWaitTime(&count);
+  papplClientPrintf(client, "jobs_started %d\n", count);
+  papplClientPrintf(client, "jobs_mean_wait_seconds %.1f\n", wait);
+  papplClientPrintf(client, "log_messages_dropped %llu\n", brf_LogGetDropped());
+
+  httpWrite2(papplClientGetHTTP(client), "", 0);
+
+  return (true);
+}
+
+// 'resume_cb()' - Resume an interrupted job from its archived output.
+
+static int                          // O - Exit status
+resume_cb(const char *base_name,    // I - Base name of program
+          int num_options,          // I - Number of options
+          cups_option_t *options,   // I - Options
+          int num_files,            // I - Number of files (unused)
+          char **files,             // I - Files (unused)
+          void *data)               // I - Callback data (unused)
+{
+  const char *job_id,               // Job to resume
+      *page,                        // Page to resume from
+      *val;                         // Option value
+  char ticket[256],                 // Resume ticket
+      job_name[256];                // Name of new job
+  http_t *http;                     // Connection to server
+  int new_id;                       // ID of new job
+
+  (void)num_files;
+  (void)files;
+  (void)data;
+
+  if ((job_id = cupsGetOption("job-id", num_options, options)) == NULL || !isdigit(*job_id & 255))
   {
-    fprintf(stderr, "DEBUG: directory \"%s\" already exists\n", dir);
+    fprintf(stderr, "%s: Missing or bad job ID, use '-j JOB-ID'.\n", base_name);
+    return (1);
   }
-  else
+
+  if ((page = cupsGetOption("page", num_options, options)) != NULL && !isdigit(*page & 255))
   {
-    fprintf(stderr, "DEBUG: directory \"%s\" created successfully\n", dir);
+    fprintf(stderr, "%s: Bad page number '%s'.\n", base_name, page);
+    return (1);
   }
 
-  // Construct the device URI
-  char device_uri[1024];
-  snprintf(device_uri, sizeof(device_uri), "file://%s", dir);
-  printf("[INFO] Device URI for printer: %s\n", device_uri);
+  if (page)
+    snprintf(ticket, sizeof(ticket), "job-id=%d\npage=%d\n", atoi(job_id), atoi(page));
+  else
+    snprintf(ticket, sizeof(ticket), "job-id=%d\n", atoi(job_id));
+
+  snprintf(job_name, sizeof(job_name), "Resume of job %d", atoi(job_id));
 
-  // Create the printer with the new device URI
+  val = cupsGetOption("server-port", num_options, options);
 
-  if (papplPrinterCreate(system, 0, "cups-brf", "gen_brf", NULL, device_uri) != NULL)
+  if ((http = brf_ClientConnect(base_name, val ? atoi(val) : 0)) == NULL)
   {
-    printf("[SUCCESS] Printer created with device URI: %s\n", device_uri);
+    fprintf(stderr, "%s: Unable to connect to server: %s\n", base_name, cupsLastErrorString());
+    return (1);
   }
-  else
+
+  new_id = brf_ClientPrint(http, cupsGetOption("printer-name", num_options, options), "application/vnd.cups-brf-resume", job_name, ticket, strlen(ticket));
+
+  httpClose(http);
+
+  if (!new_id)
   {
-    fprintf(stderr, "[ERROR] Failed to create printer with device URI: %s\n", device_uri);
+    fprintf(stderr, "%s: Unable to resume job %s: %s\n", base_name, job_id, cupsLastErrorString());
+    return (1);
   }
 
-  free(dir);
+  printf("%s: Resuming job %s as job %d.\n", base_name, job_id, new_id);
 
-  return 0;
+  return (0);
 }
 
 // 'BRFTestFilterCB()' - Print a test page.
@@ -696,10 +1329,18 @@ BRFTestFilterCB(
   cups_array_t *spooling_conversions;
   cf_filter_filter_in_chain_t *chain_filter, // Filter from PPD file
       *print;
-  cf_filter_external_t *filter_data_ext;
+  cf_filter_filter_in_chain_t pack_filter = {brf_pack_filter_function, NULL, "brfpack"};
+                                         // Packed BRF storage stage
+  cf_filter_filter_in_chain_t count_filter = {brf_count_filter_function, NULL, "brfcount"};
+                                         // Page counting stage
+  brf_progress_t *progress;              // Page counters
+  brf_cancel_t *cancel;                  // Job cancellation
   brf_print_filter_function_data_t *print_params;
   cf_filter_data_t *filter_data;
-  cups_array_t *chain;
+  cups_array_t *chain,
+      *copies,                           // Job copies of conversion filters
+      *stages;                           // Chain as it is run
+  cf_filter_filter_in_chain_t *copy;     // Current copy
   int nullfd; // File descriptor for /dev/null
   char paramstr[1024];
   char buf[1024];
@@ -716,40 +1357,27 @@ BRFTestFilterCB(
   pappl_printer_t *printer = papplJobGetPrinter(job);
   const char *device_uri = papplPrinterGetDeviceURI(printer);
 
+  // Pool jobs are printed by the pool members...
+  if (!strncmp(device_uri, "pool:", 5))
+  {
+    papplJobDeletePrintOptions(job_options);
+    return (brf_PoolDispatch(job));
+  }
+
   ipp_t *driver_attrs = papplPrinterGetDriverAttributes(printer);
 
   paramstr[sizeof(paramstr) - 1] = 0;
 
-  // Define an array of option names
-  const char *option_names[] = {"PageSize","mirror","fitplot",
-                                  "SendFF", "SendSUB",
-                                 "LibLouis", "LibLouis2", "LibLouis3", "LibLouis4",
-                                "TextDotDistance", "TextDots", "LineSpacing", "TopMargin", "BottomMargin",
-                                "LeftMargin", "RightMargin", "BraillePageNumber", "PrintPageNumber",
-                                "PageSeparator", "PageSeparatorNumber", "ContinuePages", "GraphicDotDistance",
-                                "Rotate", "Edge", "Negate", "EdgeFactor", "CannyRadius", "CannySigma",
-                                "CannyLower", "CannyUpper", "page-left", "page-right", "page-top", "page-bottom"};
-
   // Loop through each option and process them
-  for (size_t i = 0; i < sizeof(option_names) / sizeof(option_names[0]); i++)
+  for (size_t i = 0; brf_job_options[i]; i++)
   {
-    const char *option_name = option_names[i];
+    const char *option_name = brf_job_options[i];
     ipp_attribute_t *attribute = papplJobGetAttribute(job, option_name);
 
    // If attribute is not found, look for the default attribute
     if (attribute == NULL) {
         snprintf(buf, sizeof(buf), "%s-default", option_name);
         attribute = ippFindAttribute(driver_attrs, buf, IPP_TAG_ZERO);
-        if (attribute != NULL) {
-            printf("Default attribute for %s: %s\n", option_name, ippGetName(attribute));
-        }
-    }
-
-    // Try to retrieve supported attribute as well
-    snprintf(buf, sizeof(buf), "%s-supported", option_name);
-    ipp_attribute_t *attr_support = ippFindAttribute(driver_attrs, buf, IPP_TAG_ZERO);
-    if (attr_support != NULL) {
-        printf("Supported attribute for %s: %s\n", option_name, ippGetName(attr_support));
     }
 
     if (attribute != NULL)
@@ -774,28 +1402,28 @@ BRFTestFilterCB(
 
       // Add the option to job_options
       job_options->num_vendor = cupsAddOption(option_name, paramstr, job_options->num_vendor, &(job_options->vendor));
-    }
 
-    printf("****** Value for %s ****** %s\n", option_name, paramstr);
+      brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Option %s=%s", option_name, paramstr);
+    }
   }
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Entering BRFTestFilterCB()");
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Entering BRFTestFilterCB()");
 
   // Prepare job data to be supplied to filter functions/CUPS filters called during job execution
   filter_data = (cf_filter_data_t *)calloc(1, sizeof(cf_filter_data_t));
   if (!filter_data)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for filter_data");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for filter_data");
     return false;
   }
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Allocated memory for filter_data");
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Allocated memory for filter_data");
 
   // Initialize filter_data fields
   filter_data->printer = strdup(papplPrinterGetName(printer));
   if (!filter_data->printer)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for printer name");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for printer name");
     return false;
   }
 
@@ -803,19 +1431,19 @@ BRFTestFilterCB(
   filter_data->job_user = strdup(papplJobGetUsername(job));
   if (!filter_data->job_user)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for job user");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for job user");
     return false;
   }
 
   filter_data->job_title = strdup(papplJobGetName(job));
   if (!filter_data->job_title)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for job title");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for job title");
     return false;
   }
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Job ID: %d, Job User: %s, Job Title: %s",
-              filter_data->job_id, filter_data->job_user, filter_data->job_title);
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Job ID: %d, Job User: %s, Job Title: %s",
+             filter_data->job_id, filter_data->job_user, filter_data->job_title);
 
   filter_data->copies = job_options->copies;
   filter_data->num_options = job_options->num_vendor;
@@ -837,35 +1465,18 @@ BRFTestFilterCB(
   // canceled
   filter_data->iscanceleddata = job;
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Filter data initialized");
-
-  // Initialize filter_data_ext for external filter
-  filter_data_ext = (cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
-
-  if (!filter_data_ext)
-  {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for filter_data_ext");
-    close(fd);
-    return false;
-  }
-
-  filter_data_ext->filter = texttobrf_filter.filter;
-  filter_data_ext->num_options = 0;
-  filter_data_ext->options = NULL;
-  filter_data_ext->envp = NULL;
-
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Assigned external filter: %s", filter_data_ext->filter);
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Filter data initialized");
 
   // Open the input file...
   filename = papplJobGetFilename(job);
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Opening input file: %s", filename);
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Opening input file: %s", filename);
   if ((fd = open(filename, O_RDONLY)) < 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s': %s", filename, strerror(errno));
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s': %s", filename, strerror(errno));
     return false;
   }
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Input file opened successfully");
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Input file opened successfully");
 
   // Connect the job's filter_data to the backend
   if (strncmp(device_uri, "cups:", 5) == 0)
@@ -874,22 +1485,23 @@ BRFTestFilterCB(
     device_data = (brf_cups_device_data_t *)papplDeviceGetData(device);
     if (device_data == NULL)
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to get device data");
+      brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to get device data");
       close(fd);
       return false;
     }
 
     // Connect the filter_data
     device_data->filter_data = filter_data;
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Connected filter_data to backend");
+    brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Connected filter_data to backend");
   }
 
   // Set up filter function chain
   chain = cupsArrayNew(NULL, NULL);
+  copies = cupsArrayNew(NULL, NULL);
 
   // Get input file format
   informat = papplJobGetFormat(job);
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Input file format: %s", informat);
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Input file format: %s", informat);
 
   const char *currentFormat = informat;
 
@@ -898,38 +1510,47 @@ BRFTestFilterCB(
 
   while (strcmp(currentFormat, "application/vnd.cups-brf") != 0)
   {
-    for (int i = 0; converts[i].srctype != NULL; i++)
+    cf_filter_filter_in_chain_t *filter; // Job copy of conversion filter
+
+    // Only conversions whose tools were found at the last probe...
+    if ((conversion = brf_CapsFindConversion(currentFormat)) == NULL)
     {
-      conversion = &converts[i];
-      // Compare source type with informat
-      if (strcmp(conversion->srctype, informat) == 0)
-      {
-        break; // Exit the loop when a match is found
-      }
+      brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "No pre-filter found for input format %s", currentFormat);
+      close(fd);
+      return false;
     }
-    printf("****************after if conversion_srctype*********%s***********\n", conversion->srctype);
+    brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Using spooling conversion from %s to %s", conversion->srctype, conversion->dsttype);
+
+    brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Converting input file to format: %s", conversion->dsttype);
 
-    if (conversion == NULL)
+    if ((filter = brf_CapsCopyFilter(&(conversion->filters))) == NULL)
     {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No pre-filter found for input format %s", informat);
+      brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for pre-filter");
       close(fd);
       return false;
     }
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Using spooling conversion from %s to %s", conversion->srctype, conversion->dsttype);
 
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Converting input file to format: %s", conversion->dsttype);
-
-    cupsArrayAdd(chain, &(conversion->filters));
+    cupsArrayAdd(chain, filter);
+    cupsArrayAdd(copies, filter);
 
     currentFormat = conversion->dsttype;
   }
 
+  // Store packed BRF on file devices if requested, the pages are counted
+  // before packing...
+  if (global_data->packed_storage && !strncmp(device_uri, "file:", 5))
+  {
+    brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Storing packed BRF");
+    cupsArrayAdd(chain, &count_filter);
+    cupsArrayAdd(chain, &pack_filter);
+  }
+
   // Add print filter function at the end of the chain
   print = (cf_filter_filter_in_chain_t *)calloc(1, sizeof(cf_filter_filter_in_chain_t));
 
   if (!print)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for print filter");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for print filter");
     close(fd);
     return false;
   }
@@ -937,7 +1558,7 @@ BRFTestFilterCB(
   print_params = (brf_print_filter_function_data_t *)calloc(1, sizeof(brf_print_filter_function_data_t));
   if (!print_params)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for print_params");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for print_params");
     close(fd);
     return false;
   }
@@ -950,24 +1571,93 @@ BRFTestFilterCB(
   print->parameters = print_params;
   print->name = "Backend";
 
+  // Index embossers get the parameters and the copies of the job in front of
+  // the data, which is then only sent once...
+  if (!strncmp(papplPrinterGetDriverName(printer), "index_", 6))
+  {
+    if ((print_params->index = brf_IndexCreate(printer, device, job_options, filter_data->num_options, filter_data->options, filter_data->logfunc, filter_data->logdata)) == NULL)
+    {
+      brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to set up the Index embosser");
+      free(print_params);
+      free(print);
+      close(fd);
+      return false;
+    }
+
+    filter_data->copies = brf_IndexGetCopies(print_params->index);
+  }
+
   cupsArrayAdd(chain, print);
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Filter chain set up");
+  brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Filter chain set up");
+
+  // Compile the liblouis tables in the server, the filters inherit them...
+  if (strcmp(informat, "application/vnd.cups-brf"))
+  {
+    const char *text_dots = cupsGetOption("TextDots", filter_data->num_options, filter_data->options);
+
+    if (brf_LouisCacheTables(filter_data->num_options, filter_data->options, text_dots ? atoi(text_dots) : 6))
+      brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Liblouis tables are compiled");
+  }
+
+  // Count pages as they are sent, BRF jobs are counted up front so that the
+  // total is known right away...
+  progress = brf_ProgressCreate(job, !strcmp(informat, "application/vnd.cups-brf") ? brf_ProgressCountFile(filename) : 0);
+
+  if (global_data->packed_storage && !strncmp(device_uri, "file:", 5))
+    count_filter.parameters = progress;
+  else
+    print_params->progress = progress;
+
+  // Stop the stages in front of the print stage as soon as the job is
+  // canceled, the print stage ends the job on the device by itself...
+  stages = cupsArrayNew(NULL, NULL);
+
+  if ((cancel = brf_CancelCreate(job)) != NULL)
+  {
+    filter_data->iscanceledfunc = brf_CancelIsCanceled;
+    filter_data->iscanceleddata = cancel;
+  }
+
+  for (copy = (cf_filter_filter_in_chain_t *)cupsArrayFirst(chain); copy; copy = (cf_filter_filter_in_chain_t *)cupsArrayNext(chain))
+    cupsArrayAdd(stages, copy == print ? copy : brf_CancelStage(cancel, copy));
 
   // Fire up the filter functions
-  papplJobSetImpressions(job, 1);
   nullfd = open("/dev/null", O_RDWR);
 
-  if (cfFilterChain(fd, nullfd, 1, filter_data, chain) == 0)
+  if (cfFilterChain(fd, nullfd, 1, filter_data, stages) == 0)
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "cfFilterChain() completed successfully");
+    brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "cfFilterChain() completed successfully");
     ret = true;
   }
   else
   {
-    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "cfFilterChain() failed");
+    brf_LogJob(job, PAPPL_LOGLEVEL_ERROR, "cfFilterChain() failed");
   }
 
+  brf_CancelDelete(cancel);
+  brf_ProgressFinish(progress);
+
+  for (copy = (cf_filter_filter_in_chain_t *)cupsArrayFirst(copies); copy; copy = (cf_filter_filter_in_chain_t *)cupsArrayNext(copies))
+    brf_CapsFreeFilter(copy);
+
+  cupsArrayDelete(copies);
+  cupsArrayDelete(chain);
+  cupsArrayDelete(stages);
+
+  if (device_data)
+    device_data->filter_data = NULL;
+
+  brf_IndexDelete(print_params->index);
+  free(print_params);
+  free(print);
+  free(filter_data->printer);
+  free(filter_data->job_user);
+  free(filter_data->job_title);
+  free(filter_data->content_type);
+  free(filter_data->final_content_type);
+  free(filter_data);
+
   papplJobDeletePrintOptions(job_options);
 
   close(fd);
@@ -988,6 +1678,11 @@ int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_f
   brf_printer_app_global_data_t *global_data = params->global_data;
   char filename[2048];
   int debug_fd = -1;
+  brf_archive_t *archive = NULL; // Archived job output, for resuming
+  const char *ptr;               // Pointer into buffer
+  size_t count;                  // Bytes to write at once
+  bool canceled = false,         // Was the job canceled?
+      partial = false;           // Data after the last form feed?
 
   // if (papplSystemGetLogLevel(global_data->system) == PAPPL_LOGLEVEL_DEBUG) {
   //     printer = papplJobGetPrinter(job);
@@ -995,25 +1690,66 @@ int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_f
   //     debug_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
   // }
 
+  // Keep a copy of the output and its page offsets so that the job can be
+  // resumed after a jam, unless the output is packed...
+  if (!global_data->packed_storage || strncmp(params->device_uri, "file:", 5))
+    archive = brf_ArchiveCreate(papplJobGetID(job), data->job_user, data->printer);
+
   while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
   {
+    brf_ArchiveWrite(archive, buffer, (size_t)bytes);
+
     if (debug_fd >= 0)
     {
       int storeBuffer = write(debug_fd, buffer, bytes);
 
       if (storeBuffer != bytes)
-      {
-        fprintf(stderr, "*********** storeBuffer is not bytes**********%zd******\n", bytes);
-      }
+        brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Short write to debug file: %d of %d bytes", storeBuffer, (int)bytes);
     }
 
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+    // Look for a cancel between small writes, so that a slow embosser does
+    // not get much more of a canceled job...
+    for (ptr = buffer; ptr < (buffer + bytes); ptr += count)
     {
-      return 1;
+      if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      {
+        canceled = true;
+        break;
+      }
+
+      if ((count = (size_t)(buffer + bytes - ptr)) > BRF_PRINT_CHUNK)
+        count = BRF_PRINT_CHUNK;
+
+      if (params->index ? !brf_IndexWrite(params->index, ptr, count) : papplDeviceWrite(device, ptr, count) < 0)
+      {
+        brf_IndexFinish(params->index);
+        brf_ArchiveClose(archive, false);
+        return 1;
+      }
+
+      brf_ProgressCount(params->progress, ptr, count);
+      partial = ptr[count - 1] != '\f';
     }
+
+    if (canceled)
+      break;
+
+    brf_ArchiveCheckpoint(archive);
+  }
+
+  // Eject a partly embossed sheet of a canceled job...
+  if (canceled)
+  {
+    if (log)
+      (log)(ld, CF_LOGLEVEL_INFO, "brf_print_filter_function: Job canceled, ending the job on the device.");
+
+    if (partial && (params->index ? brf_IndexWrite(params->index, "\n\f", 2) : papplDeviceWrite(device, "\f", 1) == 1))
+      brf_ProgressCount(params->progress, "\f", 1);
   }
 
+  brf_IndexFinish(params->index);
   papplDeviceFlush(device);
+  brf_ArchiveClose(archive, !canceled);
 
   if (debug_fd >= 0)
     close(debug_fd);
@@ -1037,7 +1773,8 @@ int brf_JobIsCanceled(void *data)
 //
 // 'brf_JobLog()' - Job log function which calls
 //                 papplJobSetImpressionsCompleted() on page logs of
-//                 filter functions
+//                 filter functions, other messages are only formatted
+//                 when they are logged
 //
 
 void brf_JobLog(void *data,
@@ -1050,22 +1787,26 @@ void brf_JobLog(void *data,
   char buf[1024];
   int page, copies;
 
-  va_start(arglist, message);
-  vsnprintf(buf, sizeof(buf) - 1, message, arglist);
-  fflush(stdout);
-  va_end(arglist);
   if (level == CF_LOGLEVEL_CONTROL)
   {
+    va_start(arglist, message);
+    vsnprintf(buf, sizeof(buf) - 1, message, arglist);
+    va_end(arglist);
+
     if (sscanf(buf, "PAGE: %d %d", &page, &copies) == 2)
     {
       papplJobSetImpressionsCompleted(job, copies);
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printing page %d, %d copies",
-                  page, copies);
+      brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Printing page %d, %d copies",
+                 page, copies);
     }
     else
-      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Unused control message: %s",
-                  buf);
+      brf_LogJob(job, PAPPL_LOGLEVEL_DEBUG, "Unused control message: %s",
+                 buf);
+  }
+  else if (brf_LogEnabled((pappl_loglevel_t)level))
+  {
+    va_start(arglist, message);
+    brf_LogJobv(job, (pappl_loglevel_t)level, message, arglist);
+    va_end(arglist);
   }
-  else
-    papplLogJob(job, (pappl_loglevel_t)level, "%s", buf);
 }
\ No newline at end of file
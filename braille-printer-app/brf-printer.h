@@ -8,6 +8,8 @@ extern int brf_JobIsCanceled(void *data);
 
 void brf_JobLog(void *data,cf_loglevel_t level,const char *message,...);
 
+extern const char *const brf_job_options[];
+
 typedef struct brf_spooling_conversion_s
 {
     char *srctype;                         // Input data type
@@ -44,6 +46,12 @@ typedef struct brf_printer_app_config_s
 } brf_printer_app_config_t;
 
 
+typedef enum brf_schedule_e   // Job scheduling policies
+{
+  BRF_SCHEDULE_FIFO,          // First in, first out
+  BRF_SCHEDULE_SJF            // Shortest job first, with aging
+} brf_schedule_t;
+
 typedef struct brf_printer_app_global_data_s
 {
   brf_printer_app_config_t *config;
@@ -53,9 +61,30 @@ typedef struct brf_printer_app_global_data_s
                               // auto-add)
   char spool_dir[1024];       // Spool directory, customizable via
                               // SPOOL_DIR environment variable
+  int discovery_interval;     // Seconds between USB rescans, 0 for
+                              // hot-plug events only
+  bool packed_storage;        // Store packed BRF on file devices?
+  bool printer_pools;         // Group identical printers into pools?
+  int pool_split;             // Pages per part of split pool jobs, 0 to
+                              // not split
+  brf_schedule_t scheduling;  // Job scheduling policy
+  int job_aging;              // Pages per minute of waiting taken off the
+                              // size of a job
+  char state_file[1024];      // State file
+  int state_delay;            // Seconds until state changes are written
+  int stress_printers;        // Printers for the stress mode, 0 if off
+  int stress_jobs;            // Jobs per stress round
+  char stress_file[1024];     // Document for the stress mode, empty for
+                              // generated text
 
 } brf_printer_app_global_data_t;
 
+// Page counting (brf-progress.c)
+typedef struct brf_progress_s brf_progress_t;
+
+// Index embosser output (index-brf.c)
+typedef struct brf_index_s brf_index_t;
+
 // Data for brf_print_filter_function()
 typedef struct brf_print_filter_function_data_s
 // look-up table
@@ -64,6 +93,8 @@ typedef struct brf_print_filter_function_data_s
   const char *device_uri;                     // Printer device URI
   pappl_job_t *job;                           // Job
   brf_printer_app_global_data_t *global_data; // Global data
+  brf_progress_t *progress;                   // Page counters or `NULL`
+  brf_index_t *index;                         // Index embosser output or `NULL`
 } brf_print_filter_function_data_t;
 
 typedef struct brf_cups_device_data_s
@@ -84,415 +115,303 @@ typedef struct brf_cups_device_data_s
                                              // internal?
 } brf_cups_device_data_t;
 
+// Device discovery (brf-discovery.c)
+extern bool brf_DiscoveryStart(brf_printer_app_global_data_t *global_data);
 
-static cf_filter_external_t texttobrf_filter = {
-
-    .filter = "/usr/lib/cups/filter/texttobrf",
-    .envp =  (char *[]) {
-            "PPD=/dev/null",
-            "CONTENT_TYPE=text/plain",  
-            NULL
-        }
-};
-
-// pdf_to_brf comes in texttobrf_filter
-
-static cf_filter_external_t brftopagedbrf_filter = {
-
-    .filter = "/usr/lib/cups/filter/brftopagedbrf",
-    .envp =   (char *[]) {
-            "PPD=/dev/null", 
-            "CONTENT_TYPE=application/vnd.cups-brf",  
-            NULL
-        }
-};
-
-static cf_filter_external_t imagetobrf_filter = {
-
-    .filter = "/usr/lib/cups/filter/imagetobrf",
-    .envp =   (char *[]) {
-            "PPD=/dev/null",
-            "CONTENT_TYPE=image/jpeg",  
-            NULL
-        }
-};
-
-static cf_filter_external_t imagetoubrl_filter = {
-
-    .filter = "/usr/lib/cups/filter/imagetoubrl",
-    .envp = (char *[]) {
-            "PPD=/dev/null", 
-            "CONTENT_TYPE=image/jpeg",  
-            NULL
-        }
-};
-
-
-static cf_filter_external_t svgtopdf_filter = {
-
-    .filter = "/usr/lib/cups/filter/svgtopdf",
-    .envp = (char *[]) {
-            "PPD=/dev/null",
-            "CONTENT_TYPE=image/svg",  
-            NULL
-        }
-};
-
-static cf_filter_external_t xfigtopdf_filter = {
-
-    .filter = "/usr/lib/cups/filter/xfigtopdf",
-    .envp = (char *[]) {
-            "PPD=/dev/null", 
-            "CONTENT_TYPE=application/x-xfig",  
-            NULL
-        }
-};
-
-static cf_filter_external_t wmftopdf_filter = {
+// Packed BRF storage format (brf-pack.c)
+extern const char brf_dots_ascii[64];
+extern const unsigned char brf_ascii_dots[128];
+extern int brf_pack_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern int brf_unpack_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+extern bool brf_PackIsStream(const unsigned char *header, size_t headersize);
+extern int64_t brf_PackPageOffset(const unsigned char *buffer, size_t bufsize, unsigned page, unsigned *num_pages);
 
-    .filter = "/usr/lib/cups/filter/wmftopdf",
-    .envp = (char *[]) {
-            "PPD=/dev/null",
-            "CONTENT_TYPE=image/x-wmf",  
-            NULL
-        }
-};
-
-static cf_filter_external_t emftopdf_filter = {
-
-    .filter = "/usr/lib/cups/filter/emftopdf",
-    .envp = (char *[]) {
-            "PPD=/dev/null",
-            "CONTENT_TYPE=image/emf",  
-            NULL
-        }
-};
-
-static cf_filter_external_t cgmtopdf_filter = {
+// Page geometry (brf-geometry.c), in 1/100th of mm like cups-braille.sh
+typedef struct brf_geometry_s
+{
+  int page_width,             // Page width
+      page_height;            // Page height
+  int page_left,              // Margins requested by the user
+      page_right,
+      page_top,
+      page_bottom;
+  int printable_width,        // Hardware-printable area
+      printable_height;
+  int text_dots;              // Dots per cell (6 or 8)
+  int text_width,             // Cells per line
+      text_height;            // Lines per page
+  int top_margin,             // Margins in cells
+      bottom_margin,
+      left_margin,
+      right_margin;
+  int graphic_dot_distance;   // Distance between graphic dots
+  int total_graphic_width,    // Graphic area sent to the embosser, in dots
+      total_graphic_height;
+  int graphic_hoffset,        // Dots needed for the left and top margins
+      graphic_voffset;
+  int graphic_width,          // Usable graphic area, in dots
+      graphic_height;
+} brf_geometry_t;
+
+extern bool brf_GeometryInit(brf_geometry_t *geom, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+
+// Braille page formatter (brf-format.c)
+typedef enum brf_pagenum_e    // BraillePageNumber values
+{
+  BRF_PAGENUM_NONE,           // No page numbers
+  BRF_PAGENUM_TOP_MARGIN,     // In the top margin
+  BRF_PAGENUM_BOTTOM_MARGIN,  // In the bottom margin
+  BRF_PAGENUM_TOP_INLINE,     // On the first text line
+  BRF_PAGENUM_BOTTOM_INLINE   // On the last text line
+} brf_pagenum_t;
 
-    .filter = "/usr/lib/cups/filter/cgmtopdf",
-    .envp = (char *[]) {
-            "PPD=/dev/null",
-            "CONTENT_TYPE=image/cgm",  
-            NULL
-        }
-};
+#define BRF_FORMAT_NBSP '\037'    // Non-breaking space in Braille ASCII
 
+typedef struct brf_formatter_s
+{
+  int fd;                     // Output file
+  cf_logfunc_t log;           // Log function
+  void *ld;                   // Log function data
+  int width,                  // Cells per line
+      height,                 // Text lines per page
+      top_margin,             // Blank lines at top of page
+      left_margin;            // Blank cells at start of line
+  brf_pagenum_t number_at;    // Where to put braille page numbers
+  bool separator,             // Mark print page changes?
+      separator_number;       // Put print page number in the mark?
+  int page,                   // Current braille page number
+      line;                   // Current line on page
+  bool started,               // Page started?
+      error;                  // Write error?
+  char *buffer;               // Page buffer
+  size_t buflen,              // Bytes in page buffer
+      bufsize;                // Size of page buffer
+} brf_formatter_t;
+
+extern bool brf_FormatterInit(brf_formatter_t *f, int fd, const brf_geometry_t *geom, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+extern bool brf_FormatterAddLine(brf_formatter_t *f, const char *cells, size_t len);
+extern bool brf_FormatterAddParagraph(brf_formatter_t *f, const char *cells, size_t len, int indent);
+extern bool brf_FormatterSkipLines(brf_formatter_t *f, int lines);
+extern bool brf_FormatterEndPage(brf_formatter_t *f);
+extern bool brf_FormatterPrintPage(brf_formatter_t *f, int print_page);
+extern bool brf_FormatterFinish(brf_formatter_t *f);
+
+// Paragraph translation (brf-text.c)
+typedef struct brf_text_s
+{
+  brf_formatter_t fmt;        // Braille page formatter
+  char tables[1024];          // Liblouis table list or empty string
+  cf_logfunc_t log;           // Log function
+  void *ld;                   // Log function data
+  char *para;                 // Current paragraph (UTF-8)
+  size_t paralen,             // Length of paragraph
+      parasize;               // Size of paragraph buffer
+  char *cells;                // Translated paragraph
+  size_t cellsize;            // Size of translation buffer
+} brf_text_t;
+
+extern bool brf_TextInit(brf_text_t *t, int fd, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+extern bool brf_TextAdd(brf_text_t *t, const char *text, size_t len);
+extern bool brf_TextEndLine(brf_text_t *t);
+extern bool brf_TextEndParagraph(brf_text_t *t, int indent);
+extern bool brf_TextFinish(brf_text_t *t, bool complete);
+
+// Streaming XML/HTML tokenizer (brf-markup.c)
+typedef enum brf_markup_event_e // Markup events
+{
+  BRF_MARKUP_START,           // Start tag, text is the attributes
+  BRF_MARKUP_END,             // End tag, also sent for empty elements
+  BRF_MARKUP_TEXT             // Character data, entities decoded
+} brf_markup_event_t;
 
-static cf_filter_external_t cmxtopdf_filter = {
+typedef bool (*brf_markup_cb_t)(void *data, brf_markup_event_t event, const char *name, const char *text, size_t len);
 
-    .filter = "/usr/lib/cups/filter/cmxtopdf",
-    .envp = (char *[]) {
-            "PPD=/dev/null", 
-            "CONTENT_TYPE=image/x-cmx",  
-            NULL
-        }
-};
-
-
-static cf_filter_external_t vectortobrf_filter = {
-
-    .filter = "/usr/lib/cups/filter/vectortobrf",
-    .envp = (char *[]) {
-            "PPD=/dev/null", 
-            "CONTENT_TYPE=image/vnd.cups-pdf",  
-            NULL
-        }
-};
-
-
-static cf_filter_external_t vectortoubrl_filter = {
-
-    .filter = "/usr/lib/cups/filter/vectortoubrl",
-    .envp = (char *[]) {
-           "PPD=/dev/null", 
-            "CONTENT_TYPE=image/vnd.cups-pdf",  
-            NULL
-        }
-};
-
-
-static brf_spooling_conversion_t converts[] =
+typedef enum brf_markup_state_e // Tokenizer states
+{
+  BRF_MARKUP_STATE_TEXT,      // Character data
+  BRF_MARKUP_STATE_ENTITY,    // Entity or character reference
+  BRF_MARKUP_STATE_TAG,       // Tag, declaration or processing instruction
+  BRF_MARKUP_STATE_COMMENT,   // Comment
+  BRF_MARKUP_STATE_CDATA,     // CDATA section
+  BRF_MARKUP_STATE_RAWTEXT    // HTML script or style, skipped
+} brf_markup_state_t;
+
+typedef struct brf_markup_s
 {
-    {
-        "text/plain",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
-    },
-
-    {
-        "text/html",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
-    },
-    {
-        "application/xhtml",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
-    },
-    {
-        "application/xml",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
-    },
-    {
-        "application/sgml",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
-    },
-
-    {
-        "application/vnd.cups-brf",
-        "application/vnd.cups-paged-brf",
-            {cfFilterExternal, &brftopagedbrf_filter, "brftopagedbrf"}
-    },
-    {
-        "application/vnd.cups-ubrl",
-        "application/vnd.cups-paged-ubrl",
-            {cfFilterExternal, &brftopagedbrf_filter, "brftopagedbrf"}
-    },
-   
-    {
-        "application/msword",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
-    },
-   {
-        "text/rtf",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
-    },
-    {
-        "application/rtf",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
-    },
-
-    {
-        "application/pdf",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
-    },
-
-
-    {
-        "image/gif",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/jpeg",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/pcx",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/png",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/tiff",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/vnd.microsoft.icon",
-        "application/vnd.cups-brff",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-ms-bmp",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
+  brf_markup_cb_t cb;         // Event callback
+  void *data;                 // Callback data
+  bool html;                  // HTML entities and raw text elements?
+  brf_markup_state_t state;   // Current state
+  char quote;                 // Quote character in tag or 0
+  int dashes;                 // Dashes or brackets before ">", or depth
+                              // of a DOCTYPE internal subset
+  char text[4096];            // Pending character data
+  size_t textlen;             // Length of character data
+  char tagbuf[1024];          // Default tag buffer
+  char *tag;                  // Current tag, truncated if longer
+  size_t tagsize,             // Size of tag buffer
+      taglen;                 // Length of tag
+  char entity[16];            // Current entity name
+  size_t entitylen;           // Length of entity name
+  char rawtext[16];           // End tag of raw text element
+} brf_markup_t;
+
+extern void brf_MarkupInit(brf_markup_t *m, brf_markup_cb_t cb, void *data);
+extern bool brf_MarkupParse(brf_markup_t *m, const char *buffer, size_t bytes);
+extern bool brf_MarkupFinish(brf_markup_t *m);
+extern bool brf_MarkupGetAttr(const char *attrs, const char *name, char *value, size_t valuesize);
+extern void brf_MarkupSetTagBuffer(brf_markup_t *m, char *buffer, size_t bufsize);
+
+// External tool capabilities (brf-caps.c)
+extern cf_filter_filter_in_chain_t *brf_CapsCopyFilter(const cf_filter_filter_in_chain_t *filter);
+extern brf_spooling_conversion_t *brf_CapsFindConversion(const char *srctype);
+extern void brf_CapsFreeFilter(cf_filter_filter_in_chain_t *filter);
+extern bool brf_CapsHasTool(const char *name);
+extern bool brf_CapsIsAvailable(const brf_spooling_conversion_t *conversion);
+extern void brf_CapsProbe(pappl_system_t *system, brf_spooling_conversion_t *conversions);
+extern void brf_CapsUpdate(pappl_system_t *system);
+
+// Liblouis translation (brf-louis.c)
+extern void brf_LouisCacheEvent(pappl_event_t event);
+extern void brf_LouisCachePrinters(pappl_system_t *system);
+extern bool brf_LouisCacheTables(int num_options, cups_option_t *options, int text_dots);
+extern bool brf_LouisGetTables(int num_options, cups_option_t *options, int text_dots, char *tables, size_t tablesize, cf_logfunc_t log, void *ld);
+extern time_t brf_LouisGetTablesTime(void);
+extern ssize_t brf_LouisTranslate(const char *tables, const char *text, size_t textlen, char *cells, size_t cellsize);
+
+// Job scheduling (brf-schedule.c)
+extern void brf_ScheduleEvent(pappl_event_t event);
+extern double brf_ScheduleGetWaitTime(int *count);
+extern bool brf_ScheduleStart(brf_printer_app_global_data_t *global_data);
+
+// Printer pools (brf-pool.c)
+extern bool brf_PoolDispatch(pappl_job_t *job);
+extern void brf_PoolEvent(pappl_event_t event);
+extern bool brf_PoolHasIdleMember(pappl_printer_t *printer);
+extern void brf_PoolInit(brf_printer_app_global_data_t *global_data);
+extern void brf_PoolUpdate(pappl_system_t *system);
+
+// Embosser simulator device (brf-sim.c)
+extern void brf_SimInit(brf_printer_app_global_data_t *global_data);
+
+// Concurrency stress mode (brf-stress.c)
+extern void brf_StressEvent(pappl_job_t *job, pappl_event_t event);
+extern bool brf_StressStart(brf_printer_app_global_data_t *global_data);
+
+// State file (brf-state.c)
+extern bool brf_StateInit(brf_printer_app_global_data_t *global_data);
+
+// Job logging (brf-log.c)
+extern bool brf_LogEnabled(pappl_loglevel_t level);
+extern unsigned long long brf_LogGetDropped(void);
+extern void brf_LogInit(pappl_system_t *system);
+extern void brf_LogJob(pappl_job_t *job, pappl_loglevel_t level, const char *message, ...);
+extern void brf_LogJobv(pappl_job_t *job, pappl_loglevel_t level, const char *message, va_list ap);
+
+// Job cancellation (brf-cancel.c)
+typedef struct brf_cancel_s brf_cancel_t;
+
+extern brf_cancel_t *brf_CancelCreate(pappl_job_t *job);
+extern void brf_CancelDelete(brf_cancel_t *c);
+extern int brf_CancelIsCanceled(void *data);
+extern cf_filter_filter_in_chain_t *brf_CancelStage(brf_cancel_t *c, cf_filter_filter_in_chain_t *filter);
+extern int brf_cancel_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Index embossers (index-brf.c)
+extern brf_index_t *brf_IndexCreate(pappl_printer_t *printer, pappl_device_t *device, pappl_pr_options_t *job_options, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+extern void brf_IndexDelete(brf_index_t *ix);
+extern bool brf_IndexFinish(brf_index_t *ix);
+extern int brf_IndexGetCopies(brf_index_t *ix);
+extern bool brf_IndexWrite(brf_index_t *ix, const char *buffer, size_t bytes);
+
+// Page counting (brf-progress.c)
+extern brf_progress_t *brf_ProgressCreate(pappl_job_t *job, int pages_total);
+extern void brf_ProgressCount(brf_progress_t *p, const char *buffer, size_t bytes);
+extern int brf_ProgressCountFile(const char *filename);
+extern int brf_ProgressFinish(brf_progress_t *p);
+extern int brf_count_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Translation memory (brf-memory.c)
+extern bool brf_MemoryGetStats(unsigned long long *hits, unsigned long long *misses, unsigned long long *entries, unsigned long long *used, unsigned long long *size);
+extern void brf_MemoryGetJobStats(unsigned *hits, unsigned *misses);
+extern void brf_MemoryInit(const char *spool_dir, size_t size);
+extern ssize_t brf_MemoryLookup(const char *tables, const char *text, size_t textlen, char *cells, size_t cellsize);
+extern void brf_MemoryStore(const char *tables, const char *text, size_t textlen, const char *cells, size_t count);
+
+// Job output archive (brf-archive.c)
+typedef struct brf_archive_s brf_archive_t;
+
+extern void brf_ArchiveInit(const char *spool_dir, int max_hours);
+extern brf_archive_t *brf_ArchiveCreate(int job_id, const char *username, const char *printer);
+extern void brf_ArchiveWrite(brf_archive_t *a, const char *buffer, size_t bytes);
+extern bool brf_ArchiveCheckpoint(brf_archive_t *a);
+extern bool brf_ArchiveClose(brf_archive_t *a, bool complete);
+extern int brf_resume_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// IPP client helpers (brf-client.c)
+extern http_t *brf_ClientConnect(const char *base_name, int port);
+extern int brf_ClientPrint(http_t *http, const char *printer, const char *format, const char *job_name, const char *buffer, size_t bytes);
+
+// PDF text extraction (brf-pdf.c)
+extern int brf_pdftobrf_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// ODF and OOXML text extraction (brf-office.c)
+extern int brf_officetobrf_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Plain text reflow (brf-plain.c)
+extern int brf_texttobrf_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// HTML and XML text rendering (brf-html.c)
+extern int brf_htmltobrf_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Tactile graphics (brf-tactile.c)
+typedef enum brf_dither_e     // Dither values
+{
+  BRF_DITHER_NONE,            // Contours only
+  BRF_DITHER_THRESHOLD,       // Dots where darker than half grey
+  BRF_DITHER_ORDERED,         // Ordered dithering
+  BRF_DITHER_DIFFUSION,       // Error diffusion
+  BRF_DITHER_TEXTURE          // Textures for grey levels and colours
+} brf_dither_t;
+
+typedef enum brf_edge_e       // Edge values
+{
+  BRF_EDGE_NONE,              // No contours
+  BRF_EDGE_SIMPLE,            // Gradient threshold
+  BRF_EDGE_CANNY              // Canny edge detector
+} brf_edge_t;
+
+typedef struct brf_tactile_s
 {
-        "image/x-portable-anymap",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-portable-bitmap",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-portable-graymap",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-portable-pixmap",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-xbitmap",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-xpixmap",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-    {
-        "image/x-xwindowdump",
-        "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
-    },
-
-    
-
-   {
-        "image/gif",
-        "application/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/pcx",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/png",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/tiff",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/jpeg",
-        "application/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/vnd.microsoft.icon",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-ms-bmp",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetobrf"}
-    },
-    {
-        "image/x-portable-anymap",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-portable-bitmap",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-portable-graymap",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-portable-pixmap",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-xbitmap",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-xpixmap",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-    {
-        "image/x-xwindowdump",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
-    },
-
-
-    {
-        "image/svg",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &svgtopdf_filter, "svgtopdf"}
-    },
-
-    {
-        "image/svg+xml",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &svgtopdf_filter, "svgtopdf"}
-    },
-
-    {
-        "application/x-xfig",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &xfigtopdf_filter, "xfigtopdf"}
-    },
-
-    {
-        "image/wmf",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
-    },
-
-    {
-        "image/x-wmf",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
-    },
-
-    {
-        "windows/metafile",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
-    },
-    {
-        "application/x-msmetafile",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
-    },
-    {
-        "image/emf",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &emftopdf_filter, "emftopdf"}
-    },
-    {
-        "image/x-emf",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &emftopdf_filter, "emftopdf"}
-    },
-    {
-        "image/cgm",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &cgmtopdf_filter, "cgmtopdf"}
-    },
-
-    {
-        "image/x-cmx",
-        "image/vnd.cups-pdf",
-            {cfFilterExternal, &cmxtopdf_filter, "cmxtopdf"}
-    },
-
-    {
-        "image/vnd.cups-pdf",
-        "image/vnd.cups-brf",
-            {cfFilterExternal, &vectortobrf_filter, "vectortobrf"}
-    },
-    {
-        "image/vnd.cups-pdf",
-        "image/vnd.cups-ubrl",
-            {cfFilterExternal, &vectortoubrl_filter, "vectortoubrl"}
-    },
-    {
-    NULL
-    }
-};
+  int width,                  // Width in dots
+      height;                 // Height in dots
+  brf_dither_t dither;        // How to fill areas
+  int texture;                // Texture set
+  brf_edge_t edge;            // How to find contours
+  bool negate;                // Negate the picture?
+  int edge_factor,            // Edge detection options
+      canny_radius,
+      canny_sigma,
+      canny_lower,
+      canny_upper;
+  unsigned char *rgb;         // Colour at each dot
+  unsigned char *dots;        // Raised dots, 0 or 255
+} brf_tactile_t;
+
+extern bool brf_TactileInit(brf_tactile_t *tac, int width, int height, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+extern bool brf_TactileRender(brf_tactile_t *tac);
+extern bool brf_TactileWrite(brf_tactile_t *tac, int fd, const brf_geometry_t *geom, cf_logfunc_t log, void *ld);
+extern void brf_TactileFree(brf_tactile_t *tac);
+
+// Native image conversion (brf-image.c)
+extern int brf_imagetobrf_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Native SVG rendering (brf-svg.c)
+extern int brf_svgtobrf_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Rendered graphic cache (brf-cache.c)
+extern bool brf_CacheGetStats(unsigned long long *hits, unsigned long long *misses, unsigned long long *files, unsigned long long *bytes);
+extern void brf_CacheInit(const char *spool_dir, size_t size);
+extern bool brf_CacheKey(int fd, const brf_tactile_t *tac, const brf_geometry_t *geom, int num_options, cups_option_t *options, char *key, size_t keysize);
+extern bool brf_CacheLookup(const char *key, brf_tactile_t *tac, const brf_geometry_t *geom);
+extern void brf_CacheStore(const char *key, const brf_tactile_t *tac, const brf_geometry_t *geom, int x, int y, int w, int h);
@@ -0,0 +1,288 @@
+//
+// Page counting and job progress for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The filter chain runs its stages in child processes, so a stage cannot
+// update the PAPPL job directly.  The counters live in a shared anonymous
+// mapping which the stages update as form feeds pass toward the device and
+// which a monitor thread of the job copies into "job-impressions" and
+// "job-impressions-completed".
+//
+
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_PROGRESS_INTERVAL 250000 // Microseconds between job updates
+
+// Local types...
+
+typedef struct brf_progress_shared_s // Counters shared with the filter stages
+{
+  int pages_sent;           // Pages completely sent to the device
+  int pages_total;          // Known number of pages or 0 if unknown
+  int partial;              // Data after the last form feed?
+  int stop;                 // Stop the monitor thread?
+} brf_progress_shared_t;
+
+struct brf_progress_s       // Job progress
+{
+  pappl_job_t *job;         // Job
+  brf_progress_shared_t *shared; // Shared counters
+  pthread_t tid;            // Monitor thread
+  bool running;             // Is the monitor thread running?
+  int impressions,          // Last reported impressions
+      completed;            // Last reported impressions completed
+};
+
+// Local functions...
+
+static void progress_update(brf_progress_t *p);
+static void *progress_thread(void *data);
+
+// 'brf_ProgressCount()' - Count the pages in data sent to the device.
+//
+// A page is counted when its form feed passes, data after the last form feed
+// counts as one more page when the job finishes.
+
+void
+brf_ProgressCount(
+    brf_progress_t *p,      // I - Job progress or `NULL`
+    const char *buffer,     // I - Data
+    size_t bytes)           // I - Size of data
+{
+  const char *ptr,          // Pointer into data
+      *end = buffer + bytes; // End of data
+  int pages = 0;            // Form feeds in data
+
+  if (!p || !bytes)
+    return;
+
+  for (ptr = buffer; (ptr = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL; ptr++)
+    pages++;
+
+  if (pages)
+    __atomic_add_fetch(&p->shared->pages_sent, pages, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&p->shared->partial, end[-1] != '\f', __ATOMIC_RELAXED);
+}
+
+// 'brf_ProgressCountFile()' - Count the pages of a BRF spool file.
+
+int                         // O - Number of pages or 0 on error
+brf_ProgressCountFile(
+    const char *filename)   // I - BRF file
+{
+  int fd;                   // File descriptor
+  struct stat st;           // File information
+  const char *map,          // Mapped file
+      *ptr,                 // Pointer into file
+      *end;                 // End of file
+  int pages = 0;            // Number of pages
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return (0);
+
+  if (fstat(fd, &st) || st.st_size <= 0 ||
+      (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    close(fd);
+    return (0);
+  }
+
+  close(fd);
+
+  end = map + st.st_size;
+
+  for (ptr = map; (ptr = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL; ptr++)
+    pages++;
+
+  if (end[-1] != '\f')
+    pages++;
+
+  munmap((void *)map, (size_t)st.st_size);
+
+  return (pages);
+}
+
+// 'brf_ProgressCreate()' - Start tracking the progress of a job.
+
+brf_progress_t *            // O - Job progress or `NULL` on error
+brf_ProgressCreate(
+    pappl_job_t *job,       // I - Job
+    int pages_total)        // I - Number of pages or 0 if unknown
+{
+  brf_progress_t *p;        // Job progress
+
+  if ((p = (brf_progress_t *)calloc(1, sizeof(brf_progress_t))) == NULL)
+    return (NULL);
+
+  if ((p->shared = (brf_progress_shared_t *)mmap(NULL, sizeof(brf_progress_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to map page counters: %s", strerror(errno));
+    free(p);
+    return (NULL);
+  }
+
+  p->job = job;
+  p->shared->pages_total = pages_total;
+
+  progress_update(p);
+
+  if (pthread_create(&p->tid, NULL, progress_thread, p))
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to start progress thread, pages are only counted at the end of the job.");
+  else
+    p->running = true;
+
+  return (p);
+}
+
+// 'brf_ProgressFinish()' - Stop tracking the progress and set the final
+//                          page counts.
+
+int                         // O - Number of pages sent
+brf_ProgressFinish(
+    brf_progress_t *p)      // I - Job progress or `NULL`
+{
+  int pages;                // Number of pages sent
+
+  if (!p)
+    return (0);
+
+  if (p->running)
+  {
+    __atomic_store_n(&p->shared->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(p->tid, NULL);
+  }
+
+  if (p->shared->partial)
+  {
+    p->shared->pages_sent++;
+    p->shared->partial = 0;
+  }
+
+  p->shared->pages_total = p->shared->pages_sent;
+
+  progress_update(p);
+
+  pages = p->shared->pages_sent;
+
+  papplLogJob(p->job, PAPPL_LOGLEVEL_INFO, "Sent %d pages.", pages);
+
+  munmap(p->shared, sizeof(brf_progress_shared_t));
+  free(p);
+
+  return (pages);
+}
+
+// 'brf_count_filter_function()' - Count pages on their way to the device.
+//
+// This filter copies its input unchanged, it is used in front of stages
+// which do not see the BRF pages themselves, like the packed storage.
+
+int                         // O - Exit status
+brf_count_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Job progress
+{
+  brf_progress_t *p = (brf_progress_t *)parameters;
+                            // Job progress
+  char buffer[65536];       // Copy buffer
+  const char *ptr;          // Pointer into buffer
+  ssize_t bytes,            // Bytes read
+      written;              // Bytes written
+
+  (void)inputseekable;
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (data->logfunc)
+        (data->logfunc)(data->logdata, CF_LOGLEVEL_ERROR, "brf_count_filter_function: Unable to read: %s", strerror(errno));
+      return (1);
+    }
+
+    for (ptr = buffer; ptr < (buffer + bytes); ptr += written)
+    {
+      if ((written = write(outputfd, ptr, (size_t)(buffer + bytes - ptr))) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+          written = 0;
+          continue;
+        }
+
+        if (data->logfunc)
+          (data->logfunc)(data->logdata, CF_LOGLEVEL_ERROR, "brf_count_filter_function: Unable to write: %s", strerror(errno));
+        return (1);
+      }
+    }
+
+    brf_ProgressCount(p, buffer, (size_t)bytes);
+  }
+
+  return (0);
+}
+
+// 'progress_thread()' - Copy the page counters into the job.
+
+static void *               // O - Thread exit status
+progress_thread(void *data) // I - Job progress
+{
+  brf_progress_t *p = (brf_progress_t *)data;
+                            // Job progress
+
+  for (;;)
+  {
+    usleep(BRF_PROGRESS_INTERVAL);
+
+    if (__atomic_load_n(&p->shared->stop, __ATOMIC_RELAXED))
+      break;
+
+    progress_update(p);
+  }
+
+  return (NULL);
+}
+
+// 'progress_update()' - Update the job attributes if the counts changed.
+//
+// While the total is unknown the job shows one page more than was sent, so
+// that clients see the job is still growing.
+
+static void
+progress_update(brf_progress_t *p) // I - Job progress
+{
+  int sent = __atomic_load_n(&p->shared->pages_sent, __ATOMIC_RELAXED),
+      total = __atomic_load_n(&p->shared->pages_total, __ATOMIC_RELAXED);
+                                   // Current counts
+
+  if (!total || total < sent)
+    total = sent + (__atomic_load_n(&p->shared->stop, __ATOMIC_RELAXED) ? 0 : 1);
+
+  if (total != p->impressions)
+  {
+    papplJobSetImpressions(p->job, total);
+    p->impressions = total;
+  }
+
+  if (sent != p->completed)
+  {
+    papplJobSetImpressionsCompleted(p->job, sent - p->completed);
+    p->completed = sent;
+  }
+}
@@ -0,0 +1,578 @@
+//
+// Job scheduling for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL runs the pending jobs of a printer in FIFO order.  With the "sjf"
+// policy the scheduler thread holds new pending jobs and releases the one
+// with the smallest estimated size whenever the printer runs out of work.
+// Waiting jobs age: every minute of waiting takes "job-aging" pages off the
+// estimate, so long jobs still get their turn.  With both policies each
+// waiting job gets an estimated start and finish time as its job message.
+//
+// Jobs of printer pools are always held and released one at a time, in
+// policy order, while a pool member is idle.  They wait on the pool, never
+// on the queue of a busy member, so that any member which runs out of work
+// takes the next one; this replaces moving queued jobs between members.
+//
+
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_SCHEDULE_INTERVAL 5     // Seconds between scheduler passes
+#define BRF_SCHEDULE_PAGE_TIME 10.0 // Initial seconds per page
+#define BRF_SCHEDULE_MAX_JOBS 1000  // Maximum active jobs per printer
+
+// Local types...
+
+typedef struct brf_sched_job_s      // Job known to the scheduler
+{
+  int printer_id,                   // Printer ID
+      job_id;                       // Job ID
+  int pages;                        // Estimated number of pages
+  time_t created;                   // Time job was seen first
+  bool held,                        // Held by the scheduler?
+      seen;                         // Seen in the current pass?
+} brf_sched_job_t;
+
+typedef struct brf_sched_printer_s  // Printer known to the scheduler
+{
+  int printer_id;                   // Printer ID
+  int job_id;                       // Processing job or 0
+  time_t started,                   // Time processing job was seen first
+      last_seen;                    // Time processing job was seen last
+  int completed;                    // Pages completed at last_seen
+  double page_time;                 // Average seconds per page
+} brf_sched_printer_t;
+
+typedef struct brf_sched_wait_s     // Waiting job
+{
+  brf_sched_job_t *j;               // Scheduler job
+  pappl_job_t *job;                 // PAPPL job
+  double score;                     // Sort key, smaller goes first
+} brf_sched_wait_t;
+
+typedef struct brf_sched_active_s   // Active jobs of a printer
+{
+  int num_jobs;                     // Number of jobs
+  pappl_job_t *jobs[BRF_SCHEDULE_MAX_JOBS];
+                                    // Jobs
+} brf_sched_active_t;
+
+// Local functions...
+
+static int sched_compare_jobs(brf_sched_job_t *a, brf_sched_job_t *b, void *data);
+static int sched_compare_printers(brf_sched_printer_t *a, brf_sched_printer_t *b, void *data);
+static int sched_compare_waits(const void *a, const void *b);
+static void sched_collect_cb(pappl_job_t *job, void *data);
+static int sched_estimate(pappl_job_t *job);
+static brf_sched_job_t *sched_find_job(int printer_id, int job_id);
+static void sched_list_cb(pappl_printer_t *printer, void *data);
+static void sched_printer(pappl_printer_t *printer);
+static double sched_score(brf_sched_job_t *j, time_t now);
+static void *sched_thread(void *data);
+
+// Local globals...
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for wakeup and statistics
+static pthread_cond_t sched_cond = PTHREAD_COND_INITIALIZER;
+                                    // Wakeup condition
+static bool sched_wakeup = false;   // Wake up the scheduler thread?
+static brf_schedule_t sched_policy = BRF_SCHEDULE_FIFO;
+                                    // Scheduling policy
+static int sched_aging = 10;        // Pages per minute of waiting
+static bool sched_pools = false;    // Manage printer pools?
+static cups_array_t *sched_jobs = NULL,
+                                    // Known jobs
+    *sched_printers = NULL;         // Known printers
+static double sched_wait_total = 0.0; // Total waiting time of started jobs
+static int sched_wait_count = 0;    // Number of started jobs
+
+// 'brf_ScheduleEvent()' - Wake up the scheduler for job events.
+//
+// This is called from the system event callback which holds PAPPL locks, so
+// the work happens in the scheduler thread.
+
+void
+brf_ScheduleEvent(pappl_event_t event) // I - Event
+{
+  if (!(event & (PAPPL_EVENT_JOB_CREATED | PAPPL_EVENT_JOB_COMPLETED | PAPPL_EVENT_JOB_STATE_CHANGED)))
+    return;
+
+  pthread_mutex_lock(&sched_lock);
+  sched_wakeup = true;
+  pthread_cond_signal(&sched_cond);
+  pthread_mutex_unlock(&sched_lock);
+}
+
+// 'brf_ScheduleGetWaitTime()' - Get the mean waiting time of started jobs.
+
+double                              // O - Mean waiting time in seconds
+brf_ScheduleGetWaitTime(int *count) // O - Number of started jobs or `NULL`
+{
+  double mean;                      // Mean waiting time
+
+  pthread_mutex_lock(&sched_lock);
+  mean = sched_wait_count ? sched_wait_total / sched_wait_count : 0.0;
+  if (count)
+    *count = sched_wait_count;
+  pthread_mutex_unlock(&sched_lock);
+
+  return (mean);
+}
+
+// 'brf_ScheduleStart()' - Start the scheduler thread.
+
+bool // O - `true` on success, `false` on error
+brf_ScheduleStart(
+    brf_printer_app_global_data_t *global_data) // I - Global data
+{
+  pthread_t tid;       // Thread ID
+  pthread_attr_t attr; // Thread attributes
+
+  sched_policy = global_data->scheduling;
+  sched_pools = global_data->printer_pools;
+  sched_aging = global_data->job_aging;
+  sched_jobs = cupsArrayNew((cups_array_func_t)sched_compare_jobs, NULL);
+  sched_printers = cupsArrayNew((cups_array_func_t)sched_compare_printers, NULL);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&tid, &attr, sched_thread, global_data->system))
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR, "Unable to start job scheduler: %s", strerror(errno));
+    pthread_attr_destroy(&attr);
+    return (false);
+  }
+
+  pthread_attr_destroy(&attr);
+
+  papplLog(global_data->system, PAPPL_LOGLEVEL_INFO, "Job scheduling policy is %s, aging %d pages per minute.", sched_policy == BRF_SCHEDULE_SJF ? "sjf" : "fifo", sched_aging);
+
+  return (true);
+}
+
+// 'sched_collect_cb()' - Collect the active jobs of a printer.
+
+static void
+sched_collect_cb(pappl_job_t *job, // I - Job
+                 void *data)       // I - Active jobs
+{
+  brf_sched_active_t *active = (brf_sched_active_t *)data;
+                                   // Active jobs
+
+  if (active->num_jobs < BRF_SCHEDULE_MAX_JOBS)
+    active->jobs[active->num_jobs++] = job;
+}
+
+// 'sched_compare_jobs()' - Compare two scheduler jobs.
+
+static int                          // O - Result of comparison
+sched_compare_jobs(brf_sched_job_t *a, // I - First job
+                   brf_sched_job_t *b, // I - Second job
+                   void *data)         // I - Callback data (unused)
+{
+  (void)data;
+
+  if (a->printer_id != b->printer_id)
+    return (a->printer_id - b->printer_id);
+  else
+    return (a->job_id - b->job_id);
+}
+
+// 'sched_compare_printers()' - Compare two scheduler printers.
+
+static int                                  // O - Result of comparison
+sched_compare_printers(brf_sched_printer_t *a, // I - First printer
+                       brf_sched_printer_t *b, // I - Second printer
+                       void *data)             // I - Callback data (unused)
+{
+  (void)data;
+
+  return (a->printer_id - b->printer_id);
+}
+
+// 'sched_compare_waits()' - Compare two waiting jobs.
+
+static int                      // O - Result of comparison
+sched_compare_waits(const void *a, // I - First job
+                    const void *b) // I - Second job
+{
+  const brf_sched_wait_t *wa = (const brf_sched_wait_t *)a,
+                         *wb = (const brf_sched_wait_t *)b;
+                                // Waiting jobs
+
+  if (wa->score < wb->score)
+    return (-1);
+  else if (wa->score > wb->score)
+    return (1);
+  else
+    return (wa->j->job_id - wb->j->job_id);
+}
+
+// 'sched_estimate()' - Estimate the number of pages of a job.
+//
+// BRF jobs are counted, other formats use the size of the document and a
+// rough number of bytes per braille page for the format.
+
+static int                  // O - Estimated number of pages
+sched_estimate(pappl_job_t *job) // I - Job
+{
+  const char *format = papplJobGetFormat(job),
+                            // Document format
+      *filename = papplJobGetFilename(job);
+                            // Document file
+  struct stat st;           // Document information
+  size_t i;                 // Looping var
+  int pages;                // Number of pages
+  static const struct
+  {
+    const char *prefix;     // MIME media type prefix
+    int bytes;              // Bytes per braille page, 0 for one page
+  } sizes[] =
+  {
+    { "text/plain", 800 },
+    { "text/html", 2500 },
+    { "application/xhtml", 2500 },
+    { "application/xml", 2500 },
+    { "application/sgml", 2500 },
+    { "text/rtf", 1500 },
+    { "application/rtf", 1500 },
+    { "application/msword", 4000 },
+    { "application/pdf", 15000 },
+    { "image/", 0 },
+    { "application/vnd.cups-brf-resume", 0 },
+    { "", 2000 }
+  };
+
+  if (!format || !filename || stat(filename, &st))
+    return (1);
+
+  if (!strcmp(format, "application/vnd.cups-brf"))
+    return (brf_ProgressCountFile(filename));
+
+  if (!strcmp(format, "application/vnd.cups-packed-brf"))
+  {
+    int fd;                 // Document file descriptor
+    void *map;              // Mapped document
+    unsigned num_pages = 0; // Number of pages
+
+    if (st.st_size > 0 && (fd = open(filename, O_RDONLY)) >= 0)
+    {
+      if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+      {
+        brf_PackPageOffset((const unsigned char *)map, (size_t)st.st_size, 1, &num_pages);
+        munmap(map, (size_t)st.st_size);
+      }
+
+      close(fd);
+    }
+
+    return (num_pages > 0 ? (int)num_pages : 1);
+  }
+
+  for (i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++)
+  {
+    if (!strncmp(format, sizes[i].prefix, strlen(sizes[i].prefix)))
+      break;
+  }
+
+  if (i >= (sizeof(sizes) / sizeof(sizes[0])) || !sizes[i].bytes)
+    return (1);
+
+  pages = (int)(st.st_size / sizes[i].bytes) + 1;
+
+  return (pages);
+}
+
+// 'sched_find_job()' - Find a scheduler job.
+
+static brf_sched_job_t *    // O - Job or `NULL`
+sched_find_job(int printer_id, // I - Printer ID
+               int job_id)     // I - Job ID
+{
+  brf_sched_job_t key;      // Search key
+
+  key.printer_id = printer_id;
+  key.job_id = job_id;
+
+  return ((brf_sched_job_t *)cupsArrayFind(sched_jobs, &key));
+}
+
+// 'sched_list_cb()' - Collect the IDs of all printers.
+
+static void
+sched_list_cb(pappl_printer_t *printer, // I - Printer
+              void *data)               // I - Array of printer IDs
+{
+  cups_array_t *ids = (cups_array_t *)data; // Printer IDs
+
+  cupsArrayAdd(ids, (void *)(intptr_t)papplPrinterGetID(printer));
+}
+
+// 'sched_printer()' - Schedule the jobs of a printer.
+
+static void
+sched_printer(pappl_printer_t *printer) // I - Printer
+{
+  brf_sched_active_t *active;              // Active jobs
+  brf_sched_printer_t key,                 // Printer search key
+      *p;                                  // Scheduler printer
+  brf_sched_job_t *j;                      // Scheduler job
+  brf_sched_wait_t *waits;                 // Waiting jobs
+  int i,                                   // Looping var
+      num_waits = 0,                       // Number of waiting jobs
+      printer_id = papplPrinterGetID(printer);
+                                           // Printer ID
+  pappl_job_t *processing = NULL;          // Processing job
+  bool busy = false,                       // Printer has work?
+      pool = sched_pools && !strncmp(papplPrinterGetDeviceURI(printer), "pool:", 5);
+                                           // Is this a printer pool?
+  time_t now = time(NULL);                 // Current time
+  double start;                            // Estimated start time
+
+  if ((active = (brf_sched_active_t *)calloc(1, sizeof(brf_sched_active_t))) == NULL)
+    return;
+
+  if ((waits = (brf_sched_wait_t *)calloc(BRF_SCHEDULE_MAX_JOBS, sizeof(brf_sched_wait_t))) == NULL)
+  {
+    free(active);
+    return;
+  }
+
+  papplPrinterIterateActiveJobs(printer, sched_collect_cb, active, 1, BRF_SCHEDULE_MAX_JOBS);
+
+  key.printer_id = printer_id;
+  if ((p = (brf_sched_printer_t *)cupsArrayFind(sched_printers, &key)) == NULL)
+  {
+    if ((p = (brf_sched_printer_t *)calloc(1, sizeof(brf_sched_printer_t))) == NULL)
+    {
+      free(active);
+      free(waits);
+      return;
+    }
+
+    p->printer_id = printer_id;
+    p->page_time = BRF_SCHEDULE_PAGE_TIME;
+    cupsArrayAdd(sched_printers, p);
+  }
+
+  for (j = (brf_sched_job_t *)cupsArrayFirst(sched_jobs); j; j = (brf_sched_job_t *)cupsArrayNext(sched_jobs))
+  {
+    if (j->printer_id == printer_id)
+      j->seen = false;
+  }
+
+  for (i = 0; i < active->num_jobs; i++)
+  {
+    pappl_job_t *job = active->jobs[i]; // Current job
+    int job_id = papplJobGetID(job);    // Job ID
+    ipp_jstate_t state = papplJobGetState(job);
+                                        // Job state
+
+    if (state == IPP_JSTATE_PROCESSING || state == IPP_JSTATE_STOPPED)
+    {
+      processing = job;
+      busy = true;
+
+      // Measure the waiting time of the job and the speed of the
+      // embosser...
+      if (p->job_id != job_id)
+      {
+        p->job_id = job_id;
+        p->started = now;
+
+        int wait = (int)(now - papplJobGetTimeCreated(job)),
+                                    // Waiting time of this job
+            count;                  // Number of started jobs
+        double mean;                // Mean waiting time
+
+        pthread_mutex_lock(&sched_lock);
+        sched_wait_total += wait;
+        sched_wait_count ++;
+        mean = sched_wait_total / sched_wait_count;
+        count = sched_wait_count;
+        pthread_mutex_unlock(&sched_lock);
+
+        papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Started after waiting %d seconds, mean wait %.1f seconds over %d jobs.", wait, mean, count);
+      }
+
+      p->last_seen = now;
+      p->completed = papplJobGetImpressionsCompleted(job);
+    }
+
+    if ((j = sched_find_job(printer_id, job_id)) == NULL)
+    {
+      // New jobs are held by PAPPL until their documents arrive...
+      if (state != IPP_JSTATE_PENDING && state != IPP_JSTATE_PROCESSING)
+        continue;
+
+      if ((j = (brf_sched_job_t *)calloc(1, sizeof(brf_sched_job_t))) == NULL)
+        continue;
+
+      j->printer_id = printer_id;
+      j->job_id = job_id;
+      j->pages = sched_estimate(job);
+      j->created = now;
+      j->seen = true;
+
+      cupsArrayAdd(sched_jobs, j);
+
+      if (state != IPP_JSTATE_PENDING)
+        continue;
+
+      papplJobSetImpressions(job, j->pages);
+
+      if ((sched_policy == BRF_SCHEDULE_SJF || pool) && papplJobHold(job, NULL, "indefinite", 0))
+      {
+        j->held = true;
+        papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Estimated %d pages, waiting for %s.", j->pages, pool ? "an idle pool member" : "the scheduler");
+        state = IPP_JSTATE_HELD;
+      }
+    }
+
+    j->seen = true;
+
+    if (state == IPP_JSTATE_PENDING)
+      busy = true;
+
+    // Pending jobs go first, then the jobs held by the scheduler...
+    if (state == IPP_JSTATE_PENDING || (state == IPP_JSTATE_HELD && j->held))
+    {
+      waits[num_waits].j = j;
+      waits[num_waits].job = job;
+      waits[num_waits].score = state == IPP_JSTATE_PENDING ? -1e9 : sched_policy == BRF_SCHEDULE_SJF ? sched_score(j, now) : (double)job_id;
+      num_waits++;
+    }
+  }
+
+  // Finish the speed measurement when the processing job is done...
+  if (!processing && p->job_id)
+  {
+    if (p->completed > 0 && p->last_seen > p->started)
+      p->page_time = 0.7 * p->page_time + 0.3 * (double)(p->last_seen - p->started) / p->completed;
+
+    p->job_id = 0;
+  }
+
+  // Forget jobs that are no longer active...
+  for (j = (brf_sched_job_t *)cupsArrayFirst(sched_jobs); j; j = (brf_sched_job_t *)cupsArrayNext(sched_jobs))
+  {
+    if (j->printer_id == printer_id && !j->seen)
+    {
+      cupsArrayRemove(sched_jobs, j);
+      free(j);
+    }
+  }
+
+  qsort(waits, (size_t)num_waits, sizeof(brf_sched_wait_t), sched_compare_waits);
+
+  // Release the best job when the printer runs out of work, and for pools
+  // only when a member can print it right away...
+  if (!busy && num_waits > 0 && waits[0].j->held && (!pool || brf_PoolHasIdleMember(printer)) && papplJobRelease(waits[0].job, NULL))
+  {
+    int wait = (int)(now - papplJobGetTimeCreated(waits[0].job));
+                                  // Waiting time
+
+    waits[0].j->held = false;
+
+    papplLogJob(waits[0].job, PAPPL_LOGLEVEL_INFO, "Scheduled after %d seconds, %d pages estimated.", wait, waits[0].j->pages);
+  }
+
+  // Show estimated start and finish times...
+  start = (double)now;
+  if (processing && (j = sched_find_job(printer_id, papplJobGetID(processing))) != NULL && j->pages > p->completed)
+    start += (j->pages - p->completed) * p->page_time;
+
+  for (i = 0; i < num_waits; i++)
+  {
+    char start_str[32],           // Start time
+        finish_str[32];           // Finish time
+    time_t start_time = (time_t)start,
+        finish_time = (time_t)(start + waits[i].j->pages * p->page_time);
+    struct tm start_tm,           // Start date/time
+        finish_tm;                // Finish date/time
+
+    localtime_r(&start_time, &start_tm);
+    localtime_r(&finish_time, &finish_tm);
+    strftime(start_str, sizeof(start_str), "%H:%M", &start_tm);
+    strftime(finish_str, sizeof(finish_str), "%H:%M", &finish_tm);
+
+    papplJobSetMessage(waits[i].job, "Estimated start %s, finish %s.", start_str, finish_str);
+
+    start += waits[i].j->pages * p->page_time;
+  }
+
+  free(active);
+  free(waits);
+}
+
+// 'sched_score()' - Compute the aged size of a job, smaller goes first.
+
+static double             // O - Score
+sched_score(brf_sched_job_t *j, // I - Scheduler job
+            time_t now)         // I - Current time
+{
+  return (j->pages - sched_aging * (double)(now - j->created) / 60.0);
+}
+
+// 'sched_thread()' - Schedule jobs after job events and periodically.
+
+static void *             // O - Thread exit status
+sched_thread(void *data)  // I - System
+{
+  pappl_system_t *system = (pappl_system_t *)data;
+                          // System
+  struct timespec timeout; // Wakeup time
+  cups_array_t *ids = cupsArrayNew(NULL, NULL);
+                          // Printer IDs
+  void *id;               // Current printer ID
+  pappl_printer_t *printer; // Current printer
+
+  for (;;)
+  {
+    pthread_mutex_lock(&sched_lock);
+
+    if (!sched_wakeup)
+    {
+      clock_gettime(CLOCK_REALTIME, &timeout);
+      timeout.tv_sec += BRF_SCHEDULE_INTERVAL;
+      pthread_cond_timedwait(&sched_cond, &sched_lock, &timeout);
+    }
+
+    sched_wakeup = false;
+    pthread_mutex_unlock(&sched_lock);
+
+    // Hold and release jobs outside of the printer iteration, which keeps
+    // the system locked...
+    papplSystemIteratePrinters(system, sched_list_cb, ids);
+
+    for (id = cupsArrayFirst(ids); id; id = cupsArrayNext(ids))
+    {
+      if ((printer = papplSystemFindPrinter(system, NULL, (int)(intptr_t)id, NULL)) != NULL)
+        sched_printer(printer);
+    }
+
+    cupsArrayClear(ids);
+
+    if (sched_pools)
+      brf_PoolUpdate(system);
+
+    // Keep the liblouis tables of the printer defaults compiled...
+    brf_LouisCachePrinters(system);
+
+    // Probe the external tools again after SIGHUP...
+    brf_CapsUpdate(system);
+  }
+
+  return (NULL);
+}
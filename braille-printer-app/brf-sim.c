@@ -0,0 +1,378 @@
+//
+// Embosser simulator device for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The "sim" device scheme consumes BRF and Index escape streams like an
+// embosser would, so that the job path can be load-tested without one:
+//
+//   sim://NAME?cps=CHARS&ppm=PAGES&jam=PAGE&paper-out=PAGE&disconnect=PAGE&wait=SECONDS
+//
+// Data is taken at "cps" characters per second and every form feed ends a
+// page which takes at least 60/"ppm" seconds, 0 (the default) for no limit.
+// When the given page of a job starts, "jam" and "disconnect" fail the job
+// with the media-jam or offline state, and "paper-out" stalls it with the
+// media-empty state for "wait" seconds (default 10).  The time, bytes and
+// page of every page end and fault are appended to "<spool>/sim/NAME.log".
+//
+
+#include <pappl/pappl.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local types...
+
+typedef struct brf_sim_s              // Simulated embosser
+{
+  char name[256];                     // Device name
+  double cps,                         // Characters per second or 0
+      ppm;                            // Pages per minute or 0
+  int jam,                            // Page which jams or 0
+      paper_out,                      // Page without paper or 0
+      disconnect,                     // Page which disconnects or 0
+      wait;                           // Seconds without paper
+  int log_fd;                         // Timeline log or -1
+  struct timespec start,              // Time of open
+      page_start,                     // Time the current page started
+      rate_start;                     // Start of the character rate
+  unsigned long long bytes,           // Bytes received
+      rate_bytes;                     // Bytes received since rate_start
+  int page;                           // Current page, starting at 1
+  bool page_begun;                    // Has the current page received data?
+  pappl_preason_t reason;             // Current state reason
+} brf_sim_t;
+
+// Local functions...
+
+static void sim_close_cb(pappl_device_t *device);
+static char *sim_id_cb(pappl_device_t *device, char *buffer, size_t bufsize);
+static bool sim_list_cb(pappl_device_cb_t cb, void *data, pappl_deverror_cb_t err_cb, void *err_data);
+static void sim_log(brf_sim_t *sim, const char *message, ...);
+static bool sim_open_cb(pappl_device_t *device, const char *device_uri, const char *name);
+static ssize_t sim_read_cb(pappl_device_t *device, void *buffer, size_t bytes);
+static pappl_preason_t sim_status_cb(pappl_device_t *device);
+static void sim_wait(const struct timespec *from, double seconds);
+static ssize_t sim_write_cb(pappl_device_t *device, const void *buffer, size_t bytes);
+
+// Local globals...
+
+static char sim_dir[1024] = "";       // Directory for timeline logs
+
+// 'brf_SimInit()' - Register the simulator device scheme.
+
+void
+brf_SimInit(
+    brf_printer_app_global_data_t *global_data) // I - Global data
+{
+  snprintf(sim_dir, sizeof(sim_dir), "%s/sim", global_data->spool_dir);
+
+  if (mkdir(sim_dir, 0700) && errno != EEXIST)
+    sim_dir[0] = '\0';
+
+  papplDeviceAddScheme("sim", PAPPL_DEVTYPE_CUSTOM_LOCAL, sim_list_cb, sim_open_cb, sim_close_cb, sim_read_cb, sim_write_cb, sim_status_cb, sim_id_cb);
+}
+
+// 'sim_close_cb()' - Close a simulator device.
+
+static void
+sim_close_cb(pappl_device_t *device)  // I - Device
+{
+  brf_sim_t *sim = (brf_sim_t *)papplDeviceGetData(device);
+                                      // Simulated embosser
+  struct timespec now;                // Current time
+  double seconds;                     // Time since open
+
+  if (!sim)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  seconds = (now.tv_sec - sim->start.tv_sec) + (now.tv_nsec - sim->start.tv_nsec) / 1000000000.0;
+
+  sim_log(sim, "close pages %d bytes %llu cps %.1f", sim->page - (sim->page_begun ? 0 : 1), sim->bytes, seconds > 0.0 ? sim->bytes / seconds : 0.0);
+
+  if (sim->log_fd >= 0)
+    close(sim->log_fd);
+
+  free(sim);
+  papplDeviceSetData(device, NULL);
+}
+
+// 'sim_id_cb()' - Get the IEEE-1284 device ID of a simulator device.
+
+static char *                         // O - Device ID
+sim_id_cb(pappl_device_t *device,     // I - Device
+          char *buffer,               // I - Buffer
+          size_t bufsize)             // I - Size of buffer
+{
+  (void)device;
+
+  papplCopyString(buffer, "MFG:Generic;MDL:Braille Simulator;CMD:BRF;", bufsize);
+
+  return (buffer);
+}
+
+// 'sim_list_cb()' - List the default simulator device.
+
+static bool                           // O - `true` if the callback stopped the list
+sim_list_cb(pappl_device_cb_t cb,     // I - Device callback
+            void *data,               // I - Callback data
+            pappl_deverror_cb_t err_cb, // I - Error callback (unused)
+            void *err_data)           // I - Error callback data (unused)
+{
+  (void)err_cb;
+  (void)err_data;
+
+  return ((cb)("Braille Embosser Simulator", "sim://embosser?cps=120&ppm=2", "MFG:Generic;MDL:Braille Simulator;CMD:BRF;", data));
+}
+
+// 'sim_log()' - Append a line to the timeline log.
+
+static void
+sim_log(brf_sim_t *sim,               // I - Simulated embosser
+        const char *message,          // I - Printf-style message
+        ...)                          // I - Additional arguments
+{
+  va_list ap;                         // Argument pointer
+  char line[1024];                    // Log line
+  struct timespec now;                // Current time
+  int len;                            // Length of prefix
+
+  if (sim->log_fd < 0)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  len = snprintf(line, sizeof(line), "%.3f ", (now.tv_sec - sim->start.tv_sec) + (now.tv_nsec - sim->start.tv_nsec) / 1000000000.0);
+
+  va_start(ap, message);
+  vsnprintf(line + len, sizeof(line) - (size_t)len - 1, message, ap);
+  va_end(ap);
+
+  // One write per line, so that lines of different jobs do not mix...
+  len = (int)strlen(line);
+  line[len++] = '\n';
+
+  if (write(sim->log_fd, line, (size_t)len) < 0)
+    return;
+}
+
+// 'sim_open_cb()' - Open a simulator device.
+
+static bool                           // O - `true` on success, `false` on error
+sim_open_cb(pappl_device_t *device,   // I - Device
+            const char *device_uri,   // I - Device URI
+            const char *name)         // I - Job name
+{
+  brf_sim_t *sim;                     // Simulated embosser
+  char scheme[32],                    // URI scheme
+      userpass[256],                  // URI user name (unused)
+      resource[1024],                 // URI resource with options
+      filename[2048],                 // Timeline log
+      *ptr,                           // Pointer into options
+      *next,                          // Next option
+      *value;                         // Option value
+  int port;                           // URI port (unused)
+  time_t curtime = time(NULL);        // Current time
+  struct tm curdate;                  // Current date
+
+  if ((sim = (brf_sim_t *)calloc(1, sizeof(brf_sim_t))) == NULL)
+  {
+    papplDeviceError(device, "Unable to allocate memory for simulator: %s", strerror(errno));
+    return (false);
+  }
+
+  if (httpSeparateURI(HTTP_URI_CODING_ALL, device_uri, scheme, sizeof(scheme), userpass, sizeof(userpass), sim->name, sizeof(sim->name), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK || !sim->name[0] || strchr(sim->name, '/'))
+  {
+    papplDeviceError(device, "Bad simulator URI '%s'.", device_uri);
+    free(sim);
+    return (false);
+  }
+
+  sim->wait = 10;
+  sim->page = 1;
+
+  for (ptr = strchr(resource, '?'); ptr; ptr = next)
+  {
+    if ((next = strchr(++ptr, '&')) != NULL)
+      *next = '\0';
+
+    if ((value = strchr(ptr, '=')) == NULL)
+      continue;
+
+    *value++ = '\0';
+
+    if (!strcmp(ptr, "cps"))
+      sim->cps = strtod(value, NULL);
+    else if (!strcmp(ptr, "ppm"))
+      sim->ppm = strtod(value, NULL);
+    else if (!strcmp(ptr, "jam"))
+      sim->jam = atoi(value);
+    else if (!strcmp(ptr, "paper-out"))
+      sim->paper_out = atoi(value);
+    else if (!strcmp(ptr, "disconnect"))
+      sim->disconnect = atoi(value);
+    else if (!strcmp(ptr, "wait"))
+      sim->wait = atoi(value);
+    else
+    {
+      papplDeviceError(device, "Unknown simulator option '%s'.", ptr);
+      free(sim);
+      return (false);
+    }
+  }
+
+  sim->log_fd = -1;
+
+  if (sim_dir[0])
+  {
+    snprintf(filename, sizeof(filename), "%s/%s.log", sim_dir, sim->name);
+    sim->log_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &sim->start);
+  sim->page_start = sim->rate_start = sim->start;
+
+  localtime_r(&curtime, &curdate);
+  strftime(filename, sizeof(filename), "%Y-%m-%dT%H:%M:%S", &curdate);
+  sim_log(sim, "open \"%s\" at %s cps %g ppm %g", name ? name : "", filename, sim->cps, sim->ppm);
+
+  papplDeviceSetData(device, sim);
+
+  return (true);
+}
+
+// 'sim_read_cb()' - Read from a simulator device.
+
+static ssize_t                        // O - Number of bytes read
+sim_read_cb(pappl_device_t *device,   // I - Device
+            void *buffer,             // I - Read buffer
+            size_t bytes)             // I - Size of buffer
+{
+  (void)device;
+  (void)buffer;
+  (void)bytes;
+
+  return (0);
+}
+
+// 'sim_status_cb()' - Get the status of a simulator device.
+
+static pappl_preason_t                // O - Printer state reasons
+sim_status_cb(pappl_device_t *device) // I - Device
+{
+  brf_sim_t *sim = (brf_sim_t *)papplDeviceGetData(device);
+                                      // Simulated embosser
+
+  return (sim ? sim->reason : PAPPL_PREASON_NONE);
+}
+
+// 'sim_wait()' - Sleep until some time after a start time.
+
+static void
+sim_wait(const struct timespec *from, // I - Start time
+         double seconds)              // I - Seconds after start time
+{
+  struct timespec until;              // Wakeup time
+
+  until.tv_sec = from->tv_sec + (time_t)seconds;
+  until.tv_nsec = from->tv_nsec + (long)((seconds - (time_t)seconds) * 1000000000.0);
+
+  if (until.tv_nsec >= 1000000000)
+  {
+    until.tv_sec ++;
+    until.tv_nsec -= 1000000000;
+  }
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+// 'sim_write_cb()' - Write to a simulator device.
+
+static ssize_t                        // O - Number of bytes written or -1 on error
+sim_write_cb(pappl_device_t *device,  // I - Device
+             const void *buffer,      // I - Data
+             size_t bytes)            // I - Size of data
+{
+  brf_sim_t *sim = (brf_sim_t *)papplDeviceGetData(device);
+                                      // Simulated embosser
+  const char *ptr = (const char *)buffer,
+                                      // Pointer into data
+      *end = ptr + bytes,             // End of data
+      *ff;                            // Form feed
+  size_t len;                         // Length of segment
+
+  if (!sim)
+    return (-1);
+
+  while (ptr < end)
+  {
+    // Faults happen when a page starts...
+    if (!sim->page_begun)
+    {
+      if (sim->page == sim->jam)
+      {
+        sim->reason = PAPPL_PREASON_MEDIA_JAM;
+        sim_log(sim, "jam page %d bytes %llu", sim->page, sim->bytes);
+        papplDeviceError(device, "Paper jam on page %d.", sim->page);
+        return (-1);
+      }
+      else if (sim->page == sim->disconnect)
+      {
+        sim->reason = PAPPL_PREASON_OFFLINE;
+        sim_log(sim, "disconnect page %d bytes %llu", sim->page, sim->bytes);
+        papplDeviceError(device, "Embosser disconnected on page %d.", sim->page);
+        return (-1);
+      }
+      else if (sim->page == sim->paper_out)
+      {
+        struct timespec now;          // Current time
+
+        sim->reason = PAPPL_PREASON_MEDIA_EMPTY;
+        sim_log(sim, "paper-out page %d bytes %llu", sim->page, sim->bytes);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sim_wait(&now, sim->wait);
+
+        sim->reason = PAPPL_PREASON_NONE;
+        sim_log(sim, "paper-loaded page %d", sim->page);
+
+        // No catching up for the time without paper...
+        clock_gettime(CLOCK_MONOTONIC, &sim->page_start);
+        sim->rate_start = sim->page_start;
+        sim->rate_bytes = 0;
+      }
+
+      sim->page_begun = true;
+    }
+
+    // Take the data up to the end of the page at the character rate...
+    if ((ff = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL)
+      len = (size_t)(ff - ptr) + 1;
+    else
+      len = (size_t)(end - ptr);
+
+    sim->bytes += len;
+    sim->rate_bytes += len;
+    ptr += len;
+
+    if (sim->cps > 0.0)
+      sim_wait(&sim->rate_start, sim->rate_bytes / sim->cps);
+
+    if (ff)
+    {
+      // And the page at the page rate...
+      if (sim->ppm > 0.0)
+        sim_wait(&sim->page_start, 60.0 / sim->ppm);
+
+      sim_log(sim, "page %d bytes %llu", sim->page, sim->bytes);
+
+      clock_gettime(CLOCK_MONOTONIC, &sim->page_start);
+      sim->page ++;
+      sim->page_begun = false;
+    }
+  }
+
+  return ((ssize_t)bytes);
+}
@@ -0,0 +1,443 @@
+//
+// State file handling for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// PAPPL calls the save callback after every change of the configuration or
+// of a printer, and auto-adding or removing printers makes many of them.
+// The state is serialized into memory and only written when its SHA-256
+// hash differs from the state on disk.  Changed state is written once the
+// "state-save-delay" has passed since the first unsaved change, to a
+// temporary file which is then renamed over the state file, and at exit.
+// State that could not be written stays unsaved and is tried again later.
+//
+// Changes are compared with the newest state taken for writing, even while
+// that write is still in progress, and every taken state gets a sequence
+// number so that an older state never replaces a newer one on disk.
+//
+
+#define _GNU_SOURCE
+#include <pappl/pappl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local functions...
+
+static void state_flush(void);
+static void state_retry(char *pending, size_t bytes, const unsigned char *hash, unsigned seq);
+static bool state_save(pappl_system_t *system, void *data);
+static char *state_serialize(pappl_system_t *system, size_t *bytes);
+static char *state_take(size_t *bytes, unsigned char *hash, unsigned *seq);
+static void *state_thread(void *data);
+static bool state_write(const char *buffer, size_t bytes, unsigned seq);
+
+// Local globals...
+
+static pthread_mutex_t state_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for the following
+static pthread_cond_t state_cond = PTHREAD_COND_INITIALIZER;
+                                    // Unsaved state condition
+static char state_file[1024] = "";  // State file
+static int state_delay = 0;         // Seconds until changes are written
+static unsigned char state_hash[32];// SHA-256 of the newest state written
+                                    // or being written
+static bool state_hashed = false;   // Is that state hashed?
+static unsigned state_seq = 0;      // Sequence number of that state
+static char *state_pending = NULL;  // Unsaved state or `NULL`
+static size_t state_pending_bytes = 0;
+                                    // Size of unsaved state
+static unsigned char state_pending_hash[32];
+                                    // SHA-256 of unsaved state
+static time_t state_due = 0;        // Time the unsaved state is written
+static pthread_mutex_t state_write_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for writing the state file
+static unsigned state_written = 0;  // Sequence number of the state file
+
+// 'brf_StateInit()' - Load the state file and save changes from now on.
+
+bool                                // O - `true` if the state was loaded
+brf_StateInit(
+    brf_printer_app_global_data_t *global_data) // I - Global data
+{
+  pappl_system_t *system = global_data->system;
+                                    // System
+  int fd;                           // State file descriptor
+  struct stat st;                   // State file information
+  void *map;                        // Mapped state file
+  ssize_t hashlen;                  // Length of hash
+  bool loaded = false;              // Was the state loaded?
+  pthread_t tid;                    // Save thread
+  pthread_attr_t attr;              // Thread attributes
+
+  papplCopyString(state_file, global_data->state_file, sizeof(state_file));
+  state_delay = global_data->state_delay;
+
+  // The hash of the file makes loading it not count as a change...
+  if ((fd = open(state_file, O_RDONLY)) >= 0)
+  {
+    if (!fstat(fd, &st) && st.st_size > 0 && (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+    {
+      hashlen = cupsHashData("sha2-256", map, (size_t)st.st_size, state_hash, sizeof(state_hash));
+      state_hashed = hashlen == (ssize_t)sizeof(state_hash);
+
+      munmap(map, (size_t)st.st_size);
+
+      if ((loaded = papplSystemLoadState(system, state_file)) == false)
+      {
+        papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to load state file '%s'.", state_file);
+        state_hashed = false;
+      }
+    }
+
+    close(fd);
+  }
+
+  papplSystemSetSaveCallback(system, state_save, NULL);
+  atexit(state_flush);
+
+  if (state_delay > 0)
+  {
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&tid, &attr, state_thread, system))
+    {
+      papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to start state thread, changes are saved right away.");
+      state_delay = 0;
+    }
+
+    pthread_attr_destroy(&attr);
+  }
+
+  return (loaded);
+}
+
+// 'state_flush()' - Write unsaved state at exit.
+
+static void
+state_flush(void)
+{
+  char *pending;                    // Unsaved state
+  size_t bytes;                     // Size of unsaved state
+  unsigned char hash[32];           // SHA-256 of unsaved state
+  unsigned seq;                     // Sequence number of unsaved state
+
+  pthread_mutex_lock(&state_lock);
+  pending = state_take(&bytes, hash, &seq);
+  pthread_mutex_unlock(&state_lock);
+
+  if (pending)
+  {
+    state_write(pending, bytes, seq);
+    free(pending);
+  }
+}
+
+// 'state_retry()' - Keep state that could not be written for a retry.
+
+static void
+state_retry(char *pending,          // I - Unsaved state, freed or kept
+            size_t bytes,           // I - Size of unsaved state
+            const unsigned char *hash,
+                                    // I - SHA-256 of unsaved state
+            unsigned seq)           // I - Sequence number of unsaved state
+{
+  pthread_mutex_lock(&state_lock);
+
+  if (state_pending || seq != state_seq)
+  {
+    // A newer state replaces it...
+    free(pending);
+  }
+  else
+  {
+    state_pending = pending;
+    state_pending_bytes = bytes;
+    memcpy(state_pending_hash, hash, sizeof(state_pending_hash));
+    state_due = time(NULL) + (state_delay > 0 ? state_delay : 1);
+  }
+
+  pthread_mutex_unlock(&state_lock);
+}
+
+// 'state_save()' - Save the state after a change.
+
+static bool                         // O - `true` on success, `false` on error
+state_save(pappl_system_t *system,  // I - System
+           void *data)              // I - Callback data (unused)
+{
+  char *buffer;                     // Serialized state
+  size_t bytes;                     // Size of state
+  unsigned char hash[32];           // SHA-256 of state
+  unsigned seq;                     // Sequence number of state
+  bool ret = true;                  // Return value
+
+  (void)data;
+
+  if ((buffer = state_serialize(system, &bytes)) == NULL)
+  {
+    // Save directly when the state cannot be kept in memory...
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to serialize state: %s", strerror(errno));
+    return (papplSystemSaveState(system, state_file));
+  }
+
+  if (cupsHashData("sha2-256", buffer, bytes, hash, sizeof(hash)) != (ssize_t)sizeof(hash))
+    memset(hash, 0, sizeof(hash));
+
+  pthread_mutex_lock(&state_lock);
+
+  if (state_hashed && !memcmp(hash, state_hash, sizeof(hash)))
+  {
+    // Same as the state file, or the state being written, also after
+    // undoing an unsaved change...
+    free(state_pending);
+    state_pending = NULL;
+  }
+  else if (!state_pending || memcmp(hash, state_pending_hash, sizeof(hash)))
+  {
+    if (!state_pending)
+      state_due = time(NULL) + state_delay;
+
+    free(state_pending);
+    state_pending = buffer;
+    state_pending_bytes = bytes;
+    memcpy(state_pending_hash, hash, sizeof(state_pending_hash));
+    buffer = NULL;
+
+    pthread_cond_signal(&state_cond);
+  }
+
+  pthread_mutex_unlock(&state_lock);
+
+  free(buffer);
+
+  // Without a delay the state is written right away...
+  if (state_delay <= 0 || papplSystemIsShutdown(system))
+  {
+    pthread_mutex_lock(&state_lock);
+    buffer = state_take(&bytes, hash, &seq);
+    pthread_mutex_unlock(&state_lock);
+
+    if (buffer)
+    {
+      if ((ret = state_write(buffer, bytes, seq)) == false)
+      {
+        papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to save state file '%s': %s", state_file, strerror(errno));
+        state_retry(buffer, bytes, hash, seq);
+      }
+      else
+        free(buffer);
+    }
+  }
+
+  return (ret);
+}
+
+// 'state_serialize()' - Serialize the state into memory.
+
+static char *                       // O - State or `NULL` on error
+state_serialize(
+    pappl_system_t *system,         // I - System
+    size_t *bytes)                  // O - Size of state
+{
+  int fd;                           // Memory file descriptor
+  char path[64],                    // Path of memory file
+      *buffer = NULL;               // State
+  struct stat st;                   // Memory file information
+  ssize_t rbytes;                   // Bytes read
+
+  if ((fd = memfd_create("brf-state", MFD_CLOEXEC)) < 0)
+    return (NULL);
+
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+  if (papplSystemSaveState(system, path) && !fstat(fd, &st) && (buffer = (char *)malloc((size_t)st.st_size + 1)) != NULL)
+  {
+    for (*bytes = 0; *bytes < (size_t)st.st_size; *bytes += (size_t)rbytes)
+    {
+      if ((rbytes = pread(fd, buffer + *bytes, (size_t)st.st_size - *bytes, (off_t)*bytes)) <= 0)
+      {
+        free(buffer);
+        buffer = NULL;
+        break;
+      }
+    }
+  }
+
+  close(fd);
+
+  return (buffer);
+}
+
+// 'state_take()' - Take the unsaved state for writing.
+//
+// The caller holds state_lock.  From now on changes are compared with this
+// state.
+
+static char *                       // O - Unsaved state or `NULL` if none
+state_take(size_t *bytes,           // O - Size of unsaved state
+           unsigned char *hash,     // O - SHA-256 of unsaved state
+           unsigned *seq)           // O - Sequence number of unsaved state
+{
+  char *pending = state_pending;    // Unsaved state
+
+  if (!pending)
+    return (NULL);
+
+  *bytes = state_pending_bytes;
+  memcpy(hash, state_pending_hash, sizeof(state_pending_hash));
+  *seq = ++state_seq;
+
+  memcpy(state_hash, hash, sizeof(state_hash));
+  state_hashed = true;
+  state_pending = NULL;
+
+  return (pending);
+}
+
+// 'state_thread()' - Write the unsaved state once it is due.
+
+static void *                       // O - Thread exit status (unused)
+state_thread(void *data)            // I - System
+{
+  pappl_system_t *system = (pappl_system_t *)data;
+                                    // System
+  char *pending;                    // Unsaved state
+  size_t bytes;                     // Size of unsaved state
+  unsigned char hash[32];           // SHA-256 of unsaved state
+  unsigned seq;                     // Sequence number of unsaved state
+  struct timespec due;              // Time the state is due
+
+  pthread_mutex_lock(&state_lock);
+
+  for (;;)
+  {
+    while (!state_pending)
+      pthread_cond_wait(&state_cond, &state_lock);
+
+    due.tv_sec = state_due;
+    due.tv_nsec = 0;
+
+    // Later changes replace the unsaved state but do not postpone it...
+    while (state_pending && time(NULL) < state_due)
+      pthread_cond_timedwait(&state_cond, &state_lock, &due);
+
+    pending = state_take(&bytes, hash, &seq);
+
+    pthread_mutex_unlock(&state_lock);
+
+    if (pending && !state_write(pending, bytes, seq))
+    {
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to save state file '%s': %s", state_file, strerror(errno));
+      state_retry(pending, bytes, hash, seq);
+    }
+    else
+      free(pending);
+
+    pthread_mutex_lock(&state_lock);
+  }
+
+  return (NULL);
+}
+
+// 'state_write()' - Write the state file atomically.
+//
+// The state is written to a temporary file which is synced and renamed over
+// the state file, then the directory is synced so that the rename survives a
+// power failure.  A state older than the state file is not written.
+
+static bool                         // O - `true` on success, `false` on error
+state_write(const char *buffer,     // I - State
+            size_t bytes,           // I - Size of state
+            unsigned seq)           // I - Sequence number of state
+{
+  char tempfile[1100],              // Temporary file
+      dirname_buf[1024];            // Directory of state file
+  int fd;                           // File descriptor
+  size_t total;                     // Bytes written
+  ssize_t wbytes;                   // Bytes written at once
+  bool ret = true;                  // Return value
+
+  pthread_mutex_lock(&state_write_lock);
+
+  if (seq < state_written)
+  {
+    pthread_mutex_unlock(&state_write_lock);
+    return (true);
+  }
+
+  snprintf(tempfile, sizeof(tempfile), "%s.tmp", state_file);
+
+  if ((fd = open(tempfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    pthread_mutex_unlock(&state_write_lock);
+    return (false);
+  }
+
+  for (total = 0; total < bytes; total += (size_t)wbytes)
+  {
+    if ((wbytes = write(fd, buffer + total, bytes - total)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+      {
+        wbytes = 0;
+        continue;
+      }
+
+      ret = false;
+      break;
+    }
+  }
+
+  if (ret && fsync(fd))
+    ret = false;
+
+  if (close(fd))
+    ret = false;
+
+  if (ret && rename(tempfile, state_file))
+    ret = false;
+
+  if (!ret)
+  {
+    unlink(tempfile);
+  }
+  else
+  {
+    papplCopyString(dirname_buf, state_file, sizeof(dirname_buf));
+
+    if ((fd = open(dirname(dirname_buf), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+      ret = false;
+    }
+    else
+    {
+      if (fsync(fd))
+        ret = false;
+
+      close(fd);
+    }
+  }
+
+  if (ret)
+  {
+    state_written = seq;
+  }
+  else
+  {
+    // The file no longer has the state that changes are compared with...
+    pthread_mutex_lock(&state_lock);
+    if (seq == state_seq)
+      state_hashed = false;
+    pthread_mutex_unlock(&state_lock);
+  }
+
+  pthread_mutex_unlock(&state_write_lock);
+
+  return (ret);
+}
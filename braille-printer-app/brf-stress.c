@@ -0,0 +1,359 @@
+//
+// Concurrency stress mode for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// With "-o stress-printers=M" the server adds M printers writing to
+// directories below "<spool>/stress" and, once it is running, prints
+// "stress-jobs" copies of a document through IPP, spread over 1, 2, 4 ...
+// M of the printers.  Every round logs the aggregate jobs per second, then
+// the printers are deleted again and the server shuts down.  Run a build
+// with "-fsanitize=thread" to check the job path for data races.
+//
+
+#define _GNU_SOURCE
+#include <pappl/pappl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_STRESS_MAX_PRINTERS 256   // Maximum number of printers
+
+// Local types...
+
+typedef struct brf_stress_s           // Stress run state
+{
+  brf_printer_app_global_data_t *global_data;
+                                      // Global data
+  pappl_system_t *system;             // System
+  int num_printers;                   // Number of printers
+  pappl_printer_t *printers[BRF_STRESS_MAX_PRINTERS];
+                                      // Printers
+  int active;                         // Printers in the current round
+  int completed;                      // Jobs completed in the current round
+} brf_stress_t;
+
+// Local functions...
+
+static char *stress_document(const char *filename, size_t *bytes, const char **format);
+static bool stress_printers(brf_stress_t *s);
+static bool stress_round(brf_stress_t *s, http_t *http, const char *document, size_t bytes, const char *format);
+static void *stress_thread(void *data);
+
+// Local globals...
+
+static pthread_mutex_t stress_lock = PTHREAD_MUTEX_INITIALIZER;
+                                      // Lock for completion counts
+static pthread_cond_t stress_cond = PTHREAD_COND_INITIALIZER;
+                                      // Job completion condition
+static brf_stress_t *stress_run = NULL; // Current stress run or `NULL`
+
+// 'brf_StressEvent()' - Count completed jobs of the stress printers.
+//
+// This is called from the system event callback which holds PAPPL locks, so
+// only the job's printer is looked at.
+
+void
+brf_StressEvent(pappl_job_t *job,     // I - Job, if any
+                pappl_event_t event)  // I - Event
+{
+  pappl_printer_t *printer;           // Printer of job
+  int i;                              // Looping var
+
+  if (!job || !(event & PAPPL_EVENT_JOB_COMPLETED))
+    return;
+
+  printer = papplJobGetPrinter(job);
+
+  pthread_mutex_lock(&stress_lock);
+
+  if (stress_run)
+  {
+    for (i = 0; i < stress_run->active; i++)
+    {
+      if (stress_run->printers[i] == printer)
+      {
+        stress_run->completed ++;
+        pthread_cond_signal(&stress_cond);
+        break;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&stress_lock);
+}
+
+// 'brf_StressStart()' - Start the stress thread, if enabled.
+
+bool // O - `true` on success or when disabled, `false` on error
+brf_StressStart(
+    brf_printer_app_global_data_t *global_data) // I - Global data
+{
+  brf_stress_t *s;     // Stress run state
+  pthread_t tid;       // Thread ID
+  pthread_attr_t attr; // Thread attributes
+
+  if (global_data->stress_printers <= 0)
+    return (true);
+
+  if ((s = (brf_stress_t *)calloc(1, sizeof(brf_stress_t))) == NULL)
+  {
+    papplLog(global_data->system, PAPPL_LOGLEVEL_ERROR, "Unable to allocate memory for stress mode.");
+    return (false);
+  }
+
+  s->global_data = global_data;
+  s->system = global_data->system;
+  s->num_printers = global_data->stress_printers < BRF_STRESS_MAX_PRINTERS ? global_data->stress_printers : BRF_STRESS_MAX_PRINTERS;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&tid, &attr, stress_thread, s))
+  {
+    papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to create stress thread: %s", strerror(errno));
+    pthread_attr_destroy(&attr);
+    free(s);
+    return (false);
+  }
+
+  pthread_attr_destroy(&attr);
+
+  return (true);
+}
+
+// 'stress_document()' - Load or make the document to print.
+
+static char *                         // O - Document or `NULL` on error
+stress_document(const char *filename, // I - File to print or `NULL` for text
+                size_t *bytes,        // O - Size of document
+                const char **format)  // O - MIME media type
+{
+  static const char *const paragraph =
+      "The quick brown fox jumps over the lazy dog.  Pack my box with five "
+      "dozen liquor jugs.  How vexingly quick daft zebras jump!  Sphinx of "
+      "black quartz, judge my vow.  The five boxing wizards jump quickly.\n\n";
+                                      // Text of default document
+  size_t len = strlen(paragraph);     // Length of paragraph
+  char *document;                     // Document
+  int i,                              // Looping var
+      fd;                             // File descriptor
+  struct stat info;                   // File information
+  ssize_t rbytes;                     // Bytes read
+
+  if (filename && *filename)
+  {
+    if ((fd = open(filename, O_RDONLY)) < 0)
+      return (NULL);
+
+    if (fstat(fd, &info) || info.st_size <= 0 || (document = (char *)malloc((size_t)info.st_size)) == NULL)
+    {
+      close(fd);
+      return (NULL);
+    }
+
+    for (*bytes = 0; *bytes < (size_t)info.st_size; *bytes += (size_t)rbytes)
+    {
+      if ((rbytes = read(fd, document + *bytes, (size_t)info.st_size - *bytes)) <= 0)
+        break;
+    }
+
+    close(fd);
+
+    // Let the server type the file...
+    *format = "application/octet-stream";
+  }
+  else
+  {
+    // About 16k of text, a few braille pages...
+    if ((document = (char *)malloc(64 * len)) == NULL)
+      return (NULL);
+
+    for (i = 0; i < 64; i++)
+      memcpy(document + (size_t)i * len, paragraph, len);
+
+    *bytes = 64 * len;
+    *format = "text/plain";
+  }
+
+  return (document);
+}
+
+// 'stress_printers()' - Add the stress printers.
+
+static bool                           // O - `true` on success, `false` on error
+stress_printers(brf_stress_t *s)      // I - Stress run state
+{
+  char dir[1024],                     // Output directory
+      name[64],                       // Printer name
+      device_uri[1100];               // Device URI
+  int i;                              // Looping var
+
+  snprintf(dir, sizeof(dir), "%s/stress", s->global_data->spool_dir);
+  if (mkdir(dir, 0700) && errno != EEXIST)
+  {
+    papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to create stress directory '%s': %s", dir, strerror(errno));
+    return (false);
+  }
+
+  for (i = 0; i < s->num_printers; i++)
+  {
+    snprintf(dir, sizeof(dir), "%s/stress/%d", s->global_data->spool_dir, i + 1);
+    if (mkdir(dir, 0700) && errno != EEXIST)
+    {
+      papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to create stress directory '%s': %s", dir, strerror(errno));
+      return (false);
+    }
+
+    snprintf(name, sizeof(name), "stress-%d", i + 1);
+    snprintf(device_uri, sizeof(device_uri), "file://%s", dir);
+
+    // Printers left over by an interrupted run are used again...
+    if ((s->printers[i] = papplSystemFindPrinter(s->system, NULL, 0, device_uri)) == NULL && (s->printers[i] = papplPrinterCreate(s->system, 0, name, "gen_brf", "MFG:Generic;MDL:Braille Stress;CMD:BRF;", device_uri)) == NULL)
+    {
+      papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to create stress printer '%s'.", name);
+      return (false);
+    }
+  }
+
+  return (true);
+}
+
+// 'stress_round()' - Print all jobs on the first printers and wait for them.
+
+static bool                           // O - `true` on success, `false` on error
+stress_round(brf_stress_t *s,         // I - Stress run state
+             http_t *http,            // I - Connection to server
+             const char *document,    // I - Document
+             size_t bytes,            // I - Size of document
+             const char *format)      // I - MIME media type
+{
+  int i,                              // Looping var
+      submitted = 0,                  // Jobs submitted
+      completed,                      // Jobs completed
+      jobs = s->global_data->stress_jobs;
+                                      // Jobs to submit
+  char job_name[256];                 // Job name
+  struct timespec start,              // Start of round
+      end,                            // End of round
+      timeout;                        // Wait timeout
+  double seconds;                     // Length of round
+
+  pthread_mutex_lock(&stress_lock);
+  s->completed = 0;
+  pthread_mutex_unlock(&stress_lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < jobs; i++)
+  {
+    snprintf(job_name, sizeof(job_name), "Stress %d/%d", i + 1, jobs);
+
+    if (brf_ClientPrint(http, papplPrinterGetName(s->printers[i % s->active]), format, job_name, document, bytes))
+      submitted ++;
+    else
+      papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to submit stress job: %s", cupsLastErrorString());
+  }
+
+  pthread_mutex_lock(&stress_lock);
+
+  while (s->completed < submitted && !papplSystemIsShutdown(s->system))
+  {
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec ++;
+    pthread_cond_timedwait(&stress_cond, &stress_lock, &timeout);
+  }
+
+  completed = s->completed;
+  pthread_mutex_unlock(&stress_lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+  papplLog(s->system, PAPPL_LOGLEVEL_INFO, "Stress: %d printers, %d of %d jobs in %.3f seconds, %.1f jobs/sec.", s->active, completed, jobs, seconds, seconds > 0.0 ? completed / seconds : 0.0);
+
+  return (submitted == jobs);
+}
+
+// 'stress_thread()' - Run the stress rounds and shut down.
+
+static void *                         // O - Thread exit status (unused)
+stress_thread(void *data)             // I - Stress run state
+{
+  brf_stress_t *s = (brf_stress_t *)data;
+  http_t *http = NULL;                // Connection to server
+  char *document = NULL;              // Document to print
+  size_t bytes = 0;                   // Size of document
+  const char *format = NULL;          // MIME media type of document
+  int i;                              // Looping var
+
+  // Jobs are submitted through the listeners...
+  while (!papplSystemIsRunning(s->system))
+  {
+    if (papplSystemIsShutdown(s->system))
+      goto done;
+
+    usleep(100000);
+  }
+
+  if ((document = stress_document(s->global_data->stress_file, &bytes, &format)) == NULL)
+  {
+    papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to load stress document '%s': %s", s->global_data->stress_file, strerror(errno));
+    goto done;
+  }
+
+  if (!stress_printers(s))
+    goto done;
+
+  if ((http = brf_ClientConnect(program_invocation_short_name, papplSystemGetHostPort(s->system))) == NULL)
+  {
+    papplLog(s->system, PAPPL_LOGLEVEL_ERROR, "Unable to connect to server for stress mode: %s", cupsLastErrorString());
+    goto done;
+  }
+
+  papplLog(s->system, PAPPL_LOGLEVEL_INFO, "Stress: %d jobs of %lu bytes on up to %d printers.", s->global_data->stress_jobs, (unsigned long)bytes, s->num_printers);
+
+  pthread_mutex_lock(&stress_lock);
+  stress_run = s;
+  pthread_mutex_unlock(&stress_lock);
+
+  // Double the printers each round, ending with all of them...
+  for (i = 1; !papplSystemIsShutdown(s->system); i *= 2)
+  {
+    if (i > s->num_printers)
+      i = s->num_printers;
+
+    pthread_mutex_lock(&stress_lock);
+    s->active = i;
+    pthread_mutex_unlock(&stress_lock);
+
+    if (!stress_round(s, http, document, bytes, format) || i == s->num_printers)
+      break;
+  }
+
+  pthread_mutex_lock(&stress_lock);
+  stress_run = NULL;
+  pthread_mutex_unlock(&stress_lock);
+
+  done:
+
+  httpClose(http);
+  free(document);
+
+  // Do not leave the printers in the saved state...
+  for (i = 0; i < s->num_printers; i++)
+  {
+    if (s->printers[i])
+      papplPrinterDelete(s->printers[i]);
+  }
+
+  papplSystemShutdown(s->system);
+  free(s);
+
+  return (NULL);
+}
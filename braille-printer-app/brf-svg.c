@@ -0,0 +1,1690 @@
+//
+// Native SVG rendering for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Replaces svgtopdf, vectortobrf, Ghostscript and ImageMagick for SVG
+// diagrams.  The document is read through the markup tokenizer and every
+// shape is drawn as soon as its tag is complete: fills are sampled at the
+// centre of each dot into the picture of the tactile graphics engine, so
+// they get the Dither and Edge treatment of pictures, and strokes are drawn
+// straight into the dots afterwards with their width rounded to whole dots,
+// at least one, so thin lines stay lines that can be felt.
+//
+// Paths, rectangles, circles, ellipses, lines, polylines and polygons are
+// drawn with the transforms, fill, stroke, stroke-width, fill-rule, opacity
+// and display presentation attributes or style properties.  Text converted
+// to outlines is drawn like any path; "text" elements, gradients, patterns,
+// clipping and markers are not.
+//
+// Elements with an "id" are kept as markup while they are read, also inside
+// "defs" and "symbol", and a "use" element draws the kept markup of the
+// element it references again.  This is how Matplotlib and Inkscape emit
+// the glyphs of text converted to outlines.  Only elements that come before
+// the "use" can be referenced.
+//
+// The Rotate, fitplot and mirror options place the drawing like pictures.
+//
+
+#include <pappl/pappl.h>
+#include <math.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_SVG_MAX_COORD 65536.0     // Farthest point in dots
+#define BRF_SVG_MAX_DEPTH 64          // Deepest element drawn
+#define BRF_SVG_MAX_TAG 4194304       // Longest tag, for path data
+#define BRF_SVG_MAX_DEFS 16777216     // Most bytes of kept elements
+#define BRF_SVG_MAX_USE_DEPTH 8       // Deepest nesting of "use" elements
+#define BRF_SVG_MAX_USE_BYTES 268435456
+                                      // Most bytes drawn by "use" elements
+#define BRF_SVG_STROKE_RAISE 1        // Stroke raises the dot
+#define BRF_SVG_STROKE_LOWER 2        // Stroke lowers the dot
+
+// Local types...
+
+typedef struct brf_svg_style_s        // Inherited presentation attributes
+{
+  double m[6];                        // Transform to dots
+  int fill,                           // Fill colour as 0xRRGGBB or -1 for none
+      stroke;                         // Stroke colour or -1 for none
+  double stroke_width,                // Stroke width in user units
+      fill_opacity,                   // Fill opacity
+      stroke_opacity;                 // Stroke opacity
+  bool evenodd,                       // Even-odd fill rule?
+      hidden;                         // Hidden with "visibility"?
+} brf_svg_style_t;
+
+typedef struct brf_svg_def_s          // Element kept for "use"
+{
+  char *id,                           // Value of "id"
+      *markup;                        // Markup of the element
+  size_t len,                         // Length of markup
+      alloc;                          // Allocated bytes
+  int depth;                          // Depth of element
+  bool open,                          // Still being read?
+      dropped;                        // Too large to keep?
+} brf_svg_def_t;
+
+typedef struct brf_svg_point_s        // Point of a flattened path
+{
+  double x, y;                        // Position in dots
+  bool move,                          // Starts a subpath?
+      close;                          // Closes the subpath?
+} brf_svg_point_t;
+
+typedef struct brf_svg_s              // Document rendering state
+{
+  brf_tactile_t *tac;                 // Tactile graphic
+  const brf_geometry_t *geom;         // Page geometry
+  int rotate;                         // Clockwise rotation
+  char rotate_if;                     // Only rotate wide drawings ('>') or always (0)?
+  bool fit,                           // Fit drawing to the graphic area?
+      mirror;                         // Mirror the drawing?
+  bool placed;                        // Was the outer "svg" element seen?
+  int x0, y0, x1, y1;                 // Drawing area in dots
+  int depth,                          // Element depth
+      skip;                           // Depth of skipped element or 0
+  brf_svg_style_t styles[BRF_SVG_MAX_DEPTH];
+                                      // Styles of open elements
+  brf_svg_point_t *points;            // Current path
+  size_t num_points,                  // Number of points
+      alloc_points;                   // Allocated points
+  double *crossings;                  // Crossings of a row of dots
+  int *windings;                      // Direction of each crossing
+  unsigned char *strokes;             // Stroke of each dot
+  char *value;                        // Attribute value buffer
+  brf_svg_def_t *defs;                // Elements kept for "use"
+  size_t num_defs,                    // Number of kept elements
+      alloc_defs,                     // Allocated kept elements
+      defs_bytes,                     // Bytes of kept markup
+      use_bytes;                      // Bytes drawn by "use" elements
+  size_t open_defs[BRF_SVG_MAX_DEPTH];// Kept elements being read
+  int num_open_defs,                  // Number of kept elements being read
+      uses;                           // Depth of "use" being drawn
+  unsigned shapes,                    // Number of shapes drawn
+      texts,                          // Number of text elements skipped
+      missing;                        // Number of "use" elements not drawn
+  bool error;                         // Out of memory?
+} brf_svg_t;
+
+// Local functions...
+
+static bool svg_add_point(brf_svg_t *svg, const brf_svg_style_t *style, double x, double y, bool move);
+static void svg_arc(brf_svg_t *svg, const brf_svg_style_t *style, double x0, double y0, double rx, double ry, double angle, bool large, bool sweep, double x, double y);
+static int svg_color(const char *s, int current);
+static void svg_curve(brf_svg_t *svg, const brf_svg_style_t *style, double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3);
+static void svg_draw(brf_svg_t *svg, const brf_svg_style_t *style);
+static void svg_fill(brf_svg_t *svg, const brf_svg_style_t *style);
+static bool svg_get(brf_svg_t *svg, const char *attrs, const char *name);
+static double svg_length(const char *s, double percent);
+static bool svg_markup_cb(void *data, brf_markup_event_t event, const char *name, const char *text, size_t len);
+static void svg_multiply(double *m, const double *n);
+static bool svg_number(const char **s, double *value);
+static bool svg_options(brf_svg_t *svg, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld);
+static void svg_path(brf_svg_t *svg, const brf_svg_style_t *style, const char *d);
+static void svg_place(brf_svg_t *svg, const char *attrs);
+static void svg_record(brf_svg_t *svg, brf_markup_event_t event, const char *name, const char *attrs);
+static bool svg_record_put(brf_svg_t *svg, brf_svg_def_t *def, const char *s, size_t len);
+static void svg_stroke(brf_svg_t *svg, const brf_svg_style_t *style);
+static void svg_style(brf_svg_t *svg, brf_svg_style_t *style, const char *attrs);
+static void svg_transform(double *m, const char *s);
+static void svg_use(brf_svg_t *svg, brf_svg_style_t *style, const char *attrs);
+
+// 'brf_svgtobrf_filter_function()' - Convert an SVG drawing to tactile BRF.
+
+int // O - Exit status
+brf_svgtobrf_filter_function(
+    int inputfd,            // I - File descriptor input stream
+    int outputfd,           // I - File descriptor output stream
+    int inputseekable,      // I - Is input stream seekable? (unused)
+    cf_filter_data_t *data, // I - Job and printer data
+    void *parameters)       // I - Filter-specific parameters (unused)
+{
+  brf_geometry_t geom;      // Page geometry
+  brf_tactile_t tac;        // Tactile graphic
+  brf_svg_t *svg;           // Rendering state
+  brf_markup_t markup;      // Markup tokenizer
+  char buffer[65536],       // Read buffer
+      *tag = NULL,          // Tag buffer
+      key[1024];            // Graphic cache key
+  ssize_t bytes = -1;       // Bytes read
+  size_t i,                 // Looping var
+      count;                // Number of dots
+  bool cacheable,           // Can the graphic be cached?
+      rendered = false;     // Was the graphic rendered?
+  cf_logfunc_t log = data->logfunc;
+  void *ld = data->logdata;
+  int ret = 1;
+
+  (void)inputseekable;
+  (void)parameters;
+
+  if (!brf_GeometryInit(&geom, data->num_options, data->options, log, ld) ||
+      !brf_TactileInit(&tac, geom.total_graphic_width, geom.total_graphic_height, data->num_options, data->options, log, ld))
+    return (1);
+
+  count = (size_t)tac.width * (size_t)tac.height;
+
+  if ((svg = (brf_svg_t *)calloc(1, sizeof(brf_svg_t))) == NULL)
+  {
+    brf_TactileFree(&tac);
+    return (1);
+  }
+
+  svg->tac = &tac;
+  svg->geom = &geom;
+
+  if (!svg_options(svg, data->num_options, data->options, log, ld))
+    goto done;
+
+  // Repeated drawings skip rendering...
+  if ((cacheable = brf_CacheKey(inputfd, &tac, &geom, data->num_options, data->options, key, sizeof(key))) && brf_CacheLookup(key, &tac, &geom))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG, "brf_svgtobrf_filter_function: Rendered graphic found in cache.");
+
+    rendered = true;
+    goto done;
+  }
+
+  if ((tag = (char *)malloc(BRF_SVG_MAX_TAG)) == NULL || (svg->value = (char *)malloc(BRF_SVG_MAX_TAG)) == NULL || (svg->strokes = (unsigned char *)calloc(count, 1)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unable to allocate SVG buffers.");
+    goto done;
+  }
+
+  brf_MarkupInit(&markup, svg_markup_cb, svg);
+  brf_MarkupSetTagBuffer(&markup, tag, BRF_SVG_MAX_TAG);
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_svgtobrf_filter_function: Unable to read: %s", strerror(errno));
+      break;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_DEBUG, "brf_svgtobrf_filter_function: Job canceled.");
+      break;
+    }
+
+    if (!brf_MarkupParse(&markup, buffer, (size_t)bytes) || svg->error)
+      break;
+  }
+
+  if (bytes != 0 || !brf_MarkupFinish(&markup) || svg->error)
+    goto done;
+
+  if (!svg->placed)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Not an SVG drawing, no \"svg\" element found.");
+    goto done;
+  }
+
+  if (log)
+  {
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_svgtobrf_filter_function: %u shapes on %dx%d of %dx%d dots.", svg->shapes, svg->x1 - svg->x0, svg->y1 - svg->y0, tac.width, tac.height);
+
+    if (svg->texts)
+      log(ld, CF_LOGLEVEL_WARN, "%u SVG text elements not rendered, convert text to outlines to emboss it.", svg->texts);
+
+    if (svg->missing)
+      log(ld, CF_LOGLEVEL_WARN, "%u SVG use elements not rendered, their references were not found before them.", svg->missing);
+  }
+
+  // Fills get the Dither and Edge treatment, then strokes go on top...
+  if ((rendered = brf_TactileRender(&tac)) == true)
+  {
+    for (i = 0; i < count; i++)
+    {
+      if (svg->strokes[i] == BRF_SVG_STROKE_RAISE)
+        tac.dots[i] = 255;
+      else if (svg->strokes[i] == BRF_SVG_STROKE_LOWER)
+        tac.dots[i] = 0;
+    }
+
+    if (cacheable)
+      brf_CacheStore(key, &tac, &geom, svg->x0, svg->y0, svg->x1 - svg->x0, svg->y1 - svg->y0);
+  }
+
+  done:
+
+  if (rendered && brf_TactileWrite(&tac, outputfd, &geom, log, ld))
+    ret = 0;
+
+  for (i = 0; i < svg->num_defs; i ++)
+  {
+    free(svg->defs[i].id);
+    free(svg->defs[i].markup);
+  }
+
+  free(svg->defs);
+  free(svg->points);
+  free(svg->crossings);
+  free(svg->windings);
+  free(svg->strokes);
+  free(svg->value);
+  free(svg);
+  free(tag);
+  brf_TactileFree(&tac);
+
+  return (ret);
+}
+
+// 'svg_add_point()' - Add a point in user units to the current path.
+
+static bool                           // O - `true` on success, `false` on error
+svg_add_point(brf_svg_t *svg,         // I - Rendering state
+              const brf_svg_style_t *style, // I - Style with transform
+              double x,               // I - X in user units
+              double y,               // I - Y in user units
+              bool move)              // I - Start a subpath?
+{
+  brf_svg_point_t *p;                 // New point
+
+  if (svg->num_points >= svg->alloc_points)
+  {
+    if ((p = (brf_svg_point_t *)realloc(svg->points, (svg->alloc_points + 1024) * sizeof(brf_svg_point_t))) == NULL)
+    {
+      svg->error = true;
+      return (false);
+    }
+
+    svg->points = p;
+    svg->alloc_points += 1024;
+  }
+
+  p = svg->points + svg->num_points++;
+  p->x = style->m[0] * x + style->m[2] * y + style->m[4];
+  p->y = style->m[1] * x + style->m[3] * y + style->m[5];
+
+  // Keep far away points within the range of dot numbers...
+  if (!(p->x > -BRF_SVG_MAX_COORD))
+    p->x = -BRF_SVG_MAX_COORD;
+  else if (p->x > BRF_SVG_MAX_COORD)
+    p->x = BRF_SVG_MAX_COORD;
+
+  if (!(p->y > -BRF_SVG_MAX_COORD))
+    p->y = -BRF_SVG_MAX_COORD;
+  else if (p->y > BRF_SVG_MAX_COORD)
+    p->y = BRF_SVG_MAX_COORD;
+  p->move = move || svg->num_points == 1;
+  p->close = false;
+
+  return (true);
+}
+
+// 'svg_arc()' - Add an elliptical arc to the current path.
+//
+// The endpoint parameters are converted to a centre and angles as in
+// appendix B.2.4 of SVG 1.1.
+
+static void
+svg_arc(brf_svg_t *svg,               // I - Rendering state
+        const brf_svg_style_t *style, // I - Style with transform
+        double x0,                    // I - Start X
+        double y0,                    // I - Start Y
+        double rx,                    // I - X radius
+        double ry,                    // I - Y radius
+        double angle,                 // I - Rotation of the X axis in degrees
+        bool large,                   // I - Large arc?
+        bool sweep,                   // I - Positive angle direction?
+        double x,                     // I - End X
+        double y)                     // I - End Y
+{
+  double phi = angle * M_PI / 180.0,  // Rotation in radians
+      cp = cos(phi), sp = sin(phi),   // Cosine and sine of rotation
+      dx = (x0 - x) / 2.0,            // Half the chord
+      dy = (y0 - y) / 2.0,
+      x1 = cp * dx + sp * dy,         // Start in ellipse axes
+      y1 = -sp * dx + cp * dy,
+      lambda,                         // Radius correction
+      coef,                           // Centre coefficient
+      cx1, cy1,                       // Centre in ellipse axes
+      cx, cy,                         // Centre
+      theta,                          // Start angle
+      delta,                          // Angle of arc
+      scale,                          // Dots per user unit
+      length;                         // Length of arc in dots
+  int i,                              // Looping var
+      segments;                       // Number of segments
+
+  rx = fabs(rx);
+  ry = fabs(ry);
+
+  if (rx == 0.0 || ry == 0.0)
+  {
+    svg_add_point(svg, style, x, y, false);
+    return;
+  }
+
+  if ((lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry)) > 1.0)
+  {
+    rx *= sqrt(lambda);
+    ry *= sqrt(lambda);
+  }
+
+  coef = (rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1) / (rx * rx * y1 * y1 + ry * ry * x1 * x1);
+  coef = coef > 0.0 ? sqrt(coef) : 0.0;
+  if (large == sweep)
+    coef = -coef;
+
+  cx1 = coef * rx * y1 / ry;
+  cy1 = -coef * ry * x1 / rx;
+  cx = cp * cx1 - sp * cy1 + (x0 + x) / 2.0;
+  cy = sp * cx1 + cp * cy1 + (y0 + y) / 2.0;
+
+  theta = atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+  delta = atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx) - theta;
+
+  if (sweep && delta < 0.0)
+    delta += 2.0 * M_PI;
+  else if (!sweep && delta > 0.0)
+    delta -= 2.0 * M_PI;
+
+  // About one segment per dot of arc length...
+  scale = sqrt(fabs(style->m[0] * style->m[3] - style->m[1] * style->m[2]));
+  length = fabs(delta) * (rx > ry ? rx : ry) * scale;
+  segments = length < 255.0 ? (int)length + 1 : 256;
+
+  for (i = 1; i <= segments; i++)
+  {
+    double t = theta + delta * i / segments,
+                                      // Angle of point
+        ex = rx * cos(t),             // Point in ellipse axes
+        ey = ry * sin(t);
+
+    svg_add_point(svg, style, cp * ex - sp * ey + cx, sp * ex + cp * ey + cy, false);
+  }
+}
+
+// 'svg_color()' - Get a colour as 0xRRGGBB, -1 for none.
+//
+// Gradients and patterns are drawn in mid grey.
+
+static int                            // O - Colour
+svg_color(const char *s,              // I - Colour value
+          int current)                // I - Inherited colour
+{
+  static const struct
+  {
+    const char *name;                 // Colour keyword
+    int rgb;                          // Colour
+  } colors[] =
+  {
+    { "aqua", 0x00ffff }, { "black", 0x000000 }, { "blue", 0x0000ff },
+    { "fuchsia", 0xff00ff }, { "gray", 0x808080 }, { "green", 0x008000 },
+    { "grey", 0x808080 }, { "lime", 0x00ff00 }, { "maroon", 0x800000 },
+    { "navy", 0x000080 }, { "olive", 0x808000 }, { "orange", 0xffa500 },
+    { "purple", 0x800080 }, { "red", 0xff0000 }, { "silver", 0xc0c0c0 },
+    { "teal", 0x008080 }, { "white", 0xffffff }, { "yellow", 0xffff00 }
+  };
+  size_t i;                           // Looping var
+  unsigned r, g, b;                   // Colour components
+  char pct[3];                        // Percent signs
+
+  while (isspace(*s & 255))
+    s++;
+
+  if (!strncmp(s, "none", 4) || !strncmp(s, "transparent", 11))
+    return (-1);
+  else if (!strncmp(s, "inherit", 7))
+    return (current);
+  else if (!strncmp(s, "url(", 4))
+    return (0x808080);
+  else if (*s == '#')
+  {
+    for (i = 1; isxdigit(s[i] & 255); i++);
+
+    if (i == 7)
+      return ((int)strtol(s + 1, NULL, 16));
+    else if (i == 4)
+    {
+      int c = (int)strtol(s + 1, NULL, 16);
+                                      // Short colour
+
+      return (((c & 0xf00) << 12) | ((c & 0xf00) << 8) | ((c & 0xf0) << 8) | ((c & 0xf0) << 4) | ((c & 0xf) << 4) | (c & 0xf));
+    }
+  }
+  else if (!strncmp(s, "rgb(", 4))
+  {
+    if (sscanf(s + 4, "%u%1[%] ,%u%1[%] ,%u%1[%]", &r, pct, &g, pct + 1, &b, pct + 2) == 6)
+    {
+      r = r * 255 / 100;
+      g = g * 255 / 100;
+      b = b * 255 / 100;
+    }
+    else if (sscanf(s + 4, "%u ,%u ,%u", &r, &g, &b) != 3)
+      return (0);
+
+    return ((int)(((r > 255 ? 255 : r) << 16) | ((g > 255 ? 255 : g) << 8) | (b > 255 ? 255 : b)));
+  }
+  else
+  {
+    for (i = 0; i < (sizeof(colors) / sizeof(colors[0])); i++)
+    {
+      if (!strncasecmp(s, colors[i].name, strlen(colors[i].name)))
+        return (colors[i].rgb);
+    }
+  }
+
+  // Other colours, including "currentColor", are black...
+  return (0);
+}
+
+// 'svg_curve()' - Add a cubic Bezier curve to the current path.
+
+static void
+svg_curve(brf_svg_t *svg,             // I - Rendering state
+          const brf_svg_style_t *style, // I - Style with transform
+          double x0,                  // I - Start
+          double y0,
+          double x1,                  // I - First control point
+          double y1,
+          double x2,                  // I - Second control point
+          double y2,
+          double x3,                  // I - End
+          double y3)
+{
+  double scale = sqrt(fabs(style->m[0] * style->m[3] - style->m[1] * style->m[2])),
+                                      // Dots per user unit
+      length = (hypot(x1 - x0, y1 - y0) + hypot(x2 - x1, y2 - y1) + hypot(x3 - x2, y3 - y2)) * scale;
+                                      // Length of control polygon in dots
+  int i,                              // Looping var
+      segments = length < 255.0 ? (int)length + 1 : 256;
+                                      // Number of segments
+
+  for (i = 1; i <= segments; i++)
+  {
+    double t = (double)i / segments,  // Curve parameter
+        u = 1.0 - t;
+
+    svg_add_point(svg, style, u * u * u * x0 + 3.0 * u * u * t * x1 + 3.0 * u * t * t * x2 + t * t * t * x3, u * u * u * y0 + 3.0 * u * u * t * y1 + 3.0 * u * t * t * y2 + t * t * t * y3, false);
+  }
+}
+
+// 'svg_draw()' - Fill and stroke the current path.
+
+static void
+svg_draw(brf_svg_t *svg,              // I - Rendering state
+         const brf_svg_style_t *style) // I - Style
+{
+  if (svg->num_points > 1 && !style->hidden)
+  {
+    if (style->fill >= 0 && style->fill_opacity > 0.0)
+      svg_fill(svg, style);
+
+    if (style->stroke >= 0 && style->stroke_opacity > 0.0 && style->stroke_width > 0.0)
+      svg_stroke(svg, style);
+
+    svg->shapes ++;
+  }
+
+  svg->num_points = 0;
+}
+
+// 'svg_fill()' - Fill the current path, sampling at the centre of each dot.
+
+static void
+svg_fill(brf_svg_t *svg,              // I - Rendering state
+         const brf_svg_style_t *style) // I - Style
+{
+  brf_tactile_t *tac = svg->tac;      // Tactile graphic
+  size_t i, j,                        // Looping vars
+      start = 0,                      // Start of subpath
+      num_crossings;                  // Crossings in this row
+  double ymin = svg->points[0].y,     // Extent of path
+      ymax = ymin,
+      *crossings;                     // Crossings of a row
+  int x, y,                           // Looping vars
+      y0, y1,                         // Rows to fill
+      winding,                        // Winding number
+      *windings;                      // Directions of crossings
+  unsigned char fill[3] =             // Fill colour
+  {
+    (unsigned char)(style->fill >> 16),
+    (unsigned char)(style->fill >> 8),
+    (unsigned char)style->fill
+  };
+
+  for (i = 1; i < svg->num_points; i++)
+  {
+    if (svg->points[i].y < ymin)
+      ymin = svg->points[i].y;
+    if (svg->points[i].y > ymax)
+      ymax = svg->points[i].y;
+  }
+
+  if ((y0 = (int)ceil(ymin - 0.5)) < svg->y0)
+    y0 = svg->y0;
+  if ((y1 = (int)floor(ymax - 0.5)) >= svg->y1)
+    y1 = svg->y1 - 1;
+
+  // Every edge crosses a row at most once...
+  if ((crossings = (double *)realloc(svg->crossings, (svg->num_points + 1) * sizeof(double))) == NULL)
+  {
+    svg->error = true;
+    return;
+  }
+  svg->crossings = crossings;
+
+  if ((windings = (int *)realloc(svg->windings, (svg->num_points + 1) * sizeof(int))) == NULL)
+  {
+    svg->error = true;
+    return;
+  }
+  svg->windings = windings;
+
+  for (y = y0; y <= y1; y++)
+  {
+    double yc = y + 0.5;              // Centre of row
+
+    for (i = 0, num_crossings = 0; i < svg->num_points; i++)
+    {
+      const brf_svg_point_t *p = svg->points + i,
+                                      // Edge start
+          *q;                         // Edge end, closing subpaths
+
+      if (p->move)
+        start = i;
+
+      q = (i + 1 < svg->num_points && !svg->points[i + 1].move) ? p + 1 : svg->points + start;
+
+      if ((p->y <= yc && q->y > yc) || (q->y <= yc && p->y > yc))
+      {
+        double cx = p->x + (yc - p->y) * (q->x - p->x) / (q->y - p->y);
+                                      // Crossing
+        int dir = q->y > p->y ? 1 : -1;
+                                      // Direction
+
+        // Insertion sort, rows have few crossings...
+        for (j = num_crossings; j > 0 && crossings[j - 1] > cx; j--)
+        {
+          crossings[j] = crossings[j - 1];
+          windings[j] = windings[j - 1];
+        }
+
+        crossings[j] = cx;
+        windings[j] = dir;
+        num_crossings ++;
+      }
+    }
+
+    for (i = 0, winding = 0; i + 1 < num_crossings; i++)
+    {
+      int xa, xb;                     // Dots in span
+
+      winding += style->evenodd ? 1 : windings[i];
+
+      if (style->evenodd ? !(winding & 1) : !winding)
+        continue;
+
+      if ((xa = (int)ceil(crossings[i] - 0.5)) < svg->x0)
+        xa = svg->x0;
+      if ((xb = (int)floor(crossings[i + 1] - 0.5)) >= svg->x1)
+        xb = svg->x1 - 1;
+
+      for (x = xa; x <= xb; x++)
+      {
+        size_t d = (size_t)y * (size_t)tac->width + (size_t)x;
+                                      // Dot
+        unsigned char *rgb = tac->rgb + 3 * d;
+                                      // Colour of dot
+
+        if (style->fill_opacity >= 1.0)
+        {
+          memcpy(rgb, fill, 3);
+        }
+        else
+        {
+          rgb[0] = (unsigned char)(rgb[0] + (fill[0] - rgb[0]) * style->fill_opacity);
+          rgb[1] = (unsigned char)(rgb[1] + (fill[1] - rgb[1]) * style->fill_opacity);
+          rgb[2] = (unsigned char)(rgb[2] + (fill[2] - rgb[2]) * style->fill_opacity);
+        }
+
+        // Shapes on top hide the strokes below them...
+        svg->strokes[d] = 0;
+      }
+    }
+  }
+}
+
+// 'svg_get()' - Get a style property or presentation attribute.
+//
+// The value is copied to svg->value.  Properties in the "style" attribute
+// win over presentation attributes.
+
+static bool                           // O - `true` if found, `false` otherwise
+svg_get(brf_svg_t *svg,               // I - Rendering state
+        const char *attrs,            // I - Attributes
+        const char *name)             // I - Property name
+{
+  size_t namelen = strlen(name);      // Length of name
+  char *ptr,                          // Pointer into style
+      *end;                           // End of property
+
+  if (brf_MarkupGetAttr(attrs, "style", svg->value, BRF_SVG_MAX_TAG))
+  {
+    for (ptr = svg->value; *ptr; ptr = end)
+    {
+      if ((end = strchr(ptr, ';')) != NULL)
+        *end++ = '\0';
+      else
+        end = ptr + strlen(ptr);
+
+      while (isspace(*ptr & 255))
+        ptr++;
+
+      if (!strncmp(ptr, name, namelen))
+      {
+        for (ptr += namelen; isspace(*ptr & 255); ptr++);
+
+        if (*ptr == ':')
+        {
+          for (ptr++; isspace(*ptr & 255); ptr++);
+
+          memmove(svg->value, ptr, strlen(ptr) + 1);
+          return (true);
+        }
+      }
+    }
+  }
+
+  return (brf_MarkupGetAttr(attrs, name, svg->value, BRF_SVG_MAX_TAG));
+}
+
+// 'svg_length()' - Get a length in user units.
+
+static double                         // O - Length
+svg_length(const char *s,             // I - Length value
+           double percent)            // I - Length of 100%
+{
+  double value;                       // Number
+
+  if (!svg_number(&s, &value))
+    return (0.0);
+
+  if (!strncmp(s, "in", 2))
+    value *= 96.0;
+  else if (!strncmp(s, "cm", 2))
+    value *= 96.0 / 2.54;
+  else if (!strncmp(s, "mm", 2))
+    value *= 96.0 / 25.4;
+  else if (!strncmp(s, "pt", 2))
+    value *= 96.0 / 72.0;
+  else if (!strncmp(s, "pc", 2) || !strncmp(s, "em", 2))
+    value *= 16.0;
+  else if (!strncmp(s, "ex", 2))
+    value *= 8.0;
+  else if (*s == '%')
+    value *= percent / 100.0;
+
+  return (value);
+}
+
+// 'svg_markup_cb()' - Draw the elements of the document.
+
+static bool                           // O - `true` to continue, `false` to stop
+svg_markup_cb(void *data,             // I - Rendering state
+              brf_markup_event_t event, // I - Event
+              const char *name,       // I - Element name
+              const char *text,       // I - Attributes or character data
+              size_t len)             // I - Length of text
+{
+  brf_svg_t *svg = (brf_svg_t *)data; // Rendering state
+  brf_svg_style_t *style;             // Style of element
+  static const char *const skipped[] =
+  {                                   // Elements not drawn with their contents
+    "clippath", "defs", "desc", "filter", "foreignobject", "lineargradient",
+    "marker", "mask", "metadata", "pattern", "radialgradient", "script",
+    "style", "symbol", "text", "title"
+  };
+  size_t i;                           // Looping var
+  double x, y, w, h, rx, ry;          // Shape dimensions
+
+  (void)len;
+
+  if (event == BRF_MARKUP_TEXT)
+    return (true);
+
+  if (event == BRF_MARKUP_END)
+  {
+    if (svg->num_open_defs > 0 && !svg->uses)
+      svg_record(svg, event, name, NULL);
+
+    if (svg->skip == svg->depth)
+      svg->skip = 0;
+
+    if (svg->depth > 0)
+      svg->depth--;
+
+    return (!svg->error);
+  }
+
+  svg->depth++;
+
+  // Keep elements with an id for "use", also those that are not drawn...
+  if (svg->placed && !svg->uses)
+    svg_record(svg, event, name, text);
+
+  if (svg->skip)
+    return (true);
+
+  if (!strcmp(name, "svg") && !svg->placed)
+  {
+    // The outer element sets the size and place of the drawing...
+    svg->depth = 1;
+    svg_place(svg, text);
+    svg_style(svg, svg->styles, text);
+    return (true);
+  }
+
+  if (!svg->placed)
+    return (true);
+
+  for (i = 0; i < (sizeof(skipped) / sizeof(skipped[0])); i++)
+  {
+    if (!strcmp(name, skipped[i]))
+    {
+      if (!strcmp(name, "text"))
+        svg->texts ++;
+
+      svg->skip = svg->depth;
+      return (true);
+    }
+  }
+
+  if (svg->depth > BRF_SVG_MAX_DEPTH || (svg_get(svg, text, "display") && !strncmp(svg->value, "none", 4)))
+  {
+    svg->skip = svg->depth;
+    return (true);
+  }
+
+  style = svg->styles + svg->depth - 1;
+  *style = style[-1];
+
+  if (!strcmp(name, "svg"))
+  {
+    // Nested viewports only move their contents...
+    double m[6] = { 1.0, 0.0, 0.0, 1.0, 0.0, 0.0 };
+                                      // Translation
+
+    if (brf_MarkupGetAttr(text, "x", svg->value, BRF_SVG_MAX_TAG))
+      m[4] = svg_length(svg->value, 0.0);
+    if (brf_MarkupGetAttr(text, "y", svg->value, BRF_SVG_MAX_TAG))
+      m[5] = svg_length(svg->value, 0.0);
+
+    svg_multiply(style->m, m);
+  }
+
+  svg_style(svg, style, text);
+
+  if (!strcmp(name, "path"))
+  {
+    if (brf_MarkupGetAttr(text, "d", svg->value, BRF_SVG_MAX_TAG))
+      svg_path(svg, style, svg->value);
+  }
+  else if (!strcmp(name, "rect"))
+  {
+    x = brf_MarkupGetAttr(text, "x", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    y = brf_MarkupGetAttr(text, "y", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    w = brf_MarkupGetAttr(text, "width", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    h = brf_MarkupGetAttr(text, "height", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    rx = brf_MarkupGetAttr(text, "rx", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : -1.0;
+    ry = brf_MarkupGetAttr(text, "ry", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : -1.0;
+
+    if (rx < 0.0)
+      rx = ry < 0.0 ? 0.0 : ry;
+    if (ry < 0.0)
+      ry = rx;
+    if (rx > w / 2.0)
+      rx = w / 2.0;
+    if (ry > h / 2.0)
+      ry = h / 2.0;
+
+    if (w > 0.0 && h > 0.0)
+    {
+      svg_add_point(svg, style, x + rx, y, true);
+      svg_add_point(svg, style, x + w - rx, y, false);
+      if (rx > 0.0)
+        svg_arc(svg, style, x + w - rx, y, rx, ry, 0.0, false, true, x + w, y + ry);
+      svg_add_point(svg, style, x + w, y + h - ry, false);
+      if (rx > 0.0)
+        svg_arc(svg, style, x + w, y + h - ry, rx, ry, 0.0, false, true, x + w - rx, y + h);
+      svg_add_point(svg, style, x + rx, y + h, false);
+      if (rx > 0.0)
+        svg_arc(svg, style, x + rx, y + h, rx, ry, 0.0, false, true, x, y + h - ry);
+      svg_add_point(svg, style, x, y + ry, false);
+      if (rx > 0.0)
+        svg_arc(svg, style, x, y + ry, rx, ry, 0.0, false, true, x + rx, y);
+      svg->points[svg->num_points - 1].close = true;
+    }
+  }
+  else if (!strcmp(name, "circle") || !strcmp(name, "ellipse"))
+  {
+    x = brf_MarkupGetAttr(text, "cx", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    y = brf_MarkupGetAttr(text, "cy", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+
+    if (name[0] == 'c')
+      rx = ry = brf_MarkupGetAttr(text, "r", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    else
+    {
+      rx = brf_MarkupGetAttr(text, "rx", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+      ry = brf_MarkupGetAttr(text, "ry", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    }
+
+    if (rx > 0.0 && ry > 0.0)
+    {
+      svg_add_point(svg, style, x + rx, y, true);
+      svg_arc(svg, style, x + rx, y, rx, ry, 0.0, false, true, x - rx, y);
+      svg_arc(svg, style, x - rx, y, rx, ry, 0.0, false, true, x + rx, y);
+      svg->points[svg->num_points - 1].close = true;
+    }
+  }
+  else if (!strcmp(name, "line"))
+  {
+    x = brf_MarkupGetAttr(text, "x1", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    y = brf_MarkupGetAttr(text, "y1", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    w = brf_MarkupGetAttr(text, "x2", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+    h = brf_MarkupGetAttr(text, "y2", svg->value, BRF_SVG_MAX_TAG) ? svg_length(svg->value, 0.0) : 0.0;
+
+    svg_add_point(svg, style, x, y, true);
+    svg_add_point(svg, style, w, h, false);
+
+    // Lines are never filled...
+    w = style->fill_opacity;
+    style->fill_opacity = 0.0;
+    svg_draw(svg, style);
+    style->fill_opacity = w;
+  }
+  else if (!strcmp(name, "polyline") || !strcmp(name, "polygon"))
+  {
+    if (brf_MarkupGetAttr(text, "points", svg->value, BRF_SVG_MAX_TAG))
+    {
+      const char *ptr = svg->value;   // Pointer into points
+
+      while (svg_number(&ptr, &x) && svg_number(&ptr, &y))
+        svg_add_point(svg, style, x, y, false);
+
+      if (svg->num_points > 0 && name[4] == 'g')
+        svg->points[svg->num_points - 1].close = true;
+    }
+  }
+  else if (!strcmp(name, "use"))
+  {
+    svg_use(svg, style, text);
+  }
+
+  svg_draw(svg, style);
+
+  return (!svg->error);
+}
+
+// 'svg_multiply()' - Multiply a transform by another, m = m * n.
+
+static void
+svg_multiply(double *m,               // I - Transform, changed
+             const double *n)         // I - Transform applied first
+{
+  double r[6];                        // Result
+
+  r[0] = m[0] * n[0] + m[2] * n[1];
+  r[1] = m[1] * n[0] + m[3] * n[1];
+  r[2] = m[0] * n[2] + m[2] * n[3];
+  r[3] = m[1] * n[2] + m[3] * n[3];
+  r[4] = m[0] * n[4] + m[2] * n[5] + m[4];
+  r[5] = m[1] * n[4] + m[3] * n[5] + m[5];
+
+  memcpy(m, r, sizeof(r));
+}
+
+// 'svg_number()' - Read a number from a list or path data.
+//
+// Whitespace and a comma may come before the number.
+
+static bool                           // O - `true` if found, `false` otherwise
+svg_number(const char **s,            // IO - Pointer into string
+           double *value)             // O - Number
+{
+  const char *ptr = *s;               // Pointer into string
+  char *end;                          // End of number
+
+  while (isspace(*ptr & 255) || *ptr == ',')
+    ptr++;
+
+  if (!*ptr || !strchr("+-.0123456789", *ptr))
+    return (false);
+
+  *value = strtod(ptr, &end);
+
+  if (end == ptr)
+    return (false);
+
+  *s = end;
+
+  return (true);
+}
+
+// 'svg_options()' - Get the Rotate, fitplot and mirror options.
+
+static bool                           // O - `true` on success, `false` on bad options
+svg_options(brf_svg_t *svg,           // I - Rendering state
+            int num_options,          // I - Number of options
+            cups_option_t *options,   // I - Options
+            cf_logfunc_t log,         // I - Log function
+            void *ld)                 // I - Log function data
+{
+  const char *val;                    // Option value
+  char *end;                          // End of rotation
+
+  if ((val = cupsGetOption("Rotate", num_options, options)) == NULL)
+    val = "90>";
+
+  svg->rotate = (int)strtol(val, &end, 10);
+
+  if (end == val || (svg->rotate != 0 && svg->rotate != 90 && svg->rotate != 180 && svg->rotate != 270) || (*end && (strcmp(end, ">") || svg->rotate % 180 == 0)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Option Rotate must be a valid rotation value, got '%s'", val);
+    return (false);
+  }
+
+  svg->rotate_if = *end;
+
+  val = cupsGetOption("fitplot", num_options, options);
+  svg->fit = !val || !strcasecmp(val, "true");
+
+  val = cupsGetOption("mirror", num_options, options);
+  svg->mirror = val && !strcasecmp(val, "true");
+
+  return (true);
+}
+
+// 'svg_path()' - Draw path data.
+
+static void
+svg_path(brf_svg_t *svg,              // I - Rendering state
+         const brf_svg_style_t *style, // I - Style
+         const char *d)               // I - Path data
+{
+  char cmd = 0;                       // Current command
+  double x = 0.0, y = 0.0,            // Current point
+      sx = 0.0, sy = 0.0,             // Start of subpath
+      cx = 0.0, cy = 0.0,             // Last control point
+      v[7];                           // Arguments
+  int i,                              // Looping var
+      nargs;                          // Number of arguments
+  bool closed = false;                // Was the subpath just closed?
+
+  for (;;)
+  {
+    while (isspace(*d & 255) || *d == ',')
+      d++;
+
+    if (!*d)
+      break;
+
+    if (isalpha(*d & 255))
+    {
+      cmd = *d++;
+
+      if (cmd == 'Z' || cmd == 'z')
+      {
+        if (svg->num_points > 0)
+          svg->points[svg->num_points - 1].close = true;
+
+        x = cx = sx;
+        y = cy = sy;
+        closed = true;
+        continue;
+      }
+    }
+    else if (!cmd || cmd == 'Z' || cmd == 'z')
+      break;
+
+    switch (toupper(cmd))
+    {
+      case 'H' :
+      case 'V' :
+          nargs = 1;
+          break;
+      case 'M' :
+      case 'L' :
+      case 'T' :
+          nargs = 2;
+          break;
+      case 'S' :
+      case 'Q' :
+          nargs = 4;
+          break;
+      case 'C' :
+          nargs = 6;
+          break;
+      case 'A' :
+          nargs = 7;
+          break;
+      default :
+          return;
+    }
+
+    for (i = 0; i < nargs; i++)
+    {
+      // Arc flags may be written without separators...
+      if (toupper(cmd) == 'A' && (i == 3 || i == 4))
+      {
+        while (isspace(*d & 255) || *d == ',')
+          d++;
+
+        if (*d != '0' && *d != '1')
+          return;
+
+        v[i] = *d++ - '0';
+      }
+      else if (!svg_number(&d, v + i))
+        return;
+    }
+
+    // Drawing after "Z" starts a new subpath at the same point...
+    if (closed && toupper(cmd) != 'M')
+      svg_add_point(svg, style, x, y, true);
+
+    closed = false;
+
+    if (islower(cmd) && cmd != 'a')
+    {
+      for (i = 0; i < nargs; i++)
+      {
+        if (cmd == 'v')
+          v[i] += y;
+        else
+          v[i] += (i & 1) ? y : x;
+      }
+    }
+    else if (cmd == 'a')
+    {
+      v[5] += x;
+      v[6] += y;
+    }
+
+    switch (toupper(cmd))
+    {
+      case 'M' :
+          svg_add_point(svg, style, v[0], v[1], true);
+          x = cx = sx = v[0];
+          y = cy = sy = v[1];
+
+          // Further coordinate pairs are lines...
+          cmd = cmd == 'm' ? 'l' : 'L';
+          break;
+
+      case 'L' :
+          svg_add_point(svg, style, v[0], v[1], false);
+          x = cx = v[0];
+          y = cy = v[1];
+          break;
+
+      case 'H' :
+          svg_add_point(svg, style, v[0], y, false);
+          x = cx = v[0];
+          cy = y;
+          break;
+
+      case 'V' :
+          svg_add_point(svg, style, x, v[0], false);
+          cx = x;
+          y = cy = v[0];
+          break;
+
+      case 'C' :
+          svg_curve(svg, style, x, y, v[0], v[1], v[2], v[3], v[4], v[5]);
+          cx = v[2];
+          cy = v[3];
+          x = v[4];
+          y = v[5];
+          break;
+
+      case 'S' :
+          svg_curve(svg, style, x, y, 2.0 * x - cx, 2.0 * y - cy, v[0], v[1], v[2], v[3]);
+          cx = v[0];
+          cy = v[1];
+          x = v[2];
+          y = v[3];
+          break;
+
+      case 'Q' :
+      case 'T' :
+          if (toupper(cmd) == 'T')
+          {
+            // Move the arguments after the reflected control point...
+            v[2] = v[0];
+            v[3] = v[1];
+            v[0] = 2.0 * x - cx;
+            v[1] = 2.0 * y - cy;
+          }
+
+          svg_curve(svg, style, x, y, x + 2.0 * (v[0] - x) / 3.0, y + 2.0 * (v[1] - y) / 3.0, v[2] + 2.0 * (v[0] - v[2]) / 3.0, v[3] + 2.0 * (v[1] - v[3]) / 3.0, v[2], v[3]);
+          cx = v[0];
+          cy = v[1];
+          x = v[2];
+          y = v[3];
+          break;
+
+      case 'A' :
+          svg_arc(svg, style, x, y, v[0], v[1], v[2], v[3] != 0.0, v[4] != 0.0, v[5], v[6]);
+          x = cx = v[5];
+          y = cy = v[6];
+          break;
+    }
+
+    // Smooth curves only reflect the control point of the same kind...
+    if (!strchr("CcSsQqTt", cmd))
+    {
+      cx = x;
+      cy = y;
+    }
+  }
+}
+
+// 'svg_place()' - Place the drawing in the graphic area.
+//
+// The viewBox is fitted into the width and height of the drawing, centred
+// as with the default "preserveAspectRatio", and the drawing is then rotated,
+// fitted or cropped and mirrored like pictures.  Without fitplot one user
+// unit is a CSS pixel, 1/96th of an inch.
+
+static void
+svg_place(brf_svg_t *svg,             // I - Rendering state
+          const char *attrs)          // I - Attributes of "svg" element
+{
+  const brf_geometry_t *geom = svg->geom;
+                                      // Page geometry
+  brf_svg_style_t *style = svg->styles;
+                                      // Outer style
+  double vb[4] = { 0.0, 0.0, 0.0, 0.0 },
+                                      // viewBox
+      width = 0.0,                    // Width in CSS pixels
+      height = 0.0,                   // Height in CSS pixels
+      rw, rh,                         // Rotated size
+      scale,                          // Dots per CSS pixel
+      k,                              // CSS pixels per user unit
+      uw, uh,                         // Unrotated size in dots
+      dw, dh;                         // Rotated size in dots
+  const char *ptr;                    // Pointer into viewBox
+  double m[6];                        // Transform
+
+  if (brf_MarkupGetAttr(attrs, "viewBox", svg->value, BRF_SVG_MAX_TAG))
+  {
+    ptr = svg->value;
+    if (!svg_number(&ptr, vb) || !svg_number(&ptr, vb + 1) || !svg_number(&ptr, vb + 2) || !svg_number(&ptr, vb + 3) || vb[2] <= 0.0 || vb[3] <= 0.0)
+      vb[2] = vb[3] = 0.0;
+  }
+
+  if (brf_MarkupGetAttr(attrs, "width", svg->value, BRF_SVG_MAX_TAG))
+    width = svg_length(svg->value, vb[2]);
+  if (brf_MarkupGetAttr(attrs, "height", svg->value, BRF_SVG_MAX_TAG))
+    height = svg_length(svg->value, vb[3]);
+
+  if (width <= 0.0)
+    width = vb[2] > 0.0 ? vb[2] : 300.0;
+  if (height <= 0.0)
+    height = vb[3] > 0.0 ? vb[3] : 150.0;
+  if (vb[2] <= 0.0 || vb[3] <= 0.0)
+  {
+    vb[2] = width;
+    vb[3] = height;
+  }
+
+  if (svg->rotate_if == '>' && (geom->graphic_width > geom->graphic_height ? width >= height : width <= height))
+    svg->rotate = 0;
+
+  rw = svg->rotate % 180 ? height : width;
+  rh = svg->rotate % 180 ? width : height;
+
+  if (svg->fit)
+    scale = rw * geom->graphic_height > rh * geom->graphic_width ? geom->graphic_width / rw : geom->graphic_height / rh;
+  else
+    scale = 2540.0 / 96.0 / geom->graphic_dot_distance;
+
+  uw = width * scale;
+  uh = height * scale;
+  dw = rw * scale;
+  dh = rh * scale;
+
+  // Offset, then mirror, then rotation, then the viewBox...
+  style->m[0] = style->m[3] = 1.0;
+  style->m[1] = style->m[2] = 0.0;
+  style->m[4] = geom->graphic_hoffset;
+  style->m[5] = geom->graphic_voffset;
+
+  if (svg->mirror)
+  {
+    m[0] = -1.0; m[1] = 0.0; m[2] = 0.0; m[3] = 1.0; m[4] = dw; m[5] = 0.0;
+    svg_multiply(style->m, m);
+  }
+
+  switch (svg->rotate)
+  {
+    case 90 :
+        m[0] = 0.0; m[1] = 1.0; m[2] = -1.0; m[3] = 0.0; m[4] = uh; m[5] = 0.0;
+        svg_multiply(style->m, m);
+        break;
+    case 180 :
+        m[0] = -1.0; m[1] = 0.0; m[2] = 0.0; m[3] = -1.0; m[4] = uw; m[5] = uh;
+        svg_multiply(style->m, m);
+        break;
+    case 270 :
+        m[0] = 0.0; m[1] = -1.0; m[2] = 1.0; m[3] = 0.0; m[4] = 0.0; m[5] = uw;
+        svg_multiply(style->m, m);
+        break;
+  }
+
+  k = width / vb[2] < height / vb[3] ? width / vb[2] : height / vb[3];
+  m[0] = m[3] = k * scale;
+  m[1] = m[2] = 0.0;
+  m[4] = ((width - vb[2] * k) / 2.0 - vb[0] * k) * scale;
+  m[5] = ((height - vb[3] * k) / 2.0 - vb[1] * k) * scale;
+  svg_multiply(style->m, m);
+
+  // Drawing area, cropped to the graphic area...
+  svg->x0 = geom->graphic_hoffset;
+  svg->y0 = geom->graphic_voffset;
+  svg->x1 = svg->x0 + (int)(dw + 0.5);
+  svg->y1 = svg->y0 + (int)(dh + 0.5);
+
+  if (svg->x1 > svg->x0 + geom->graphic_width)
+    svg->x1 = svg->x0 + geom->graphic_width;
+  if (svg->x1 > svg->tac->width)
+    svg->x1 = svg->tac->width;
+  if (svg->y1 > svg->y0 + geom->graphic_height)
+    svg->y1 = svg->y0 + geom->graphic_height;
+  if (svg->y1 > svg->tac->height)
+    svg->y1 = svg->tac->height;
+
+  // Initial values of the properties...
+  style->fill = 0x000000;
+  style->stroke = -1;
+  style->stroke_width = 1.0;
+  style->fill_opacity = style->stroke_opacity = 1.0;
+  style->evenodd = false;
+  style->hidden = false;
+
+  svg->placed = true;
+}
+
+// 'svg_record()' - Keep the markup of elements with an id.
+
+static void
+svg_record(brf_svg_t *svg,            // I - Rendering state
+           brf_markup_event_t event,  // I - Event
+           const char *name,          // I - Element name
+           const char *attrs)         // I - Attributes
+{
+  brf_svg_def_t *def;                 // Kept element
+  int i;                              // Looping var
+
+  // Symbols are drawn like groups when they are used...
+  if (!strcmp(name, "symbol"))
+    name = "g";
+
+  if (event == BRF_MARKUP_END)
+  {
+    for (i = 0; i < svg->num_open_defs; i ++)
+    {
+      def = svg->defs + svg->open_defs[i];
+
+      if (svg_record_put(svg, def, "</", 2) && svg_record_put(svg, def, name, strlen(name)))
+        svg_record_put(svg, def, ">", 1);
+    }
+
+    while (svg->num_open_defs > 0 && svg->defs[svg->open_defs[svg->num_open_defs - 1]].depth >= svg->depth)
+    {
+      svg->num_open_defs --;
+      svg->defs[svg->open_defs[svg->num_open_defs]].open = false;
+    }
+
+    return;
+  }
+
+  if (brf_MarkupGetAttr(attrs, "id", svg->value, BRF_SVG_MAX_TAG) && svg->value[0] && svg->num_open_defs < BRF_SVG_MAX_DEPTH)
+  {
+    if (svg->num_defs >= svg->alloc_defs)
+    {
+      size_t alloc = svg->alloc_defs ? 2 * svg->alloc_defs : 64;
+                                      // New allocation
+      brf_svg_def_t *defs;            // New kept elements
+
+      if ((defs = (brf_svg_def_t *)realloc(svg->defs, alloc * sizeof(brf_svg_def_t))) == NULL)
+      {
+        svg->error = true;
+        return;
+      }
+
+      svg->defs = defs;
+      svg->alloc_defs = alloc;
+    }
+
+    def = svg->defs + svg->num_defs;
+    memset(def, 0, sizeof(brf_svg_def_t));
+
+    if ((def->id = strdup(svg->value)) == NULL)
+    {
+      svg->error = true;
+      return;
+    }
+
+    def->depth = svg->depth;
+    def->open = true;
+    svg->open_defs[svg->num_open_defs ++] = svg->num_defs ++;
+  }
+
+  for (i = 0; i < svg->num_open_defs; i ++)
+  {
+    def = svg->defs + svg->open_defs[i];
+
+    if (svg_record_put(svg, def, "<", 1) && svg_record_put(svg, def, name, strlen(name)) && svg_record_put(svg, def, " ", 1) && svg_record_put(svg, def, attrs, strlen(attrs)))
+      svg_record_put(svg, def, ">", 1);
+  }
+}
+
+// 'svg_record_put()' - Add markup to a kept element.
+//
+// Elements past BRF_SVG_MAX_DEFS bytes are dropped.
+
+static bool                           // O - `true` on success, `false` if dropped
+svg_record_put(brf_svg_t *svg,        // I - Rendering state
+               brf_svg_def_t *def,    // I - Kept element
+               const char *s,         // I - Markup
+               size_t len)            // I - Length of markup
+{
+  if (def->dropped)
+    return (false);
+
+  if (svg->defs_bytes + len > BRF_SVG_MAX_DEFS)
+  {
+    // Drop the element, it cannot be used any more...
+    svg->defs_bytes -= def->alloc;
+    free(def->markup);
+    def->markup = NULL;
+    def->len = def->alloc = 0;
+    def->dropped = true;
+    return (false);
+  }
+
+  if (def->len + len > def->alloc)
+  {
+    size_t alloc = def->alloc ? 2 * def->alloc : 256;
+                                      // New allocation
+    char *markup;                     // New markup
+
+    while (alloc < def->len + len)
+      alloc *= 2;
+
+    if ((markup = (char *)realloc(def->markup, alloc)) == NULL)
+    {
+      svg->error = true;
+      return (false);
+    }
+
+    svg->defs_bytes += alloc - def->alloc;
+    def->markup = markup;
+    def->alloc = alloc;
+  }
+
+  memcpy(def->markup + def->len, s, len);
+  def->len += len;
+
+  return (true);
+}
+
+// 'svg_stroke()' - Stroke the current path with whole dots.
+//
+// A square pen of the stroke width rounded to dots, at least one, is moved
+// along each segment in steps of half a dot.  Dark strokes raise dots and
+// light strokes lower them, the other way round for negated graphics.
+
+static void
+svg_stroke(brf_svg_t *svg,            // I - Rendering state
+           const brf_svg_style_t *style) // I - Style
+{
+  brf_tactile_t *tac = svg->tac;      // Tactile graphic
+  double width = style->stroke_width * sqrt(fabs(style->m[0] * style->m[3] - style->m[1] * style->m[2]));
+                                      // Stroke width in dots
+  int pen = width < tac->width ? (int)(width + 0.5) : tac->width,
+                                      // Pen size in dots
+      gray = (((style->stroke >> 16) & 255) * 30 + ((style->stroke >> 8) & 255) * 59 + (style->stroke & 255) * 11) / 100;
+                                      // Grey level of stroke
+  unsigned char mark = (gray < 128) != tac->negate ? BRF_SVG_STROKE_RAISE : BRF_SVG_STROKE_LOWER;
+                                      // Stroke mark
+  size_t i,                           // Looping var
+      start = 0;                      // Start of subpath
+
+  if (pen < 1)
+    pen = 1;
+
+  for (i = 0; i < svg->num_points; i++)
+  {
+    const brf_svg_point_t *p = svg->points + i,
+                                      // Segment start
+        *q;                           // Segment end
+    int j,                            // Looping var
+        steps;                        // Number of pen positions
+
+    if (p->move)
+      start = i;
+
+    if (i + 1 < svg->num_points && !svg->points[i + 1].move)
+      q = p + 1;
+    else if (p->close)
+      q = svg->points + start;
+    else
+      q = p;
+
+    steps = (int)(2.0 * hypot(q->x - p->x, q->y - p->y)) + 1;
+
+    for (j = 0; j <= steps; j++)
+    {
+      double px = p->x + (q->x - p->x) * j / steps,
+          py = p->y + (q->y - p->y) * j / steps;
+                                      // Pen centre
+      int x0 = (int)floor(px - pen / 2.0 + 0.5),
+          y0 = (int)floor(py - pen / 2.0 + 0.5),
+                                      // Top left of pen
+          x, y;                       // Looping vars
+
+      for (y = y0 < svg->y0 ? svg->y0 : y0; y < y0 + pen && y < svg->y1; y++)
+      {
+        for (x = x0 < svg->x0 ? svg->x0 : x0; x < x0 + pen && x < svg->x1; x++)
+          svg->strokes[(size_t)y * (size_t)tac->width + (size_t)x] = mark;
+      }
+    }
+  }
+}
+
+// 'svg_style()' - Apply the transform and properties of an element.
+
+static void
+svg_style(brf_svg_t *svg,             // I - Rendering state
+          brf_svg_style_t *style,     // IO - Inherited style, changed
+          const char *attrs)          // I - Attributes
+{
+  double opacity;                     // Element opacity
+
+  if (brf_MarkupGetAttr(attrs, "transform", svg->value, BRF_SVG_MAX_TAG))
+    svg_transform(style->m, svg->value);
+
+  if (svg_get(svg, attrs, "fill"))
+    style->fill = svg_color(svg->value, style->fill);
+  if (svg_get(svg, attrs, "stroke"))
+    style->stroke = svg_color(svg->value, style->stroke);
+  if (svg_get(svg, attrs, "stroke-width"))
+    style->stroke_width = svg_length(svg->value, 0.0);
+  if (svg_get(svg, attrs, "fill-rule"))
+    style->evenodd = !strncmp(svg->value, "evenodd", 7);
+  if (svg_get(svg, attrs, "visibility"))
+    style->hidden = !strncmp(svg->value, "hidden", 6) || !strncmp(svg->value, "collapse", 8);
+  if (svg_get(svg, attrs, "fill-opacity"))
+    style->fill_opacity = strtod(svg->value, NULL);
+  if (svg_get(svg, attrs, "stroke-opacity"))
+    style->stroke_opacity = strtod(svg->value, NULL);
+
+  // Group opacity is applied to each shape...
+  if (svg_get(svg, attrs, "opacity") && (opacity = strtod(svg->value, NULL)) < 1.0)
+  {
+    style->fill_opacity *= opacity;
+    style->stroke_opacity *= opacity;
+  }
+}
+
+// 'svg_transform()' - Apply a "transform" attribute.
+
+static void
+svg_transform(double *m,              // IO - Transform
+              const char *s)          // I - Transform list
+{
+  char name[16];                      // Transform name
+  double v[6],                        // Arguments
+      t[6];                           // Transform
+  int i,                              // Looping var
+      nargs;                          // Number of arguments
+
+  for (;;)
+  {
+    while (isspace(*s & 255) || *s == ',')
+      s++;
+
+    for (i = 0; isalpha(*s & 255) && i < (int)sizeof(name) - 1; s++)
+      name[i++] = *s;
+    name[i] = '\0';
+
+    while (isspace(*s & 255))
+      s++;
+
+    if (!name[0] || *s != '(')
+      return;
+
+    for (s++, nargs = 0; nargs < 6 && svg_number(&s, v + nargs); nargs++);
+
+    while (*s && *s != ')')
+      s++;
+    if (*s)
+      s++;
+
+    t[0] = t[3] = 1.0;
+    t[1] = t[2] = t[4] = t[5] = 0.0;
+
+    if (!strcmp(name, "matrix") && nargs == 6)
+    {
+      memcpy(t, v, sizeof(t));
+    }
+    else if (!strcmp(name, "translate") && nargs >= 1)
+    {
+      t[4] = v[0];
+      t[5] = nargs > 1 ? v[1] : 0.0;
+    }
+    else if (!strcmp(name, "scale") && nargs >= 1)
+    {
+      t[0] = v[0];
+      t[3] = nargs > 1 ? v[1] : v[0];
+    }
+    else if (!strcmp(name, "rotate") && nargs >= 1)
+    {
+      double a = v[0] * M_PI / 180.0; // Angle
+      double cx = nargs == 3 ? v[1] : 0.0,
+          cy = nargs == 3 ? v[2] : 0.0;
+                                      // Centre of rotation
+
+      t[0] = cos(a);
+      t[1] = sin(a);
+      t[2] = -t[1];
+      t[3] = t[0];
+      t[4] = cx - t[0] * cx - t[2] * cy;
+      t[5] = cy - t[1] * cx - t[3] * cy;
+    }
+    else if (!strcmp(name, "skewX") && nargs == 1)
+    {
+      t[2] = tan(v[0] * M_PI / 180.0);
+    }
+    else if (!strcmp(name, "skewY") && nargs == 1)
+    {
+      t[1] = tan(v[0] * M_PI / 180.0);
+    }
+
+    svg_multiply(m, t);
+  }
+}
+
+// 'svg_use()' - Draw the element referenced by a "use" element.
+
+static void
+svg_use(brf_svg_t *svg,               // I - Rendering state
+        brf_svg_style_t *style,       // IO - Style of "use", changed
+        const char *attrs)            // I - Attributes
+{
+  double m[6] = { 1.0, 0.0, 0.0, 1.0, 0.0, 0.0 };
+                                      // Translation
+  brf_svg_def_t *def = NULL;          // Referenced element
+  brf_markup_t markup;                // Markup tokenizer
+  char *tag;                          // Tag buffer
+  size_t i;                           // Looping var
+
+  if ((!brf_MarkupGetAttr(attrs, "xlink:href", svg->value, BRF_SVG_MAX_TAG) && !brf_MarkupGetAttr(attrs, "href", svg->value, BRF_SVG_MAX_TAG)) || svg->value[0] != '#')
+  {
+    svg->missing ++;
+    return;
+  }
+
+  for (i = svg->num_defs; i > 0; i --)
+  {
+    if (!strcmp(svg->defs[i - 1].id, svg->value + 1))
+    {
+      def = svg->defs + i - 1;
+      break;
+    }
+  }
+
+  // The reference must be complete, which also stops references to itself...
+  if (!def || def->open || def->dropped || !def->markup || svg->uses >= BRF_SVG_MAX_USE_DEPTH || svg->use_bytes + def->len > BRF_SVG_MAX_USE_BYTES)
+  {
+    svg->missing ++;
+    return;
+  }
+
+  if (brf_MarkupGetAttr(attrs, "x", svg->value, BRF_SVG_MAX_TAG))
+    m[4] = svg_length(svg->value, 0.0);
+  if (brf_MarkupGetAttr(attrs, "y", svg->value, BRF_SVG_MAX_TAG))
+    m[5] = svg_length(svg->value, 0.0);
+
+  svg_multiply(style->m, m);
+
+  if ((tag = (char *)malloc(def->len + 1)) == NULL)
+  {
+    svg->error = true;
+    return;
+  }
+
+  // Draw the kept markup as children of the "use" element...
+  svg->uses ++;
+  svg->use_bytes += def->len;
+
+  brf_MarkupInit(&markup, svg_markup_cb, svg);
+  brf_MarkupSetTagBuffer(&markup, tag, def->len + 1);
+  if (brf_MarkupParse(&markup, def->markup, def->len))
+    brf_MarkupFinish(&markup);
+
+  svg->uses --;
+
+  free(tag);
+}
@@ -0,0 +1,949 @@
+//
+// Tactile graphics for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Turns a picture sampled at the graphic dot grid into raised dots.  Areas
+// are filled by thresholding, ordered or error-diffusion dithering, or with
+// tactile textures that tell grey levels and colours apart, and contours
+// found like the "-edge" and "-canny" operators of ImageMagick are added on
+// top.  The per-dot kernels work on 16 dots at a time with the compiler's
+// vector extensions and large grids are split into bands of rows rendered
+// by one thread each.
+//
+
+#include <pappl/pappl.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_TACTILE_BAND_DOTS 262144  // Dots per rendering thread
+#define BRF_TACTILE_CLASSES 11        // Number of texture classes
+#define BRF_TACTILE_MAX_THREADS 16    // Maximum rendering threads
+
+// Local types...
+
+#if defined(__GNUC__)
+typedef unsigned char brf_vec_t __attribute__((vector_size(16)));
+                                      // 16 dots
+#endif // __GNUC__
+
+typedef struct brf_texture_s          // Texture set
+{
+  const char *name;                   // Texture option value
+  bool hues;                          // Tell colours apart?
+  unsigned char patterns[BRF_TACTILE_CLASSES][8];
+                                      // 8x8 pattern of each class, MSB left
+} brf_texture_t;
+
+typedef struct brf_tactile_band_s     // Rows rendered by one thread
+{
+  brf_tactile_t *tac;                 // Tactile graphic
+  const unsigned char *gray;          // Grey level of each dot
+  const unsigned char *cls;           // Texture class of each dot
+  const unsigned char *matrix;        // 8x8 threshold matrix
+  int y0, y1;                         // First and last+1 row
+} brf_tactile_band_t;
+
+// Local functions...
+
+static void tactile_bands(brf_tactile_t *tac, const unsigned char *gray, const unsigned char *cls, const unsigned char *matrix, void *(*fn)(void *));
+static void tactile_blur(unsigned char *gray, int width, int height, int radius, int sigma);
+static void *tactile_classify(void *data);
+static void tactile_diffuse(brf_tactile_t *tac, const unsigned char *gray);
+static bool tactile_edges(brf_tactile_t *tac, unsigned char *gray);
+static bool tactile_number(const char *name, int num_options, cups_option_t *options, int defvalue, int *value, cf_logfunc_t log, void *ld);
+static void *tactile_texture(void *data);
+static void *tactile_threshold(void *data);
+static bool tactile_write(int fd, const char *s, size_t len);
+
+// Local globals...
+
+static const unsigned char tactile_bayer[64] =
+{                                     // Ordered dither matrix
+    0, 128,  32, 160,   8, 136,  40, 168,
+  192,  64, 224,  96, 200,  72, 232, 104,
+   48, 176,  16, 144,  56, 184,  24, 152,
+  240, 112, 208,  80, 248, 120, 216,  88,
+   12, 140,  44, 172,   4, 132,  36, 164,
+  204,  76, 236, 108, 196,  68, 228, 100,
+   60, 188,  28, 156,  52, 180,  20, 148,
+  252, 124, 220,  92, 244, 116, 212,  84
+};
+static const unsigned char tactile_flat[64] =
+{                                     // Threshold at half grey
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128,
+  128, 128, 128, 128, 128, 128, 128, 128
+};
+static const brf_texture_t tactile_textures[] =
+{                                     // Texture sets
+  {
+    "Lines", true,
+    {
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // White
+      { 0x80, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00 }, // Light grey: sparse dots
+      { 0xff, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00 }, // Grey: horizontal lines
+      { 0xff, 0x88, 0x88, 0x88, 0xff, 0x88, 0x88, 0x88 }, // Dark grey: grid
+      { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }, // Black: solid
+      { 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88 }, // Red: vertical lines
+      { 0x88, 0x44, 0x22, 0x11, 0x88, 0x44, 0x22, 0x11 }, // Yellow: falling diagonals
+      { 0x11, 0x22, 0x44, 0x88, 0x11, 0x22, 0x44, 0x88 }, // Green: rising diagonals
+      { 0x99, 0x66, 0x66, 0x99, 0x99, 0x66, 0x66, 0x99 }, // Cyan: diagonal grid
+      { 0xaa, 0x00, 0xaa, 0x00, 0xaa, 0x00, 0xaa, 0x00 }, // Blue: dense dots
+      { 0xcc, 0x00, 0x00, 0x00, 0x33, 0x00, 0x00, 0x00 }  // Magenta: dashes
+    }
+  },
+  {
+    "Dots", false,
+    {
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // White
+      { 0x80, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00 }, // Light grey
+      { 0x88, 0x00, 0x22, 0x00, 0x88, 0x00, 0x22, 0x00 }, // Grey
+      { 0xaa, 0x00, 0xaa, 0x00, 0xaa, 0x00, 0xaa, 0x00 }, // Dark grey
+      { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }  // Black
+    }
+  },
+  {
+    "Hatch", false,
+    {
+      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // White
+      { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 }, // Light grey: one diagonal
+      { 0x88, 0x44, 0x22, 0x11, 0x88, 0x44, 0x22, 0x11 }, // Grey: diagonals
+      { 0x99, 0x66, 0x66, 0x99, 0x99, 0x66, 0x66, 0x99 }, // Dark grey: cross hatch
+      { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }  // Black
+    }
+  }
+};
+
+// 'brf_TactileFree()' - Free a tactile graphic.
+
+void
+brf_TactileFree(brf_tactile_t *tac) // I - Tactile graphic
+{
+  free(tac->rgb);
+  free(tac->dots);
+
+  tac->rgb = tac->dots = NULL;
+}
+
+// 'brf_TactileInit()' - Set up a tactile graphic for the job options.
+//
+// The picture starts out white; fill in the colour of each dot in "rgb"
+// before rendering.
+
+bool                                // O - `true` on success, `false` on error
+brf_TactileInit(
+    brf_tactile_t *tac,             // O - Tactile graphic
+    int width,                      // I - Width in dots
+    int height,                     // I - Height in dots
+    int num_options,                // I - Number of options
+    cups_option_t *options,         // I - Options
+    cf_logfunc_t log,               // I - Log function
+    void *ld)                       // I - Log function data
+{
+  const char *val;                  // Option value
+  static const char *const dithers[] = { "None", "Threshold", "Ordered", "Diffusion", "Texture" };
+  static const char *const edges[] = { "None", "Edge", "Canny" };
+  size_t i;                         // Looping var
+
+  memset(tac, 0, sizeof(brf_tactile_t));
+
+  tac->width = width;
+  tac->height = height;
+
+  if ((val = cupsGetOption("Dither", num_options, options)) == NULL)
+    val = "None";
+
+  for (i = 0; i < (sizeof(dithers) / sizeof(dithers[0])); i++)
+  {
+    if (!strcmp(val, dithers[i]))
+      break;
+  }
+
+  if (i >= (sizeof(dithers) / sizeof(dithers[0])))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unknown Dither option value '%s'", val);
+    return (false);
+  }
+
+  tac->dither = (brf_dither_t)i;
+
+  if ((val = cupsGetOption("Texture", num_options, options)) == NULL)
+    val = tactile_textures[0].name;
+
+  for (i = 0; i < (sizeof(tactile_textures) / sizeof(tactile_textures[0])); i++)
+  {
+    if (!strcmp(val, tactile_textures[i].name))
+      break;
+  }
+
+  if (i >= (sizeof(tactile_textures) / sizeof(tactile_textures[0])))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unknown Texture option value '%s'", val);
+    return (false);
+  }
+
+  tac->texture = (int)i;
+
+  if ((val = cupsGetOption("Edge", num_options, options)) == NULL)
+    val = "None";
+
+  for (i = 0; i < (sizeof(edges) / sizeof(edges[0])); i++)
+  {
+    if (!strcmp(val, edges[i]))
+      break;
+  }
+
+  if (i >= (sizeof(edges) / sizeof(edges[0])))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unknown Edge option value '%s'", val);
+    return (false);
+  }
+
+  tac->edge = (brf_edge_t)i;
+
+  if ((val = cupsGetOption("Negate", num_options, options)) != NULL && strcasecmp(val, "true") && strcasecmp(val, "false"))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Option Negate must either True or False, got '%s'", val);
+    return (false);
+  }
+
+  tac->negate = val && !strcasecmp(val, "true");
+
+  if (!tactile_number("EdgeFactor", num_options, options, 1, &tac->edge_factor, log, ld) ||
+      !tactile_number("CannyRadius", num_options, options, 0, &tac->canny_radius, log, ld) ||
+      !tactile_number("CannySigma", num_options, options, 1, &tac->canny_sigma, log, ld) ||
+      !tactile_number("CannyLower", num_options, options, 10, &tac->canny_lower, log, ld) ||
+      !tactile_number("CannyUpper", num_options, options, 30, &tac->canny_upper, log, ld))
+    return (false);
+
+  if (width <= 0 || height <= 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Bad graphic area %dx%d", width, height);
+    return (false);
+  }
+
+  if ((tac->rgb = (unsigned char *)malloc(3 * (size_t)width * (size_t)height)) == NULL || (tac->dots = (unsigned char *)calloc((size_t)width, (size_t)height)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unable to allocate %dx%d dot graphic.", width, height);
+    brf_TactileFree(tac);
+    return (false);
+  }
+
+  memset(tac->rgb, 255, 3 * (size_t)width * (size_t)height);
+
+  return (true);
+}
+
+// 'brf_TactileRender()' - Raise the dots for the picture.
+
+bool                                // O - `true` on success, `false` on error
+brf_TactileRender(brf_tactile_t *tac) // I - Tactile graphic
+{
+  size_t count = (size_t)tac->width * (size_t)tac->height;
+                                    // Number of dots
+  unsigned char *gray,              // Grey level of each dot
+      *cls;                         // Texture class of each dot
+  bool ret = true;                  // Return value
+
+  if ((gray = (unsigned char *)malloc(2 * count)) == NULL)
+    return (false);
+
+  cls = gray + count;
+
+  tactile_bands(tac, gray, cls, NULL, tactile_classify);
+
+  switch (tac->dither)
+  {
+    case BRF_DITHER_NONE :
+        // Contours only, like ImageMagick, unless there are none...
+        if (tac->edge == BRF_EDGE_NONE)
+          tactile_bands(tac, gray, cls, tactile_flat, tactile_threshold);
+        else
+          memset(tac->dots, 0, count);
+        break;
+
+    case BRF_DITHER_THRESHOLD :
+        tactile_bands(tac, gray, cls, tactile_flat, tactile_threshold);
+        break;
+
+    case BRF_DITHER_ORDERED :
+        tactile_bands(tac, gray, cls, tactile_bayer, tactile_threshold);
+        break;
+
+    case BRF_DITHER_DIFFUSION :
+        tactile_diffuse(tac, gray);
+        break;
+
+    case BRF_DITHER_TEXTURE :
+        tactile_bands(tac, gray, cls, NULL, tactile_texture);
+        break;
+  }
+
+  if (tac->edge != BRF_EDGE_NONE)
+    ret = tactile_edges(tac, gray);
+
+  free(gray);
+
+  return (ret);
+}
+
+// 'brf_TactileWrite()' - Write the graphic as six-dot Braille ASCII.
+//
+// Each cell holds 2x3 dots.  The text margins are added like addmargins in
+// filter/cups-braille.sh does for the output of ImageMagick.
+
+bool                                // O - `true` on success, `false` on error
+brf_TactileWrite(
+    brf_tactile_t *tac,             // I - Tactile graphic
+    int fd,                         // I - Output file
+    const brf_geometry_t *geom,     // I - Page geometry
+    cf_logfunc_t log,               // I - Log function
+    void *ld)                       // I - Log function data
+{
+  static const char brl[] = " A1B'K2L@CIF/MSP\"E3H9O6R^DJG>NTQ,*5<-U8V.%[$+X!&;:4\\0Z7(_?W]#Y)=";
+                                    // Braille ASCII of each dot pattern
+  static const unsigned char bits[3][2] = { { 1, 8 }, { 2, 16 }, { 4, 32 } };
+                                    // Dot numbers in a cell
+  int cols = (tac->width + 1) / 2,  // Cells per line
+      rows = (tac->height + 2) / 3, // Lines
+      x, y,                         // Looping vars
+      dx, dy;                       // Dot in cell
+  char *line,                       // Output line
+      *ptr;                         // Pointer into line
+  size_t linesize = (size_t)(geom->left_margin + cols + 3);
+                                    // Size of line
+  bool ret = true;                  // Return value
+
+  if ((line = (char *)malloc(linesize)) == NULL)
+    return (false);
+
+  memset(line, ' ', (size_t)geom->left_margin);
+
+  for (y = 0; y < geom->top_margin && ret; y++)
+    ret = tactile_write(fd, "\r\n", 2);
+
+  for (y = 0; y < rows && ret; y++)
+  {
+    for (x = 0, ptr = line + geom->left_margin; x < cols; x++)
+    {
+      int pattern = 0;              // Dot pattern of cell
+
+      for (dy = 0; dy < 3; dy++)
+      {
+        if (3 * y + dy >= tac->height)
+          break;
+
+        for (dx = 0; dx < 2; dx++)
+        {
+          if (2 * x + dx < tac->width && tac->dots[(size_t)(3 * y + dy) * (size_t)tac->width + (size_t)(2 * x + dx)])
+            pattern |= bits[dy][dx];
+        }
+      }
+
+      *ptr++ = brl[pattern];
+    }
+
+    // Trailing blank cells are not needed...
+    while (ptr > line + geom->left_margin && ptr[-1] == ' ')
+      ptr--;
+
+    if (ptr == line + geom->left_margin)
+      ptr = line;
+
+    *ptr++ = '\r';
+    *ptr++ = '\n';
+
+    ret = tactile_write(fd, line, (size_t)(ptr - line));
+  }
+
+  if (ret)
+    ret = tactile_write(fd, "\f", 1);
+
+  if (!ret && log)
+    log(ld, CF_LOGLEVEL_ERROR, "Unable to write tactile graphic: %s", strerror(errno));
+
+  free(line);
+
+  return (ret);
+}
+
+// 'tactile_bands()' - Run a kernel over the rows, in parallel when large.
+
+static void
+tactile_bands(
+    brf_tactile_t *tac,             // I - Tactile graphic
+    const unsigned char *gray,      // I - Grey levels
+    const unsigned char *cls,       // I - Texture classes
+    const unsigned char *matrix,    // I - Threshold matrix
+    void *(*fn)(void *))            // I - Kernel
+{
+  brf_tactile_band_t bands[BRF_TACTILE_MAX_THREADS];
+                                    // Bands of rows
+  pthread_t threads[BRF_TACTILE_MAX_THREADS];
+                                    // Rendering threads
+  bool started[BRF_TACTILE_MAX_THREADS];
+                                    // Was the thread started?
+  size_t count = (size_t)tac->width * (size_t)tac->height;
+                                    // Number of dots
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                                    // Number of processors
+  int i,                            // Looping var
+      num_bands = (int)(count / BRF_TACTILE_BAND_DOTS) + 1;
+                                    // Number of bands
+
+  if (num_bands > cpus)
+    num_bands = cpus > 0 ? (int)cpus : 1;
+  if (num_bands > BRF_TACTILE_MAX_THREADS)
+    num_bands = BRF_TACTILE_MAX_THREADS;
+  if (num_bands > tac->height)
+    num_bands = tac->height;
+
+  for (i = 0; i < num_bands; i++)
+  {
+    bands[i].tac = tac;
+    bands[i].gray = gray;
+    bands[i].cls = cls;
+    bands[i].matrix = matrix;
+    bands[i].y0 = tac->height * i / num_bands;
+    bands[i].y1 = tac->height * (i + 1) / num_bands;
+
+    // The first band is done by this thread, as is any band that cannot
+    // get a thread of its own...
+    started[i] = i > 0 && !pthread_create(threads + i, NULL, fn, bands + i);
+  }
+
+  for (i = 0; i < num_bands; i++)
+  {
+    if (!started[i])
+      (fn)(bands + i);
+  }
+
+  for (i = 1; i < num_bands; i++)
+  {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  }
+}
+
+// 'tactile_blur()' - Smooth the grey levels with a Gaussian.
+
+static void
+tactile_blur(unsigned char *gray,   // I - Grey levels
+             int width,             // I - Width
+             int height,            // I - Height
+             int radius,            // I - Radius or 0 for automatic
+             int sigma)             // I - Standard deviation
+{
+  int kernel[33],                   // Weights, 16.16 fixed point
+      total,                        // Sum of weights
+      i, x, y, xx, yy;              // Looping vars
+  unsigned char *temp;              // Horizontal pass
+
+  if (sigma <= 0)
+    return;
+
+  if (radius <= 0)
+    radius = 2 * sigma;
+  if (radius > 16)
+    radius = 16;
+
+  for (i = -radius, total = 0; i <= radius; i++)
+    total += kernel[i + radius] = (int)(65536.0 * exp(-(double)(i * i) / (2.0 * sigma * sigma)));
+
+  if ((temp = (unsigned char *)malloc((size_t)width * (size_t)height)) == NULL)
+    return;
+
+  for (y = 0; y < height; y++)
+  {
+    for (x = 0; x < width; x++)
+    {
+      long sum = 0;                 // Weighted sum
+
+      for (i = -radius; i <= radius; i++)
+      {
+        xx = x + i < 0 ? 0 : x + i >= width ? width - 1 : x + i;
+        sum += (long)kernel[i + radius] * gray[(size_t)y * (size_t)width + (size_t)xx];
+      }
+
+      temp[(size_t)y * (size_t)width + (size_t)x] = (unsigned char)(sum / total);
+    }
+  }
+
+  for (y = 0; y < height; y++)
+  {
+    for (x = 0; x < width; x++)
+    {
+      long sum = 0;                 // Weighted sum
+
+      for (i = -radius; i <= radius; i++)
+      {
+        yy = y + i < 0 ? 0 : y + i >= height ? height - 1 : y + i;
+        sum += (long)kernel[i + radius] * temp[(size_t)yy * (size_t)width + (size_t)x];
+      }
+
+      gray[(size_t)y * (size_t)width + (size_t)x] = (unsigned char)(sum / total);
+    }
+  }
+
+  free(temp);
+}
+
+// 'tactile_classify()' - Compute the grey level and texture class of rows.
+
+static void *                       // O - Unused
+tactile_classify(void *data)        // I - Band
+{
+  brf_tactile_band_t *band = (brf_tactile_band_t *)data;
+                                    // Band
+  brf_tactile_t *tac = band->tac;   // Tactile graphic
+  bool hues = tactile_textures[tac->texture].hues;
+                                    // Tell colours apart?
+  size_t i = (size_t)band->y0 * (size_t)tac->width,
+                                    // Current dot
+      end = (size_t)band->y1 * (size_t)tac->width;
+                                    // Last dot + 1
+  unsigned char *gray = (unsigned char *)band->gray,
+                                    // Grey levels
+      *cls = (unsigned char *)band->cls;
+                                    // Texture classes
+  const unsigned char *rgb;         // Colour of dot
+
+  for (rgb = tac->rgb + 3 * i; i < end; i++, rgb += 3)
+  {
+    int r = rgb[0], g = rgb[1], b = rgb[2],
+                                    // Colour
+        l,                          // Luminance
+        max, min;                   // Largest and smallest component
+
+    if (tac->negate)
+    {
+      r = 255 - r;
+      g = 255 - g;
+      b = 255 - b;
+    }
+
+    l = (r * 77 + g * 150 + b * 29) >> 8;
+    max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+    min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+
+    gray[i] = (unsigned char)l;
+
+    if (hues && max - min >= 64 && l >= 32 && l < 224)
+    {
+      // Saturated colour, one class per sixth of the hue circle...
+      int h;                        // Hue, 0 to 5
+
+      if (r >= g && r >= b)
+        h = g >= b ? (6 * (g - b) >= max - min ? 1 : 0) : (6 * (b - g) >= max - min ? 5 : 0);
+      else if (g >= b)
+        h = r >= b ? (6 * (r - b) >= max - min ? 1 : 2) : (6 * (b - r) >= max - min ? 3 : 2);
+      else
+        h = r >= g ? (6 * (r - g) >= max - min ? 5 : 4) : (6 * (g - r) >= max - min ? 3 : 4);
+
+      cls[i] = (unsigned char)(5 + h);
+    }
+    else if (l >= 224)
+      cls[i] = 0;
+    else if (l >= 160)
+      cls[i] = 1;
+    else if (l >= 96)
+      cls[i] = 2;
+    else if (l >= 32)
+      cls[i] = 3;
+    else
+      cls[i] = 4;
+  }
+
+  return (NULL);
+}
+
+// 'tactile_diffuse()' - Dither with Floyd-Steinberg error diffusion.
+//
+// The error flows from row to row, so this runs in one thread.  Rows are
+// done in alternating directions to avoid diagonal artifacts.
+
+static void
+tactile_diffuse(brf_tactile_t *tac,  // I - Tactile graphic
+                const unsigned char *gray) // I - Grey levels
+{
+  int width = tac->width,           // Width
+      x, y,                         // Looping vars
+      dir,                          // Direction of row
+      value;                        // Corrected grey level
+  int *errors,                      // Errors of current and next row
+      *cur, *next;                  // Current and next row
+
+  if ((errors = (int *)calloc(2 * (size_t)(width + 2), sizeof(int))) == NULL)
+    return;
+
+  cur = errors + 1;
+  next = errors + width + 3;
+
+  for (y = 0; y < tac->height; y++)
+  {
+    const unsigned char *grow = gray + (size_t)y * (size_t)width;
+                                    // Grey row
+    unsigned char *drow = tac->dots + (size_t)y * (size_t)width;
+                                    // Dots row
+    int *temp;                      // Swap rows
+
+    dir = (y & 1) ? -1 : 1;
+
+    for (x = dir > 0 ? 0 : width - 1; x >= 0 && x < width; x += dir)
+    {
+      int err;                      // Error of this dot
+
+      value = grow[x] + cur[x] / 16;
+
+      if (value < 128)
+      {
+        drow[x] = 255;
+        err = value;
+      }
+      else
+      {
+        drow[x] = 0;
+        err = value - 255;
+      }
+
+      cur[x + dir] += err * 7;
+      next[x - dir] += err * 3;
+      next[x] += err * 5;
+      next[x + dir] += err;
+    }
+
+    temp = cur;
+    cur = next;
+    next = temp;
+    memset(next - 1, 0, (size_t)(width + 2) * sizeof(int));
+  }
+
+  free(errors);
+}
+
+// 'tactile_edges()' - Add the contours of the picture.
+//
+// The simple detector raises dots where the Sobel gradient is strong; the
+// Canny detector smooths first, thins the gradient to its ridges and keeps
+// weak ridges only when they touch strong ones.
+
+static bool                         // O - `true` on success, `false` on error
+tactile_edges(brf_tactile_t *tac,   // I - Tactile graphic
+              unsigned char *gray)  // I - Grey levels, changed
+{
+  int width = tac->width,           // Width
+      height = tac->height,         // Height
+      x, y,                         // Looping vars
+      maxmag = 0,                   // Strongest gradient
+      lower, upper;                 // Canny thresholds
+  size_t count = (size_t)width * (size_t)height;
+                                    // Number of dots
+  unsigned short *mag;              // Gradient magnitudes
+  unsigned char *dirs,              // Gradient directions
+      *marks;                       // Edge marks
+  size_t *stack,                    // Dots to follow
+      num_stack = 0;                // Number of dots to follow
+
+  if ((mag = (unsigned short *)calloc(count, sizeof(unsigned short))) == NULL)
+    return (false);
+
+  if ((dirs = (unsigned char *)calloc(count, 2)) == NULL)
+  {
+    free(mag);
+    return (false);
+  }
+
+  marks = dirs + count;
+
+  if (tac->edge == BRF_EDGE_CANNY)
+    tactile_blur(gray, width, height, tac->canny_radius, tac->canny_sigma);
+
+  for (y = 1; y < height - 1; y++)
+  {
+    for (x = 1; x < width - 1; x++)
+    {
+      const unsigned char *p = gray + (size_t)y * (size_t)width + (size_t)x;
+                                    // Current dot
+      int gx = (p[1 - width] + 2 * p[1] + p[1 + width]) - (p[-1 - width] + 2 * p[-1] + p[-1 + width]),
+          gy = (p[width - 1] + 2 * p[width] + p[width + 1]) - (p[-width - 1] + 2 * p[-width] + p[-width + 1]),
+          m = abs(gx) + abs(gy);    // Gradient magnitude
+      size_t i = (size_t)(p - gray);
+
+      mag[i] = (unsigned short)m;
+
+      if (m > maxmag)
+        maxmag = m;
+
+      // Quantize the direction to horizontal, vertical or a diagonal...
+      if (abs(gy) * 5 < abs(gx) * 2)
+        dirs[i] = 0;
+      else if (abs(gx) * 5 < abs(gy) * 2)
+        dirs[i] = 2;
+      else
+        dirs[i] = (gx > 0) == (gy > 0) ? 1 : 3;
+    }
+  }
+
+  if (tac->edge == BRF_EDGE_SIMPLE)
+  {
+    for (size_t i = 0; i < count; i ++)
+    {
+      if (mag[i] * tac->edge_factor >= 512)
+        tac->dots[i] = 255;
+    }
+
+    free(mag);
+    free(dirs);
+
+    return (true);
+  }
+
+  if ((stack = (size_t *)malloc(count * sizeof(size_t))) == NULL)
+  {
+    free(mag);
+    free(dirs);
+    return (false);
+  }
+
+  lower = maxmag * tac->canny_lower / 100;
+  upper = maxmag * tac->canny_upper / 100;
+
+  if (lower < 1)
+    lower = 1;
+  if (upper < lower)
+    upper = lower;
+
+  // Keep the ridges of the gradient: 1 = weak, 2 = strong...
+  for (y = 1; y < height - 1; y++)
+  {
+    for (x = 1; x < width - 1; x++)
+    {
+      static const int offsets[4][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { 1, -1 } };
+                                    // Neighbours across each direction
+      size_t i = (size_t)y * (size_t)width + (size_t)x;
+      int m = mag[i],
+          d = (offsets[dirs[i]][1] * width + offsets[dirs[i]][0]);
+
+      if (m < lower || m < mag[i + (size_t)d] || m < mag[i - (size_t)d])
+        continue;
+
+      if (m >= upper)
+      {
+        marks[i] = 2;
+        stack[num_stack++] = i;
+      }
+      else
+        marks[i] = 1;
+    }
+  }
+
+  // Follow the weak ridges connected to strong ones...
+  while (num_stack > 0)
+  {
+    size_t i = stack[--num_stack];  // Current dot
+
+    tac->dots[i] = 255;
+
+    y = (int)(i / (size_t)width);
+    x = (int)(i % (size_t)width);
+
+    for (int yy = y - 1; yy <= y + 1; yy++)
+    {
+      for (int xx = x - 1; xx <= x + 1; xx++)
+      {
+        size_t j = (size_t)yy * (size_t)width + (size_t)xx;
+
+        if (yy < 0 || yy >= height || xx < 0 || xx >= width || marks[j] != 1)
+          continue;
+
+        marks[j] = 2;
+        stack[num_stack++] = j;
+      }
+    }
+  }
+
+  free(stack);
+  free(mag);
+  free(dirs);
+
+  return (true);
+}
+
+// 'tactile_number()' - Get a numeric option.
+
+static bool                         // O - `true` on success, `false` on bad value
+tactile_number(const char *name,    // I - Option name
+               int num_options,     // I - Number of options
+               cups_option_t *options, // I - Options
+               int defvalue,        // I - Default value
+               int *value,          // O - Option value
+               cf_logfunc_t log,    // I - Log function
+               void *ld)            // I - Log function data
+{
+  const char *val;                  // Option value
+  char *end;                        // End of number
+
+  if ((val = cupsGetOption(name, num_options, options)) == NULL)
+  {
+    *value = defvalue;
+    return (true);
+  }
+
+  *value = (int)strtol(val, &end, 10);
+
+  if (end == val || *end || *value < 0 || *value > 100)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Bad %s option value '%s'", name, val);
+    return (false);
+  }
+
+  return (true);
+}
+
+// 'tactile_texture()' - Fill rows with the texture of their class.
+
+static void *                       // O - Unused
+tactile_texture(void *data)         // I - Band
+{
+  brf_tactile_band_t *band = (brf_tactile_band_t *)data;
+                                    // Band
+  brf_tactile_t *tac = band->tac;   // Tactile graphic
+  const brf_texture_t *texture = tactile_textures + tac->texture;
+                                    // Texture set
+  int num_classes = texture->hues ? BRF_TACTILE_CLASSES : 5,
+                                    // Classes used by the set
+      k, x, y;                      // Looping vars
+
+  for (y = band->y0; y < band->y1; y++)
+  {
+    const unsigned char *crow = band->cls + (size_t)y * (size_t)tac->width;
+                                    // Classes of row
+    unsigned char *drow = tac->dots + (size_t)y * (size_t)tac->width;
+                                    // Dots of row
+    unsigned char rows[BRF_TACTILE_CLASSES][16];
+                                    // Pattern rows as dots
+
+    for (k = 0; k < num_classes; k++)
+    {
+      for (x = 0; x < 16; x++)
+        rows[k][x] = (texture->patterns[k][y & 7] & (0x80 >> (x & 7))) ? 255 : 0;
+    }
+
+    x = 0;
+
+#if defined(__GNUC__)
+    for (; x + 16 <= tac->width; x += 16)
+    {
+      brf_vec_t c,                  // Classes
+          d = { 0 },                // Dots
+          p,                        // Pattern row
+          kv;                       // Class number
+
+      memcpy(&c, crow + x, 16);
+
+      for (k = 1; k < num_classes; k++)
+      {
+        memcpy(&p, rows[k], 16);
+        memset(&kv, k, 16);
+        d |= (brf_vec_t)(c == kv) & p;
+      }
+
+      memcpy(drow + x, &d, 16);
+    }
+#endif // __GNUC__
+
+    for (; x < tac->width; x++)
+      drow[x] = rows[crow[x] < num_classes ? crow[x] : 4][x & 15];
+  }
+
+  return (NULL);
+}
+
+// 'tactile_threshold()' - Raise the dots darker than a threshold matrix.
+
+static void *                       // O - Unused
+tactile_threshold(void *data)       // I - Band
+{
+  brf_tactile_band_t *band = (brf_tactile_band_t *)data;
+                                    // Band
+  brf_tactile_t *tac = band->tac;   // Tactile graphic
+  int x, y;                         // Looping vars
+
+  for (y = band->y0; y < band->y1; y++)
+  {
+    const unsigned char *grow = band->gray + (size_t)y * (size_t)tac->width,
+                                    // Grey levels of row
+        *mrow = band->matrix + 8 * (y & 7);
+                                    // Threshold matrix row
+    unsigned char *drow = tac->dots + (size_t)y * (size_t)tac->width;
+                                    // Dots of row
+
+    x = 0;
+
+#if defined(__GNUC__)
+    brf_vec_t m;                    // Thresholds for 16 dots
+
+    memcpy(&m, mrow, 8);
+    memcpy((unsigned char *)&m + 8, mrow, 8);
+
+    for (; x + 16 <= tac->width; x += 16)
+    {
+      brf_vec_t g,                  // Grey levels
+          d;                        // Dots
+
+      memcpy(&g, grow + x, 16);
+      d = (brf_vec_t)(g < m);
+      memcpy(drow + x, &d, 16);
+    }
+#endif // __GNUC__
+
+    for (; x < tac->width; x++)
+      drow[x] = grow[x] < mrow[x & 7] ? 255 : 0;
+  }
+
+  return (NULL);
+}
+
+// 'tactile_write()' - Write all of a buffer.
+
+static bool                         // O - `true` on success, `false` on error
+tactile_write(int fd,               // I - Output file
+              const char *s,        // I - Bytes
+              size_t len)           // I - Number of bytes
+{
+  ssize_t bytes;                    // Bytes written
+
+  while (len > 0)
+  {
+    if ((bytes = write(fd, s, len)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (false);
+    }
+
+    s += bytes;
+    len -= (size_t)bytes;
+  }
+
+  return (true);
+}
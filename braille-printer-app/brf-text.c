@@ -0,0 +1,258 @@
+//
+// Paragraph translation for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// The native document filters collect the text of a paragraph here, which
+// is then translated with liblouis, or only reduced to ASCII when no table
+// was selected, and passed to the page formatter.  Preformatted text is
+// passed a line at a time instead, keeping its blanks.
+//
+
+#include <pappl/pappl.h>
+
+#include "brf-printer.h"
+
+
+//
+// Local functions...
+//
+
+static size_t text_ascii(const char *text, size_t len, char *cells);
+static bool text_reserve(brf_text_t *t, size_t size);
+
+
+// 'brf_TextAdd()' - Add UTF-8 text to the current paragraph.
+
+bool                            // O - `true` on success, `false` on error
+brf_TextAdd(brf_text_t *t,      // I - Text state
+            const char *text,   // I - Text
+            size_t len)         // I - Length of text
+{
+  if (t->paralen + len + 1 > t->parasize)
+  {
+    size_t parasize = t->parasize ? 2 * t->parasize : 4096;
+                                // New buffer size
+    char *temp;                 // New buffer
+
+    while (parasize < t->paralen + len + 1)
+      parasize *= 2;
+
+    if ((temp = (char *)realloc(t->para, parasize)) == NULL)
+      return (false);
+
+    t->para = temp;
+    t->parasize = parasize;
+  }
+
+  memcpy(t->para + t->paralen, text, len);
+  t->paralen += len;
+
+  return (true);
+}
+
+// 'brf_TextEndParagraph()' - Translate and format the current paragraph.
+
+bool                            // O - `true` on success, `false` on error
+brf_TextEndParagraph(
+    brf_text_t *t,              // I - Text state
+    int indent)                 // I - Cells to indent the first line
+{
+  ssize_t count;                // Number of cells
+  size_t i;                     // Looping var
+
+  // Skip paragraphs with nothing but whitespace...
+  for (i = 0; i < t->paralen && isspace(t->para[i] & 255); i++);
+
+  if (i >= t->paralen)
+  {
+    t->paralen = 0;
+    return (true);
+  }
+
+  if (!text_reserve(t, 4 * t->paralen + 64))
+    return (false);
+
+  if (t->tables[0])
+  {
+    if ((count = brf_LouisTranslate(t->tables, t->para, t->paralen, t->cells, t->cellsize)) < 0)
+    {
+      if (t->log)
+        (t->log)(t->ld, CF_LOGLEVEL_ERROR, "Unable to translate text with '%s'.", t->tables);
+      return (false);
+    }
+  }
+  else
+    count = (ssize_t)text_ascii(t->para, t->paralen, t->cells);
+
+  t->paralen = 0;
+
+  return (brf_FormatterAddParagraph(&t->fmt, t->cells, (size_t)count, indent));
+}
+
+// 'brf_TextEndLine()' - Translate and format the current line as is.
+//
+// The blanks of the line are kept, tabs are expanded to every 8th cell, and
+// only the words between them are translated, so that the columns of
+// preformatted text survive.  Long lines are cut, not reflowed.  An empty
+// line is kept as a blank line.
+
+bool                            // O - `true` on success, `false` on error
+brf_TextEndLine(brf_text_t *t)  // I - Text state
+{
+  size_t count = 0,             // Number of cells
+      i = 0,                    // Looping var
+      start;                    // Start of word
+  ssize_t wordcount;            // Cells of translated word
+
+  // Tabs expand to at most 8 cells and words to 4 cells per byte...
+  if (!text_reserve(t, 8 * t->paralen + 64))
+    return (false);
+
+  while (i < t->paralen)
+  {
+    if (t->para[i] == '\t')
+    {
+      do
+        t->cells[count++] = ' ';
+      while (count % 8);
+
+      i++;
+    }
+    else if (isspace(t->para[i] & 255))
+    {
+      t->cells[count++] = ' ';
+      i++;
+    }
+    else
+    {
+      for (start = i; i < t->paralen && !isspace(t->para[i] & 255); i++);
+
+      if (!t->tables[0])
+      {
+        count += text_ascii(t->para + start, i - start, t->cells + count);
+      }
+      else if ((wordcount = brf_LouisTranslate(t->tables, t->para + start, i - start, t->cells + count, t->cellsize - count)) < 0)
+      {
+        if (t->log)
+          (t->log)(t->ld, CF_LOGLEVEL_ERROR, "Unable to translate text with '%s'.", t->tables);
+        return (false);
+      }
+      else
+        count += (size_t)wordcount;
+    }
+  }
+
+  // Trailing blanks would only make the line wrap...
+  while (count > 0 && t->cells[count - 1] == ' ')
+    count--;
+
+  t->paralen = 0;
+
+  return (brf_FormatterAddLine(&t->fmt, t->cells, count));
+}
+
+// 'brf_TextFinish()' - Finish the document and free the buffers.
+
+bool                            // O - `true` on success, `false` on error
+brf_TextFinish(brf_text_t *t,   // I - Text state
+               bool complete)   // I - Was the whole document added?
+{
+  bool ret = complete;          // Return value
+
+  if (complete)
+    ret = brf_TextEndParagraph(t, 2);
+
+  ret = brf_FormatterFinish(&t->fmt) && ret;
+
+  if (t->log && t->tables[0])
+  {
+    unsigned hits, misses;      // Translation memory counts
+
+    brf_MemoryGetJobStats(&hits, &misses);
+    (t->log)(t->ld, CF_LOGLEVEL_INFO, "Translation memory hits %u, misses %u.", hits, misses);
+  }
+
+  free(t->para);
+  free(t->cells);
+
+  t->para = t->cells = NULL;
+  t->paralen = t->parasize = t->cellsize = 0;
+
+  return (ret);
+}
+
+// 'brf_TextInit()' - Set up translation and formatting for the job options.
+
+bool                            // O - `true` on success, `false` on bad options
+brf_TextInit(brf_text_t *t,     // O - Text state
+             int fd,            // I - Output file
+             int num_options,   // I - Number of options
+             cups_option_t *options, // I - Options
+             cf_logfunc_t log,  // I - Log function
+             void *ld)          // I - Log function data
+{
+  brf_geometry_t geom;          // Page geometry
+
+  memset(t, 0, sizeof(brf_text_t));
+
+  t->log = log;
+  t->ld = ld;
+
+  if (!brf_GeometryInit(&geom, num_options, options, log, ld) ||
+      !brf_LouisGetTables(num_options, options, geom.text_dots, t->tables, sizeof(t->tables), log, ld) ||
+      !brf_FormatterInit(&t->fmt, fd, &geom, num_options, options, log, ld))
+    return (false);
+
+  if (!t->tables[0] && log)
+    log(ld, CF_LOGLEVEL_WARN, "No braille table translation was selected");
+
+  return (true);
+}
+
+
+// 'text_ascii()' - Keep ASCII text and replace the rest, without translation.
+
+static size_t                   // O - Number of cells
+text_ascii(const char *text,    // I - UTF-8 text
+           size_t len,          // I - Length of text
+           char *cells)         // O - Braille ASCII
+{
+  size_t i,                     // Looping var
+      count = 0;                // Number of cells
+
+  for (i = 0; i < len; i++)
+  {
+    unsigned char ch = (unsigned char)text[i]; // Current byte
+
+    if (ch < 0x80)
+      cells[count++] = ch < ' ' ? ' ' : (char)ch;
+    else if (ch == 0xc2 && i + 1 < len && (text[i + 1] & 255) == 0xa0)
+      cells[count++] = BRF_FORMAT_NBSP;
+    else if (ch >= 0xc0)
+      cells[count++] = '?';
+  }
+
+  return (count);
+}
+
+// 'text_reserve()' - Make room in the translation buffer.
+
+static bool                     // O - `true` on success, `false` on error
+text_reserve(brf_text_t *t,     // I - Text state
+             size_t size)       // I - Cells needed
+{
+  char *temp;                   // New buffer
+
+  if (t->cellsize >= size)
+    return (true);
+
+  if ((temp = (char *)realloc(t->cells, size)) == NULL)
+    return (false);
+
+  t->cells = temp;
+  t->cellsize = size;
+
+  return (true);
+}
@@ -4,6 +4,8 @@
 #include <pappl/pappl.h>
 #include <math.h>
 
+#include "brf-printer.h"
+
 #define brf_TESTPAGE_MIMETYPE "application/vnd.cups-brf";
 
 // Local functions...
@@ -89,8 +91,6 @@ brf_gen(
   papplCopyString(driver_data->media_default.type, "labels", sizeof(driver_data->media_default.type));
   driver_data->media_ready[0] = driver_data->media_default;
 
-  printf("************************gen-brf-called *********************************\n");
-
   return (true);
 }
 
@@ -104,14 +104,20 @@ brf_gen_printfile(
 {
   int fd;             // Input file
   ssize_t bytes;      // Bytes read/written
-  char buffer[10000007]; // Read/write buffer
+  char buffer[65536]; // Read/write buffer
+  brf_progress_t *progress; // Page counters
 
-  // Copy the raw file...
-  papplJobSetImpressions(job, 1);
+  // Pool jobs are printed by the pool members...
+  if (!strncmp(papplPrinterGetDeviceURI(papplJobGetPrinter(job)), "pool:", 5))
+    return (brf_PoolDispatch(job));
+
+  // Copy the raw file, counting pages as they are sent...
+  progress = brf_ProgressCreate(job, brf_ProgressCountFile(papplJobGetFilename(job)));
 
   if ((fd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    brf_ProgressFinish(progress);
     return (false);
   }
 
@@ -121,12 +127,15 @@ brf_gen_printfile(
     {
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
       close(fd);
+      brf_ProgressFinish(progress);
       return (false);
     }
+
+    brf_ProgressCount(progress, buffer, (size_t)bytes);
   }
   close(fd);
 
-  papplJobSetImpressionsCompleted(job, 1);
+  brf_ProgressFinish(progress);
 
   return (true);
 }
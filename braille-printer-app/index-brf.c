@@ -0,0 +1,777 @@
+//
+// Index Braille embosser driver for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// This is the C version of driver/index/index.sh, indexv3.sh, indexv4.sh and
+// textbrftoindexv3.  Index V3 and V4 embossers with firmware 10.30 and above
+// take the parameters of a job from an "ESC D" sequence sent in front of it,
+// including the number of copies, so the BRF data is only sent once.  The
+// sequence only depends on the printer and a few options, it is kept in a
+// small cache so that the options and the page geometry are only looked at
+// for the first job with a given set of them.  Text translated by liblouis is
+// sent line by line in transparent mode, as Index 6-dot patterns, while it
+// streams to the device.
+//
+
+#include <pappl/pappl.h>
+#include <pthread.h>
+
+#include "brf-printer.h"
+
+extern bool brf_gen(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
+
+// Local constants...
+
+#define BRF_INDEX_CACHE 32          // Number of cached INIT sequences
+#define BRF_INDEX_INIT 256          // Maximum size of an INIT sequence
+#define BRF_INDEX_KEY 1024          // Maximum size of a cache key
+#define BRF_INDEX_LINE 127          // Maximum cells per line in transparent mode
+
+// Local types...
+
+typedef struct brf_index_model_s    // Index embosser model
+{
+  const char *name;                 // Driver name
+  int version;                      // Protocol version, 3 or 4
+  const char *paper_length;         // IndexPaperLength ("In" or "Mm") or `NULL`
+  bool duplex;                      // Long edge duplex?
+  const char *const folding[4];     // Supported IndexFolding values
+} brf_index_model_t;
+
+typedef struct brf_index_cache_s    // Cached INIT sequence
+{
+  int printer_id;                   // Printer ID, 0 if unused
+  char key[BRF_INDEX_KEY];          // Driver name, copies, sides and options
+  char init[BRF_INDEX_INIT];        // INIT sequence
+  bool transparent;                 // Send text in transparent mode?
+  unsigned long long used;          // Last use
+} brf_index_cache_t;
+
+struct brf_index_s                  // Index embosser output
+{
+  pappl_device_t *device;           // Output device
+  cf_logfunc_t log;                 // Log function
+  void *ld;                         // Log function data
+  char init[BRF_INDEX_INIT];        // INIT sequence
+  int copies;                       // Copies the host has to send
+  bool transparent,                 // Send text in transparent mode?
+      started,                      // INIT sequence sent?
+      nonascii;                     // Last byte was not ASCII?
+  size_t linelen;                   // Cells in current line
+  unsigned char line[4 + BRF_INDEX_LINE];
+                                    // Transparent mode sequence and cells
+};
+
+// Local functions...
+
+static bool brf_index_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
+static bool index_build(const brf_index_model_t *model, int copies, bool duplex, int num_options, cups_option_t *options, cf_logfunc_t log, void *ld, char *init, size_t initsize, bool *transparent);
+static const brf_index_model_t *index_model(const char *driver_name);
+static bool index_number(int num_options, cups_option_t *options, const char *name, int defvalue, int *value, cf_logfunc_t log, void *ld);
+static bool index_start(brf_index_t *ix);
+static bool index_write(brf_index_t *ix, const void *buffer, size_t bytes);
+static bool index_write_line(brf_index_t *ix);
+
+// Local globals...
+
+static const brf_index_model_t brf_index_models[] =
+{
+  { "index_basicd3",    3, "In", true,  { "None", "ZFolding", NULL } },
+  { "index_basics3",    3, "In", false, { "None", NULL } },
+  { "index_4waves3",    3, NULL, true,  { "None", "ZFolding", NULL } },
+  { "index_everestd3",  3, "Mm", true,  { "None", NULL } },
+  { "index_4x4pro3",    3, "Mm", true,  { "None", "SaddleStitch", NULL } },
+  { "index_basicd4",    4, NULL, true,  { "None", "ZFolding", "ZFoldingSideWays", NULL } },
+  { "index_basics4",    4, NULL, false, { "None", NULL } },
+  { "index_everestd4",  4, NULL, true,  { "None", "SaddleStitch", NULL } },
+  { "index_braillebox4", 4, NULL, true, { "None", "SaddleStitch", NULL } }
+};
+
+static const char *const brf_index_key_options[] =
+{                                   // Options the INIT sequence depends on
+  "IndexFirmwareVersion", "IndexTable", "IndexMultipleImpact", "IndexFolding",
+  "IndexPaperLength", "HardwarePageNumber", "PageSize", "TextDotDistance",
+  "TextDots", "LineSpacing", "GraphicDotDistance", "LibLouis", "LibLouis2",
+  "LibLouis3", "LibLouis4"
+};
+
+static const char *const brf_index_pagenums[] =
+{                                   // HardwarePageNumber values, PN0 to PN6
+  "None", "Top", "TopLeft", "TopRight", "Bottom", "BottomLeft", "BottomRight"
+};
+
+static pthread_mutex_t brf_index_lock = PTHREAD_MUTEX_INITIALIZER;
+                                    // Lock for the cache
+static brf_index_cache_t brf_index_cache[BRF_INDEX_CACHE];
+                                    // Cached INIT sequences
+static unsigned long long brf_index_uses = 0;
+                                    // Cache uses
+
+// 'brf_index()' - Set up an Index embosser driver.
+
+bool // O - `true` on success, `false` on error
+brf_index(
+    pappl_system_t *system,              // I - System
+    const char *driver_name,             // I - Driver name
+    const char *device_uri,              // I - Device URI
+    const char *device_id,               // I - 1284 device ID
+    pappl_pr_driver_data_t *driver_data, // I - Pointer to driver data
+    ipp_t **attrs,                       // O - Pointer to driver attributes
+    void *cbdata)                        // I - Callback data (not used)
+{
+  const brf_index_model_t *model;        // Embosser model
+  int num_folding;                       // Number of folding values
+
+  if ((model = index_model(driver_name)) == NULL)
+    return (false);
+
+  // Index embossers take BRF like the generic ones, with a different way to
+  // send it...
+  if (!brf_gen(system, driver_name, device_uri, device_id, driver_data, attrs, cbdata))
+    return (false);
+
+  driver_data->printfile_cb = brf_index_printfile;
+
+  if (model->duplex)
+    driver_data->sides_supported |= PAPPL_SIDES_TWO_SIDED_LONG_EDGE;
+
+  // Options of the job...
+  if (driver_data->num_vendor < PAPPL_MAX_VENDOR)
+  {
+    driver_data->vendor[driver_data->num_vendor++] = "IndexMultipleImpact";
+    ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "IndexMultipleImpact-default", 1);
+    ippAddRange(*attrs, IPP_TAG_PRINTER, "IndexMultipleImpact-supported", 1, 3);
+  }
+
+  for (num_folding = 0; num_folding < 4 && model->folding[num_folding]; num_folding++);
+
+  if (num_folding > 1 && driver_data->num_vendor < PAPPL_MAX_VENDOR)
+  {
+    driver_data->vendor[driver_data->num_vendor++] = "IndexFolding";
+    ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, "IndexFolding-default", NULL, "None");
+    ippAddStrings(*attrs, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, "IndexFolding-supported", num_folding, NULL, model->folding);
+  }
+
+  // Settings of the embosser, like the PPD attributes of the CUPS driver...
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "IndexFirmwareVersion-default", 103000);
+  ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "IndexTable-default", 0);
+  ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, "HardwarePageNumber-default", NULL, "None");
+
+  if (model->paper_length)
+    ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_KEYWORD, "IndexPaperLength-default", NULL, model->paper_length);
+
+  return (true);
+}
+
+// 'brf_IndexCreate()' - Start the output of a job to an Index embosser.
+
+brf_index_t *                       // O - Index embosser output or `NULL` on error
+brf_IndexCreate(
+    pappl_printer_t *printer,       // I - Printer
+    pappl_device_t *device,         // I - Output device
+    pappl_pr_options_t *job_options,// I - Job options
+    int num_options,                // I - Number of options
+    cups_option_t *options,         // I - Options
+    cf_logfunc_t log,               // I - Log function
+    void *ld)                       // I - Log function data
+{
+  brf_index_t *ix;                  // Index embosser output
+  const char *driver_name = papplPrinterGetDriverName(printer);
+                                    // Driver name
+  const brf_index_model_t *model;   // Embosser model
+  int printer_id = papplPrinterGetID(printer);
+                                    // Printer ID
+  int copies = job_options->copies > 1 ? job_options->copies : 1;
+                                    // Number of copies
+  bool duplex = (job_options->sides & PAPPL_SIDES_TWO_SIDED_LONG_EDGE) != 0;
+                                    // Long edge duplex?
+  char key[BRF_INDEX_KEY],          // Cache key
+      *keyptr;                      // Pointer into key
+  const char *val;                  // Option value
+  size_t i;                         // Looping var
+  brf_index_cache_t *entry = NULL,  // Cache entry
+      *oldest;                      // Least recently used entry
+
+  if ((model = index_model(driver_name)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_IndexCreate: Unknown Index embosser driver '%s'.", driver_name);
+    return (NULL);
+  }
+
+  if ((ix = (brf_index_t *)calloc(1, sizeof(brf_index_t))) == NULL)
+    return (NULL);
+
+  ix->device = device;
+  ix->log = log;
+  ix->ld = ld;
+
+  snprintf(key, sizeof(key), "%s|%d|%d", driver_name, copies, duplex);
+
+  for (i = 0, keyptr = key + strlen(key); i < (sizeof(brf_index_key_options) / sizeof(brf_index_key_options[0])); i++, keyptr += strlen(keyptr))
+  {
+    if ((val = cupsGetOption(brf_index_key_options[i], num_options, options)) == NULL)
+      val = "";
+
+    snprintf(keyptr, sizeof(key) - (size_t)(keyptr - key), "|%s", val);
+  }
+
+  pthread_mutex_lock(&brf_index_lock);
+
+  brf_index_uses++;
+
+  for (i = 0, oldest = brf_index_cache; i < BRF_INDEX_CACHE; i++)
+  {
+    if (brf_index_cache[i].printer_id == printer_id && !strcmp(brf_index_cache[i].key, key))
+    {
+      entry = brf_index_cache + i;
+      break;
+    }
+
+    if (brf_index_cache[i].used < oldest->used)
+      oldest = brf_index_cache + i;
+  }
+
+  if (entry)
+  {
+    entry->used = brf_index_uses;
+    papplCopyString(ix->init, entry->init, sizeof(ix->init));
+    ix->transparent = entry->transparent;
+  }
+
+  pthread_mutex_unlock(&brf_index_lock);
+
+  if (entry)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_DEBUG, "brf_IndexCreate: Using the cached INIT sequence.");
+  }
+  else
+  {
+    // Build the sequence outside of the lock, a second job with the same
+    // options at the same time only builds it twice...
+    if (!index_build(model, copies, duplex, num_options, options, log, ld, ix->init, sizeof(ix->init), &ix->transparent))
+    {
+      free(ix);
+      return (NULL);
+    }
+
+    pthread_mutex_lock(&brf_index_lock);
+
+    oldest->printer_id = printer_id;
+    papplCopyString(oldest->key, key, sizeof(oldest->key));
+    papplCopyString(oldest->init, ix->init, sizeof(oldest->init));
+    oldest->transparent = ix->transparent;
+    oldest->used = brf_index_uses;
+
+    pthread_mutex_unlock(&brf_index_lock);
+  }
+
+  if (log && ix->init[0])
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_IndexCreate: INIT sequence is \"ESC %s\".", ix->init + 1);
+
+  // Older firmware does not take copies, they are sent again...
+  ix->copies = strstr(ix->init, ",MC") ? 1 : copies;
+
+  return (ix);
+}
+
+// 'brf_IndexDelete()' - Free the output of a job to an Index embosser.
+
+void
+brf_IndexDelete(brf_index_t *ix)    // I - Index embosser output or `NULL`
+{
+  free(ix);
+}
+
+// 'brf_IndexFinish()' - End the output of a job to an Index embosser.
+
+bool                                // O - `true` on success, `false` on error
+brf_IndexFinish(brf_index_t *ix)    // I - Index embosser output or `NULL`
+{
+  if (!ix)
+    return (true);
+
+  if (!ix->started && !index_start(ix))
+    return (false);
+
+  // A last line without a newline is sent as it is...
+  if (ix->linelen > 0 && !index_write_line(ix))
+    return (false);
+
+  return (index_write(ix, "\032", 1));
+}
+
+// 'brf_IndexGetCopies()' - Return the number of copies the host has to send.
+
+int                                 // O - Number of copies
+brf_IndexGetCopies(brf_index_t *ix) // I - Index embosser output
+{
+  return (ix ? ix->copies : 1);
+}
+
+// 'brf_IndexWrite()' - Send BRF data to an Index embosser.
+
+bool                                // O - `true` on success, `false` on error
+brf_IndexWrite(brf_index_t *ix,     // I - Index embosser output
+               const char *buffer,  // I - BRF data
+               size_t bytes)        // I - Number of bytes
+{
+  const unsigned char *ptr,         // Pointer into buffer
+      *end = (const unsigned char *)buffer + bytes;
+                                    // End of buffer
+  unsigned char c,                  // Current character
+      dots;                         // Dot pattern
+  bool nonascii;                    // Was the last byte not ASCII?
+
+  if (!ix->started && !index_start(ix))
+    return (false);
+
+  // Without translation on the host, the embosser translates the text...
+  if (!ix->transparent)
+    return (index_write(ix, buffer, bytes));
+
+  for (ptr = (const unsigned char *)buffer; ptr < end; ptr++)
+  {
+    c = *ptr;
+    nonascii = ix->nonascii;
+    ix->nonascii = c >= 0x80;
+
+    if (c == '\n')
+    {
+      if ((ix->linelen > 0 && !index_write_line(ix)) || !index_write(ix, "\r\n", 2))
+        return (false);
+
+      continue;
+    }
+    else if (c == '\r' || c == '\032')
+    {
+      continue;
+    }
+    else if (c == '\f' && ix->linelen == 0)
+    {
+      if (!index_write(ix, "\f", 1))
+        return (false);
+
+      continue;
+    }
+    else if (c >= 0x80)
+    {
+      // A UTF-8 sequence (non-breakable space or a stray character) is a
+      // single space...
+      if (nonascii && c < 0xc0)
+        continue;
+
+      c = ' ';
+    }
+    else if (c >= '`' && c <= '~')
+    {
+      // Normalize the non-standard BRF characters like textbrftoindexv3...
+      c = c == '~' ? '_' : (unsigned char)(c - 32);
+    }
+
+    if (ix->linelen >= BRF_INDEX_LINE)
+    {
+      // Index embossers get numbers between 128 and 255 wrong in the
+      // transparent mode sequence...
+      if (ix->log)
+        ix->log(ix->ld, CF_LOGLEVEL_ERROR, "brf_IndexWrite: Line too long (more than %d cells).", BRF_INDEX_LINE);
+      return (false);
+    }
+
+    // Other characters are spaces, dots 1-3 are bits 0-2 and dots 4-6 bits
+    // 4-6 on Index embossers...
+    if ((dots = brf_ascii_dots[c & 127]) == 0xff)
+      dots = 0;
+
+    ix->line[4 + ix->linelen++] = (unsigned char)((dots & 0x07) | ((dots & 0x38) << 1));
+  }
+
+  return (true);
+}
+
+// 'brf_index_printfile()' - Print a BRF file.
+
+static bool // O - `true` on success, `false` on failure
+brf_index_printfile(
+    pappl_job_t *job,            // I - Job
+    pappl_pr_options_t *options, // I - Job options
+    pappl_device_t *device)      // I - Output device
+{
+  int fd;                        // Input file
+  ssize_t bytes;                 // Bytes read
+  char buffer[65536];            // Read buffer
+  brf_progress_t *progress;      // Page counters
+  brf_index_t *ix;               // Index embosser output
+  bool ret = true;               // Return value
+
+  // Pool jobs are printed by the pool members...
+  if (!strncmp(papplPrinterGetDeviceURI(papplJobGetPrinter(job)), "pool:", 5))
+    return (brf_PoolDispatch(job));
+
+  if ((ix = brf_IndexCreate(papplJobGetPrinter(job), device, options, options->num_vendor, options->vendor, brf_JobLog, job)) == NULL)
+    return (false);
+
+  if ((fd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    brf_IndexDelete(ix);
+    return (false);
+  }
+
+  progress = brf_ProgressCreate(job, brf_ProgressCountFile(papplJobGetFilename(job)));
+
+  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    if (!brf_IndexWrite(ix, buffer, (size_t)bytes))
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
+      ret = false;
+      break;
+    }
+
+    brf_ProgressCount(progress, buffer, (size_t)bytes);
+  }
+
+  close(fd);
+
+  if (!brf_IndexFinish(ix))
+    ret = false;
+
+  brf_ProgressFinish(progress);
+  brf_IndexDelete(ix);
+
+  return (ret);
+}
+
+// 'index_build()' - Build the INIT sequence of a job.
+
+static bool                         // O - `true` on success, `false` on bad options
+index_build(
+    const brf_index_model_t *model, // I - Embosser model
+    int copies,                     // I - Number of copies
+    bool duplex,                    // I - Long edge duplex?
+    int num_options,                // I - Number of options
+    cups_option_t *options,         // I - Options
+    cf_logfunc_t log,               // I - Log function
+    void *ld,                       // I - Log function data
+    char *init,                     // O - INIT sequence
+    size_t initsize,                // I - Size of INIT sequence
+    bool *transparent)              // O - Send text in transparent mode?
+{
+  brf_geometry_t geom;              // Page geometry
+  const char *val,                  // Option value
+      *folding;                     // Folding
+  int firmware,                     // Firmware version
+      table,                        // Braille table of the embosser
+      impact,                       // Multiple impact
+      text_dot_distance,            // Distance between dots in cells
+      line_spacing,                 // Distance between lines
+      dp,                           // Duplex and folding mode
+      td,                           // Text dot distance mode
+      gd,                           // Graphic dot distance mode
+      pn,                           // Page number mode
+      ls,                           // Line spacing mode
+      i;                            // Looping var
+  char mc[32] = "",                 // Multiple copies
+      size[64] = "",                // Paper size
+      bt[32] = "";                  // Braille table
+  static const int linespacings[] = { 250, 375, 450, 475, 500, 525, 550, 750, 1000 };
+                                    // V3 line spacings, LS0 to LS8
+  static const char *const louis[] = { "LibLouis", "LibLouis2", "LibLouis3", "LibLouis4" };
+                                    // Liblouis table options
+
+  *init = '\0';
+  *transparent = false;
+
+  // Text translated by liblouis is sent in transparent mode...
+  for (i = 0; i < 4; i++)
+  {
+    if ((val = cupsGetOption(louis[i], num_options, options)) != NULL && *val && strcmp(val, "None"))
+      *transparent = true;
+  }
+
+  if (!index_number(num_options, options, "IndexFirmwareVersion", 103000, &firmware, log, ld))
+    return (false);
+
+  // Older firmware has no temporary parameters, hoping that the printer is
+  // configured the same way as the embosser...
+  if (firmware < 103000)
+    return (true);
+
+  if (!brf_GeometryInit(&geom, num_options, options, log, ld) ||
+      !index_number(num_options, options, "IndexTable", 0, &table, log, ld) ||
+      !index_number(num_options, options, "IndexMultipleImpact", 1, &impact, log, ld) ||
+      !index_number(num_options, options, "TextDotDistance", 250, &text_dot_distance, log, ld) ||
+      !index_number(num_options, options, "LineSpacing", 500, &line_spacing, log, ld))
+    return (false);
+
+  if (copies != 1)
+    snprintf(mc, sizeof(mc), ",MC%d", copies);
+
+  // Duplex and folding...
+  if ((folding = cupsGetOption("IndexFolding", num_options, options)) == NULL || !*folding)
+    folding = "None";
+
+  for (i = 0; i < 4 && model->folding[i]; i++)
+  {
+    if (!strcmp(folding, model->folding[i]))
+      break;
+  }
+
+  if (i >= 4 || !model->folding[i])
+    dp = 0;
+  else if (!strcmp(folding, "ZFolding"))
+    dp = duplex ? 3 : 5;
+  else if (!strcmp(folding, "SaddleStitch"))
+    dp = duplex ? 4 : 8;
+  else if (!strcmp(folding, "ZFoldingSideWays"))
+    dp = duplex ? 6 : 7;
+  else
+    dp = duplex ? 2 : 1;
+
+  if (!dp)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unsupported page folding '%s'", folding);
+    return (false);
+  }
+
+  // Dot spacing...
+  switch (text_dot_distance)
+  {
+    case 220 :
+        td = 1;
+        break;
+    case 250 :
+        td = 0;
+        break;
+    case 320 :
+        td = 2;
+        break;
+    default :
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Unsupported '%d' text dot distance", text_dot_distance);
+        return (false);
+  }
+
+  switch (geom.graphic_dot_distance)
+  {
+    case 160 :
+        gd = 2;
+        break;
+    case 200 :
+        gd = 0;
+        break;
+    case 250 :
+        gd = 1;
+        break;
+    default :
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Unsupported '%d' graphic dot distance", geom.graphic_dot_distance);
+        return (false);
+  }
+
+  // Page numbers are done in software...
+  if ((val = cupsGetOption("HardwarePageNumber", num_options, options)) == NULL || !*val)
+    val = "None";
+
+  for (pn = 0; pn < (int)(sizeof(brf_index_pagenums) / sizeof(brf_index_pagenums[0])); pn++)
+  {
+    if (!strcmp(val, brf_index_pagenums[pn]))
+      break;
+  }
+
+  if (pn >= (int)(sizeof(brf_index_pagenums) / sizeof(brf_index_pagenums[0])))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unsupported %s page number", val);
+    return (false);
+  }
+
+  // Paper size and line spacing...
+  if (model->version == 3)
+  {
+    if ((val = cupsGetOption("IndexPaperLength", num_options, options)) == NULL)
+      val = model->paper_length ? model->paper_length : "";
+
+    if (!strcmp(val, "In"))
+    {
+      int width = geom.page_width * 12 / 254,
+          height = geom.page_height * 12 / 254;
+                                    // Size in 1/120th of inch
+      int wfrac = width % 120,      // Fractional parts
+          hfrac = height % 120;
+
+      // Index embossers take inches and a code for the fraction...
+      wfrac = wfrac < 30 ? 0 : wfrac < 40 ? 1 : wfrac < 60 ? 2 : wfrac < 80 ? 3 : wfrac < 90 ? 4 : 5;
+      hfrac = hfrac < 30 ? 0 : hfrac < 40 ? 1 : hfrac < 60 ? 2 : hfrac < 80 ? 3 : hfrac < 90 ? 4 : 5;
+
+      snprintf(size, sizeof(size), ",PW%d%d,PL%d%d", width / 120, wfrac, height / 120, hfrac);
+    }
+    else if (!strcmp(val, "Mm"))
+    {
+      snprintf(size, sizeof(size), ",PW%d,PL%d", geom.page_width / 100, geom.page_height / 100);
+    }
+
+    for (ls = 0; ls < (int)(sizeof(linespacings) / sizeof(linespacings[0])); ls++)
+    {
+      if (line_spacing == linespacings[ls])
+        break;
+    }
+
+    if (ls >= (int)(sizeof(linespacings) / sizeof(linespacings[0])))
+    {
+      if (firmware < 120130)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Unsupported %d line spacing, please upgrade firmware to at least 12.01.3", line_spacing);
+        return (false);
+      }
+
+      if (line_spacing < 100)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "Too small %d line spacing", line_spacing);
+        return (false);
+      }
+
+      ls = line_spacing / 10;
+    }
+  }
+  else
+  {
+    // Cells and lines of the page without the software margins...
+    snprintf(size, sizeof(size), ",CH%d,LP%d", geom.text_width + geom.left_margin + geom.right_margin, geom.text_height + geom.top_margin + geom.bottom_margin);
+
+    if (line_spacing == 500 || line_spacing == 1000)
+    {
+      ls = line_spacing / 10;
+    }
+    else
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "Unsupported %d line spacing", line_spacing);
+      return (false);
+    }
+  }
+
+  // Braille table...
+  if (*transparent)
+  {
+    // Make sure to use a 6-dot table, 8-dot tables are only known for V4...
+    if (geom.text_dots == 6)
+      papplCopyString(bt, ",BT0", sizeof(bt));
+    else if (geom.text_dots == 8 && model->version == 4)
+      papplCopyString(bt, ",BT6", sizeof(bt));
+    else if (geom.text_dots != 8)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "Unsupported %d dots", geom.text_dots);
+      return (false);
+    }
+  }
+  else
+  {
+    // Hoping that the table of the embosser has the right number of dots...
+    snprintf(bt, sizeof(bt), ",BT%d", table);
+  }
+
+  // Margins are done in software, the first line offset is disabled...
+  snprintf(init, initsize, "\033DTM0,BI0,FO0%s,MI%d,DP%d,TD%d,GD%d,PN%d%s,LS%d%s;", mc, impact, dp, td, gd, pn, size, ls, bt);
+
+  return (true);
+}
+
+// 'index_model()' - Find the model of an Index embosser driver.
+
+static const brf_index_model_t *    // O - Embosser model or `NULL`
+index_model(const char *driver_name)// I - Driver name
+{
+  size_t i;                         // Looping var
+
+  for (i = 0; i < (sizeof(brf_index_models) / sizeof(brf_index_models[0])); i++)
+  {
+    if (!strcmp(driver_name, brf_index_models[i].name))
+      return (brf_index_models + i);
+  }
+
+  return (NULL);
+}
+
+// 'index_number()' - Get a numeric option, "Custom." prefix allowed.
+
+static bool                         // O - `true` on success, `false` if not a number
+index_number(int num_options,       // I - Number of options
+             cups_option_t *options,// I - Options
+             const char *name,      // I - Option name
+             int defvalue,          // I - Default value
+             int *value,            // O - Value
+             cf_logfunc_t log,      // I - Log function
+             void *ld)              // I - Log function data
+{
+  const char *val;                  // Option value
+
+  if ((val = cupsGetOption(name, num_options, options)) == NULL || !*val)
+  {
+    *value = defvalue;
+    return (true);
+  }
+
+  if (!strncmp(val, "Custom.", 7))
+    val += 7;
+
+  if (!isdigit(*val & 255))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Option %s must be a number, got '%s'", name, val);
+    return (false);
+  }
+
+  *value = atoi(val);
+
+  return (true);
+}
+
+// 'index_start()' - Send the INIT sequence.
+
+static bool                         // O - `true` on success, `false` on error
+index_start(brf_index_t *ix)        // I - Index embosser output
+{
+  ix->started = true;
+
+  if (ix->log)
+    ix->log(ix->ld, CF_LOGLEVEL_INFO, "%s", ix->transparent ? "Writing text to Index embosser in transparent mode" : "Writing text to Index embosser");
+
+  return (!ix->init[0] || index_write(ix, ix->init, strlen(ix->init)));
+}
+
+// 'index_write()' - Write to the device.
+
+static bool                         // O - `true` on success, `false` on error
+index_write(brf_index_t *ix,        // I - Index embosser output
+            const void *buffer,     // I - Data
+            size_t bytes)           // I - Number of bytes
+{
+  return (papplDeviceWrite(ix->device, buffer, bytes) >= 0);
+}
+
+// 'index_write_line()' - Write the current line in transparent mode.
+
+static bool                         // O - `true` on success, `false` on error
+index_write_line(brf_index_t *ix)   // I - Index embosser output
+{
+  size_t linelen = ix->linelen;     // Cells in line
+
+  ix->linelen = 0;
+
+  // ESC \ <count> NUL, then the cells...
+  ix->line[0] = '\033';
+  ix->line[1] = '\\';
+  ix->line[2] = (unsigned char)linelen;
+  ix->line[3] = '\0';
+
+  return (index_write(ix, ix->line, 4 + linelen));
+}
@@ -0,0 +1,638 @@
+//
+// Unit tests for the Braille Printer Application
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   testbrf
+//
+// Runs the markup tokenizer over documents split at every possible place,
+// converts ODF and Word documents which are built here, so that no test
+// file is needed, and checks that packed BRF decodes to the original, from
+// the start and from every page.  No table is selected, so the text is only
+// reduced to ASCII and liblouis is not used.  Exits with status 1 if a test
+// fails.
+//
+
+#include <pappl/pappl.h>
+#include <zlib.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define TEST_MAX_EVENTS 4096          // Size of event log
+
+// Local types...
+
+typedef struct test_events_s          // Markup events of a document
+{
+  char log[TEST_MAX_EVENTS];          // Events, as tags and text
+  size_t loglen;                      // Length of log
+  char attr[256];                     // Value of the "a" attribute
+} test_events_t;
+
+// Local globals...
+
+static int test_failures = 0;         // Number of failed tests
+
+// Local functions...
+
+static void test_begin(const char *name);
+static bool test_convert(cf_filter_function_t filter, const unsigned char *input, size_t inputlen, size_t start, bool seekable, char *output, size_t outputsize, size_t *outputlen);
+static void test_end(bool pass, const char *message);
+static bool test_markup_cb(void *data, brf_markup_event_t event, const char *name, const char *text, size_t len);
+static bool test_markup_parse(const char *document, bool html, size_t split, test_events_t *events);
+static void test_markup(void);
+static void test_office(void);
+static void test_pack(void);
+static bool test_pack_one(const char *input, size_t inputlen);
+static size_t test_zip(unsigned char *zip, size_t zipsize, const char *name, const char *content, bool deflated);
+
+// 'main()' - Run the unit tests.
+
+int                                   // O - Exit status
+main(void)
+{
+  test_markup();
+  test_office();
+  test_pack();
+
+  if (test_failures)
+    printf("%d test(s) failed.\n", test_failures);
+  else
+    puts("All tests passed.");
+
+  return (test_failures ? 1 : 0);
+}
+
+// 'test_begin()' - Start a test.
+
+static void
+test_begin(const char *name)          // I - Test name
+{
+  printf("%s: ", name);
+  fflush(stdout);
+}
+
+// 'test_convert()' - Run a filter on a buffer and get the output.
+
+static bool                           // O - `true` if the filter succeeded
+test_convert(
+    cf_filter_function_t filter,       // I - Filter function
+    const unsigned char *input,       // I - Input data
+    size_t inputlen,                  // I - Length of input
+    size_t start,                     // I - Offset to read a file from
+    bool seekable,                    // I - Pass the input as a file?
+    char *output,                     // O - Output, nul-terminated
+    size_t outputsize,                // I - Size of output buffer
+    size_t *outputlen)                // O - Length of output or `NULL`
+{
+  cf_filter_data_t data;              // Filter data
+  int infd,                           // Input file
+      outfd,                          // Output file
+      fds[2];                         // Pipe for unseekable input
+  char outname[] = "/tmp/testbrfXXXXXX";
+                                      // Output file name
+  ssize_t bytes;                      // Bytes read
+  int status;                         // Filter status
+
+  memset(&data, 0, sizeof(data));
+
+  *output = '\0';
+
+  if ((outfd = mkstemp(outname)) < 0)
+    return (false);
+
+  unlink(outname);
+
+  if (seekable)
+  {
+    char inname[] = "/tmp/testbrfXXXXXX";
+                                      // Input file name
+
+    if ((infd = mkstemp(inname)) < 0)
+    {
+      close(outfd);
+      return (false);
+    }
+
+    unlink(inname);
+
+    if (write(infd, input, inputlen) != (ssize_t)inputlen || lseek(infd, (off_t)start, SEEK_SET) != (off_t)start)
+    {
+      close(infd);
+      close(outfd);
+      return (false);
+    }
+  }
+  else
+  {
+    // The input fits in the pipe buffer...
+    if (inputlen > 65536 || pipe(fds))
+    {
+      close(outfd);
+      return (false);
+    }
+
+    if (write(fds[1], input, inputlen) != (ssize_t)inputlen)
+    {
+      close(fds[0]);
+      close(fds[1]);
+      close(outfd);
+      return (false);
+    }
+
+    close(fds[1]);
+    infd = fds[0];
+  }
+
+  status = (filter)(infd, outfd, seekable, &data, NULL);
+
+  close(infd);
+
+  if (lseek(outfd, 0, SEEK_SET) != 0 || (bytes = read(outfd, output, outputsize - 1)) < 0)
+    bytes = 0;
+
+  output[bytes] = '\0';
+
+  if (outputlen)
+    *outputlen = (size_t)bytes;
+
+  close(outfd);
+
+  return (status == 0);
+}
+
+// 'test_end()' - Finish a test.
+
+static void
+test_end(bool pass,                   // I - Did the test pass?
+         const char *message)         // I - Detail for a failure or `NULL`
+{
+  if (pass)
+  {
+    puts("PASS");
+  }
+  else
+  {
+    printf("FAIL%s%s\n", message ? " " : "", message ? message : "");
+    test_failures++;
+  }
+}
+
+// 'test_markup()' - Test the markup tokenizer.
+
+static void
+test_markup(void)
+{
+  test_events_t events;               // Events of document
+  size_t i;                           // Looping var
+  bool pass;                          // Did all the splits pass?
+  char value[256];                    // Attribute value
+  static const char *xml =            // XML document
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE doc [ <!ENTITY x \"y\"> ]>\n"
+    "<doc><!-- <p>skipped</p> -->"
+    "<p a=\"1 &gt; 0\" b='two'>x &amp; y&#65;&#x42;&unknown; &#xe9;</p>"
+    "<br/><![CDATA[<raw> & ]]>"
+    "</doc>";
+  static const char *xml_log =        // Events of XML document
+    "\n\n<doc><p a=\"1 &gt; 0\" b='two'>x & yAB&unknown; \303\251</p><br></br><raw> & </doc>";
+  static const char *html =           // HTML document
+    "<HTML><Body><P Class=x>caf&eacute;&nbsp;au lait"
+    "<SCRIPT>if (a<b) s = \"</p>\";</SCRIPT><style>p > b {}</style>"
+    "done &copy</P></Body></HTML>";
+  static const char *html_log =       // Events of HTML document
+    "<html><body><p Class=x>caf\303\251\302\240au lait<script></script><style></style>done &copy</p></body></html>";
+
+  test_begin("brf_MarkupParse(XML)");
+  pass = test_markup_parse(xml, false, 0, &events);
+  if (pass && strcmp(events.log, xml_log))
+  {
+    pass = false;
+    printf("got \"%s\" ", events.log);
+  }
+  test_end(pass, NULL);
+
+  test_begin("brf_MarkupParse(XML, every split)");
+  for (i = 0, pass = true; pass && xml[i]; i++)
+  {
+    if (!test_markup_parse(xml, false, i, &events) || strcmp(events.log, xml_log))
+    {
+      printf("split at %u, got \"%s\" ", (unsigned)i, events.log);
+      pass = false;
+    }
+  }
+  test_end(pass, NULL);
+
+  test_begin("brf_MarkupParse(HTML, every split)");
+  for (i = 0, pass = true; pass && html[i]; i++)
+  {
+    if (!test_markup_parse(html, true, i, &events) || strcmp(events.log, html_log))
+    {
+      printf("split at %u, got \"%s\" ", (unsigned)i, events.log);
+      pass = false;
+    }
+  }
+  test_end(pass, NULL);
+
+  test_begin("brf_MarkupGetAttr");
+  pass = brf_MarkupGetAttr(" a=\"1\" bb = 'two words' c=bare d", "bb", value, sizeof(value)) && !strcmp(value, "two words");
+  pass = pass && brf_MarkupGetAttr(" a=\"1\" bb = 'two words' c=bare d", "c", value, sizeof(value)) && !strcmp(value, "bare");
+  pass = pass && brf_MarkupGetAttr(" a=\"1\" bb = 'two words' c=bare d", "a", value, sizeof(value)) && !strcmp(value, "1");
+  pass = pass && !brf_MarkupGetAttr(" a=\"1\" bb = 'two words' c=bare d", "b", value, sizeof(value));
+  pass = pass && brf_MarkupGetAttr(" a=\"0123456789\"", "a", value, 5) && !strcmp(value, "0123");
+  test_end(pass, NULL);
+
+  test_begin("brf_MarkupParse(start tag attributes)");
+  pass = test_markup_parse("<x a='&lt;one&gt;'>", false, 0, &events) && !strcmp(events.attr, "&lt;one&gt;");
+  test_end(pass, events.attr);
+}
+
+// 'test_markup_cb()' - Log markup events.
+
+static bool                           // O - `true` to continue
+test_markup_cb(
+    void *data,                       // I - Event log
+    brf_markup_event_t event,         // I - Event
+    const char *name,                 // I - Element name
+    const char *text,                 // I - Character data or attributes
+    size_t len)                       // I - Length of text
+{
+  test_events_t *events = (test_events_t *)data;
+                                      // Event log
+  size_t remaining = sizeof(events->log) - events->loglen;
+                                      // Space left in log
+
+  switch (event)
+  {
+    case BRF_MARKUP_START :
+        snprintf(events->log + events->loglen, remaining, "<%s%s%.*s>", name, len ? " " : "", (int)len, text);
+        brf_MarkupGetAttr(text, "a", events->attr, sizeof(events->attr));
+        break;
+
+    case BRF_MARKUP_END :
+        snprintf(events->log + events->loglen, remaining, "</%s>", name);
+        break;
+
+    case BRF_MARKUP_TEXT :
+        // Character data may come in several pieces...
+        snprintf(events->log + events->loglen, remaining, "%.*s", (int)len, text);
+        break;
+  }
+
+  events->loglen += strlen(events->log + events->loglen);
+
+  return (true);
+}
+
+// 'test_markup_parse()' - Tokenize a document in two pieces.
+
+static bool                           // O - `true` on success
+test_markup_parse(
+    const char *document,             // I - Document
+    bool html,                        // I - HTML mode?
+    size_t split,                     // I - Length of first piece
+    test_events_t *events)            // O - Events
+{
+  brf_markup_t m;                     // Tokenizer
+  size_t len = strlen(document);      // Length of document
+
+  memset(events, 0, sizeof(test_events_t));
+
+  brf_MarkupInit(&m, test_markup_cb, events);
+  m.html = html;
+
+  return (brf_MarkupParse(&m, document, split) && brf_MarkupParse(&m, document + split, len - split) && brf_MarkupFinish(&m));
+}
+
+// 'test_office()' - Test the ODF and OOXML conversion.
+
+static void
+test_office(void)
+{
+  unsigned char zip[8192];            // ZIP archive
+  size_t zipsize;                     // Size of archive
+  char output[8192];                  // Converted document
+  bool pass;                          // Did the test pass?
+  static const char *odf =            // ODF content
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<office:document-content><office:body><office:text>"
+    "<text:h text:outline-level=\"1\">Title</text:h>"
+    "<text:p>Hello<text:s/>world<office:annotation><text:p>note</text:p></office:annotation>.</text:p>"
+    "<text:p>caf\303\251 &amp; cr\303\250me</text:p>"
+    "</office:text></office:body></office:document-content>";
+  static const char *ooxml =          // OOXML content
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<w:document><w:body>"
+    "<w:p><w:pPr><w:pStyle w:val=\"Heading1\"/></w:pPr><w:r><w:t>Title</w:t></w:r></w:p>"
+    "<w:p><w:r><w:t>Hello</w:t></w:r><w:r><w:tab/><w:t>world</w:t></w:r>"
+    "<w:r><w:instrText>PAGE</w:instrText></w:r><w:del><w:r><w:delText>gone</w:delText></w:r></w:del></w:p>"
+    "</w:body></w:document>";
+
+  test_begin("brf_officetobrf_filter_function(ODF, stored, mapped)");
+  zipsize = test_zip(zip, sizeof(zip), "content.xml", odf, false);
+  pass = zipsize > 0 && test_convert(brf_officetobrf_filter_function, zip, zipsize, 0, true, output, sizeof(output), NULL);
+  pass = pass && strstr(output, "Title\r\n") && strstr(output, "  Hello world.\r\n") && strstr(output, "  caf? & cr?me\r\n") && !strstr(output, "note");
+  test_end(pass, output);
+
+  test_begin("brf_officetobrf_filter_function(ODF, deflated, pipe)");
+  zipsize = test_zip(zip, sizeof(zip), "content.xml", odf, true);
+  pass = zipsize > 0 && test_convert(brf_officetobrf_filter_function, zip, zipsize, 0, false, output, sizeof(output), NULL);
+  pass = pass && strstr(output, "Title\r\n") && strstr(output, "  Hello world.\r\n") && !strstr(output, "note");
+  test_end(pass, output);
+
+  test_begin("brf_officetobrf_filter_function(OOXML, deflated, mapped)");
+  zipsize = test_zip(zip, sizeof(zip), "word/document.xml", ooxml, true);
+  pass = zipsize > 0 && test_convert(brf_officetobrf_filter_function, zip, zipsize, 0, true, output, sizeof(output), NULL);
+  pass = pass && strstr(output, "Title\r\n") && !strstr(output, "  Title") && strstr(output, "  Hello world\r\n") && !strstr(output, "PAGE") && !strstr(output, "gone");
+  test_end(pass, output);
+
+  test_begin("brf_officetobrf_filter_function(no document part)");
+  zipsize = test_zip(zip, sizeof(zip), "styles.xml", odf, true);
+  pass = zipsize > 0 && !test_convert(brf_officetobrf_filter_function, zip, zipsize, 0, true, output, sizeof(output), NULL);
+  test_end(pass, NULL);
+
+  test_begin("brf_officetobrf_filter_function(truncated)");
+  zipsize = test_zip(zip, sizeof(zip), "content.xml", odf, true);
+  pass = zipsize > 0 && !test_convert(brf_officetobrf_filter_function, zip, zipsize - 30, 0, true, output, sizeof(output), NULL);
+  test_end(pass, NULL);
+
+  test_begin("brf_officetobrf_filter_function(not a ZIP archive)");
+  pass = !test_convert(brf_officetobrf_filter_function, (const unsigned char *)odf, strlen(odf), 0, true, output, sizeof(output), NULL);
+  test_end(pass, NULL);
+}
+
+// 'test_pack()' - Test the packed BRF storage format.
+
+static void
+test_pack(void)
+{
+  char *input;                        // Generated input
+  size_t i;                           // Looping var
+  bool pass;                          // Did the test pass?
+  static const char page[] =          // One page
+    "ABC DEF\r\n,HELLO  \"W\r\n\f";
+  static const char pages[] =         // Pages with blank lines and runs
+    "PAGE ONE\r\n\fPAGE TWO\r\n\r\n\r\n\r\n\r\n\r\n\r\nEND\r\n\f"
+    "PAGE    THREE         X\r\n\f";
+  static const char empty_pages[] =   // Empty pages
+    "\f\f\fA\f";
+  static const char line_ends[] =     // Line ends and case
+    "lower case\nMixed Case\nUPPER\r\nCR\r\f\n\n\nNO END";
+  static const char blanks[] =        // Leading and trailing blanks
+    "      \r\n  LEADING\r\nTRAILING      \r\n\r\n\r";
+  static const char literals[] =      // Lines which are not braille ASCII
+    "\033A1 ESC\r\nTAB\tTAB\r\n\303\251t\303\251\r\n\0NUL\r\n~`{|}\r\n";
+  static const unsigned char wrap[] = // Blanks and cells which wrap around
+  {
+    'B', 'R', 'F', '6', 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x00, 0x01, 0xf6, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 0x14, 0x00,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x07
+  };
+  static const unsigned char bomb[] = // 2^40 blank lines
+  {
+    'B', 'R', 'F', '6', 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x06, 0x80, 0x80, 0x80, 0x80, 0x80, 0x20,
+    0x07
+  };
+  char packed[1024];                  // Packed BRF
+  char output[1024];                  // Unpacked BRF
+  size_t packedlen,                   // Length of packed BRF
+      outputlen;                      // Length of unpacked BRF
+
+  test_begin("brf_pack_filter_function(empty)");
+  test_end(test_pack_one("", 0), NULL);
+
+  test_begin("brf_pack_filter_function(pages)");
+  pass = test_pack_one(page, sizeof(page) - 1);
+  pass = pass && test_pack_one(pages, sizeof(pages) - 1);
+  pass = pass && test_pack_one(empty_pages, sizeof(empty_pages) - 1);
+  test_end(pass, NULL);
+
+  test_begin("brf_pack_filter_function(line ends and case)");
+  pass = test_pack_one(line_ends, sizeof(line_ends) - 1);
+  pass = pass && test_pack_one(blanks, sizeof(blanks) - 1);
+  test_end(pass, NULL);
+
+  test_begin("brf_pack_filter_function(literals)");
+  pass = test_pack_one(literals, sizeof(literals) - 1);
+  test_end(pass, NULL);
+
+  test_begin("brf_pack_filter_function(long lines)");
+  if ((input = malloc(200000)) != NULL)
+  {
+    // Longer than a record, with runs of blanks of every length...
+    for (i = 0; i < 199998; i++)
+      input[i] = (i % 7) < (i % 11) ? ' ' : "A1B'K2L"[i % 7];
+
+    input[i++] = '\r';
+    input[i++] = '\n';
+
+    pass = test_pack_one(input, 200000);
+    free(input);
+  }
+  else
+    pass = false;
+  test_end(pass, NULL);
+
+  test_begin("brf_PackPageOffset(bad stream)");
+  pass = brf_PackPageOffset((const unsigned char *)"BRF6 not a packed stream", 24, 1, NULL) < 0;
+  test_end(pass, NULL);
+
+  test_begin("brf_PackIsStream");
+  pass = test_convert(brf_pack_filter_function, (const unsigned char *)pages, sizeof(pages) - 1, 0, true, packed, sizeof(packed), &packedlen);
+  pass = pass && brf_PackIsStream((unsigned char *)packed, packedlen);
+  pass = pass && !brf_PackIsStream((const unsigned char *)"BRF6 is the name of this document.\r\n", 36);
+  pass = pass && !brf_PackIsStream(wrap, 16);
+  test_end(pass, NULL);
+
+  test_begin("brf_unpack_filter_function(pipe)");
+  pass = test_convert(brf_unpack_filter_function, (unsigned char *)packed, packedlen, 0, false, output, sizeof(output), &outputlen);
+  pass = pass && outputlen == sizeof(pages) - 1 && !memcmp(output, pages, outputlen);
+  test_end(pass, NULL);
+
+  test_begin("brf_unpack_filter_function(bad page index)");
+  packed[packedlen - 1] ^= 1;
+  pass = !test_convert(brf_unpack_filter_function, (unsigned char *)packed, packedlen, 0, true, output, sizeof(output), &outputlen) && outputlen == 0;
+  test_end(pass, NULL);
+
+  test_begin("brf_unpack_filter_function(line counts wrap around)");
+  pass = !test_convert(brf_unpack_filter_function, wrap, sizeof(wrap), 0, false, output, sizeof(output), &outputlen) && outputlen == 0;
+  test_end(pass, NULL);
+
+  test_begin("brf_unpack_filter_function(too many blank lines)");
+  pass = !test_convert(brf_unpack_filter_function, bomb, sizeof(bomb), 0, false, output, sizeof(output), &outputlen) && outputlen == 0;
+  test_end(pass, NULL);
+}
+
+// 'test_pack_one()' - Pack BRF, then unpack it from the start and each page.
+
+static bool                           // O - `true` if the round trips match
+test_pack_one(const char *input,      // I - BRF
+              size_t inputlen)        // I - Length of BRF
+{
+  char *packed,                       // Packed BRF
+      *output;                        // Unpacked BRF
+  size_t packedlen,                   // Length of packed BRF
+      outputlen,                      // Length of unpacked BRF
+      start,                          // Start of page in input
+      i;                              // Looping var
+  unsigned page,                      // Current page
+      num_pages,                      // Number of pages in stream
+      expected = 1;                   // Expected number of pages
+  int64_t offset;                     // Offset of page
+  bool pass = false;                  // Did the test pass?
+
+  // A trailing form feed does not start another page...
+  for (i = 0; i < inputlen; i++)
+  {
+    if (input[i] == '\f' && i + 1 < inputlen)
+      expected++;
+  }
+
+  packed = malloc(2 * inputlen + 1024);
+  output = malloc(inputlen + 1024);
+
+  if (!packed || !output)
+    goto done;
+
+  if (!test_convert(brf_pack_filter_function, (const unsigned char *)input, inputlen, 0, true, packed, 2 * inputlen + 1024, &packedlen))
+  {
+    printf("pack failed ");
+    goto done;
+  }
+
+  if (!test_convert(brf_unpack_filter_function, (const unsigned char *)packed, packedlen, 0, true, output, inputlen + 1024, &outputlen) || outputlen != inputlen || memcmp(output, input, inputlen))
+  {
+    printf("round trip differs (%u of %u bytes) ", (unsigned)outputlen, (unsigned)inputlen);
+    goto done;
+  }
+
+  if (brf_PackPageOffset((const unsigned char *)packed, packedlen, 1, &num_pages) < 0 || num_pages != expected)
+  {
+    printf("%u pages, expected %u ", num_pages, expected);
+    goto done;
+  }
+
+  for (page = 1, start = 0; page <= num_pages; page++)
+  {
+    if ((offset = brf_PackPageOffset((const unsigned char *)packed, packedlen, page, NULL)) < 0 || (size_t)offset >= packedlen)
+    {
+      printf("no offset for page %u ", page);
+      goto done;
+    }
+
+    if (!test_convert(brf_unpack_filter_function, (const unsigned char *)packed, packedlen, (size_t)offset, true, output, inputlen + 1024, &outputlen) || outputlen != inputlen - start || memcmp(output, input + start, outputlen))
+    {
+      printf("page %u differs ", page);
+      goto done;
+    }
+
+    while (start < inputlen && input[start] != '\f')
+      start++;
+
+    start++;
+  }
+
+  pass = brf_PackPageOffset((const unsigned char *)packed, packedlen, num_pages + 1, NULL) < 0;
+
+  done:
+
+  free(packed);
+  free(output);
+
+  return (pass);
+}
+
+// 'test_zip()' - Build a ZIP archive with a single part.
+
+static size_t                         // O - Size of archive or 0 on error
+test_zip(unsigned char *zip,          // O - ZIP archive
+         size_t zipsize,              // I - Size of archive buffer
+         const char *name,            // I - Part name
+         const char *content,         // I - Part content
+         bool deflated)               // I - Compress the part?
+{
+  unsigned char *ptr = zip;           // Pointer into archive
+  size_t namelen = strlen(name),      // Length of name
+      len = strlen(content),          // Length of content
+      datalen;                        // Length of stored data
+  unsigned long crc;                  // CRC-32 of content
+  unsigned char *central;             // Central directory
+  z_stream stream;                    // Deflate stream
+
+  if (zipsize < 2 * namelen + len + 256)
+    return (0);
+
+  crc = crc32(0, (const Bytef *)content, (uInt)len);
+
+  // Local file header, then the data...
+  memcpy(ptr, "PK\003\004", 4);
+  memset(ptr + 4, 0, 26);
+  ptr[4] = 20;
+  ptr[8] = deflated ? Z_DEFLATED : 0;
+  ptr[14] = (unsigned char)crc;
+  ptr[15] = (unsigned char)(crc >> 8);
+  ptr[16] = (unsigned char)(crc >> 16);
+  ptr[17] = (unsigned char)(crc >> 24);
+  ptr[22] = (unsigned char)len;
+  ptr[23] = (unsigned char)(len >> 8);
+  ptr[26] = (unsigned char)namelen;
+  memcpy(ptr + 30, name, namelen);
+
+  if (deflated)
+  {
+    memset(&stream, 0, sizeof(stream));
+
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return (0);
+
+    stream.next_in = (Bytef *)content;
+    stream.avail_in = (uInt)len;
+    stream.next_out = ptr + 30 + namelen;
+    stream.avail_out = (uInt)(zipsize - (size_t)(ptr - zip) - 30 - namelen - 128);
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+    {
+      deflateEnd(&stream);
+      return (0);
+    }
+
+    datalen = stream.total_out;
+    deflateEnd(&stream);
+  }
+  else
+  {
+    memcpy(ptr + 30 + namelen, content, len);
+    datalen = len;
+  }
+
+  ptr[18] = (unsigned char)datalen;
+  ptr[19] = (unsigned char)(datalen >> 8);
+
+  central = ptr + 30 + namelen + datalen;
+
+  // Central directory entry pointing at the local header...
+  memcpy(central, "PK\001\002", 4);
+  memset(central + 4, 0, 42);
+  central[4] = central[6] = 20;
+  memcpy(central + 10, ptr + 8, 16);
+  central[28] = (unsigned char)namelen;
+  memcpy(central + 46, name, namelen);
+
+  // End of central directory record...
+  ptr = central + 46 + namelen;
+  memcpy(ptr, "PK\005\006", 4);
+  memset(ptr + 4, 0, 18);
+  ptr[8] = ptr[10] = 1;
+  ptr[12] = (unsigned char)(46 + namelen);
+  ptr[16] = (unsigned char)(central - zip);
+  ptr[17] = (unsigned char)((central - zip) >> 8);
+
+  return ((size_t)(ptr + 22 - zip));
+}